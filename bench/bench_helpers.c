@@ -0,0 +1,269 @@
+/*
+ * Microbenchmarks for the per-line helper functions in record_core.c
+ *
+ * The corpora are extracted from a real (or generated) strace -f trace the same way
+ * record_build's main loop feeds the helpers:
+ *    extract_sources:        the arguments of every execve line
+ *    is_desired_cmd:         the name of every executed program
+ *    parse_target_from_cmd:  the joined argv of every gcc/g++ command
+ *    LIST_find_pid:          the pid of every line, looked up in a list of compiler pids
+ *    TARGET_add_dep:         the successful openat paths, in order, under each target
+ * Each helper is run over its whole corpus repeatedly for at least the minimum time, and
+ * reported as ns/op and allocations/op. Allocations are counted by interposing malloc.
+ *
+ * usage: bench_helpers [-m min_seconds] trace_file
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../record_core.h"
+
+// number of allocations made through malloc, calloc and realloc since the last reset
+static long alloc_count = 0;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+/*
+ * Allocation counting wrappers, which replace the libc allocator for this binary
+ * and for the libc functions it calls, such as strdup
+ */
+void *malloc(size_t size) {
+  alloc_count++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+  alloc_count++;
+  return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  alloc_count++;
+  return __libc_realloc(ptr, size);
+}
+
+/*
+ * A growable array of strings
+ */
+typedef struct corpus_struct {
+  char **items;
+  int count;
+  int cap;
+} corpus;
+
+static void CORPUS_add(corpus *c, char *item) {
+  if ( c->count == c->cap ) {
+    c->cap = c->cap ? c->cap * 2 : 64;
+    c->items = realloc(c->items, c->cap * sizeof(char *));
+  }
+  c->items[c->count++] = item;
+}
+
+/*
+ * The dependency paths of one target, in the order they were opened
+ */
+typedef struct dep_run_struct {
+  corpus deps;
+} dep_run;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Joins the quoted argv of an execve the way record_build does: quotes and commas dropped
+ */
+static char *join_argv(char *args) {
+  char *lbracket = strchr(args, '[');
+  char *rbracket = lbracket ? strchr(lbracket, ']') : NULL;
+  if ( rbracket == NULL ) {
+    return NULL;
+  }
+  char *cmd = malloc(rbracket - lbracket + 1);
+  int len = 0;
+  for ( char *c = lbracket + 1; c < rbracket; c++ ) {
+    if ( *c != '\"' && *c != ',' ) {
+      cmd[len++] = *c;
+    }
+  }
+  cmd[len] = '\0';
+  return cmd;
+}
+
+/*
+ * Returns the name of the program executed by an execve, without its directory
+ */
+static char *program_name(char *args) {
+  char *end = strchr(args, '\"');
+  if ( end == NULL ) {
+    return NULL;
+  }
+  char *start = end;
+  while ( start > args && *(start - 1) != '/' ) {
+    start--;
+  }
+  return strndup(start, end - start);
+}
+
+/*
+ * Times one helper: runs the body for i over [0, count) until min_seconds have passed.
+ * One pass over the corpus counts as pass_ops operations.
+ */
+#define RUN_BENCH(name, count, pass_ops, min_seconds, ...)                          \
+  do {                                                                              \
+    long ops = 0;                                                                   \
+    long allocs = 0;                                                                \
+    double elapsed = 0;                                                             \
+    while ( elapsed < (min_seconds) && (pass_ops) > 0 ) {                           \
+      alloc_count = 0;                                                              \
+      double start = now();                                                         \
+      for ( int i = 0; i < (count); i++ ) {                                         \
+        __VA_ARGS__;                                                                \
+      }                                                                             \
+      elapsed += now() - start;                                                     \
+      allocs += alloc_count;                                                        \
+      ops += (pass_ops);                                                            \
+    }                                                                               \
+    if ( ops == 0 ) {                                                               \
+      printf("%-24s %12s\n", name, "no corpus");                                    \
+    }                                                                               \
+    else {                                                                          \
+      printf("%-24s %12d %12ld %10.1f %10.2f\n", name, (pass_ops), ops,             \
+             elapsed * 1e9 / ops, (double) allocs / ops);                           \
+    }                                                                               \
+  } while ( 0 )
+
+int main(int argc, char **argv) {
+  double min_seconds = 0.5;
+  int opt;
+  while ( (opt = getopt(argc, argv, "m:")) != -1 ) {
+    switch ( opt ) {
+      case 'm': min_seconds = atof(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-m min_seconds] trace_file\n", argv[0]);
+        exit(1);
+    }
+  }
+  if ( optind >= argc ) {
+    fprintf(stderr, "usage: %s [-m min_seconds] trace_file\n", argv[0]);
+    exit(1);
+  }
+  FILE *trace = fopen(argv[optind], "r");
+  if ( trace == NULL ) {
+    fprintf(stderr, "ERROR: trace file %s could not be opened!\n", argv[optind]);
+    exit(1);
+  }
+
+  // extract the corpora
+  corpus execve_args = { 0 };
+  corpus cmd_names = { 0 };
+  corpus gcc_cmds = { 0 };
+  int *line_pids = NULL;
+  int line_count = 0;
+  int line_cap = 0;
+  list compiler_pids = { NULL, NULL };
+  dep_run *runs = NULL;
+  int run_count = 0;
+
+  char *line = NULL;
+  size_t cap = 0;
+  while ( getline(&line, &cap, trace) != -1 ) {
+    int pid;
+    if ( sscanf(line, "%d", &pid) != 1 ) {
+      continue;
+    }
+    if ( line_count == line_cap ) {
+      line_cap = line_cap ? line_cap * 2 : 1024;
+      line_pids = realloc(line_pids, line_cap * sizeof(int));
+    }
+    line_pids[line_count++] = pid;
+
+    char *execve = strstr(line, " execve(\"");
+    if ( execve != NULL && strstr(execve, "ENOENT") == NULL ) {
+      char *args = strdup(execve + 9);
+      CORPUS_add(&execve_args, args);
+      char *name = program_name(args);
+      if ( name == NULL ) {
+        continue;
+      }
+      CORPUS_add(&cmd_names, name);
+      if ( !strcmp(name, "gcc") || !strcmp(name, "g++") ) {
+        char *cmd = join_argv(args);
+        if ( cmd != NULL ) {
+          CORPUS_add(&gcc_cmds, cmd);
+        }
+        LIST_add(&compiler_pids, pid, name);
+        runs = realloc(runs, (run_count + 1) * sizeof(dep_run));
+        memset(&runs[run_count], 0, sizeof(dep_run));
+        run_count++;
+      }
+      continue;
+    }
+    char *openat = strstr(line, " openat(AT_FDCWD, \"");
+    if ( openat != NULL && run_count > 0 && strstr(openat, "ENOENT") == NULL ) {
+      char *path = openat + 19;
+      char *end = strchr(path, '\"');
+      if ( end != NULL ) {
+        CORPUS_add(&runs[run_count - 1].deps, strndup(path, end - path));
+      }
+    }
+  }
+  free(line);
+  fclose(trace);
+
+  int dep_ops = 0;
+  for ( int r = 0; r < run_count; r++ ) {
+    dep_ops += runs[r].deps.count;
+  }
+
+  printf("%-24s %12s %12s %10s %10s\n", "helper", "corpus", "ops", "ns/op", "allocs/op");
+
+  RUN_BENCH("extract_sources", execve_args.count, execve_args.count, min_seconds, {
+    free(extract_sources(execve_args.items[i]));
+  });
+
+  volatile int desired = 0;
+  RUN_BENCH("is_desired_cmd", cmd_names.count, cmd_names.count, min_seconds, {
+    desired += is_desired_cmd(cmd_names.items[i]);
+  });
+
+  RUN_BENCH("parse_target_from_cmd", gcc_cmds.count, gcc_cmds.count, min_seconds, {
+    char *name = parse_target_from_cmd(gcc_cmds.items[i]);
+    if ( name != NULL ) {
+      // parse_target_from_cmd returns a pointer 3 bytes into its allocation
+      free(name - 3);
+    }
+  });
+
+  volatile int found = 0;
+  RUN_BENCH("LIST_find_pid", line_count, line_count, min_seconds, {
+    found += LIST_find_pid(&compiler_pids, line_pids[i]) != NULL;
+  });
+
+  // one op is one TARGET_add_dep call; each target is rebuilt from empty on every pass
+  RUN_BENCH("TARGET_add_dep", run_count, dep_ops, min_seconds, {
+    target tar = { "bench", "bench", NULL, NULL };
+    for ( int d = 0; d < runs[i].deps.count; d++ ) {
+      TARGET_add_dep(&tar, runs[i].deps.items[d]);
+    }
+    depnode *cur = tar.head;
+    while ( cur != NULL ) {
+      depnode *next = cur->next;
+      free(cur->dep);
+      free(cur);
+      cur = next;
+    }
+  });
+
+  return 0;
+}
@@ -0,0 +1,280 @@
+/*
+ * Benchmark harness for the record_build parse/copy/emit pipeline
+ *
+ * For each scenario, a synthetic trace and its source tree are generated with gen_trace
+ * into a scratch directory, and record_build --no-trace is run on the trace there. The
+ * harness reports the time of each phase it drives, and for the record_build run the
+ * throughput in lines/s and MB/s of trace, and the peak RSS of the record_build process.
+ * The "read" phase is a plain line by line read of the same trace, the floor the parser
+ * can not go below. record_build's own --stats=json report breaks its run down further
+ * into the parse, deps, copy and emit phases.
+ *
+ * usage: bench_parse [-b record_build] [-g gen_trace] [-w workdir] [-x scale] [scenario...]
+ *    -b PATH   the record_build binary to measure (default ./record_build)
+ *    -g PATH   the gen_trace binary (default ./bench/gen_trace)
+ *    -w DIR    scratch directory for traces and sandboxes (default ./bench_work)
+ *    -x N      multiply the number of targets in every scenario by N (default 1)
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * One benchmark scenario, given as gen_trace arguments
+ */
+typedef struct scenario_struct {
+  char *name;
+  int targets;
+  int headers_per_tu;
+  int interleave;
+  char *fork_mode;
+  int extra_args;
+  int enoent_pct;
+  int split_pct;      // calls split into <unfinished ...> and <... resumed> lines
+  bool per_pid;       // parsed from one file per process, record_build --per-pid
+} scenario;
+
+static scenario scenarios[] = {
+  { "baseline",    200,  40, 1, "mixed",  8, 50,  0 },
+  { "headers",     200, 200, 1, "mixed",  8, 50,  0 },
+  { "interleaved", 200,  40, 8, "mixed",  8, 50,  0 },
+  { "vfork",       200,  40, 4, "vfork",  8, 50,  0 },
+  { "long-argv",   200,  40, 1, "clone", 96, 50,  0 },
+  { "enoent",      200,  40, 1, "mixed",  8, 95,  0 },
+  { "split",       200,  40, 8, "mixed",  8, 50, 30 },
+  { "per-pid",     200,  40, 8, "mixed",  8, 50,  0, true },
+};
+
+/*
+ * The resources used by one child process
+ */
+typedef struct run_result_struct {
+  double wall;     // seconds
+  double cpu;      // user + system seconds
+  long max_rss_kb;
+  int status;
+} run_result;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Runs a program in the given directory with stdout and stderr sent to log_name,
+ * and measures it with wait4()
+ */
+static run_result run_child(char *dir, char **args, char *log_name) {
+  run_result result = { 0, 0, 0, -1 };
+  double start = now();
+  pid_t pid = fork();
+  if ( pid == 0 ) {
+    if ( dir != NULL && chdir(dir) != 0 ) {
+      fprintf(stderr, "ERROR: could not change into %s\n", dir);
+      _exit(1);
+    }
+    int log = open(log_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if ( log >= 0 ) {
+      dup2(log, STDOUT_FILENO);
+      dup2(log, STDERR_FILENO);
+      close(log);
+    }
+    execv(args[0], args);
+    fprintf(stderr, "ERROR: %s could not be executed!\n", args[0]);
+    _exit(1);
+  }
+  struct rusage usage;
+  int status;
+  if ( pid < 0 || wait4(pid, &status, 0, &usage) != pid ) {
+    return result;
+  }
+  result.wall = now() - start;
+  result.cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+               usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+  result.max_rss_kb = usage.ru_maxrss;
+  result.status = status;
+  return result;
+}
+
+/*
+ * Reads the trace line by line without parsing it, counting lines and bytes
+ */
+static double read_trace(char *path, long *lines, long *bytes) {
+  double start = now();
+  FILE *f = fopen(path, "r");
+  *lines = 0;
+  *bytes = 0;
+  if ( f == NULL ) {
+    return 0;
+  }
+  char *line = NULL;
+  size_t cap = 0;
+  ssize_t len;
+  while ( (len = getline(&line, &cap, f)) != -1 ) {
+    (*lines)++;
+    *bytes += len;
+  }
+  free(line);
+  fclose(f);
+  return now() - start;
+}
+
+/*
+ * Reads the wall time of one phase from a record_build --stats=json report
+ */
+static double phase_wall(char *report, char *phase_name) {
+  char key[64];
+  double wall = 0;
+  snprintf(key, sizeof(key), "\"%s\": {\"wall\": ", phase_name);
+  char *found = report ? strstr(report, key) : NULL;
+  if ( found != NULL ) {
+    sscanf(found + strlen(key), "%lf", &wall);
+  }
+  return wall;
+}
+
+/*
+ * Helper function to read a whole small file into memory
+ */
+static char *read_file(char *path) {
+  FILE *f = fopen(path, "r");
+  if ( f == NULL ) {
+    return NULL;
+  }
+  char *contents = NULL;
+  size_t cap = 0;
+  if ( getdelim(&contents, &cap, '\0', f) == -1 ) {
+    free(contents);
+    contents = NULL;
+  }
+  fclose(f);
+  return contents;
+}
+
+/*
+ * Helper function to turn a possibly relative path into an absolute one
+ */
+static char *absolute(char *path) {
+  char *abs = realpath(path, NULL);
+  if ( abs == NULL ) {
+    fprintf(stderr, "ERROR: %s does not exist!\n", path);
+    exit(1);
+  }
+  return abs;
+}
+
+static bool run_scenario(scenario *sc, char *record_build, char *gen_trace, char *workdir, int scale) {
+  char dir[PATH_MAX];
+  char trace[PATH_MAX];
+  char log[PATH_MAX];
+  char cmd[PATH_MAX + 32];
+  snprintf(dir, sizeof(dir), "%s/%s", workdir, sc->name);
+  snprintf(trace, sizeof(trace), "%s/t.out", dir);
+  snprintf(cmd, sizeof(cmd), "rm -rf '%s'", dir);
+  if ( system(cmd) != 0 || mkdir(dir, 0777) != 0 ) {
+    fprintf(stderr, "ERROR: scratch directory %s could not be created\n", dir);
+    return false;
+  }
+
+  // phase 1: generate the trace and its source tree
+  char targets[16], headers[16], interleave[16], extra_args[16], enoent[16], split[16];
+  snprintf(targets, sizeof(targets), "%d", sc->targets * scale);
+  snprintf(headers, sizeof(headers), "%d", sc->headers_per_tu);
+  snprintf(interleave, sizeof(interleave), "%d", sc->interleave);
+  snprintf(extra_args, sizeof(extra_args), "%d", sc->extra_args);
+  snprintf(enoent, sizeof(enoent), "%d", sc->enoent_pct);
+  snprintf(split, sizeof(split), "%d", sc->split_pct);
+  char *gen_args[] = { gen_trace, "-t", targets, "-H", headers, "-P", interleave, "-f", sc->fork_mode,
+                       "-a", extra_args, "-e", enoent, "-u", split, "-r", dir, "-m", "-o", trace,
+                       sc->per_pid ? "-F" : NULL, NULL };
+  snprintf(log, sizeof(log), "%s/gen.log", dir);
+  run_result gen = run_child(dir, gen_args, log);
+  if ( !WIFEXITED(gen.status) || WEXITSTATUS(gen.status) != 0 ) {
+    fprintf(stderr, "ERROR: trace generation failed for %s, see %s\n", sc->name, log);
+    return false;
+  }
+
+  // phase 2: read the trace without parsing it
+  long lines, bytes;
+  double read_time = read_trace(trace, &lines, &bytes);
+
+  // phase 3: parse, copy and emit with record_build
+  char *rb_args[] = { record_build, "--no-trace", "--stats=json", "--stats-out=stats.json",
+                      sc->per_pid ? "--per-pid" : NULL, NULL };
+  snprintf(log, sizeof(log), "%s/record_build.log", dir);
+  run_result rb = run_child(dir, rb_args, log);
+  if ( !WIFEXITED(rb.status) || WEXITSTATUS(rb.status) != 0 ) {
+    fprintf(stderr, "ERROR: record_build failed for %s, see %s\n", sc->name, log);
+    return false;
+  }
+
+  snprintf(log, sizeof(log), "%s/stats.json", dir);
+  char *report = read_file(log);
+  double mb = bytes / (1024.0 * 1024.0);
+  printf("%-12s %9ld %8.1f %8.3f %8.3f %9.3f %8.3f %11.0f %8.1f %8ld %8.3f %8.3f %8.3f %8.3f\n", sc->name,
+         lines, mb, gen.wall, read_time, rb.wall, rb.cpu, lines / rb.wall, mb / rb.wall, rb.max_rss_kb,
+         phase_wall(report, "parse"), phase_wall(report, "deps"), phase_wall(report, "copy"),
+         phase_wall(report, "emit"));
+  free(report);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  char *record_build = "./record_build";
+  char *gen_trace = "./bench/gen_trace";
+  char *workdir = "./bench_work";
+  int scale = 1;
+  int opt;
+  while ( (opt = getopt(argc, argv, "b:g:w:x:")) != -1 ) {
+    switch ( opt ) {
+      case 'b': record_build = optarg; break;
+      case 'g': gen_trace = optarg; break;
+      case 'w': workdir = optarg; break;
+      case 'x': scale = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-b record_build] [-g gen_trace] [-w workdir] [-x scale] [scenario...]\n",
+                argv[0]);
+        exit(1);
+    }
+  }
+  if ( scale < 1 ) {
+    scale = 1;
+  }
+  mkdir(workdir, 0777);
+  record_build = absolute(record_build);
+  gen_trace = absolute(gen_trace);
+  workdir = absolute(workdir);
+
+  printf("%-12s %9s %8s %8s %8s %9s %8s %11s %8s %8s %8s %8s %8s %8s\n", "scenario", "lines", "MB",
+         "gen(s)", "read(s)", "run(s)", "cpu(s)", "lines/s", "MB/s", "rss(KB)", "parse", "deps", "copy",
+         "emit");
+  bool ok = true;
+  int count = sizeof(scenarios) / sizeof(scenarios[0]);
+  for ( int i = 0; i < count; i++ ) {
+    // run every scenario, or only the ones named on the command line
+    bool selected = optind == argc;
+    for ( int j = optind; j < argc; j++ ) {
+      if ( !strcmp(argv[j], scenarios[i].name) ) {
+        selected = true;
+      }
+    }
+    if ( selected ) {
+      fflush(stdout);
+      ok = run_scenario(&scenarios[i], record_build, gen_trace, workdir, scale) && ok;
+    }
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,551 @@
+/*
+ * Deterministic generator for synthetic strace -f output
+ *
+ * Writes a trace in the same format record_build reads from t.out, shaped like a make
+ * build of a C project: make spawns one gcc per translation unit, gcc spawns cc1 and as,
+ * cc1 probes the include path and opens every header, and a final gcc links all objects.
+ * The same seed and parameters always produce byte-identical output, so runs of the
+ * parser benchmark can be compared against each other.
+ *
+ * usage: gen_trace [options]
+ *    -t N      number of compiled targets (default 200)
+ *    -H N      headers included per translation unit (default 40)
+ *    -P N      number of compiles whose lines are interleaved, like make -jN (default 1)
+ *    -f MODE   how processes are spawned: vfork, clone or mixed (default mixed)
+ *    -a N      extra -D/-I arguments on every gcc command, for long argv lines (default 8)
+ *    -e PCT    percentage of header lookups preceded by failed ENOENT probes (default 50)
+ *    -u PCT    percentage of the calls of a compile that strace splits into "<unfinished ...>"
+ *              and "<... resumed>" lines, with other compiles' lines between them (default 0)
+ *    -R PCT    follow each header cc1 opens with a read and a close; PCT percent of them are
+ *              read, the rest are closed unread, like a header its include guard skips.
+ *              gcc also reads and maps libc, cc1 reads its source. (default -1: no reads at all)
+ *    -s SEED   random seed (default 1)
+ *    -r DIR    absolute directory the traced build ran in (default the current directory)
+ *    -m        materialize the source tree under -r, so dependencies can be copied
+ *    -o FILE   write the trace to FILE instead of stdout
+ *    -F        also write it one file per process like strace -ff does, FILE.PID (needs -o)
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// constant for path buffer lengths
+#define PATH_SIZE 4096
+
+// headers are drawn from a pool this many times larger than the headers per TU
+#define HEADER_POOL_FACTOR 4
+
+// number of failed include path probes in front of a header that has any
+#define ENOENT_PROBES 3
+
+// the pid of the make process at the root of the traced build
+#define MAKE_PID 1000
+
+/*
+ * Parameters of one generated trace
+ */
+typedef struct gen_params_struct {
+  int targets;
+  int headers_per_tu;
+  int interleave;
+  char *fork_mode;
+  int extra_args;
+  int enoent_pct;
+  int split_pct;
+  int read_pct;
+  uint64_t seed;
+  char *root;
+  bool materialize;
+  bool per_pid;
+} gen_params;
+
+/*
+ * The state of one simulated gcc invocation. Each compile is a small state machine
+ * that emits one line per step, so several of them can be interleaved line by line.
+ */
+typedef struct compile_struct {
+  int index;      // which translation unit
+  int gcc_pid;
+  int cc1_pid;
+  int as_pid;
+  int step;       // next line to emit
+  int header;     // next header to open in the cc1 phase
+  int probe;      // next ENOENT probe for the current header
+  int *headers;   // indices into the header pool
+  char *resumed;  // the second part of a split call, emitted as the compile's next line
+  int io;         // with -R, the read and close lines still to come for the last header
+  bool done;
+} compile;
+
+static uint64_t rng_state;
+
+/*
+ * xorshift64* pseudo random number generator, used so output does not depend on libc
+ */
+static uint64_t rng_next(void) {
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 2685821657736338717ULL;
+}
+
+static int rng_range(int n) {
+  return (int) (rng_next() % (uint64_t) n);
+}
+
+static int next_pid = MAKE_PID + 1;
+
+/*
+ * Emits the line with which the parent process spawns a child before the child execs,
+ * and for a vfork the matching resumed line after it
+ */
+static void emit_spawn(FILE *out, gen_params *p, int parent, int child, bool before_exec) {
+  bool use_vfork = !strcmp(p->fork_mode, "vfork") ||
+                   ( !strcmp(p->fork_mode, "mixed") && (child & 1) );
+  if ( use_vfork ) {
+    if ( before_exec ) {
+      fprintf(out, "%d vfork( <unfinished ...>\n", parent);
+    }
+    else {
+      fprintf(out, "%d <... vfork resumed>) = %d\n", parent, child);
+    }
+  }
+  else if ( before_exec ) {
+    fprintf(out, "%d clone(child_stack=NULL, flags=CLONE_CHILD_CLEARTID|CLONE_CHILD_SETTID|SIGCHLD, "
+                 "child_tidptr=0x7f3a1c5e0a10) = %d\n", parent, child);
+  }
+}
+
+/*
+ * Writes the argv of one gcc compile command, with the optional long run of flags
+ */
+static void emit_gcc_argv(FILE *out, gen_params *p, int index) {
+  fprintf(out, "[\"gcc\", \"-c\", \"-O2\", \"-g\"");
+  for ( int i = 0; i < p->extra_args; i++ ) {
+    if ( i & 1 ) {
+      fprintf(out, ", \"-I%s/include/dir%d\"", p->root, i);
+    }
+    else {
+      fprintf(out, ", \"-DCONFIG_OPTION_NUMBER_%d=%d\"", i, i * 7);
+    }
+  }
+  fprintf(out, ", \"-Iinclude\", \"-o\", \"obj/tu%d.o\", \"src/tu%d.c\"]", index, index);
+}
+
+/*
+ * Writes the next line of a compile to out. Marks the compile done after its last line.
+ */
+static void emit_compile_line(FILE *out, gen_params *p, compile *c) {
+  int pool = p->headers_per_tu * HEADER_POOL_FACTOR;
+  switch ( c->step ) {
+    case 0:
+      emit_spawn(out, p, MAKE_PID, c->gcc_pid, true);
+      break;
+    case 1:
+      fprintf(out, "%d execve(\"/usr/bin/gcc\", ", c->gcc_pid);
+      emit_gcc_argv(out, p, c->index);
+      fprintf(out, ", 0x55d0c8a4e2a0 /* 42 vars */) = 0\n");
+      break;
+    case 2:
+      emit_spawn(out, p, MAKE_PID, c->gcc_pid, false);
+      break;
+    case 3:
+      fprintf(out, "%d openat(AT_FDCWD, \"/etc/ld.so.cache\", O_RDONLY|O_CLOEXEC) = 3\n", c->gcc_pid);
+      break;
+    case 4:
+      fprintf(out, "%d openat(AT_FDCWD, \"/lib/x86_64-linux-gnu/libc.so.6\", O_RDONLY|O_CLOEXEC) = 3\n",
+              c->gcc_pid);
+      if ( p->read_pct >= 0 ) {
+        // a shared library is read for its headers, then mapped
+        fprintf(out, "%d read(3, \"\\177ELF\\2\\1\\1\\3\\0\\0\\0\\0\\0\\0\\0\\0\\3\\0>\\0\\1\\0\\0\\0\"..., 832) = 832\n",
+                c->gcc_pid);
+        fprintf(out, "%d mmap(NULL, 2264656, PROT_READ, MAP_PRIVATE|MAP_DENYWRITE, 3, 0) = 0x7f3a1c200000\n",
+                c->gcc_pid);
+        fprintf(out, "%d close(3) = 0\n", c->gcc_pid);
+      }
+      break;
+    case 5:
+      emit_spawn(out, p, c->gcc_pid, c->cc1_pid, true);
+      break;
+    case 6:
+      fprintf(out, "%d execve(\"/usr/lib/gcc/x86_64-linux-gnu/12/cc1\", [\"/usr/lib/gcc/x86_64-linux-gnu/12/cc1\", "
+                   "\"-quiet\", \"-Iinclude\", \"src/tu%d.c\", \"-quiet\", \"-dumpbase\", \"tu%d.c\", "
+                   "\"-O2\", \"-o\", \"/tmp/ccA%05d.s\"], 0x1c3e2b0 /* 47 vars */) = 0\n",
+              c->cc1_pid, c->index, c->index, c->index);
+      break;
+    case 7:
+      emit_spawn(out, p, c->gcc_pid, c->cc1_pid, false);
+      break;
+    case 8:
+      fprintf(out, "%d openat(AT_FDCWD, \"src/tu%d.c\", O_RDONLY|O_NOCTTY) = 3\n", c->cc1_pid, c->index);
+      if ( p->read_pct >= 0 ) {
+        // the source stays open until cc1 exits
+        fprintf(out, "%d read(3, \"int f(int x) { return x * 3 + 1; }\\nint f(int x) \"..., 4096) = 576\n",
+                c->cc1_pid);
+      }
+      break;
+    case 9:
+      // with -R, the header opened last is read and closed before the next one is opened
+      if ( c->io > 0 ) {
+        if ( c->io == 2 ) {
+          fprintf(out, "%d read(4, \"#define HEADER_MACRO(x) ((x) + 1)\\nextern int \"..., 4096) = 1888\n",
+                  c->cc1_pid);
+        }
+        else {
+          fprintf(out, "%d close(4) = 0\n", c->cc1_pid);
+        }
+        c->io--;
+        if ( c->io > 0 || ( c->header < p->headers_per_tu && c->header < pool ) ) {
+          return;
+        }
+        break;
+      }
+      // headers, with failed include path probes in front of some of them
+      if ( c->probe == 0 && rng_range(100) < p->enoent_pct ) {
+        c->probe = ENOENT_PROBES;
+      }
+      if ( c->probe > 0 ) {
+        fprintf(out, "%d openat(AT_FDCWD, \"%s/include/dir%d/hdr%d.h\", O_RDONLY|O_NOCTTY) = -1 ENOENT "
+                     "(No such file or directory)\n", c->cc1_pid, p->root, c->probe, c->headers[c->header]);
+        c->probe--;
+        if ( c->probe == 0 ) {
+          c->probe = -1; // the real header is next
+        }
+        return;
+      }
+      c->probe = 0;
+      fprintf(out, "%d openat(AT_FDCWD, \"%s/include/hdr%d.h\", O_RDONLY|O_NOCTTY) = 4\n",
+              c->cc1_pid, p->root, c->headers[c->header]);
+      c->header++;
+      if ( p->read_pct >= 0 ) {
+        c->io = rng_range(100) < p->read_pct ? 2 : 1;
+        return;
+      }
+      if ( c->header < p->headers_per_tu && c->header < pool ) {
+        return;
+      }
+      break;
+    case 10:
+      fprintf(out, "%d +++ exited with 0 +++\n", c->cc1_pid);
+      break;
+    case 11:
+      fprintf(out, "%d wait4(-1, [{WIFEXITED(s) && WEXITSTATUS(s) == 0}], 0, NULL) = %d\n",
+              c->gcc_pid, c->cc1_pid);
+      break;
+    case 12:
+      emit_spawn(out, p, c->gcc_pid, c->as_pid, true);
+      break;
+    case 13:
+      fprintf(out, "%d execve(\"/usr/bin/as\", [\"as\", \"--64\", \"-o\", \"obj/tu%d.o\", \"/tmp/ccA%05d.s\"], "
+                   "0x1c3e2b0 /* 47 vars */) = 0\n", c->as_pid, c->index, c->index);
+      break;
+    case 14:
+      emit_spawn(out, p, c->gcc_pid, c->as_pid, false);
+      break;
+    case 15:
+      fprintf(out, "%d openat(AT_FDCWD, \"/tmp/ccA%05d.s\", O_RDONLY) = 3\n", c->as_pid, c->index);
+      break;
+    case 16:
+      fprintf(out, "%d +++ exited with 0 +++\n", c->as_pid);
+      break;
+    case 17:
+      fprintf(out, "%d +++ exited with 0 +++\n", c->gcc_pid);
+      c->done = true;
+      break;
+  }
+  c->step++;
+}
+
+/*
+ * Emits the next line of a compile. With -u, a call may be split like strace -f splits
+ * one that another process's output interrupts: its first part is written now and the
+ * "<... resumed>" part becomes the compile's next line.
+ */
+static void emit_compile_step(FILE *out, gen_params *p, compile *c) {
+  if ( c->resumed != NULL ) {
+    fputs(c->resumed, out);
+    free(c->resumed);
+    c->resumed = NULL;
+    return;
+  }
+  char *line = NULL;
+  size_t line_size = 0;
+  FILE *line_out = open_memstream(&line, &line_size);
+  emit_compile_line(line_out, p, c);
+  fclose(line_out);
+  // only the calls that have returned, and are not already a resumed part, are split
+  char *result = strstr(line, ") = ");
+  if ( p->split_pct == 0 || result == NULL || strstr(line, "<...") != NULL ||
+       rng_range(100) >= p->split_pct ) {
+    fputs(line, out);
+    free(line);
+    return;
+  }
+  char *call = line + strspn(line, "0123456789 ");
+  int name_len = strcspn(call, "(");
+  fprintf(out, "%.*s <unfinished ...>\n", (int) (result - line), line);
+  c->resumed = malloc(strlen(line) + name_len + 32);
+  sprintf(c->resumed, "%d <... %.*s resumed>%s", atoi(line), name_len, call, result);
+  free(line);
+}
+
+/*
+ * Emits the final link of all objects into one program
+ */
+static void emit_link(FILE *out, gen_params *p) {
+  int gcc_pid = next_pid++;
+  int ld_pid = next_pid++;
+  emit_spawn(out, p, MAKE_PID, gcc_pid, true);
+  fprintf(out, "%d execve(\"/usr/bin/gcc\", [\"gcc\", \"-o\", \"prog\"", gcc_pid);
+  for ( int i = 0; i < p->targets; i++ ) {
+    fprintf(out, ", \"obj/tu%d.o\"", i);
+  }
+  fprintf(out, "], 0x55d0c8a4e2a0 /* 42 vars */) = 0\n");
+  emit_spawn(out, p, MAKE_PID, gcc_pid, false);
+  emit_spawn(out, p, gcc_pid, ld_pid, true);
+  fprintf(out, "%d execve(\"/usr/bin/ld\", [\"/usr/bin/ld\", \"-o\", \"prog\"], 0x1c3e2b0 /* 47 vars */) = 0\n",
+          ld_pid);
+  emit_spawn(out, p, gcc_pid, ld_pid, false);
+  for ( int i = 0; i < p->targets; i++ ) {
+    fprintf(out, "%d openat(AT_FDCWD, \"obj/tu%d.o\", O_RDONLY) = 3\n", ld_pid, i);
+  }
+  fprintf(out, "%d +++ exited with 0 +++\n", ld_pid);
+  fprintf(out, "%d +++ exited with 0 +++\n", gcc_pid);
+}
+
+/*
+ * Helper function to create a directory and all of its missing parents
+ */
+static void mkdirs(char *path) {
+  char buf[PATH_SIZE];
+  snprintf(buf, sizeof(buf), "%s", path);
+  for ( char *c = buf + 1; *c != '\0'; c++ ) {
+    if ( *c == '/' ) {
+      *c = '\0';
+      mkdir(buf, 0777);
+      *c = '/';
+    }
+  }
+  mkdir(buf, 0777);
+}
+
+/*
+ * Helper function to write a small file with the given contents
+ */
+static void write_file(char *path, char *contents, int repeat) {
+  FILE *f = fopen(path, "w");
+  if ( f == NULL ) {
+    fprintf(stderr, "ERROR: %s could not be opened for writing!\n", path);
+    exit(1);
+  }
+  for ( int i = 0; i < repeat; i++ ) {
+    fputs(contents, f);
+  }
+  fclose(f);
+}
+
+/*
+ * Creates the sources, headers and objects the generated trace refers to
+ */
+static void materialize_tree(gen_params *p) {
+  char path[PATH_SIZE];
+  int pool = p->headers_per_tu * HEADER_POOL_FACTOR;
+  snprintf(path, sizeof(path), "%s/src", p->root);
+  mkdirs(path);
+  snprintf(path, sizeof(path), "%s/include", p->root);
+  mkdirs(path);
+  snprintf(path, sizeof(path), "%s/obj", p->root);
+  mkdirs(path);
+  for ( int i = 0; i < p->targets; i++ ) {
+    snprintf(path, sizeof(path), "%s/src/tu%d.c", p->root, i);
+    write_file(path, "int f(int x) { return x * 3 + 1; }\n", 16);
+    snprintf(path, sizeof(path), "%s/obj/tu%d.o", p->root, i);
+    write_file(path, "\x7f" "ELF", 1);
+  }
+  for ( int i = 0; i < pool; i++ ) {
+    snprintf(path, sizeof(path), "%s/include/hdr%d.h", p->root, i);
+    write_file(path, "#define HEADER_MACRO(x) ((x) + 1)\nextern int header_symbol;\n", 32);
+  }
+}
+
+/*
+ * Splits the trace in out_name into the files strace -ff would have written: the lines
+ * of each process in out_name.PID, without the pid in front of them. A call split into
+ * "<unfinished ...>" and "<... resumed>" lines is joined again, strace -ff never splits one.
+ */
+static void write_per_pid(char *out_name) {
+  FILE *in = fopen(out_name, "r");
+  if ( in == NULL ) {
+    fprintf(stderr, "ERROR: %s could not be opened for reading!\n", out_name);
+    exit(1);
+  }
+  int count = next_pid - MAKE_PID;
+  char **contents = calloc(count, sizeof(char *));
+  size_t *sizes = calloc(count, sizeof(size_t));
+  FILE **outs = calloc(count, sizeof(FILE *));
+  char **held = calloc(count, sizeof(char *));
+  char *line = NULL;
+  size_t cap = 0;
+  ssize_t len;
+  while ( (len = getline(&line, &cap, in)) != -1 ) {
+    char *call;
+    int index = (int) strtol(line, &call, 10) - MAKE_PID;
+    if ( index < 0 || index >= count ) {
+      continue;
+    }
+    call += strspn(call, " ");
+    if ( outs[index] == NULL ) {
+      outs[index] = open_memstream(&contents[index], &sizes[index]);
+    }
+    char *unfinished = strstr(call, " <unfinished ...>\n");
+    char *resumed = strstr(call, " resumed>");
+    if ( unfinished != NULL ) {
+      held[index] = strndup(call, unfinished - call);
+    }
+    else if ( !strncmp(call, "<... ", 5) && resumed != NULL && held[index] != NULL ) {
+      fprintf(outs[index], "%s%s", held[index], resumed + 9);
+      free(held[index]);
+      held[index] = NULL;
+    }
+    else {
+      fputs(call, outs[index]);
+    }
+  }
+  free(line);
+  fclose(in);
+  char path[PATH_SIZE];
+  for ( int i = 0; i < count; i++ ) {
+    if ( outs[i] == NULL ) {
+      continue;
+    }
+    fclose(outs[i]);
+    snprintf(path, sizeof(path), "%s.%d", out_name, MAKE_PID + i);
+    FILE *f = fopen(path, "w");
+    if ( f == NULL ) {
+      fprintf(stderr, "ERROR: %s could not be opened for writing!\n", path);
+      exit(1);
+    }
+    fwrite(contents[i], 1, sizes[i], f);
+    fclose(f);
+    free(contents[i]);
+    free(held[i]);
+  }
+  free(contents);
+  free(sizes);
+  free(outs);
+  free(held);
+}
+
+int main(int argc, char **argv) {
+  gen_params p = { 200, 40, 1, "mixed", 8, 50, 0, -1, 1, NULL, false, false };
+  char *out_name = NULL;
+  char cwd[PATH_SIZE];
+  int opt;
+  while ( (opt = getopt(argc, argv, "t:H:P:f:a:e:u:R:s:r:mo:F")) != -1 ) {
+    switch ( opt ) {
+      case 't': p.targets = atoi(optarg); break;
+      case 'H': p.headers_per_tu = atoi(optarg); break;
+      case 'P': p.interleave = atoi(optarg); break;
+      case 'f': p.fork_mode = optarg; break;
+      case 'a': p.extra_args = atoi(optarg); break;
+      case 'e': p.enoent_pct = atoi(optarg); break;
+      case 'u': p.split_pct = atoi(optarg); break;
+      case 'R': p.read_pct = atoi(optarg); break;
+      case 's': p.seed = strtoull(optarg, NULL, 10); break;
+      case 'r': p.root = optarg; break;
+      case 'm': p.materialize = true; break;
+      case 'o': out_name = optarg; break;
+      case 'F': p.per_pid = true; break;
+      default:
+        fprintf(stderr, "usage: %s [-t targets] [-H headers] [-P interleave] [-f vfork|clone|mixed] "
+                        "[-a extra_args] [-e enoent_pct] [-u split_pct] [-R read_pct] [-s seed] [-r root] [-m] [-o file] [-F]\n", argv[0]);
+        exit(1);
+    }
+  }
+  if ( strcmp(p.fork_mode, "vfork") && strcmp(p.fork_mode, "clone") && strcmp(p.fork_mode, "mixed") ) {
+    fprintf(stderr, "ERROR: unknown fork mode %s\n", p.fork_mode);
+    exit(1);
+  }
+  if ( p.targets < 1 || p.headers_per_tu < 1 || p.interleave < 1 ) {
+    fprintf(stderr, "ERROR: targets, headers and interleave must be positive\n");
+    exit(1);
+  }
+  if ( p.per_pid && out_name == NULL ) {
+    fprintf(stderr, "ERROR: -F needs the trace file name given with -o\n");
+    exit(1);
+  }
+  if ( p.root == NULL ) {
+    if ( getcwd(cwd, sizeof(cwd)) == NULL ) {
+      fprintf(stderr, "ERROR: current directory could not be read\n");
+      exit(1);
+    }
+    p.root = cwd;
+  }
+  rng_state = p.seed * 0x9E3779B97F4A7C15ULL + 1;
+
+  FILE *out = stdout;
+  if ( out_name != NULL ) {
+    out = fopen(out_name, "w");
+    if ( out == NULL ) {
+      fprintf(stderr, "ERROR: output file %s could not be opened!\n", out_name);
+      exit(1);
+    }
+  }
+  if ( p.materialize ) {
+    materialize_tree(&p);
+  }
+
+  fprintf(out, "%d execve(\"/usr/bin/make\", [\"make\"], 0x7ffd6f9e8a58 /* 40 vars */) = 0\n", MAKE_PID);
+  fprintf(out, "%d openat(AT_FDCWD, \"Makefile\", O_RDONLY) = 3\n", MAKE_PID);
+
+  // run up to interleave compiles at once, picking which one emits the next line at random
+  int pool = p.headers_per_tu * HEADER_POOL_FACTOR;
+  compile *running = calloc(p.interleave, sizeof(compile));
+  int started = 0;
+  int active = 0;
+  while ( started < p.targets || active > 0 ) {
+    for ( int i = 0; i < p.interleave && started < p.targets; i++ ) {
+      if ( running[i].headers == NULL ) {
+        compile *c = &running[i];
+        c->index = started++;
+        c->gcc_pid = next_pid++;
+        c->cc1_pid = next_pid++;
+        c->as_pid = next_pid++;
+        c->headers = malloc(p.headers_per_tu * sizeof(int));
+        for ( int h = 0; h < p.headers_per_tu; h++ ) {
+          c->headers[h] = rng_range(pool);
+        }
+        active++;
+      }
+    }
+    int slot = rng_range(p.interleave);
+    while ( running[slot].headers == NULL ) {
+      slot = (slot + 1) % p.interleave;
+    }
+    emit_compile_step(out, &p, &running[slot]);
+    if ( running[slot].done ) {
+      free(running[slot].headers);
+      memset(&running[slot], 0, sizeof(compile));
+      active--;
+    }
+  }
+  free(running);
+
+  emit_link(out, &p);
+  fprintf(out, "%d +++ exited with 0 +++\n", MAKE_PID);
+  if ( out != stdout ) {
+    fclose(out);
+  }
+  if ( p.per_pid ) {
+    write_per_pid(out_name);
+  }
+  return 0;
+}
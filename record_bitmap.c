@@ -0,0 +1,337 @@
+/*
+ * Compressed bitmaps, see record_bitmap.h
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "record_bitmap.h"
+
+void BITMAP_init(bitmap *b) {
+  memset(b, 0, sizeof(bitmap));
+}
+
+/*
+ * Returns the index of the container of key, or, when there is none, -1 minus the index
+ * it would be inserted at
+ */
+static int BITMAP_find(const bitmap *b, uint16_t key) {
+  // ids mostly arrive in order, into the last container
+  int n = b->container_count;
+  if ( n > 0 && b->containers[n - 1].key == key ) {
+    return n - 1;
+  }
+  if ( n == 0 || b->containers[n - 1].key < key ) {
+    return -1 - n;
+  }
+  int lo = 0, hi = n;
+  while ( lo < hi ) {
+    int mid = (lo + hi) / 2;
+    if ( b->containers[mid].key < key ) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  return lo < n && b->containers[lo].key == key ? lo : -1 - lo;
+}
+
+static bitmap_container *BITMAP_insert(bitmap *b, int index, uint16_t key) {
+  if ( b->container_count == b->container_cap ) {
+    b->container_cap = b->container_cap ? b->container_cap * 2 : 4;
+    b->containers = realloc(b->containers, b->container_cap * sizeof(bitmap_container));
+  }
+  memmove(b->containers + index + 1, b->containers + index,
+          (b->container_count - index) * sizeof(bitmap_container));
+  b->container_count++;
+  bitmap_container *c = &b->containers[index];
+  memset(c, 0, sizeof(bitmap_container));
+  c->key = key;
+  return c;
+}
+
+/*
+ * Returns the index of the first value of an array container that is not below low
+ */
+static int BITMAP_lower_bound(const uint16_t *values, int count, uint16_t low) {
+  int lo = 0, hi = count;
+  while ( lo < hi ) {
+    int mid = (lo + hi) / 2;
+    if ( values[mid] < low ) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static bool BITMAP_has_bit(const uint64_t *words, uint16_t low) {
+  return (words[low >> 6] >> (low & 63)) & 1;
+}
+
+static int BITMAP_popcount(const uint64_t *words) {
+  int count = 0;
+  for ( int i = 0; i < BITMAP_WORDS; i++ ) {
+    count += __builtin_popcountll(words[i]);
+  }
+  return count;
+}
+
+/*
+ * Turns an array container into a bitset container
+ */
+static void BITMAP_to_bitset(bitmap_container *c) {
+  c->words = calloc(BITMAP_WORDS, sizeof(uint64_t));
+  for ( int i = 0; i < c->count; i++ ) {
+    c->words[c->values[i] >> 6] |= 1ULL << (c->values[i] & 63);
+  }
+  free(c->values);
+  c->values = NULL;
+  c->cap = 0;
+}
+
+void BITMAP_add(bitmap *b, int id) {
+  uint16_t key = (uint32_t) id >> 16;
+  uint16_t low = id & 0xffff;
+  int index = BITMAP_find(b, key);
+  bitmap_container *c = index >= 0 ? &b->containers[index] : BITMAP_insert(b, -1 - index, key);
+  if ( c->words != NULL ) {
+    if ( !BITMAP_has_bit(c->words, low) ) {
+      c->words[low >> 6] |= 1ULL << (low & 63);
+      c->count++;
+      b->count++;
+    }
+    return;
+  }
+  int at = c->count > 0 && c->values[c->count - 1] < low ? c->count :
+           BITMAP_lower_bound(c->values, c->count, low);
+  if ( at < c->count && c->values[at] == low ) {
+    return;
+  }
+  b->count++;
+  if ( c->count == BITMAP_ARRAY_MAX ) {
+    BITMAP_to_bitset(c);
+    c->words[low >> 6] |= 1ULL << (low & 63);
+    c->count++;
+    return;
+  }
+  if ( c->count == c->cap ) {
+    c->cap = c->cap ? c->cap * 2 : 4;
+    c->values = realloc(c->values, c->cap * sizeof(uint16_t));
+  }
+  memmove(c->values + at + 1, c->values + at, (c->count - at) * sizeof(uint16_t));
+  c->values[at] = low;
+  c->count++;
+}
+
+bool BITMAP_contains(const bitmap *b, int id) {
+  int index = BITMAP_find(b, (uint32_t) id >> 16);
+  if ( index < 0 ) {
+    return false;
+  }
+  const bitmap_container *c = &b->containers[index];
+  uint16_t low = id & 0xffff;
+  if ( c->words != NULL ) {
+    return BITMAP_has_bit(c->words, low);
+  }
+  int at = BITMAP_lower_bound(c->values, c->count, low);
+  return at < c->count && c->values[at] == low;
+}
+
+/*
+ * Adds the ids of container from to container c, of the same key
+ */
+static void BITMAP_or_container(bitmap_container *c, const bitmap_container *from) {
+  if ( c->words == NULL && ( from->words != NULL || c->count + from->count > BITMAP_ARRAY_MAX ) ) {
+    BITMAP_to_bitset(c);
+  }
+  if ( c->words != NULL ) {
+    if ( from->words != NULL ) {
+      for ( int i = 0; i < BITMAP_WORDS; i++ ) {
+        c->words[i] |= from->words[i];
+      }
+    }
+    else {
+      for ( int i = 0; i < from->count; i++ ) {
+        c->words[from->values[i] >> 6] |= 1ULL << (from->values[i] & 63);
+      }
+    }
+    c->count = BITMAP_popcount(c->words);
+    return;
+  }
+  // two arrays, merged into a new one
+  int cap = c->count + from->count;
+  uint16_t *merged = malloc(cap * sizeof(uint16_t));
+  int i = 0, j = 0, n = 0;
+  while ( i < c->count || j < from->count ) {
+    if ( j == from->count || ( i < c->count && c->values[i] < from->values[j] ) ) {
+      merged[n++] = c->values[i++];
+    }
+    else if ( i == c->count || from->values[j] < c->values[i] ) {
+      merged[n++] = from->values[j++];
+    }
+    else {
+      merged[n++] = c->values[i++];
+      j++;
+    }
+  }
+  free(c->values);
+  c->values = merged;
+  c->count = n;
+  c->cap = cap;
+}
+
+/*
+ * Adds every id of other to b
+ */
+void BITMAP_or(bitmap *b, const bitmap *other) {
+  for ( int k = 0; k < other->container_count; k++ ) {
+    const bitmap_container *from = &other->containers[k];
+    if ( from->count == 0 ) {
+      continue;
+    }
+    int index = BITMAP_find(b, from->key);
+    bitmap_container *c;
+    if ( index < 0 ) {
+      c = BITMAP_insert(b, -1 - index, from->key);
+    }
+    else {
+      c = &b->containers[index];
+      b->count -= c->count;
+    }
+    BITMAP_or_container(c, from);
+    b->count += c->count;
+  }
+}
+
+/*
+ * Returns the ids two array containers have in common
+ */
+static int BITMAP_and_arrays(const bitmap_container *a, const bitmap_container *b) {
+  if ( a->count > b->count ) {
+    const bitmap_container *t = a;
+    a = b;
+    b = t;
+  }
+  int count = 0;
+  if ( a->count * 32 < b->count ) {
+    // far apart: search the larger for each id of the smaller, past the last one found
+    int from = 0;
+    for ( int i = 0; i < a->count && from < b->count; i++ ) {
+      from += BITMAP_lower_bound(b->values + from, b->count - from, a->values[i]);
+      if ( from < b->count && b->values[from] == a->values[i] ) {
+        count++;
+      }
+    }
+    return count;
+  }
+  int i = 0, j = 0;
+  while ( i < a->count && j < b->count ) {
+    if ( a->values[i] < b->values[j] ) {
+      i++;
+    }
+    else if ( b->values[j] < a->values[i] ) {
+      j++;
+    }
+    else {
+      count++;
+      i++;
+      j++;
+    }
+  }
+  return count;
+}
+
+static int BITMAP_and_container(const bitmap_container *a, const bitmap_container *b) {
+  if ( a->words != NULL && b->words != NULL ) {
+    int count = 0;
+    for ( int i = 0; i < BITMAP_WORDS; i++ ) {
+      count += __builtin_popcountll(a->words[i] & b->words[i]);
+    }
+    return count;
+  }
+  if ( a->words == NULL && b->words == NULL ) {
+    return BITMAP_and_arrays(a, b);
+  }
+  if ( a->words != NULL ) {
+    const bitmap_container *t = a;
+    a = b;
+    b = t;
+  }
+  int count = 0;
+  for ( int i = 0; i < a->count; i++ ) {
+    count += BITMAP_has_bit(b->words, a->values[i]);
+  }
+  return count;
+}
+
+/*
+ * Returns the number of ids in both a and b
+ */
+long BITMAP_and_count(const bitmap *a, const bitmap *b) {
+  long count = 0;
+  int i = 0, j = 0;
+  while ( i < a->container_count && j < b->container_count ) {
+    if ( a->containers[i].key < b->containers[j].key ) {
+      i++;
+    }
+    else if ( b->containers[j].key < a->containers[i].key ) {
+      j++;
+    }
+    else {
+      count += BITMAP_and_container(&a->containers[i++], &b->containers[j++]);
+    }
+  }
+  return count;
+}
+
+/*
+ * Writes the ids of a bitmap, ascending, into *buffer, which is grown as needed
+ * Returns the number of ids
+ */
+long BITMAP_values(const bitmap *b, int **buffer, long *cap) {
+  if ( b->count > *cap ) {
+    *cap = b->count * 2;
+    *buffer = realloc(*buffer, *cap * sizeof(int));
+  }
+  long n = 0;
+  for ( int k = 0; k < b->container_count; k++ ) {
+    const bitmap_container *c = &b->containers[k];
+    int high = (int) c->key << 16;
+    if ( c->words == NULL ) {
+      for ( int i = 0; i < c->count; i++ ) {
+        (*buffer)[n++] = high | c->values[i];
+      }
+      continue;
+    }
+    for ( int w = 0; w < BITMAP_WORDS; w++ ) {
+      for ( uint64_t bits = c->words[w]; bits != 0; bits &= bits - 1 ) {
+        (*buffer)[n++] = high | (w << 6 | __builtin_ctzll(bits));
+      }
+    }
+  }
+  return n;
+}
+
+/*
+ * Empties a bitmap, keeping it ready for use
+ */
+void BITMAP_clear(bitmap *b) {
+  for ( int k = 0; k < b->container_count; k++ ) {
+    free(b->containers[k].values);
+    free(b->containers[k].words);
+  }
+  b->container_count = 0;
+  b->count = 0;
+}
+
+void BITMAP_free(bitmap *b) {
+  BITMAP_clear(b);
+  free(b->containers);
+  memset(b, 0, sizeof(bitmap));
+}
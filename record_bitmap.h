@@ -0,0 +1,55 @@
+/*
+ * Compressed bitmaps of ids, for set algebra over dependencies and targets
+ *
+ * A bitmap holds a set of non-negative ints, such as the path ids of an intern_table or
+ * the indices of a model's targets, in the layout of roaring bitmaps: the ids are
+ * grouped by their high 16 bits, and each group is a container of its low 16 bits,
+ * either a sorted array while it holds at most BITMAP_ARRAY_MAX of them, or a bitset of
+ * all 65536 beyond that. A set of a few ids takes two bytes per id, and one of most of
+ * a range one bit per id. Adding the ids in ascending order, as they are when a table of
+ * targets is walked, only ever appends.
+ *
+ * Unions are taken in place, and intersections are counted without being built, which
+ * is all the analyses need: a subset is one whose intersection with the other set is
+ * the whole of it. Two bitsets are intersected a word at a time, in loops the compiler
+ * vectorizes, an array and a bitset by testing the bits of the array's ids, and two
+ * arrays by merging them, or by binary searches of the larger for the smaller's ids when
+ * their sizes are far apart.
+ */
+
+#ifndef RECORD_BITMAP_H
+#define RECORD_BITMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// the most ids a container keeps as an array: beyond that the 8 KB bitset is smaller
+#define BITMAP_ARRAY_MAX 4096
+// 64-bit words of a bitset container
+#define BITMAP_WORDS 1024
+
+typedef struct bitmap_container_struct {
+  uint16_t key;           // the high 16 bits of its ids
+  int count;              // ids in the container
+  int cap;                // of values
+  uint16_t *values;       // the low 16 bits, ascending, for an array container
+  uint64_t *words;        // a bit per low 16 bits for a bitset container, else NULL
+} bitmap_container;
+
+typedef struct bitmap_struct {
+  bitmap_container *containers;   // ascending key
+  int container_count;
+  int container_cap;
+  long count;             // ids in the set
+} bitmap;
+
+void BITMAP_init(bitmap *b);
+void BITMAP_add(bitmap *b, int id);
+bool BITMAP_contains(const bitmap *b, int id);
+void BITMAP_or(bitmap *b, const bitmap *other);
+long BITMAP_and_count(const bitmap *a, const bitmap *b);
+long BITMAP_values(const bitmap *b, int **buffer, long *cap);
+void BITMAP_clear(bitmap *b);
+void BITMAP_free(bitmap *b);
+
+#endif
@@ -0,0 +1,405 @@
+/*
+ * Checkpoints of a trace parse, see record_checkpoint.h
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "record_checkpoint.h"
+#include "record_core.h"
+#include "record_hash.h"
+#include "record_model.h"
+#include "record_probed.h"
+
+// the first bytes of a checkpoint file, with the version of its layout
+#define CHECKPOINT_MAGIC "RBCKPT04"
+// the bytes of trace before the offset hashed into trace_check
+#define CHECKPOINT_CHECK_BYTES 4096
+
+/*
+ * Returns a hash of the bytes of the trace before offset, or 0 if they cannot be read
+ */
+uint64_t CHECKPOINT_trace_check(int trace_fd, long long offset) {
+  char buffer[CHECKPOINT_CHECK_BYTES];
+  size_t len = offset < CHECKPOINT_CHECK_BYTES ? offset : CHECKPOINT_CHECK_BYTES;
+  uint64_t hash;
+  if ( HASH_range(trace_fd, offset - len, len, buffer, &hash) != 0 ) {
+    return 0;
+  }
+  return hash;
+}
+
+static void put_int(FILE *file, long long value) {
+  int64_t v = value;
+  fwrite(&v, sizeof(v), 1, file);
+}
+
+static void put_double(FILE *file, double value) {
+  fwrite(&value, sizeof(value), 1, file);
+}
+
+static void put_string(FILE *file, const char *s) {
+  put_int(file, s != NULL ? (long long) strlen(s) : -1);
+  if ( s != NULL ) {
+    fwrite(s, 1, strlen(s), file);
+  }
+}
+
+static void put_probed(FILE *file, const probe_set *s) {
+  put_int(file, s->count);
+  for ( int i = 0; i < s->count; i++ ) {
+    put_string(file, PROBED_path(s->ids[i]));
+  }
+}
+
+static void put_target(FILE *file, const target *tar) {
+  put_string(file, tar->target_name);
+  put_string(file, tar->cmd);
+  put_string(file, tar->dir);
+  put_double(file, tar->duration);
+  put_int(file, tar->peak_rss);
+  put_double(file, tar->cpu_time);
+  long long deps = 0;
+  for ( depnode *dep = tar->head; dep != NULL; dep = dep->next ) {
+    deps++;
+  }
+  put_int(file, deps);
+  for ( depnode *dep = tar->head; dep != NULL; dep = dep->next ) {
+    put_string(file, dep->dep);
+    put_int(file, dep->bytes_read);
+  }
+  put_probed(file, &tar->absent);
+  put_probed(file, &tar->exists);
+}
+
+/*
+ * Reads back what the put_ functions wrote; a short or corrupt file sets bad, after
+ * which every value read is 0 or NULL
+ */
+typedef struct checkpoint_reader_struct {
+  FILE *file;
+  bool bad;
+} checkpoint_reader;
+
+static long long get_int(checkpoint_reader *r) {
+  int64_t v = 0;
+  if ( r->bad || fread(&v, sizeof(v), 1, r->file) != 1 ) {
+    r->bad = true;
+    return 0;
+  }
+  return v;
+}
+
+static double get_double(checkpoint_reader *r) {
+  double v = 0;
+  if ( r->bad || fread(&v, sizeof(v), 1, r->file) != 1 ) {
+    r->bad = true;
+    return 0;
+  }
+  return v;
+}
+
+/*
+ * Returns a string allocated with malloc, or NULL for one that was written as NULL
+ */
+static char *get_string(checkpoint_reader *r) {
+  long long len = get_int(r);
+  if ( r->bad || len < 0 ) {
+    return NULL;
+  }
+  char *s = malloc(len + 1);
+  if ( len > 0 && fread(s, 1, len, r->file) != (size_t) len ) {
+    r->bad = true;
+    free(s);
+    return NULL;
+  }
+  s[len] = '\0';
+  return s;
+}
+
+/*
+ * Returns a count read from the file, which is bad if it is negative
+ */
+static long long get_count(checkpoint_reader *r) {
+  long long count = get_int(r);
+  if ( count < 0 ) {
+    r->bad = true;
+    return 0;
+  }
+  return count;
+}
+
+static void get_probed(checkpoint_reader *r, probe_set *s) {
+  long long count = get_count(r);
+  for ( long long i = 0; i < count && !r->bad; i++ ) {
+    char *path = get_string(r);
+    if ( path != NULL ) {
+      PROBED_add(s, path);
+      free(path);
+    }
+  }
+}
+
+/*
+ * Returns a target read back, which is bad if it has no name or command
+ */
+static target *get_target(checkpoint_reader *r) {
+  target *tar = calloc(1, sizeof(target));
+  tar->target_name = get_string(r);
+  tar->cmd = get_string(r);
+  tar->dir = get_string(r);
+  tar->duration = get_double(r);
+  tar->peak_rss = get_int(r);
+  tar->cpu_time = get_double(r);
+  long long deps = get_count(r);
+  for ( long long i = 0; i < deps && !r->bad; i++ ) {
+    char *dep = get_string(r);
+    long bytes = get_int(r);
+    if ( dep != NULL ) {
+      TARGET_append_dep(tar, dep);
+      tar->tail->bytes_read = bytes;
+      free(dep);
+    }
+  }
+  get_probed(r, &tar->absent);
+  get_probed(r, &tar->exists);
+  if ( tar->target_name == NULL || tar->cmd == NULL ) {
+    r->bad = true;
+  }
+  return tar;
+}
+
+/*
+ * Writes a checkpoint of the parse, replacing the previous one atomically
+ * Returns 0 on success, or -1 if the previous checkpoint was kept
+ */
+int CHECKPOINT_save(const char *file_name, const parser *p, const checkpoint *ck) {
+  char *tmp_path;
+  FILE *file = ATOMIC_open(file_name, &tmp_path);
+  if ( file == NULL ) {
+    return -1;
+  }
+  fwrite(CHECKPOINT_MAGIC, 1, strlen(CHECKPOINT_MAGIC), file);
+  put_int(file, p->track_reads | p->track_probes << 1);
+  put_int(file, ck->trace_offset);
+  put_int(file, (long long) ck->trace_check);
+  for ( int i = 0; i < CHECKPOINT_OUTPUTS; i++ ) {
+    put_int(file, ck->outputs[i]);
+  }
+  put_string(file, ck->make_targets);
+
+  // the parser's state and counters
+  put_string(file, p->pwd);
+  put_int(file, p->pid);
+  put_int(file, p->timed);
+  put_double(file, p->now);
+  put_double(file, p->target_start);
+  long long counters[7] = { p->lines, p->bytes, p->processes, p->targets, p->deps_pending,
+                            p->files_copied, p->bytes_copied };
+  for ( int i = 0; i < 7; i++ ) {
+    put_int(file, counters[i]);
+  }
+  put_int(file, p->pending_count);
+  for ( int i = 0; i < p->pending_count; i++ ) {
+    put_int(file, p->pending[i].pid);
+    put_string(file, p->pending[i].head);
+  }
+  long long gcc_pids = 0;
+  for ( node *n = p->fps_list->head; n != NULL; n = n->next ) {
+    gcc_pids++;
+  }
+  put_int(file, gcc_pids);
+  for ( node *n = p->fps_list->head; n != NULL; n = n->next ) {
+    put_int(file, n->pid);
+    put_string(file, n->path);
+  }
+  put_int(file, p->open_count);
+  for ( int i = 0; i < p->open_count; i++ ) {
+    open_file *f = &p->open_files[i];
+    put_int(file, f->pid);
+    put_int(file, f->fd);
+    put_int(file, f->bytes);
+    put_int(file, f->read);
+    put_string(file, f->path);
+  }
+
+  // the targets held for their processes, with the one being collected among them
+  int current = -1;
+  put_int(file, p->held_count);
+  for ( int i = 0; i < p->held_count; i++ ) {
+    put_target(file, p->held[i].tar);
+    put_double(file, p->held[i].start);
+    put_int(file, p->held[i].pids);
+    current = p->held[i].tar == p->cur_target ? i : current;
+  }
+  put_int(file, p->owner_count);
+  for ( int i = 0; i < p->owner_count; i++ ) {
+    int held = 0;
+    while ( p->held[held].tar != p->owners[i].tar ) {
+      held++;
+    }
+    put_int(file, p->owners[i].pid);
+    put_int(file, held);
+  }
+  put_int(file, current);
+  // or the target being collected, when it is not held
+  put_int(file, current == -1 && p->cur_target != NULL);
+  if ( current == -1 && p->cur_target != NULL ) {
+    put_target(file, p->cur_target);
+  }
+  fwrite(CHECKPOINT_MAGIC, 1, strlen(CHECKPOINT_MAGIC), file);
+  if ( ferror(file) ) {
+    fprintf(stderr, "ERROR: checkpoint %s could not be written!\n", file_name);
+    fclose(file);
+    unlink(tmp_path);
+    free(tmp_path);
+    return -1;
+  }
+  return ATOMIC_commit(file, tmp_path, file_name);
+}
+
+/*
+ * Restores the state of a checkpointed parse into a parser that has only been
+ * initialized, with the same track_reads and track_probes as the parse that wrote it
+ * Returns 0, or -1 if the checkpoint could not be read or is of another kind of parse
+ */
+int CHECKPOINT_load(const char *file_name, parser *p, checkpoint *ck) {
+  memset(ck, 0, sizeof(checkpoint));
+  FILE *file = fopen(file_name, "r");
+  if ( file == NULL ) {
+    fprintf(stderr, "ERROR: checkpoint %s could not be opened!\n", file_name);
+    return -1;
+  }
+  checkpoint_reader r = { file, false };
+  char magic[sizeof(CHECKPOINT_MAGIC)] = "";
+  if ( fread(magic, 1, strlen(CHECKPOINT_MAGIC), file) != strlen(CHECKPOINT_MAGIC) ||
+       strcmp(magic, CHECKPOINT_MAGIC) ) {
+    fprintf(stderr, "ERROR: %s is not a checkpoint of this version of record_build!\n",
+            file_name);
+    fclose(file);
+    return -1;
+  }
+  long long flags = get_int(&r);
+  if ( !r.bad && flags != (p->track_reads | p->track_probes << 1) ) {
+    fprintf(stderr, "ERROR: checkpoint %s was taken %s --reads and %s --probes!\n", file_name,
+            flags & 1 ? "with" : "without", flags & 2 ? "with" : "without");
+    fclose(file);
+    return -1;
+  }
+  ck->trace_offset = get_int(&r);
+  ck->trace_check = (uint64_t) get_int(&r);
+  for ( int i = 0; i < CHECKPOINT_OUTPUTS; i++ ) {
+    ck->outputs[i] = get_int(&r);
+  }
+  ck->make_targets = get_string(&r);
+
+  char *pwd = get_string(&r);
+  if ( pwd != NULL ) {
+    free(p->pwd);
+    p->pwd = pwd;
+  }
+  p->pid = get_int(&r);
+  p->timed = get_int(&r) != 0;
+  p->now = get_double(&r);
+  p->target_start = get_double(&r);
+  long *counters[7] = { &p->lines, &p->bytes, &p->processes, &p->targets, &p->deps_pending,
+                        &p->files_copied, &p->bytes_copied };
+  for ( int i = 0; i < 7; i++ ) {
+    *counters[i] = get_int(&r);
+  }
+  long long pending = get_count(&r);
+  if ( pending > 0 && !r.bad ) {
+    p->pending = calloc(pending, sizeof(pending_call));
+    p->pending_cap = pending;
+  }
+  for ( long long i = 0; i < pending && !r.bad; i++ ) {
+    pending_call *pc = &p->pending[p->pending_count++];
+    pc->pid = get_int(&r);
+    pc->head = get_string(&r);
+    pc->len = pc->head != NULL ? strlen(pc->head) : 0;
+    pc->cap = pc->len + 1;
+  }
+  long long gcc_pids = get_count(&r);
+  for ( long long i = 0; i < gcc_pids && !r.bad; i++ ) {
+    int pid = get_int(&r);
+    char *path = get_string(&r);
+    if ( path != NULL ) {
+      LIST_add(p->fps_list, pid, path);
+      free(path);
+    }
+  }
+  long long open = get_count(&r);
+  if ( open > 0 && !r.bad ) {
+    p->open_files = calloc(open, sizeof(open_file));
+    p->open_cap = open;
+  }
+  for ( long long i = 0; i < open && !r.bad; i++ ) {
+    open_file *f = &p->open_files[p->open_count++];
+    f->pid = get_int(&r);
+    f->fd = get_int(&r);
+    f->bytes = get_int(&r);
+    f->read = get_int(&r) != 0;
+    f->path = get_string(&r);
+  }
+
+  long long held = get_count(&r);
+  if ( held > 0 && !r.bad ) {
+    p->held = calloc(held, sizeof(held_target));
+    p->held_cap = held;
+  }
+  for ( long long i = 0; i < held && !r.bad; i++ ) {
+    held_target *h = &p->held[p->held_count++];
+    h->tar = get_target(&r);
+    h->start = get_double(&r);
+    h->pids = get_int(&r);
+  }
+  long long owners = get_count(&r);
+  if ( owners > 0 && !r.bad ) {
+    p->owners = calloc(owners, sizeof(owned_pid));
+    p->owner_cap = owners;
+  }
+  for ( long long i = 0; i < owners && !r.bad; i++ ) {
+    int pid = get_int(&r);
+    long long index = get_int(&r);
+    if ( index < 0 || index >= p->held_count ) {
+      r.bad = true;
+      break;
+    }
+    p->owners[p->owner_count].pid = pid;
+    p->owners[p->owner_count++].tar = p->held[index].tar;
+  }
+  long long current = get_int(&r);
+  if ( current < -1 || current >= p->held_count ) {
+    r.bad = true;
+  }
+  else if ( current >= 0 ) {
+    p->cur_target = p->held[current].tar;
+  }
+  if ( get_int(&r) != 0 ) {
+    if ( p->cur_target != NULL ) {
+      r.bad = true;
+    }
+    else {
+      p->cur_target = get_target(&r);
+    }
+  }
+  if ( fread(magic, 1, strlen(CHECKPOINT_MAGIC), file) != strlen(CHECKPOINT_MAGIC) ||
+       strcmp(magic, CHECKPOINT_MAGIC) || fgetc(file) != EOF ) {
+    r.bad = true;
+  }
+  fclose(file);
+  if ( r.bad ) {
+    fprintf(stderr, "ERROR: checkpoint %s is incomplete!\n", file_name);
+    return -1;
+  }
+  return 0;
+}
+
+void CHECKPOINT_free(checkpoint *ck) {
+  free(ck->make_targets);
+  ck->make_targets = NULL;
+}
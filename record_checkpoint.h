@@ -0,0 +1,53 @@
+/*
+ * Checkpoints of a long trace parse, so an interrupted one can be resumed
+ *
+ * Every config.checkpoint_bytes of trace, at the end of a line, the session writes the
+ * state of its parse into the checkpoint file: how far into the trace it got, the state
+ * the parser carries from line to line (the pids running gcc, the calls strace left
+ * unfinished, the files open, the target being collected and the ones held for their
+ * running processes, with their dependencies, and the target of each of those processes)
+ * and the length each output file had when the checkpoint was taken, after flushing it.
+ * Only the targets that have not been written out are in the checkpoint; the ones
+ * written are already in the output files. Resuming (record_build --resume) loads the
+ * parser's state, cuts each output file back to its recorded length and parses the
+ * trace from the recorded offset, so the lines are parsed exactly once across both runs.
+ *
+ * The file is binary, in the byte order of the host that wrote it, and is written next
+ * to the trace and renamed over the previous checkpoint (see ATOMIC_open()), so a crash
+ * while one is written leaves the one before it. To tell a checkpoint of another trace,
+ * it keeps a hash of the bytes of the trace just before its offset.
+ */
+
+#ifndef RECORD_CHECKPOINT_H
+#define RECORD_CHECKPOINT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "record_parser.h"
+
+// the output files whose lengths a checkpoint records, in this order
+enum {
+  CHECKPOINT_CMDS,
+  CHECKPOINT_SOURCES,
+  CHECKPOINT_DEPS,
+  CHECKPOINT_MAKEFILE,
+  CHECKPOINT_OUTPUTS
+};
+
+/*
+ * What a checkpoint records besides the parser's state
+ */
+typedef struct checkpoint_struct {
+  long long trace_offset;             // bytes of the trace parsed, up to the end of a line
+  uint64_t trace_check;               // see CHECKPOINT_trace_check()
+  long long outputs[CHECKPOINT_OUTPUTS]; // the length of each output file, -1 if not written
+  char *make_targets;                 // the sandbox Makefile's targets so far, see append_make_target()
+} checkpoint;
+
+uint64_t CHECKPOINT_trace_check(int trace_fd, long long offset);
+int CHECKPOINT_save(const char *file_name, const parser *p, const checkpoint *ck);
+int CHECKPOINT_load(const char *file_name, parser *p, checkpoint *ck);
+void CHECKPOINT_free(checkpoint *ck);
+
+#endif
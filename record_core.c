@@ -0,0 +1,529 @@
+/*
+ * Helper functions for parsing strace -f output and building the sandbox,
+ * see record_core.h
+ */
+
+#include <errno.h>
+#include <libgen.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "record_core.h"
+#include "record_probed.h"
+#include "record_probes.h"
+#include "record_stats.h"
+
+/*
+ * Adds a new dependency filepath to a target
+ */
+void TARGET_add_dep(target *tar, char *new_dep) {
+  depnode *copy = tar->head;
+  while ( copy != NULL ) {
+    if ( !strcmp(copy->dep, new_dep ) ) {
+      // target already has this dependency, do not repeat it
+      return;
+    }
+    copy = copy->next;
+  }
+  depnode *newnode = malloc(sizeof(depnode));
+  newnode->dep = strdup(new_dep);
+  newnode->bytes_read = 0;
+  newnode->next = NULL;
+  if ( tar->head == NULL ) {
+    tar->head = tar->tail = newnode;
+  }
+  else {
+    tar->tail->next = newnode;
+    tar->tail = newnode;
+  }
+}
+
+/*
+ * Adds a dependency the target's command read bytes from, adding them to the bytes
+ * already counted if the target has it
+ */
+void TARGET_add_read(target *tar, char *dep, long bytes) {
+  for ( depnode *node = tar->head; node != NULL; node = node->next ) {
+    if ( !strcmp(node->dep, dep) ) {
+      node->bytes_read += bytes;
+      return;
+    }
+  }
+  TARGET_append_dep(tar, dep);
+  tar->tail->bytes_read = bytes;
+}
+
+bool TARGET_has_dep(target *tar, char *dep) {
+  for ( depnode *node = tar->head; node != NULL; node = node->next ) {
+    if ( !strcmp(node->dep, dep) ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * Appends a dependency filepath to a target without checking for a repeat,
+ * for dependency lists that are already known to be unique
+ */
+void TARGET_append_dep(target *tar, char *new_dep) {
+  depnode *newnode = malloc(sizeof(depnode));
+  newnode->dep = strdup(new_dep);
+  newnode->bytes_read = 0;
+  newnode->next = NULL;
+  if ( tar->head == NULL ) {
+    tar->head = tar->tail = newnode;
+  }
+  else {
+    tar->tail->next = newnode;
+    tar->tail = newnode;
+  }
+}
+
+/*
+ * Frees a target and all of its dependencies
+ */
+void TARGET_free(target *tar) {
+  depnode *cur = tar->head;
+  while ( cur != NULL ) {
+    depnode *next = cur->next;
+    free(cur->dep);
+    free(cur);
+    cur = next;
+  }
+  PROBED_free(&tar->absent);
+  PROBED_free(&tar->exists);
+  free(tar->target_name);
+  free(tar->cmd);
+  free(tar->dir);
+  free(tar);
+}
+
+/*
+ * Returns the command that rebuilds a target inside the sandbox: the recorded command
+ * with "-I[path-to-sandbox]" inserted after gcc/g++. The result must be freed.
+ */
+char *TARGET_sandbox_cmd(target *tar, char *sb_pwd) {
+  //TODO: need to change to track multiple commands
+  char *gcc_index = strstr(tar->cmd, "gcc");
+  if ( !gcc_index ) {
+    //if it is not a gcc command, check for a g++ command
+    gcc_index = strstr(tar->cmd, "g++");
+  }
+  if ( !gcc_index ) {
+    return strdup(tar->cmd);
+  }
+  //all chars up to and including "gcc " in the command, then the -I flag, then the rest
+  size_t prefix_len = gcc_index - tar->cmd + 4;
+  char *sandbox_cmd = malloc(strlen(tar->cmd) + strlen(sb_pwd) + 4);
+  memcpy(sandbox_cmd, tar->cmd, prefix_len);
+  sprintf(sandbox_cmd + prefix_len, "-I%s %s", sb_pwd, gcc_index + 4);
+  return sandbox_cmd;
+}
+
+/*
+ * Returns where a dependency is copied to in the sandbox: the sandbox directory followed
+ * by the dependency's absolute path, or by its path relative to the build directory.
+ * The result must be freed.
+ */
+char *sandbox_path(char *sandbox_pwd, char *dep) {
+  char *new_path = malloc(strlen(sandbox_pwd) + 2 + strlen(dep));
+  strcpy(new_path, sandbox_pwd);
+  if ( dep[0] != '/') {
+    strcat(new_path, "/");
+  }
+  // append dep filepath onto pwd to create abs filepath
+  strcat(new_path, dep);
+  return new_path;
+}
+
+/*
+ * Emits the information needed to build one target to the generated sandbox makefile
+ * params:
+ *    file: the file pointer to the generated makefile in the sandbox dir
+ *    sb_pwd: the filepath to the sandbox, used to insert -I flag in gcc cmds
+ *    tar:  pointer to the target struct containing the information to be writen
+ */
+void emit_target_to_makefile(FILE *file, char *sb_pwd, target *tar) {
+  // first file is the local dependency
+  // ex: target: target.cc
+  fprintf(file, "\n%s: %s\n", tar->target_name, tar->head ? tar->head->dep : "");
+  // write the command to execute for this target, with the sandbox directory
+  // added to the include path of gcc commands
+  char *sandbox_cmd = TARGET_sandbox_cmd(tar, sb_pwd);
+  fprintf(file, "\t%s\n", sandbox_cmd);
+  free(sandbox_cmd);
+}
+
+/*
+ * Emits information for one target and its command and dependencies
+ * to the dependency.txt file
+ */
+void emit_target_to_file( FILE *file, target *tar ) {
+  fprintf(file, "TARGET:  %s\n", tar->target_name);
+  fprintf(file, "COMMAND:  %s\n", tar->cmd);
+  // its relative paths are relative to the directory it ran in
+  if ( tar->dir != NULL ) {
+    fprintf(file, "DIRECTORY:  %s\n", tar->dir);
+  }
+  fprintf(file, "DEPENDENCY:");
+  // output all dependencies for this target
+  depnode *copy = tar->head;
+  int line_len = 12;
+  while ( copy != NULL ) {
+    // formatting
+    if ( line_len + strlen(copy->dep) > 80 ) {
+      fprintf(file, "\n            ");
+      line_len = 12;
+    }
+    fprintf(file, "  %s", copy->dep);
+    line_len += strlen(copy->dep) + 2;
+    copy = copy->next;
+  }
+  fprintf(file, "\n");
+  // the bytes read from each dependency, in the same order, when reads were tracked
+  bool reads = false;
+  for ( copy = tar->head; copy != NULL; copy = copy->next ) {
+    reads |= copy->bytes_read > 0;
+  }
+  if ( reads ) {
+    fprintf(file, "READ:");
+    line_len = 12;
+    for ( copy = tar->head; copy != NULL; copy = copy->next ) {
+      char bytes[24];
+      int len = snprintf(bytes, sizeof(bytes), "%ld", copy->bytes_read);
+      if ( line_len + len > 80 ) {
+        fprintf(file, "\n            ");
+        line_len = 12;
+      }
+      fprintf(file, "  %s", bytes);
+      line_len += len + 2;
+    }
+    fprintf(file, "\n");
+  }
+  // the paths probed, when probes were tracked
+  PROBED_emit(file, "ABSENT:", &tar->absent);
+  PROBED_emit(file, "EXISTS:", &tar->exists);
+  if ( tar->duration > 0 ) {
+    fprintf(file, "DURATION:  %.6f\n", tar->duration);
+  }
+  if ( tar->peak_rss > 0 ) {
+    fprintf(file, "PEAK_RSS:  %ld\n", tar->peak_rss);
+  }
+  if ( tar->cpu_time > 0 ) {
+    fprintf(file, "CPU_TIME:  %.6f\n", tar->cpu_time);
+  }
+}
+
+/*
+ * Helper function for creating subdirectories recursively from a given filepath
+ * dirpath: the absolute filepath of the the dependency to be copied from
+ * sandboxDir: the absolute filepath of the sandbox directory to copy to
+ */
+void dep_mkdirs(char *dirpath, char *sandboxDir) {
+
+  char *full_path = malloc(strlen(dirpath) + strlen(sandboxDir) + 100);
+  strcpy(full_path, sandboxDir);
+  strcat(full_path, dirpath);
+  struct stat statbf;
+  char *dirpath_cpy = strdup(dirpath);
+  char *dname = dirname(dirpath_cpy);
+  if ( strcmp(dname, ".") &&
+       ( stat(dname, &statbf) != 0 || !S_ISDIR(statbf.st_mode) ) ) {
+    //recursively make the parent directories before making this directory
+    dep_mkdirs(dname, sandboxDir);
+  }
+  free(dirpath_cpy);
+  int ret = mkdir(dirpath, 0777);
+  free(full_path);
+}
+
+/*
+ * Creates the directories leading to new_path inside the sandbox, if they do not exist
+ */
+void sandbox_parent_dirs(char *new_path, char *sandbox_pwd) {
+  if ( strcmp(basename(new_path), new_path) ) {
+    //dependency has a directory in its filepath, need to check if those directories exist
+    struct stat stat_result;
+    char *new_path_cpy = strdup(new_path);
+    char *copy_dname = dirname(new_path_cpy);
+    if ( stat(copy_dname, &stat_result) != 0 || !S_ISDIR(stat_result.st_mode) ) {
+      //subdir in sandbox does not exist, need to make it
+      dep_mkdirs(copy_dname, sandbox_pwd);
+    }
+    free(new_path_cpy);
+  }
+}
+
+/*
+ * Copies the file at src to new_path inside the sandbox, creating the directories
+ * leading to it
+ * Returns the number of bytes copied, or -1 if the copy could not be made
+ */
+long copy_to_sandbox(char *src, char *new_path, char *sandbox_pwd) {
+  // the original source dependency to copy from
+  FILE *depfile = fopen(src, "r");
+  if ( depfile == NULL ) {
+    fprintf(stderr, "ERROR: Dependency file %s could not be opened to copy!\n", src);
+    return -1;
+  }
+  //create subdirs if not exist alr
+  sandbox_parent_dirs(new_path, sandbox_pwd);
+  FILE *towrite = fopen(new_path, "w");
+  if ( towrite == NULL ) {
+    fprintf(stderr, "ERROR: Sandbox copy, %s, of dependency %s could not be opened!\n\n",
+              new_path, src);
+    fclose(depfile);
+    return -1;
+  }
+  // copy from the dependency file to the towrite copy
+  char *read_buffer = malloc(BUFFER_SIZE);
+  int bytes_read = -1;
+  long bytes_copied = 0;
+  do {
+    //read 512 items of 1 byte each
+    bytes_read = fread(read_buffer, 1, BUFFER_SIZE, depfile);
+    fwrite(read_buffer, 1, bytes_read, towrite);
+    bytes_copied += bytes_read;
+  } while ( bytes_read > 0);
+  free(read_buffer);
+  // the copy keeps the modification time of its original, so --verify can tell an
+  //  unchanged copy from its size and time alone
+  struct stat src_stat;
+  if ( fflush(towrite) == 0 && fstat(fileno(depfile), &src_stat) == 0 ) {
+    struct timespec times[2] = { src_stat.st_atim, src_stat.st_mtim };
+    futimens(fileno(towrite), times);
+  }
+  fclose(depfile);
+  fclose(towrite);
+  return bytes_copied;
+}
+
+/*
+ * Helper function to create copies of the dependency files for the given
+ * target in the given sandbox directory
+ * Every copied file is counted in st when statistics are enabled
+ * Returns the number of bytes copied
+ */
+long TARGET_copy_deps(target *tar, char *sandbox_pwd, stats *st) {
+  long total_bytes = 0;
+  for ( depnode *copy = tar->head; copy != NULL; copy = copy->next ) {
+    // create a new copy of the dependency file to write to
+    // pwd/dep
+    char *new_path = sandbox_path(sandbox_pwd, copy->dep);
+    PROBE_COPY_BEGIN(copy->dep, new_path);
+    long bytes_copied = copy_to_sandbox(copy->dep, new_path, sandbox_pwd);
+    if ( bytes_copied >= 0 ) {
+      PROBE_COPY_END(copy->dep, bytes_copied);
+      STATS_count_copy(st, new_path, bytes_copied);
+      total_bytes += bytes_copied;
+    }
+    free(new_path);
+  }
+  return total_bytes;
+}
+
+/*
+ * Helper function to find the filepath associated with a particular pid.
+ * Iterates across all nodes in the linked list.and returns the node
+ * with the matching pid key.
+ */
+node *LIST_find_pid(list *list_in, int pid) {
+  node *cur = list_in->head;
+  while ( cur != NULL ) {
+    if ( cur->pid == pid ) {
+      return cur;
+    }
+    cur = cur->next;
+  }
+  return NULL;
+}
+
+/*
+ * Helper function to add a node to the linked list, with a copy of filepath.
+ * Uses LIST_find_pid() to check for pre-existence in the linked list.
+ */
+void LIST_add(list *fp_list,int pid, char *filepath) {
+  // do not add to list if node with matching pid already exists
+  node *existing_node = LIST_find_pid(fp_list, pid);
+  if ( existing_node == NULL ) {
+    node *new_node = malloc(sizeof(node));
+    new_node->pid = pid;
+    new_node->path = strdup(filepath);
+    new_node->next = NULL;
+    if ( fp_list->head == NULL ) {
+      fp_list->head = fp_list->tail = new_node;
+    }
+    else {
+      fp_list->tail->next = new_node;
+      fp_list->tail = new_node;
+    }
+  }
+  else {
+    // matching pid exists in list, update its fp
+    free(existing_node->path);
+    existing_node->path = strdup(filepath);
+  }
+}
+
+/*
+ * Frees the list, its nodes and their paths
+ */
+void LIST_free(list *list_in) {
+  if ( list_in == NULL ) {
+    return;
+  }
+  node *cur = list_in->head;
+  while ( cur != NULL ) {
+    node *next = cur->next;
+    free(cur->path);
+    free(cur);
+    cur = next;
+  }
+  free(list_in);
+}
+
+/*
+ * Helper function to parse the name of the target executablefile from a gcc/g++ command
+ * Examples:
+ * - Command:         gcc -o output source.c
+ *   Target File is:  output
+ * - Command:         g++ -o otheroutput othersource
+ *   Target File is:  otheroutput
+ */
+char * parse_target_from_cmd(char *cmd) {
+  //create a copy to not put null terminator in the original command argument
+  char *target = strstr(cmd, "-o ");
+  if ( target == NULL ) {
+    // no output file named in this command
+    return NULL;
+  }
+  char *target_copy = strdup(target) + 3; // cut off "-o "
+  int index = 0;
+  while ( target_copy[index] != ' ' && target_copy[index] != '\0' ) {
+    index++;
+  }
+  target_copy[index] = '\0';
+  return target_copy;
+}
+
+/*
+ * Helper function to check if a given command is one of the desired commands
+ */
+bool is_desired_cmd(char *cmd) {
+  return !strcmp(cmd, "gcc") || !strcmp(cmd, "g++") ||
+         !strcmp(cmd, "as" )  || !strcmp(cmd, "ld") ;
+}
+
+/*
+ * Helper function to extract source c/c++, .s, and .o file names from a line
+ */
+char *extract_sources(char *line) {
+  // check for .cc files first so the check for .c does not match them
+  char *fname = strstr((const char *) line, ".cc");
+  if ( fname != NULL ) {
+    int fname_len = 3;
+    //decrement the pointer until reaching a space
+    for ( int i = 0; i < fname - line ; i++ ) {
+      if ( *(fname - 1) == '\"' ) { // reached the first char of the file name
+        break;
+      }
+      fname--;
+      fname_len++;
+    }
+    // create cooy of fname to null terminate without corrupting the original string
+    char *fname_copy = strdup(fname);
+    *(fname_copy + fname_len) = '\0';
+    return fname_copy;
+  }
+  // check for .c files
+  fname = strstr((const char *) line, ".c");
+  if ( fname != NULL ) {
+    int fname_len = 2;
+    //decrement the pointer until reaching a space
+    for ( int i = 0; i < fname - line ; i++ ) {
+      if ( *(fname - 1) == '\"' ) { // reached the first char of the file name
+        break;
+      }
+      fname--;
+      fname_len++;
+    }
+    // create copy of fname to null terminate without corrupting the original string
+    char *fname_copy = strdup(fname);
+    *(fname_copy + fname_len) = '\0';
+    return fname_copy;
+  }
+  // check for .o files
+  fname = strstr((const char *) line, ".o");
+  if ( fname != NULL ) {
+    int fname_len = 2;
+    //decrement the pointer until reaching a space
+    for ( int i = 0; i < fname - line ; i++ ) {
+      if ( *(fname - 1) == '\"' ) { // reached the first char of the file name
+        break;
+      }
+      fname--;
+      fname_len++;
+    }
+    // create copy of fname to null terminate without corrupting the original string
+    char *fname_copy = strdup(fname);
+    *(fname_copy + fname_len) = '\0';
+    return fname_copy;
+  }
+  // check for .s files
+  fname = strstr((const char *) line, ".s");
+  if ( fname != NULL ) {
+    int fname_len = 2;
+    //decrement the pointer until reaching a space
+    for ( int i = 0; i < fname - line ; i++ ) {
+      if ( *(fname - 1) == '\"' ) { // reached the first char of the file name
+        break;
+      }
+      fname--;
+      fname_len++;
+    }
+    // create copy of fname to null terminate without corrupting the original string
+    char *fname_copy = strdup(fname);
+    *(fname_copy + fname_len) = '\0';
+    return fname_copy;
+  }
+  return NULL;
+}
+
+/*
+ * Is the path a C or C++ source file, given to the compiler rather than included?
+ */
+bool is_source_file(const char *path) {
+  static const char *extensions[] = { ".c", ".cc", ".cpp", ".cxx", ".c++", ".C" };
+  const char *dot = strrchr(path, '.');
+  if ( dot == NULL || strchr(dot, '/') != NULL ) {
+    return false;
+  }
+  for ( int i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++ ) {
+    if ( !strcmp(dot, extensions[i]) ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * Helper function to append a target name to the space separated list of make targets,
+ * growing the list buffer when it is full
+ */
+void append_make_target(char **make_targets_list, size_t *cap, char *target_name) {
+  size_t needed = strlen(*make_targets_list) + strlen(target_name) + 2;
+  if ( needed > *cap ) {
+    while ( needed > *cap ) {
+      *cap *= 2;
+    }
+    *make_targets_list = realloc(*make_targets_list, *cap);
+  }
+  strcat(*make_targets_list, " ");
+  strcat(*make_targets_list, target_name);
+}
@@ -0,0 +1,85 @@
+/*
+ * The linkable core of record_build
+ *
+ * Data structures and per-line helper functions shared by the record_build command
+ * and the benchmarks, which link against this core instead of copying it.
+ */
+
+#ifndef RECORD_CORE_H
+#define RECORD_CORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "record_probed.h"
+#include "record_stats.h"
+
+// constant for large buffer lengths
+#define BUFFER_SIZE 512
+
+/*
+ * Linked list node struct for dependency files for one target
+ */
+typedef struct depnode_struct {
+  char *dep; //dependency filepath
+  long bytes_read; // bytes the command read from it, 0 when reads were not tracked
+  struct depnode_struct *next;
+}  depnode;
+
+/*
+ * Contains information about one make target
+ */
+typedef struct targetstruct {
+  char *target_name;
+  char *cmd;
+  char *dir; // the directory its command ran in, NULL for the one the build started in
+  depnode *head;
+  depnode *tail;
+  double duration; // seconds the command ran for, 0 when the trace had no timestamps
+  long peak_rss; // kB, the largest resident set of its processes, 0 when not sampled
+  double cpu_time; // seconds of cpu its processes used, 0 when not sampled, see record_usage.h
+  probe_set absent; // paths the command looked for and did not find, see record_probed.h
+  probe_set exists; // paths it looked for and found, without reading them
+} target;
+
+/*
+ * linked list node struct to hold a process id and its associated filepath
+ */
+typedef struct list_node {
+  int pid; // pid of current process
+  char *path;
+  struct list_node *next;
+} node;
+
+/*
+ * Linked list struct
+ */
+typedef struct linked_list {
+  node *head;
+  node *tail;
+} list;
+
+void TARGET_add_dep(target *tar, char *new_dep);
+void TARGET_append_dep(target *tar, char *new_dep);
+void TARGET_add_read(target *tar, char *dep, long bytes);
+bool TARGET_has_dep(target *tar, char *dep);
+void TARGET_free(target *tar);
+char *TARGET_sandbox_cmd(target *tar, char *sb_pwd);
+char *sandbox_path(char *sandbox_pwd, char *dep);
+void emit_target_to_makefile(FILE *file, char *sb_pwd, target *tar);
+void emit_target_to_file(FILE *file, target *tar);
+void dep_mkdirs(char *dirpath, char *sandboxDir);
+void sandbox_parent_dirs(char *new_path, char *sandbox_pwd);
+long copy_to_sandbox(char *src, char *new_path, char *sandbox_pwd);
+long TARGET_copy_deps(target *tar, char *sandbox_pwd, stats *st);
+node *LIST_find_pid(list *list_in, int pid);
+void LIST_add(list *fp_list, int pid, char *filepath);
+void LIST_free(list *list_in);
+char *parse_target_from_cmd(char *cmd);
+bool is_desired_cmd(char *cmd);
+char *extract_sources(char *line);
+bool is_source_file(const char *path);
+void append_make_target(char **make_targets_list, size_t *cap, char *target_name);
+
+#endif
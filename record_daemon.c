@@ -0,0 +1,583 @@
+/*
+ * Daemon mode, see record_daemon.h
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/fsuid.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "record_core.h"
+#include "record_daemon.h"
+#include "record_session.h"
+#include "record_store.h"
+
+// limits on a binary event, beyond which the stream is taken to be corrupt
+#define EVENT_MAX_STRING (1 << 20)
+#define EVENT_MAX_ARGS (1 << 16)
+
+static volatile sig_atomic_t daemon_stop = 0;
+
+static void DAEMON_on_signal(int sig) {
+  daemon_stop = 1;
+}
+
+/*
+ * The state shared by every session of the daemon
+ */
+typedef struct record_daemon_struct {
+  content_store store;
+  pthread_mutex_t lock;   // guards the session counts
+  pthread_cond_t idle;    // signalled when a session ends
+  int active;
+  long sessions;
+} record_daemon;
+
+/*
+ * One connection, recorded on its own thread
+ */
+typedef struct daemon_session_struct {
+  record_daemon *d;
+  int fd;
+  struct ucred peer;      // the process that connected
+  char *dir;              // the build's directory, where the outputs are written
+  long targets;
+  long placed;            // dependencies placed in the sandbox
+  long shared;            // of those, the ones linked from the content store
+} daemon_session;
+
+/*
+ * The buffers a binary event is decoded into, reused from one event to the next
+ */
+typedef struct event_buffer_struct {
+  char *strings;          // the path and the arguments, each terminated by a 0
+  size_t strings_cap;
+  size_t *offsets;        // argument -> its offset in strings
+  const char **argv;
+  int args_cap;
+} event_buffer;
+
+static char *DAEMON_path(const char *dir, const char *name) {
+  char *path = malloc(strlen(dir) + strlen(name) + 2);
+  sprintf(path, "%s/%s", dir, name);
+  return path;
+}
+
+static void DAEMON_count_target(void *ctx, const target *tar) {
+  daemon_session *ds = ctx;
+  ds->targets++;
+}
+
+/*
+ * Copies a finished target's dependencies into the session's sandbox: the files of the
+ * project itself are copied, every other file is linked from the shared content store
+ */
+static long DAEMON_copy(void *ctx, record_session *s, target *tar) {
+  daemon_session *ds = ctx;
+  char *sandbox_pwd = (char *) RECORD_sandbox_dir(s);
+  size_t dir_len = strlen(ds->dir);
+  long total_bytes = 0;
+  for ( depnode *dep = tar->head; dep != NULL; dep = dep->next ) {
+    char *src = dep->dep[0] == '/' ? strdup(dep->dep) : sandbox_path(ds->dir, dep->dep);
+    char *new_path = sandbox_path(sandbox_pwd, dep->dep);
+    long bytes;
+    // the project's own files are the ones edited in a sandbox, so they are not shared
+    if ( !strncmp(src, ds->dir, dir_len) && src[dir_len] == '/' ) {
+      bytes = copy_to_sandbox(src, new_path, sandbox_pwd);
+    }
+    else {
+      bytes = STORE_place(&ds->d->store, src, new_path, sandbox_pwd);
+      ds->shared += bytes >= 0;
+    }
+    if ( bytes >= 0 ) {
+      ds->placed++;
+      total_bytes += bytes;
+    }
+    free(new_path);
+    free(src);
+  }
+  return total_bytes;
+}
+
+/*
+ * Reads len bytes of a string into the event buffer at offset
+ * Returns false if the stream ended first
+ */
+static bool DAEMON_read_string(FILE *in, event_buffer *buf, size_t offset, uint32_t len) {
+  if ( offset + len + 1 > buf->strings_cap ) {
+    buf->strings_cap = (offset + len + 1) * 2;
+    buf->strings = realloc(buf->strings, buf->strings_cap);
+  }
+  if ( len > 0 && fread(buf->strings + offset, 1, len, in) != len ) {
+    return false;
+  }
+  buf->strings[offset + len] = '\0';
+  return true;
+}
+
+/*
+ * Decodes the next binary event; its strings stay valid until the next call
+ * Returns 1, 0 at the end of the stream, or -1 if the event is malformed
+ */
+static int DAEMON_read_event(FILE *in, record_event *ev, event_buffer *buf) {
+  daemon_event header;
+  if ( fread(&header, sizeof(header), 1, in) != 1 ) {
+    return 0;
+  }
+  if ( header.type > RECORD_EVENT_SPAWN || header.path_len > EVENT_MAX_STRING ||
+       header.argc > EVENT_MAX_ARGS ) {
+    return -1;
+  }
+  if ( (int) header.argc > buf->args_cap ) {
+    buf->args_cap = header.argc * 2;
+    buf->offsets = realloc(buf->offsets, buf->args_cap * sizeof(size_t));
+    buf->argv = realloc(buf->argv, buf->args_cap * sizeof(char *));
+  }
+  if ( !DAEMON_read_string(in, buf, 0, header.path_len) ) {
+    return -1;
+  }
+  size_t offset = header.path_len + 1;
+  for ( uint32_t i = 0; i < header.argc; i++ ) {
+    uint32_t len;
+    if ( fread(&len, sizeof(len), 1, in) != 1 || len > EVENT_MAX_STRING ||
+         !DAEMON_read_string(in, buf, offset, len) ) {
+      return -1;
+    }
+    buf->offsets[i] = offset;
+    offset += len + 1;
+  }
+  // the buffer may have moved while it grew, so the pointers are taken at the end
+  for ( uint32_t i = 0; i < header.argc; i++ ) {
+    buf->argv[i] = buf->strings + buf->offsets[i];
+  }
+  memset(ev, 0, sizeof(record_event));
+  ev->type = header.type;
+  ev->pid = header.pid;
+  ev->child = header.child;
+  ev->result = header.result;
+  ev->time = header.time;
+  ev->path = buf->strings;
+  ev->argv = buf->argv;
+  ev->argc = header.argc;
+  return 1;
+}
+
+/*
+ * Writes an event in the form a daemon reads after EVENTS
+ * Returns 0, or -1 if it could not be written
+ */
+int DAEMON_write_event(FILE *out, const record_event *ev) {
+  const char *path = ev->path != NULL ? ev->path : "";
+  daemon_event header = { ev->type, ev->pid, ev->child, ev->result, ev->time, strlen(path),
+                          ev->argc };
+  fwrite(&header, sizeof(header), 1, out);
+  fwrite(path, 1, header.path_len, out);
+  for ( int i = 0; i < ev->argc; i++ ) {
+    uint32_t len = strlen(ev->argv[i]);
+    fwrite(&len, sizeof(len), 1, out);
+    fwrite(ev->argv[i], 1, len, out);
+  }
+  return ferror(out) ? -1 : 0;
+}
+
+/*
+ * Reads the events of one connection into a recording session
+ * Returns NULL, or what went wrong
+ */
+static const char *DAEMON_read_events(FILE *in, record_session *s) {
+  event_buffer buf;
+  memset(&buf, 0, sizeof(event_buffer));
+  record_event ev;
+  int status;
+  while ( (status = DAEMON_read_event(in, &ev, &buf)) == 1 ) {
+    RECORD_push_event(s, &ev);
+  }
+  free(buf.strings);
+  free(buf.offsets);
+  free(buf.argv);
+  return status < 0 ? "malformed event" : NULL;
+}
+
+/*
+ * Checks that the client may have its outputs written in the directory it named: one
+ * that exists and is owned by the client's user, or any directory for root. The name is
+ * replaced by the directory's real path, so that ".." or a symbolic link cannot take the
+ * outputs anywhere else once it is checked.
+ * Returns NULL, or the error to answer with
+ */
+static const char *DAEMON_check_dir(daemon_session *ds) {
+  struct ucred peer;
+  socklen_t len = sizeof(peer);
+  if ( getsockopt(ds->fd, SOL_SOCKET, SO_PEERCRED, &peer, &len) != 0 ) {
+    return "the client could not be identified";
+  }
+  ds->peer = peer;
+  char *dir = realpath(ds->dir, NULL);
+  struct stat st;
+  if ( dir == NULL || stat(dir, &st) != 0 || !S_ISDIR(st.st_mode) ) {
+    free(dir);
+    return "RECORD names no existing directory";
+  }
+  free(ds->dir);
+  ds->dir = dir;
+  if ( peer.uid != 0 && st.st_uid != peer.uid ) {
+    return "RECORD names a directory the client does not own";
+  }
+  return NULL;
+}
+
+/*
+ * Makes the session's thread open and create files as the client's user and groups, so
+ * that it reads no file the client could not and writes nowhere the client could not,
+ * whatever a path or a symbolic link in the build's directory names. Only the file
+ * system credentials of this thread change; the content store switches back to the
+ * daemon's own to write its snapshots (see STORE_place()).
+ * Returns NULL, or the error to answer with
+ */
+static const char *DAEMON_act_as_client(daemon_session *ds) {
+  if ( ds->peer.uid == geteuid() && ds->peer.gid == getegid() ) {
+    return NULL;
+  }
+  // the client's supplementary groups, none if they cannot be read
+  gid_t some_groups[64];
+  gid_t *groups = some_groups;
+  socklen_t len = sizeof(some_groups);
+  if ( getsockopt(ds->fd, SOL_SOCKET, SO_PEERGROUPS, groups, &len) != 0 ) {
+    groups = NULL;
+    if ( errno == ERANGE ) {
+      groups = malloc(len);
+      if ( getsockopt(ds->fd, SOL_SOCKET, SO_PEERGROUPS, groups, &len) != 0 ) {
+        free(groups);
+        groups = NULL;
+      }
+    }
+  }
+  int count = groups != NULL ? len / sizeof(gid_t) : 0;
+  // the system call, as the C library's setgroups() changes every thread of the daemon
+  long failed = syscall(SYS_setgroups, count, groups);
+  if ( groups != some_groups ) {
+    free(groups);
+  }
+  setfsgid(ds->peer.gid);
+  setfsuid(ds->peer.uid);
+  // each returns the previous value, an invalid one only reads it
+  if ( failed || setfsuid(-1) != (int) ds->peer.uid || setfsgid(-1) != (int) ds->peer.gid ) {
+    return "the daemon cannot act as the client's user";
+  }
+  return NULL;
+}
+
+/*
+ * Records one connection: reads its header, then its trace or events, and answers
+ */
+static void *DAEMON_session(void *arg) {
+  daemon_session *ds = arg;
+  FILE *in = fdopen(ds->fd, "r");
+  char *line = NULL;
+  size_t cap = 0;
+  ssize_t len;
+  bool incremental = false;
+  bool track_reads = false;
+  bool track_probes = false;
+  bool hash = false;
+  bool events = false;
+  bool body = false;
+  const char *error = NULL;
+  while ( error == NULL && !body && (len = getline(&line, &cap, in)) != -1 ) {
+    if ( len > 0 && line[len - 1] == '\n' ) {
+      line[--len] = '\0';
+    }
+    if ( !strncmp(line, "RECORD ", 7) ) {
+      free(ds->dir);
+      ds->dir = strdup(line + 7);
+    }
+    else if ( !strcmp(line, "INCREMENTAL") ) {
+      incremental = true;
+    }
+    else if ( !strcmp(line, "READS") ) {
+      track_reads = true;
+    }
+    else if ( !strcmp(line, "PROBES") ) {
+      track_probes = true;
+    }
+    else if ( !strcmp(line, "HASH") ) {
+      hash = true;
+    }
+    else if ( !strcmp(line, "TRACE") || !strcmp(line, "EVENTS") ) {
+      events = line[0] == 'E';
+      body = true;
+    }
+    else {
+      error = "unknown header line";
+    }
+  }
+  if ( error == NULL && !body ) {
+    error = "no TRACE or EVENTS line";
+  }
+  if ( error == NULL && ( ds->dir == NULL || ds->dir[0] != '/' ) ) {
+    error = "RECORD needs the absolute directory of the build";
+  }
+  if ( error == NULL ) {
+    error = DAEMON_check_dir(ds);
+  }
+  if ( error == NULL ) {
+    error = DAEMON_act_as_client(ds);
+  }
+
+  long lines = 0;
+  if ( error == NULL ) {
+    // the same outputs as a recording made in that directory
+    record_config config;
+    RECORD_default_config(&config);
+    char *names[5] = { DAEMON_path(ds->dir, config.trace_file_name),
+                       DAEMON_path(ds->dir, config.cmds_file_name),
+                       DAEMON_path(ds->dir, config.sources_file_name),
+                       DAEMON_path(ds->dir, config.dependency_file_name),
+                       DAEMON_path(ds->dir, config.manifest_file_name) };
+    config.pwd = ds->dir;
+    config.trace_file_name = names[0];
+    config.cmds_file_name = names[1];
+    config.sources_file_name = names[2];
+    config.dependency_file_name = names[3];
+    config.incremental = incremental;
+    config.track_reads = track_reads;
+    config.track_probes = track_probes;
+    config.hash = hash;
+    config.manifest_file_name = names[4];
+    record_hooks hooks = { ds, DAEMON_count_target, DAEMON_copy, NULL };
+    record_session *s = RECORD_open(&config, &hooks);
+    if ( s == NULL ) {
+      error = "the outputs could not be opened";
+    }
+    else {
+      if ( events ) {
+        error = DAEMON_read_events(in, s);
+      }
+      else {
+        while ( (len = getline(&line, &cap, in)) != -1 ) {
+          RECORD_push_line(s, line, len);
+        }
+      }
+      lines = RECORD_lines(s);
+      if ( RECORD_close(s) != 0 && error == NULL ) {
+        error = "the outputs could not be written";
+      }
+    }
+    for ( int i = 0; i < 5; i++ ) {
+      free(names[i]);
+    }
+  }
+
+  if ( error != NULL ) {
+    dprintf(ds->fd, "ERROR %s\n", error);
+    fprintf(stderr, "ERROR: session %s failed: %s\n", ds->dir ? ds->dir : "(unnamed)", error);
+  }
+  else {
+    dprintf(ds->fd, "OK %ld targets, %ld lines, %ld files placed, %ld from the shared store\n",
+            ds->targets, lines, ds->placed, ds->shared);
+  }
+  free(line);
+  fclose(in);
+
+  record_daemon *d = ds->d;
+  pthread_mutex_lock(&d->lock);
+  d->active--;
+  pthread_cond_signal(&d->idle);
+  pthread_mutex_unlock(&d->lock);
+  free(ds->dir);
+  free(ds);
+  return NULL;
+}
+
+/*
+ * Serves recording sessions on socket_path until interrupted, sharing the content store
+ * in store_dir between them
+ * Returns 0, or 1 if the socket could not be set up
+ */
+int DAEMON_serve(const char *socket_path, const char *store_dir) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if ( strlen(socket_path) >= sizeof(addr.sun_path) ) {
+    fprintf(stderr, "ERROR: socket path %s is too long!\n", socket_path);
+    return 1;
+  }
+  strcpy(addr.sun_path, socket_path);
+
+  record_daemon d;
+  if ( STORE_init(&d.store, store_dir) != 0 ) {
+    return 1;
+  }
+  pthread_mutex_init(&d.lock, NULL);
+  pthread_cond_init(&d.idle, NULL);
+  d.active = 0;
+  d.sessions = 0;
+
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  // a socket left behind by a daemon that did not shut down cleanly
+  unlink(socket_path);
+  if ( listen_fd < 0 || bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+       listen(listen_fd, SOMAXCONN) != 0 ) {
+    fprintf(stderr, "ERROR: socket %s could not be opened!\n", socket_path);
+    STORE_free(&d.store);
+    return 1;
+  }
+
+  // SIGINT and SIGTERM interrupt accept() in this thread only, the sessions block them
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = DAEMON_on_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  sigset_t stop_signals;
+  sigemptyset(&stop_signals);
+  sigaddset(&stop_signals, SIGINT);
+  sigaddset(&stop_signals, SIGTERM);
+
+  fprintf(stdout, "Listening on %s, sharing the content store in %s\n", socket_path, d.store.dir);
+  fflush(stdout);
+  while ( !daemon_stop ) {
+    int conn = accept(listen_fd, NULL, NULL);
+    if ( conn < 0 ) {
+      if ( errno != EINTR ) {
+        fprintf(stderr, "ERROR: connection on %s could not be accepted!\n", socket_path);
+      }
+      continue;
+    }
+    daemon_session *ds = calloc(1, sizeof(daemon_session));
+    ds->d = &d;
+    ds->fd = conn;
+    pthread_mutex_lock(&d.lock);
+    d.active++;
+    d.sessions++;
+    pthread_mutex_unlock(&d.lock);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    sigset_t old_mask;
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &old_mask);
+    pthread_t thread;
+    int failed = pthread_create(&thread, &attr, DAEMON_session, ds);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    pthread_attr_destroy(&attr);
+    if ( failed ) {
+      fprintf(stderr, "ERROR: no thread could be started for a session!\n");
+      close(conn);
+      free(ds);
+      pthread_mutex_lock(&d.lock);
+      d.active--;
+      pthread_mutex_unlock(&d.lock);
+    }
+  }
+
+  // stop taking sessions, then let the running ones finish
+  close(listen_fd);
+  unlink(socket_path);
+  pthread_mutex_lock(&d.lock);
+  if ( d.active > 0 ) {
+    fprintf(stdout, "Waiting for %d sessions to finish\n", d.active);
+  }
+  while ( d.active > 0 ) {
+    pthread_cond_wait(&d.idle, &d.lock);
+  }
+  pthread_mutex_unlock(&d.lock);
+  fprintf(stdout, "Served %ld sessions: %ld files (%ld bytes) stored, %ld placed from the store\n",
+          d.sessions, d.store.files, d.store.bytes, d.store.links);
+  STORE_free(&d.store);
+  pthread_mutex_destroy(&d.lock);
+  pthread_cond_destroy(&d.idle);
+  return 0;
+}
+
+/*
+ * Sends one trace line to the daemon, completing a last line that has no newline
+ */
+static void DAEMON_send_line(void *ctx, char *line, long len) {
+  FILE *out = ctx;
+  fwrite(line, 1, len, out);
+  if ( len > 0 && line[len - 1] != '\n' ) {
+    fputc('\n', out);
+  }
+}
+
+/*
+ * Records a build through the daemon on socket_path: runs make with the given arguments
+ * under strace, or with make_args NULL reads the trace of an earlier run, and streams the
+ * trace to the daemon, which writes the outputs into config->pwd or the current directory
+ * Returns 0, or 1 if the recording failed
+ */
+int DAEMON_submit(const char *socket_path, const record_config *config, char **make_args,
+                  int count) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if ( fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ) {
+    fprintf(stderr, "ERROR: no daemon is listening on %s!\n", socket_path);
+    return 1;
+  }
+  char dir[BUFFER_SIZE];
+  if ( config->pwd != NULL ) {
+    snprintf(dir, sizeof(dir), "%s", config->pwd);
+  }
+  else if ( getcwd(dir, sizeof(dir)) == NULL ) {
+    fprintf(stderr, "ERROR: current directory could not be read\n");
+    close(fd);
+    return 1;
+  }
+
+  // a daemon that goes away shows up as a write error, not as SIGPIPE
+  signal(SIGPIPE, SIG_IGN);
+  FILE *out = fdopen(dup(fd), "w");
+  fprintf(out, "RECORD %s\n", dir);
+  if ( config->incremental ) {
+    fprintf(out, "INCREMENTAL\n");
+  }
+  if ( config->track_reads ) {
+    fprintf(out, "READS\n");
+  }
+  if ( config->track_probes ) {
+    fprintf(out, "PROBES\n");
+  }
+  if ( config->hash ) {
+    fprintf(out, "HASH\n");
+  }
+  fprintf(out, "TRACE\n");
+  int status = RECORD_stream_trace(config, make_args, count, DAEMON_send_line, out);
+  if ( fclose(out) != 0 ) {
+    fprintf(stderr, "ERROR: the daemon on %s closed the connection!\n", socket_path);
+    status = 1;
+  }
+  // the end of the trace tells the daemon to finish the session
+  shutdown(fd, SHUT_WR);
+
+  FILE *in = fdopen(fd, "r");
+  char *reply = NULL;
+  size_t cap = 0;
+  if ( getline(&reply, &cap, in) == -1 ) {
+    fprintf(stderr, "ERROR: the daemon on %s did not answer!\n", socket_path);
+    status = 1;
+  }
+  else {
+    fputs(reply, strncmp(reply, "OK", 2) ? stderr : stdout);
+    status |= strncmp(reply, "OK", 2) != 0;
+  }
+  free(reply);
+  fclose(in);
+  return status;
+}
@@ -0,0 +1,58 @@
+/*
+ * Daemon mode: one record_build process serving many recordings at once
+ *
+ * DAEMON_serve() listens on a Unix socket. Each connection is a recording session, run
+ * on its own thread so that concurrent builds are parsed on as many cores as there are
+ * sessions. The sessions share the content store (see record_store.h): its intern table
+ * of paths and its snapshot of the files outside their projects, such as the sysroot,
+ * which is copied once for all of them. Each session writes its own outputs, the same
+ * files as a plain recording, in the directory it names; that directory must exist and
+ * belong to the user that connected, unless it is root. A session reads the build's
+ * files and writes its outputs as that user, so a daemon run by root serves every user
+ * and one run by another user serves only that user.
+ *
+ * A client sends a header of text lines, then the trace:
+ *
+ *    RECORD /absolute/directory/of/the/build
+ *    INCREMENTAL                  (optional, see --incremental)
+ *    READS                        (optional, see --reads; a trace only, events have no reads)
+ *    PROBES                       (optional, see --probes; a trace only)
+ *    HASH                         (optional, see --hash)
+ *    TRACE                        followed by strace -f lines until the end of the stream
+ *      or
+ *    EVENTS                       followed by binary events until the end of the stream
+ *
+ * Once it has read everything the daemon answers with one line, "OK ..." with a summary
+ * of the session, or "ERROR ...". DAEMON_submit() is that client for a traced make build.
+ */
+
+#ifndef RECORD_DAEMON_H
+#define RECORD_DAEMON_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "record_session.h"
+
+/*
+ * A binary event as sent after EVENTS, in the daemon's byte order; it is followed by
+ * path_len bytes of path, then for each of the argc arguments a uint32_t length and
+ * that many bytes
+ */
+typedef struct daemon_event_struct {
+  uint32_t type;          // a record_event_type
+  int32_t pid;
+  int32_t child;
+  int32_t result;
+  double time;
+  uint32_t path_len;
+  uint32_t argc;
+} daemon_event;
+
+int DAEMON_serve(const char *socket_path, const char *store_dir);
+int DAEMON_submit(const char *socket_path, const record_config *config, char **make_args,
+                  int count);
+int DAEMON_write_event(FILE *out, const record_event *ev);
+
+#endif
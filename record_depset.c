@@ -0,0 +1,279 @@
+/*
+ * Shared dependency sets, see record_depset.h
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "record_depset.h"
+#include "record_hash.h"
+
+void DEPSET_init(depset_table *t) {
+  memset(t, 0, sizeof(depset_table));
+  t->bucket_cap = 1024;
+  t->buckets = calloc(t->bucket_cap, sizeof(depset *));
+}
+
+/*
+ * Returns the ids of a set: those of a full set, or the delta applied to its base in
+ * *buffer, which is grown as needed
+ */
+const int *DEPSET_expand(const depset *s, int **buffer, int *cap) {
+  if ( s->ids != NULL ) {
+    return s->ids;
+  }
+  if ( s->count > *cap ) {
+    *cap = s->count * 2;
+    *buffer = realloc(*buffer, *cap * sizeof(int));
+  }
+  int *out = *buffer;
+  const depset *base = s->base;
+  int o = 0, r = 0, a = 0;
+  for ( int i = 0; i <= base->count; i++ ) {
+    while ( a < s->added_count && s->added[2 * a] == o ) {
+      out[o++] = s->added[2 * a + 1];
+      a++;
+    }
+    if ( i == base->count ) {
+      break;
+    }
+    if ( r < s->removed_count && s->removed[r] == i ) {
+      r++;
+      continue;
+    }
+    out[o++] = base->ids[i];
+  }
+  return out;
+}
+
+/*
+ * Records the position of every id of a base, for DEPSET_match()
+ */
+static void DEPSET_index(depset_table *t, const depset *base, const int *ids, int count) {
+  int max = -1;
+  for ( int i = 0; i < base->count; i++ ) {
+    max = base->ids[i] > max ? base->ids[i] : max;
+  }
+  for ( int j = 0; j < count; j++ ) {
+    max = ids[j] > max ? ids[j] : max;
+  }
+  if ( max >= t->pos_cap ) {
+    int cap = t->pos_cap ? t->pos_cap : 4096;
+    while ( cap <= max ) {
+      cap *= 2;
+    }
+    t->pos = realloc(t->pos, cap * sizeof(int));
+    t->stamp = realloc(t->stamp, cap * sizeof(int));
+    memset(t->stamp + t->pos_cap, 0, (cap - t->pos_cap) * sizeof(int));
+    t->pos_cap = cap;
+  }
+  t->current++;
+  for ( int i = 0; i < base->count; i++ ) {
+    t->pos[base->ids[i]] = i;
+    t->stamp[base->ids[i]] = t->current;
+  }
+}
+
+/*
+ * Matches a list against the base last indexed: the ids kept are the longest run of ids
+ * of the list found in the base in the same order, and every other id is added
+ * Returns the ids kept, filling kept[] with whether each id of the list was, if not NULL
+ */
+static int DEPSET_match(depset_table *t, const int *ids, int count, char *kept) {
+  if ( count > t->match_cap ) {
+    t->match_cap = count * 2;
+    t->match = realloc(t->match, 3 * t->match_cap * sizeof(int));
+  }
+  // a longest increasing subsequence of the positions: tails[k] is the list index that
+  //  ends the run of length k + 1 with the lowest position
+  int *pos = t->match;
+  int *tails = pos + t->match_cap;
+  int *prev = tails + t->match_cap;
+  int length = 0;
+  for ( int j = 0; j < count; j++ ) {
+    pos[j] = t->stamp[ids[j]] == t->current ? t->pos[ids[j]] : -1;
+    if ( pos[j] == -1 ) {
+      continue;
+    }
+    int lo = 0, hi = length;
+    while ( lo < hi ) {
+      int mid = (lo + hi) / 2;
+      if ( pos[tails[mid]] < pos[j] ) {
+        lo = mid + 1;
+      }
+      else {
+        hi = mid;
+      }
+    }
+    prev[j] = lo > 0 ? tails[lo - 1] : -1;
+    tails[lo] = j;
+    length += lo == length;
+  }
+  if ( kept != NULL ) {
+    memset(kept, 0, count);
+    for ( int j = length > 0 ? tails[length - 1] : -1; j != -1; j = prev[j] ) {
+      kept[j] = 1;
+    }
+  }
+  return length;
+}
+
+/*
+ * Returns the ids a delta of a list against a base stores: its removed positions, and
+ * two for each id it adds
+ */
+static long DEPSET_delta_cost(const depset *base, int count, int matched) {
+  return (long) (base->count - matched) + 2L * (count - matched);
+}
+
+/*
+ * Fills the delta of set s, a list, against base
+ */
+static void DEPSET_make_delta(depset_table *t, depset *s, depset *base, const int *ids,
+                              int count) {
+  DEPSET_index(t, base, ids, count);
+  char *kept = malloc(count + 1);
+  int matched = DEPSET_match(t, ids, count, kept);
+  s->base = base;
+  s->removed_count = base->count - matched;
+  s->added_count = count - matched;
+  s->removed = malloc((s->removed_count + 1) * sizeof(int));
+  s->added = malloc((2 * s->added_count + 1) * sizeof(int));
+  int r = 0, a = 0, next = 0;
+  for ( int j = 0; j < count; j++ ) {
+    if ( !kept[j] ) {
+      s->added[2 * a] = j;
+      s->added[2 * a + 1] = ids[j];
+      a++;
+      continue;
+    }
+    // the positions of the base skipped to reach this id are removed
+    int p = t->pos[ids[j]];
+    while ( next < p ) {
+      s->removed[r++] = next++;
+    }
+    next = p + 1;
+  }
+  while ( next < base->count ) {
+    s->removed[r++] = next++;
+  }
+  free(kept);
+}
+
+/*
+ * Returns the recent full set with the smallest delta to a list, if that delta is small
+ * enough to keep, or NULL
+ */
+static depset *DEPSET_best_base(depset_table *t, const int *ids, int count) {
+  depset *best = NULL;
+  long best_cost = count / DEPSET_DELTA_RATIO + 1;
+  for ( int i = 0; i < DEPSET_RECENT; i++ ) {
+    depset *base = t->recent[i];
+    // the delta removes or adds at least the difference in size
+    if ( base == NULL || labs((long) base->count - count) >= best_cost ) {
+      continue;
+    }
+    DEPSET_index(t, base, ids, count);
+    long cost = DEPSET_delta_cost(base, count, DEPSET_match(t, ids, count, NULL));
+    if ( cost < best_cost ) {
+      best = base;
+      best_cost = cost;
+    }
+  }
+  return best;
+}
+
+/*
+ * Moves a full set to the front of the recent sets, pushing out the last one if it is
+ * not one of them yet
+ */
+static void DEPSET_use(depset_table *t, depset *s) {
+  int i = 0;
+  while ( i < DEPSET_RECENT - 1 && t->recent[i] != s ) {
+    i++;
+  }
+  memmove(t->recent + 1, t->recent, i * sizeof(depset *));
+  t->recent[0] = s;
+}
+
+static void DEPSET_grow(depset_table *t) {
+  int cap = t->bucket_cap * 2;
+  depset **buckets = calloc(cap, sizeof(depset *));
+  for ( int b = 0; b < t->bucket_cap; b++ ) {
+    depset *s = t->buckets[b];
+    while ( s != NULL ) {
+      depset *next = s->next;
+      s->next = buckets[s->key & (cap - 1)];
+      buckets[s->key & (cap - 1)] = s;
+      s = next;
+    }
+  }
+  free(t->buckets);
+  t->buckets = buckets;
+  t->bucket_cap = cap;
+}
+
+/*
+ * Returns the shared set of a list of ids, added to the table when it is new; the set
+ * lives as long as the table
+ */
+const depset *DEPSET_intern(depset_table *t, const int *ids, int count) {
+  uint64_t key = HASH_bytes(ids, count * sizeof(int), 0);
+  t->interned++;
+  t->ids += count;
+  for ( depset *s = t->buckets[key & (t->bucket_cap - 1)]; s != NULL; s = s->next ) {
+    // an empty list may have no ids at all to compare
+    if ( s->key == key && s->count == count && ( count == 0 ||
+         !memcmp(DEPSET_expand(s, &t->scratch, &t->scratch_cap), ids, count * sizeof(int)) ) ) {
+      return s;
+    }
+  }
+  if ( t->count >= t->bucket_cap ) {
+    DEPSET_grow(t);
+  }
+  depset *s = calloc(1, sizeof(depset));
+  s->key = key;
+  s->id = t->count;
+  s->count = count;
+  depset *base = count > 0 ? DEPSET_best_base(t, ids, count) : NULL;
+  if ( base != NULL ) {
+    DEPSET_make_delta(t, s, base, ids, count);
+    t->stored += s->removed_count + 2L * s->added_count;
+    t->deltas++;
+    DEPSET_use(t, base);
+  }
+  else {
+    s->ids = malloc((count + 1) * sizeof(int));
+    if ( count > 0 ) {
+      memcpy(s->ids, ids, count * sizeof(int));
+    }
+    t->stored += count;
+    DEPSET_use(t, s);
+  }
+  size_t b = key & (t->bucket_cap - 1);
+  s->next = t->buckets[b];
+  t->buckets[b] = s;
+  t->count++;
+  return s;
+}
+
+void DEPSET_free(depset_table *t) {
+  for ( int b = 0; b < t->bucket_cap; b++ ) {
+    depset *s = t->buckets[b];
+    while ( s != NULL ) {
+      depset *next = s->next;
+      free(s->ids);
+      free(s->removed);
+      free(s->added);
+      free(s);
+      s = next;
+    }
+  }
+  free(t->buckets);
+  free(t->pos);
+  free(t->stamp);
+  free(t->scratch);
+  free(t->match);
+  memset(t, 0, sizeof(depset_table));
+}
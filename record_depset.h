@@ -0,0 +1,66 @@
+/*
+ * Shared dependency sets: hash-consed sequences of path ids
+ *
+ * The translation units of one library mostly depend on the same headers, so the
+ * dependency lists of their targets are identical, or differ by a few files. A table of
+ * dependency sets keeps each distinct list once: interning a list returns the set
+ * already in the table when there is one, and targets hold the shared set, which is
+ * never changed once interned. A list is a sequence of ids, as an intern_table gives
+ * them out, in the order the dependencies were opened; two lists are one set only when
+ * they have the same ids in the same order.
+ *
+ * A new list close to one of the sets interned or used lately is not stored in full but
+ * as a delta against that base: the positions of the base it drops, and the ids it adds
+ * with their positions. The base of a delta is always a set stored in full, so a set is
+ * expanded in one pass, without following a chain. A delta is only kept while it is
+ * much smaller than the list, see DEPSET_DELTA_RATIO.
+ */
+
+#ifndef RECORD_DEPSET_H
+#define RECORD_DEPSET_H
+
+#include <stdint.h>
+
+// full sets tried as the base of a delta, those most recently added or used as one
+#define DEPSET_RECENT 8
+// a delta is kept when it stores at most 1/DEPSET_DELTA_RATIO of the ids of its set
+#define DEPSET_DELTA_RATIO 4
+
+typedef struct depset_struct {
+  uint64_t key;                 // hash of the ids, in order
+  int id;                       // sets are numbered from 0 in the order they are added
+  int count;                    // ids in the set
+  int *ids;                     // for a set stored in full, NULL for a delta
+  struct depset_struct *base;   // the full set a delta is against
+  int *removed;                 // positions in base dropped, ascending
+  int removed_count;
+  int *added;                   // (position in the set, id) pairs, ascending position
+  int added_count;
+  struct depset_struct *next;   // in its bucket
+} depset;
+
+typedef struct depset_table_struct {
+  depset **buckets;             // chained on the key, a power of two of buckets
+  int bucket_cap;
+  int count;                    // distinct sets
+  int deltas;                   // of those, stored as a delta
+  depset *recent[DEPSET_RECENT]; // full sets, the last used as a base or added first
+  long interned;                // lists interned, one per target
+  long ids;                     // ids in all the lists interned
+  long stored;                  // ids stored, with two per id added by a delta
+  int *pos;                     // id -> its position in the base being tried, by stamp
+  int *stamp;
+  int pos_cap;
+  int current;
+  int *match;                   // positions, and the runs found in them, see DEPSET_match()
+  int match_cap;
+  int *scratch;                 // a set expanded, to compare a list with
+  int scratch_cap;
+} depset_table;
+
+void DEPSET_init(depset_table *t);
+const depset *DEPSET_intern(depset_table *t, const int *ids, int count);
+const int *DEPSET_expand(const depset *s, int **buffer, int *cap);
+void DEPSET_free(depset_table *t);
+
+#endif
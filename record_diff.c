@@ -0,0 +1,457 @@
+/*
+ * Diff mode, see record_diff.h
+ */
+
+#define _GNU_SOURCE
+#include <libgen.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "record_bitmap.h"
+#include "record_core.h"
+#include "record_depset.h"
+#include "record_diff.h"
+#include "record_intern.h"
+#include "record_model.h"
+
+// the size of a path that has not been looked up yet
+#define SIZE_UNKNOWN -2
+
+/*
+ * A target whose recording changed between the old and new model
+ */
+typedef struct diff_entry_struct {
+  int old_index;
+  int new_index;
+  target *old_tar;
+  target *new_tar;
+  long deps_added;
+  long deps_removed;
+  long bytes_delta;         // bytes of the dependencies gained, minus those of the ones lost
+  double duration_delta;
+  bool cmd_changed;
+} diff_entry;
+
+/*
+ * Both models with their paths interned in one table
+ */
+typedef struct differ_struct {
+  model old_m;
+  model new_m;
+  intern_table paths;
+  depset_table sets;
+  const depset **old_deps;  // old target index -> its dependencies, shared with the targets
+  const depset **new_deps;  //  of either model that have the same ones
+  int *ids;                 // a set expanded, see DEPSET_expand()
+  int id_cap;
+  bitmap *bitmaps;          // set id -> its paths, once it is compared with another
+  bool *built;
+  long *size;               // path id -> size in bytes, -1 if missing, or SIZE_UNKNOWN
+  long *old_size;           // the same, looked up in the old recording first
+  char *new_dir;            // directories the relative paths of each recording start from
+  char *old_dir;
+  bool timed;               // do both recordings have durations?
+} differ;
+
+/*
+ * Interns the dependencies of every target of a model into shared sets; the targets'
+ * own lists are freed, the diff only reads the sets
+ */
+static const depset **DIFF_intern_deps(differ *d, model *m) {
+  const depset **deps = malloc((m->count + 1) * sizeof(depset *));
+  for ( int t = 0; t < m->count; t++ ) {
+    int count = 0;
+    depnode *dep = m->targets[t]->head;
+    while ( dep != NULL ) {
+      if ( count == d->id_cap ) {
+        d->id_cap = d->id_cap ? d->id_cap * 2 : 256;
+        d->ids = realloc(d->ids, d->id_cap * sizeof(int));
+      }
+      d->ids[count++] = INTERN_id(&d->paths, dep->dep);
+      depnode *next = dep->next;
+      free(dep->dep);
+      free(dep);
+      dep = next;
+    }
+    m->targets[t]->head = m->targets[t]->tail = NULL;
+    deps[t] = DEPSET_intern(&d->sets, d->ids, count);
+  }
+  return deps;
+}
+
+/*
+ * Returns the size of a dependency, looked up once: relative paths are found from the
+ * recording's directory, and paths that no longer exist in its sandbox; the recording
+ * the dependency is in, the old one if old, is searched before the other
+ */
+static long DIFF_size(differ *d, int id, bool old) {
+  long *size = old ? d->old_size : d->size;
+  if ( size[id] != SIZE_UNKNOWN ) {
+    return size[id];
+  }
+  const char *path = INTERN_string(&d->paths, id);
+  char *dirs[2] = { old ? d->old_dir : d->new_dir, old ? d->new_dir : d->old_dir };
+  struct stat st;
+  size[id] = -1;
+  for ( int i = 0; i < 2 && size[id] == -1; i++ ) {
+    char full[PATH_MAX];
+    if ( path[0] == '/' ) {
+      snprintf(full, sizeof(full), "%s", path);
+    }
+    else {
+      snprintf(full, sizeof(full), "%s/%s", dirs[i], path);
+    }
+    if ( stat(full, &st) == 0 ) {
+      size[id] = st.st_size;
+      break;
+    }
+    snprintf(full, sizeof(full), "%s/sandbox%s%s", dirs[i], path[0] == '/' ? "" : "/", path);
+    if ( stat(full, &st) == 0 ) {
+      size[id] = st.st_size;
+    }
+  }
+  return size[id];
+}
+
+/*
+ * Returns the bitmap of the paths of a dependency set, built the first time
+ */
+static bitmap *DIFF_bitmap(differ *d, const depset *deps) {
+  bitmap *b = &d->bitmaps[deps->id];
+  if ( !d->built[deps->id] ) {
+    const int *ids = DEPSET_expand(deps, &d->ids, &d->id_cap);
+    for ( int i = 0; i < deps->count; i++ ) {
+      BITMAP_add(b, ids[i]);
+    }
+    d->built[deps->id] = true;
+  }
+  return b;
+}
+
+/*
+ * Calls found() for each path of deps that is not in others
+ */
+static void DIFF_missing(differ *d, const depset *deps, const depset *others,
+                         void (*found)(differ *, int, void *), void *arg) {
+  if ( deps == others ) {
+    // one shared set: nothing is missing
+    return;
+  }
+  bitmap *in_deps = DIFF_bitmap(d, deps);
+  bitmap *in_others = DIFF_bitmap(d, others);
+  if ( BITMAP_and_count(in_deps, in_others) == in_deps->count ) {
+    // the same paths, or fewer, in another order
+    return;
+  }
+  // the paths are reported in the order they were recorded
+  const int *ids = DEPSET_expand(deps, &d->ids, &d->id_cap);
+  for ( int i = 0; i < deps->count; i++ ) {
+    if ( !BITMAP_contains(in_others, ids[i]) ) {
+      found(d, ids[i], arg);
+    }
+  }
+}
+
+static void DIFF_count_added(differ *d, int id, void *arg) {
+  diff_entry *e = arg;
+  long size = DIFF_size(d, id, false);
+  e->deps_added++;
+  e->bytes_delta += size > 0 ? size : 0;
+}
+
+static void DIFF_count_removed(differ *d, int id, void *arg) {
+  diff_entry *e = arg;
+  long size = DIFF_size(d, id, true);
+  e->deps_removed++;
+  e->bytes_delta -= size > 0 ? size : 0;
+}
+
+static void DIFF_print_added(differ *d, int id, void *arg) {
+  long size = DIFF_size(d, id, false);
+  if ( size >= 0 ) {
+    fprintf(stdout, "    + %s  (%ld bytes)\n", INTERN_string(&d->paths, id), size);
+  }
+  else {
+    fprintf(stdout, "    + %s  (missing)\n", INTERN_string(&d->paths, id));
+  }
+}
+
+static void DIFF_print_removed(differ *d, int id, void *arg) {
+  fprintf(stdout, "    - %s\n", INTERN_string(&d->paths, id));
+}
+
+static int compare_strings(const void *a, const void *b) {
+  return strcmp(*(char **) a, *(char **) b);
+}
+
+/*
+ * Splits a command into its arguments, sorted; the arguments point into the copy in *buf
+ */
+static char **DIFF_split_cmd(const char *cmd, char **buf, int *count) {
+  *buf = strdup(cmd);
+  int cap = 16;
+  char **args = malloc(cap * sizeof(char *));
+  *count = 0;
+  char *save = NULL;
+  for ( char *arg = strtok_r(*buf, " ", &save); arg != NULL; arg = strtok_r(NULL, " ", &save) ) {
+    if ( *count == cap ) {
+      cap *= 2;
+      args = realloc(args, cap * sizeof(char *));
+    }
+    args[(*count)++] = arg;
+  }
+  qsort(args, *count, sizeof(char *), compare_strings);
+  return args;
+}
+
+/*
+ * Prints the arguments only one of two commands has
+ */
+static void DIFF_print_flags(const char *old_cmd, const char *new_cmd) {
+  char *old_buf, *new_buf;
+  int old_count, new_count;
+  char **old_args = DIFF_split_cmd(old_cmd, &old_buf, &old_count);
+  char **new_args = DIFF_split_cmd(new_cmd, &new_buf, &new_count);
+  // a merge of the sorted arguments, printing the added ones on the first pass and the
+  //  removed ones on the second
+  for ( int pass = 0; pass < 2; pass++ ) {
+    bool printed = false;
+    int i = 0, j = 0;
+    while ( i < old_count || j < new_count ) {
+      int cmp = i == old_count ? 1 : j == new_count ? -1 : strcmp(old_args[i], new_args[j]);
+      char *arg = NULL;
+      if ( cmp == 0 ) {
+        i++;
+        j++;
+      }
+      else if ( cmp < 0 ) {
+        arg = pass == 1 ? old_args[i] : NULL;
+        i++;
+      }
+      else {
+        arg = pass == 0 ? new_args[j] : NULL;
+        j++;
+      }
+      if ( arg != NULL ) {
+        if ( !printed ) {
+          fprintf(stdout, pass == 0 ? "    flags added:  " : "    flags removed:");
+          printed = true;
+        }
+        fprintf(stdout, " %s", arg);
+      }
+    }
+    if ( printed ) {
+      fprintf(stdout, "\n");
+    }
+  }
+  free(old_args);
+  free(new_args);
+  free(old_buf);
+  free(new_buf);
+}
+
+// qsort() has no context argument, so the ordering of the current diff is kept here
+static bool sort_by_duration;
+
+/*
+ * Orders changed targets by estimated impact on build time, largest slowdown first
+ */
+static int compare_impact(const void *a, const void *b) {
+  const diff_entry *x = a;
+  const diff_entry *y = b;
+  if ( sort_by_duration && x->duration_delta != y->duration_delta ) {
+    return x->duration_delta < y->duration_delta ? 1 : -1;
+  }
+  if ( x->bytes_delta != y->bytes_delta ) {
+    return x->bytes_delta < y->bytes_delta ? 1 : -1;
+  }
+  return strcmp(x->new_tar->target_name, y->new_tar->target_name);
+}
+
+/*
+ * Returns the directory a dependency file is in, which must be freed
+ */
+static char *DIFF_dir(const char *file_name) {
+  char *copy = strdup(file_name);
+  char *dir = strdup(dirname(copy));
+  free(copy);
+  return dir;
+}
+
+/*
+ * Compares the recordings in two dependency files, printing the report to stdout
+ * Returns 0, or 1 if a recording could not be read
+ */
+int DIFF_run(const char *old_file_name, const char *new_file_name) {
+  differ d;
+  memset(&d, 0, sizeof(differ));
+  MODEL_init(&d.old_m);
+  MODEL_init(&d.new_m);
+  if ( MODEL_load(&d.old_m, old_file_name) != 0 ) {
+    fprintf(stderr, "ERROR: recording %s could not be opened!\n", old_file_name);
+    return 1;
+  }
+  if ( MODEL_load(&d.new_m, new_file_name) != 0 ) {
+    fprintf(stderr, "ERROR: recording %s could not be opened!\n", new_file_name);
+    MODEL_free(&d.old_m);
+    return 1;
+  }
+  d.old_dir = DIFF_dir(old_file_name);
+  d.new_dir = DIFF_dir(new_file_name);
+  INTERN_init(&d.paths);
+  DEPSET_init(&d.sets);
+  d.old_deps = DIFF_intern_deps(&d, &d.old_m);
+  d.new_deps = DIFF_intern_deps(&d, &d.new_m);
+  d.size = malloc(d.paths.count * sizeof(long));
+  d.old_size = malloc(d.paths.count * sizeof(long));
+  for ( int id = 0; id < d.paths.count; id++ ) {
+    d.size[id] = SIZE_UNKNOWN;
+    d.old_size[id] = SIZE_UNKNOWN;
+  }
+  d.bitmaps = calloc(d.sets.count + 1, sizeof(bitmap));
+  d.built = calloc(d.sets.count + 1, sizeof(bool));
+
+  // old target name -> index; a later target with the same name replaces an earlier one
+  intern_table names;
+  INTERN_init(&names);
+  int *old_index = malloc((d.old_m.count + 1) * sizeof(int));
+  bool old_timed = false;
+  for ( int t = 0; t < d.old_m.count; t++ ) {
+    old_index[INTERN_id(&names, d.old_m.targets[t]->target_name)] = t;
+    old_timed |= d.old_m.targets[t]->duration > 0;
+  }
+  int old_names = names.count;
+  bool new_timed = false;
+  for ( int t = 0; t < d.new_m.count; t++ ) {
+    new_timed |= d.new_m.targets[t]->duration > 0;
+  }
+  d.timed = old_timed && new_timed;
+
+  // match the targets of the new recording with the old
+  bool *old_matched = calloc(d.old_m.count + 1, sizeof(bool));
+  int *added = malloc((d.new_m.count + 1) * sizeof(int));
+  int added_count = 0;
+  diff_entry *changed = malloc((d.new_m.count + 1) * sizeof(diff_entry));
+  int changed_count = 0;
+  long deps_added = 0, deps_removed = 0, bytes_added = 0;
+  double old_total = 0, new_total = 0;
+  for ( int t = 0; t < d.new_m.count; t++ ) {
+    target *new_tar = d.new_m.targets[t];
+    new_total += new_tar->duration;
+    int id = INTERN_find(&names, new_tar->target_name);
+    if ( id == -1 ) {
+      added[added_count++] = t;
+      INTERN_id(&names, new_tar->target_name);
+      continue;
+    }
+    if ( id >= old_names ) {
+      // an added target recorded twice
+      continue;
+    }
+    int o = old_index[id];
+    if ( old_matched[o] ) {
+      // the same name recorded twice in the new recording, compared once
+      continue;
+    }
+    old_matched[o] = true;
+    diff_entry e = { o, t, d.old_m.targets[o], new_tar, 0, 0, 0, 0, false };
+    DIFF_missing(&d, d.new_deps[t], d.old_deps[o], DIFF_count_added, &e);
+    DIFF_missing(&d, d.old_deps[o], d.new_deps[t], DIFF_count_removed, &e);
+    e.cmd_changed = strcmp(e.old_tar->cmd, new_tar->cmd) != 0;
+    if ( d.timed ) {
+      e.duration_delta = new_tar->duration - e.old_tar->duration;
+    }
+    deps_added += e.deps_added;
+    deps_removed += e.deps_removed;
+    if ( e.deps_added || e.deps_removed || e.cmd_changed || e.duration_delta != 0 ) {
+      changed[changed_count++] = e;
+    }
+  }
+  int removed_count = 0;
+  for ( int t = 0; t < d.old_m.count; t++ ) {
+    old_total += d.old_m.targets[t]->duration;
+    int id = INTERN_find(&names, d.old_m.targets[t]->target_name);
+    if ( !old_matched[old_index[id]] && old_index[id] == t ) {
+      removed_count++;
+    }
+  }
+  for ( int i = 0; i < changed_count; i++ ) {
+    bytes_added += changed[i].bytes_delta;
+  }
+  sort_by_duration = d.timed;
+  qsort(changed, changed_count, sizeof(diff_entry), compare_impact);
+
+  fprintf(stdout, "Targets: %d -> %d (%d added, %d removed, %d changed)\n", d.old_m.count,
+          d.new_m.count, added_count, removed_count, changed_count);
+  fprintf(stdout, "Dependencies of changed targets: +%ld -%ld (%+ld bytes)\n", deps_added,
+          deps_removed, bytes_added);
+  if ( d.timed ) {
+    fprintf(stdout, "Total duration: %.3fs -> %.3fs (%+.3fs)\n", old_total, new_total,
+            new_total - old_total);
+  }
+
+  for ( int i = 0; i < added_count; i++ ) {
+    target *tar = d.new_m.targets[added[i]];
+    long bytes = 0;
+    int deps = d.new_deps[added[i]]->count;
+    const int *ids = DEPSET_expand(d.new_deps[added[i]], &d.ids, &d.id_cap);
+    for ( int j = 0; j < deps; j++ ) {
+      long size = DIFF_size(&d, ids[j], false);
+      bytes += size > 0 ? size : 0;
+    }
+    fprintf(stdout, "\nADDED    %s  (%d dependencies, %ld bytes", tar->target_name, deps, bytes);
+    if ( tar->duration > 0 ) {
+      fprintf(stdout, ", %.3fs", tar->duration);
+    }
+    fprintf(stdout, ")\n");
+  }
+  for ( int t = 0; t < d.old_m.count; t++ ) {
+    int id = INTERN_find(&names, d.old_m.targets[t]->target_name);
+    if ( !old_matched[old_index[id]] && old_index[id] == t ) {
+      fprintf(stdout, "\nREMOVED  %s\n", d.old_m.targets[t]->target_name);
+    }
+  }
+  for ( int i = 0; i < changed_count; i++ ) {
+    diff_entry *e = &changed[i];
+    fprintf(stdout, "\nCHANGED  %s  (+%ld -%ld dependencies, %+ld bytes", e->new_tar->target_name,
+            e->deps_added, e->deps_removed, e->bytes_delta);
+    if ( d.timed ) {
+      fprintf(stdout, ", %.3fs -> %.3fs, %+.3fs", e->old_tar->duration, e->new_tar->duration,
+              e->duration_delta);
+    }
+    fprintf(stdout, ")\n");
+    DIFF_missing(&d, d.new_deps[e->new_index], d.old_deps[e->old_index], DIFF_print_added, NULL);
+    DIFF_missing(&d, d.old_deps[e->old_index], d.new_deps[e->new_index], DIFF_print_removed, NULL);
+    if ( e->cmd_changed ) {
+      DIFF_print_flags(e->old_tar->cmd, e->new_tar->cmd);
+    }
+  }
+
+  free(d.old_deps);
+  free(d.new_deps);
+  for ( int i = 0; i < d.sets.count; i++ ) {
+    BITMAP_free(&d.bitmaps[i]);
+  }
+  free(d.bitmaps);
+  free(d.built);
+  free(d.ids);
+  DEPSET_free(&d.sets);
+  free(d.size);
+  free(d.old_size);
+  free(d.old_dir);
+  free(d.new_dir);
+  free(old_index);
+  free(old_matched);
+  free(added);
+  free(changed);
+  INTERN_free(&names);
+  INTERN_free(&d.paths);
+  MODEL_free(&d.old_m);
+  MODEL_free(&d.new_m);
+  return 0;
+}
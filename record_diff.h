@@ -0,0 +1,17 @@
+/*
+ * Diff mode: compare two recordings to explain build-performance regressions
+ *
+ * Reports the targets added and removed between an old and a new dependency.txt, and for
+ * every target in both: the dependencies it gained, with their sizes in bytes, the ones it
+ * lost, and the command-line flags that changed. When both recordings were made with
+ * --timing, the change in each target's duration is shown too. Changed targets are listed
+ * by their estimated impact on build time: the duration delta when both recordings have
+ * timing, otherwise the change in the bytes of their dependencies.
+ */
+
+#ifndef RECORD_DIFF_H
+#define RECORD_DIFF_H
+
+int DIFF_run(const char *old_file_name, const char *new_file_name);
+
+#endif
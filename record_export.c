@@ -0,0 +1,341 @@
+/*
+ * Export mode, see record_export.h
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "record_core.h"
+#include "record_export.h"
+#include "record_hash.h"
+#include "record_intern.h"
+#include "record_model.h"
+
+/*
+ * A set of headers, known by the hash of its sorted path ids
+ */
+typedef struct export_group_struct {
+  uint64_t key;
+  bool used;              // the slot holds a set
+  int targets;            // that depend on exactly this set
+  int id;                 // numbered in the order the groups are written, 0 until then
+} export_group;
+
+typedef struct exporter_struct {
+  const export_options *opts;
+  FILE *out;
+  intern_table paths;
+  int *fanin;             // path id -> targets depending on it, with min_fanin
+  int fanin_cap;
+  export_group *groups;   // open addressing on the key, a power of two of slots
+  int group_cap;
+  int group_count;
+  int groups_written;
+  // the kept dependencies of the current target: the headers go to headers with collapse
+  int *kept;
+  int kept_count;
+  int *headers;
+  int header_count;
+  int *sorted;            // the headers, sorted to key their set
+  int scratch_cap;
+  long targets;           // written
+  long edges;
+} exporter;
+
+static bool EXPORT_is_header(const char *path) {
+  return strstr(path, ".h") != NULL;
+}
+
+static bool EXPORT_has_prefix(const export_options *opts, const char *path) {
+  if ( opts->prefixes == NULL ) {
+    return true;
+  }
+  for ( int i = 0; i < opts->prefix_count; i++ ) {
+    if ( !strncmp(path, opts->prefixes[i], strlen(opts->prefixes[i])) ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static int compare_ids(const void *a, const void *b) {
+  int x = *(const int *) a;
+  int y = *(const int *) b;
+  return x < y ? -1 : x > y;
+}
+
+/*
+ * Returns the group of a header set, added when it is new
+ */
+static export_group *EXPORT_group(exporter *ex, uint64_t key) {
+  if ( ex->group_count * 2 >= ex->group_cap ) {
+    int old_cap = ex->group_cap;
+    export_group *old = ex->groups;
+    ex->group_cap = old_cap ? old_cap * 2 : 1024;
+    ex->groups = calloc(ex->group_cap, sizeof(export_group));
+    for ( int i = 0; i < old_cap; i++ ) {
+      if ( old[i].used ) {
+        size_t slot = old[i].key & (ex->group_cap - 1);
+        while ( ex->groups[slot].used ) {
+          slot = (slot + 1) & (ex->group_cap - 1);
+        }
+        ex->groups[slot] = old[i];
+      }
+    }
+    free(old);
+  }
+  size_t slot = key & (ex->group_cap - 1);
+  while ( ex->groups[slot].used && ex->groups[slot].key != key ) {
+    slot = (slot + 1) & (ex->group_cap - 1);
+  }
+  export_group *g = &ex->groups[slot];
+  if ( !g->used ) {
+    g->used = true;
+    g->key = key;
+    ex->group_count++;
+  }
+  return g;
+}
+
+/*
+ * Sorts the dependencies of a target that pass the filters into kept and headers
+ * Returns the key of its header set, 0 when it has no headers to collapse
+ */
+static uint64_t EXPORT_filter(exporter *ex, target *tar) {
+  const export_options *opts = ex->opts;
+  ex->kept_count = ex->header_count = 0;
+  for ( depnode *dep = tar->head; dep != NULL; dep = dep->next ) {
+    if ( !EXPORT_has_prefix(opts, dep->dep) ) {
+      continue;
+    }
+    int id = INTERN_id(&ex->paths, dep->dep);
+    if ( opts->min_fanin > 1 && ( id >= ex->fanin_cap || ex->fanin[id] < opts->min_fanin ) ) {
+      continue;
+    }
+    if ( ex->kept_count + ex->header_count == ex->scratch_cap ) {
+      ex->scratch_cap = ex->scratch_cap ? ex->scratch_cap * 2 : 256;
+      ex->kept = realloc(ex->kept, ex->scratch_cap * sizeof(int));
+      ex->headers = realloc(ex->headers, ex->scratch_cap * sizeof(int));
+      ex->sorted = realloc(ex->sorted, ex->scratch_cap * sizeof(int));
+    }
+    if ( opts->collapse && EXPORT_is_header(dep->dep) ) {
+      ex->headers[ex->header_count++] = id;
+    }
+    else {
+      ex->kept[ex->kept_count++] = id;
+    }
+  }
+  if ( ex->header_count == 0 ) {
+    return 0;
+  }
+  memcpy(ex->sorted, ex->headers, ex->header_count * sizeof(int));
+  qsort(ex->sorted, ex->header_count, sizeof(int), compare_ids);
+  uint64_t key = HASH_bytes(ex->sorted, ex->header_count * sizeof(int), 0);
+  return key != 0 ? key : 1;
+}
+
+/*
+ * Counts the targets depending on each path that passes the prefix filter
+ */
+static void EXPORT_count_fanin(exporter *ex, target *tar) {
+  for ( depnode *dep = tar->head; dep != NULL; dep = dep->next ) {
+    if ( !EXPORT_has_prefix(ex->opts, dep->dep) ) {
+      continue;
+    }
+    int id = INTERN_id(&ex->paths, dep->dep);
+    if ( id >= ex->fanin_cap ) {
+      int cap = ex->fanin_cap ? ex->fanin_cap * 2 : 4096;
+      while ( cap <= id ) {
+        cap *= 2;
+      }
+      ex->fanin = realloc(ex->fanin, cap * sizeof(int));
+      memset(ex->fanin + ex->fanin_cap, 0, (cap - ex->fanin_cap) * sizeof(int));
+      ex->fanin_cap = cap;
+    }
+    ex->fanin[id]++;
+  }
+}
+
+static void EXPORT_count_group(exporter *ex, target *tar) {
+  uint64_t key = EXPORT_filter(ex, tar);
+  if ( key != 0 ) {
+    EXPORT_group(ex, key)->targets++;
+  }
+}
+
+/*
+ * Writes s between double quotes, escaped the way both DOT and JSON read it
+ */
+static void EXPORT_quoted(FILE *out, const char *s) {
+  fputc('"', out);
+  for ( ; *s != '\0'; s++ ) {
+    if ( *s == '"' || *s == '\\' ) {
+      fputc('\\', out);
+      fputc(*s, out);
+    }
+    else if ( (unsigned char) *s < 0x20 ) {
+      fprintf(out, "\\u%04x", *s);
+    }
+    else {
+      fputc(*s, out);
+    }
+  }
+  fputc('"', out);
+}
+
+/*
+ * Writes the list of paths ids, as DOT edges from the node from, or as a JSON array
+ */
+static void EXPORT_deps(exporter *ex, const char *from, int *ids, int count) {
+  FILE *out = ex->out;
+  ex->edges += count;
+  if ( ex->opts->format == EXPORT_JSONL ) {
+    fputc('[', out);
+    for ( int i = 0; i < count; i++ ) {
+      fputs(i ? ", " : "", out);
+      EXPORT_quoted(out, INTERN_string(&ex->paths, ids[i]));
+    }
+    fputc(']', out);
+    return;
+  }
+  for ( int i = 0; i < count; i++ ) {
+    fputs("  ", out);
+    EXPORT_quoted(out, from);
+    fputs(" -> ", out);
+    EXPORT_quoted(out, INTERN_string(&ex->paths, ids[i]));
+    fputs(";\n", out);
+  }
+}
+
+static void EXPORT_write_group(exporter *ex, export_group *g) {
+  FILE *out = ex->out;
+  g->id = ++ex->groups_written;
+  if ( ex->opts->format == EXPORT_JSONL ) {
+    fprintf(out, "{\"group\": %d, \"deps\": ", g->id);
+    EXPORT_deps(ex, NULL, ex->headers, ex->header_count);
+    fputs("}\n", out);
+  }
+  else {
+    char name[32];
+    snprintf(name, sizeof(name), "group:%d", g->id);
+    fprintf(out, "  \"%s\" [shape=folder, label=\"group %d\\n%d headers, %d targets\"];\n", name,
+            g->id, ex->header_count, g->targets);
+    EXPORT_deps(ex, name, ex->headers, ex->header_count);
+  }
+}
+
+/*
+ * Writes a target with the dependencies it keeps, and its header group the first time
+ * one of the group's targets is written
+ */
+static void EXPORT_write_target(exporter *ex, target *tar) {
+  FILE *out = ex->out;
+  uint64_t key = EXPORT_filter(ex, tar);
+  if ( ex->kept_count + ex->header_count == 0 ) {
+    return;
+  }
+  ex->targets++;
+  export_group *g = NULL;
+  if ( key != 0 ) {
+    g = EXPORT_group(ex, key);
+    if ( g->targets < 2 ) {
+      // no other target shares the set, its headers are plain dependencies
+      memcpy(ex->kept + ex->kept_count, ex->headers, ex->header_count * sizeof(int));
+      ex->kept_count += ex->header_count;
+      g = NULL;
+    }
+    else {
+      if ( g->id == 0 ) {
+        EXPORT_write_group(ex, g);
+      }
+      ex->edges++;
+    }
+  }
+  if ( ex->opts->format == EXPORT_JSONL ) {
+    fputs("{\"target\": ", out);
+    EXPORT_quoted(out, tar->target_name);
+    fputs(", \"command\": ", out);
+    EXPORT_quoted(out, tar->cmd);
+    fputs(", \"deps\": ", out);
+    EXPORT_deps(ex, NULL, ex->kept, ex->kept_count);
+    if ( g != NULL ) {
+      fprintf(out, ", \"group\": %d", g->id);
+    }
+    fputs("}\n", out);
+    return;
+  }
+  fputs("  ", out);
+  EXPORT_quoted(out, tar->target_name);
+  fputs(" [shape=box];\n", out);
+  EXPORT_deps(ex, tar->target_name, ex->kept, ex->kept_count);
+  if ( g != NULL ) {
+    fputs("  ", out);
+    EXPORT_quoted(out, tar->target_name);
+    fprintf(out, " -> \"group:%d\";\n", g->id);
+  }
+}
+
+/*
+ * Reads the dependency file through once, handing each target to pass()
+ * Returns the number of targets, or -1 if the file could not be opened
+ */
+static long EXPORT_pass(exporter *ex, const char *dependency_file_name,
+                        void (*pass)(exporter *ex, target *tar)) {
+  model_reader r;
+  if ( MODEL_open(&r, dependency_file_name) != 0 ) {
+    fprintf(stderr, "ERROR: dependency file %s could not be opened!\n", dependency_file_name);
+    return -1;
+  }
+  long targets = 0;
+  target *tar;
+  while ( (tar = MODEL_read_target(&r)) != NULL ) {
+    pass(ex, tar);
+    TARGET_free(tar);
+    targets++;
+  }
+  MODEL_close(&r);
+  return targets;
+}
+
+/*
+ * Writes the graph of a dependency file to out, in the format and with the reductions
+ * of opts
+ * Returns 0, or 1 if the dependency file could not be read
+ */
+int EXPORT_run(const char *dependency_file_name, const export_options *opts, FILE *out) {
+  exporter ex;
+  memset(&ex, 0, sizeof(exporter));
+  ex.opts = opts;
+  ex.out = out;
+  INTERN_init(&ex.paths);
+  long targets = 0;
+  if ( opts->min_fanin > 1 ) {
+    targets = EXPORT_pass(&ex, dependency_file_name, EXPORT_count_fanin);
+  }
+  if ( targets >= 0 && opts->collapse ) {
+    targets = EXPORT_pass(&ex, dependency_file_name, EXPORT_count_group);
+  }
+  if ( targets >= 0 ) {
+    if ( opts->format == EXPORT_DOT ) {
+      fprintf(out, "digraph dependencies {\n  rankdir=LR;\n");
+    }
+    targets = EXPORT_pass(&ex, dependency_file_name, EXPORT_write_target);
+    if ( opts->format == EXPORT_DOT ) {
+      fprintf(out, "}\n");
+    }
+  }
+  if ( targets >= 0 ) {
+    fprintf(stderr, "Exported %ld of %ld targets: %d shared header groups, %ld edges\n",
+            ex.targets, targets, ex.groups_written, ex.edges);
+  }
+  INTERN_free(&ex.paths);
+  free(ex.fanin);
+  free(ex.groups);
+  free(ex.kept);
+  free(ex.headers);
+  free(ex.sorted);
+  return targets >= 0 ? 0 : 1;
+}
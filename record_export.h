@@ -0,0 +1,47 @@
+/*
+ * Export mode: write the recorded dependency graph for graph tools
+ *
+ * dependency.txt lists every header under every target that includes it, which makes a
+ * graph far too large to draw or load. The exporter writes it as Graphviz DOT or as JSON
+ * lines, reduced by:
+ *    prefixes   only dependencies whose path starts with one of them are kept
+ *    min_fanin  only dependencies that at least this many targets depend on are kept
+ *    collapse   a set of headers that more than one target depends on, exactly, becomes
+ *               one shared "header group" node: its targets point at the group, and only
+ *               the group points at the headers
+ * A header is any dependency with ".h" in its path, as for the parser. Targets left
+ * without any dependency are not written.
+ *
+ * The dependency file is streamed a target at a time (see MODEL_read_target()), once to
+ * count fan-in, once to count how many targets share each header set, and once to
+ * write, each pass only as needed. Memory grows with the distinct paths and header sets,
+ * not with the number of targets or the edges between them, and the output is written
+ * as it goes: a group is written just before the first target that uses it.
+ *
+ * JSON lines, one object per line:
+ *    {"group": 1, "deps": ["a.h", "b.h"]}
+ *    {"target": "t.o", "command": "gcc ...", "deps": ["t.c"], "group": 1}
+ */
+
+#ifndef RECORD_EXPORT_H
+#define RECORD_EXPORT_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+typedef enum {
+  EXPORT_DOT,
+  EXPORT_JSONL
+} export_format;
+
+typedef struct export_options_struct {
+  export_format format;
+  char **prefixes;        // NULL to keep dependencies of any path
+  int prefix_count;
+  int min_fanin;          // 0 or 1 to keep dependencies of any fan-in
+  bool collapse;          // shared header sets become group nodes
+} export_options;
+
+int EXPORT_run(const char *dependency_file_name, const export_options *opts, FILE *out);
+
+#endif
@@ -0,0 +1,158 @@
+/*
+ * Content hashing, see record_hash.h
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "record_hash.h"
+
+// the primes of XXH64
+#define P1 11400714785074694791ULL
+#define P2 14029467366897019727ULL
+#define P3 1609587929392839161ULL
+#define P4 9650029242287828579ULL
+#define P5 2870177450012600261ULL
+
+static inline uint64_t rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+// unaligned little-endian reads, the byte order of every host record_build runs on
+static inline uint64_t read64(const unsigned char *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t read32(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input) {
+  acc += input * P2;
+  acc = rotl(acc, 31);
+  return acc * P1;
+}
+
+static inline uint64_t merge64(uint64_t acc, uint64_t lane) {
+  acc ^= round64(0, lane);
+  return acc * P1 + P4;
+}
+
+/*
+ * XXH64 of len bytes of data
+ */
+uint64_t HASH_bytes(const void *data, size_t len, uint64_t seed) {
+  const unsigned char *p = data;
+  const unsigned char *end = p + len;
+  uint64_t h;
+  if ( len >= 32 ) {
+    uint64_t v1 = seed + P1 + P2;
+    uint64_t v2 = seed + P2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - P1;
+    const unsigned char *last_stripe = end - 32;
+    do {
+      v1 = round64(v1, read64(p));
+      v2 = round64(v2, read64(p + 8));
+      v3 = round64(v3, read64(p + 16));
+      v4 = round64(v4, read64(p + 24));
+      p += 32;
+    } while ( p <= last_stripe );
+    h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    h = merge64(h, v1);
+    h = merge64(h, v2);
+    h = merge64(h, v3);
+    h = merge64(h, v4);
+  }
+  else {
+    h = seed + P5;
+  }
+  h += len;
+  for ( ; p + 8 <= end; p += 8 ) {
+    h ^= round64(0, read64(p));
+    h = rotl(h, 27) * P1 + P4;
+  }
+  if ( p + 4 <= end ) {
+    h ^= (uint64_t) read32(p) * P1;
+    h = rotl(h, 23) * P2 + P3;
+    p += 4;
+  }
+  for ( ; p < end; p++ ) {
+    h ^= *p * P5;
+    h = rotl(h, 11) * P1;
+  }
+  // avalanche
+  h ^= h >> 33;
+  h *= P2;
+  h ^= h >> 29;
+  h *= P3;
+  h ^= h >> 32;
+  return h;
+}
+
+/*
+ * Returns the hash of a file hashed in chunks, from the hashes of its chunks in order
+ */
+uint64_t HASH_combine(const uint64_t *chunk_hashes, long chunks) {
+  return HASH_bytes(chunk_hashes, chunks * sizeof(uint64_t), 0);
+}
+
+/*
+ * Hashes len bytes of the open file fd from offset, read into buffer, which must hold them
+ * Returns 0, or -1 if they could not all be read
+ */
+int HASH_range(int fd, long long offset, size_t len, void *buffer, uint64_t *hash) {
+  size_t done = 0;
+  while ( done < len ) {
+    ssize_t got = pread(fd, (char *) buffer + done, len - done, offset + done);
+    if ( got <= 0 ) {
+      return -1;
+    }
+    done += got;
+  }
+  *hash = HASH_bytes(buffer, len, 0);
+  return 0;
+}
+
+/*
+ * Hashes a whole file on the calling thread, chunk after chunk, to the same hash the
+ * chunks hashed on several threads give; buffer must hold HASH_CHUNK bytes
+ * Returns the size of the file, or -1 if it could not be read
+ */
+long long HASH_file(const char *path, void *buffer, uint64_t *hash) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat sb;
+  if ( fd < 0 ) {
+    return -1;
+  }
+  if ( fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode) ) {
+    close(fd);
+    return -1;
+  }
+  long long size = sb.st_size;
+  long chunks = size > HASH_CHUNK ? (size + HASH_CHUNK - 1) / HASH_CHUNK : 1;
+  uint64_t single;
+  uint64_t *chunk_hashes = chunks == 1 ? &single : malloc(chunks * sizeof(uint64_t));
+  int failed = 0;
+  for ( long c = 0; c < chunks && !failed; c++ ) {
+    long long offset = (long long) c * HASH_CHUNK;
+    size_t len = size - offset < HASH_CHUNK ? size - offset : HASH_CHUNK;
+    failed = HASH_range(fd, offset, len, buffer, &chunk_hashes[c]) != 0;
+  }
+  close(fd);
+  if ( !failed ) {
+    *hash = chunks == 1 ? single : HASH_combine(chunk_hashes, chunks);
+  }
+  if ( chunks > 1 ) {
+    free(chunk_hashes);
+  }
+  return failed ? -1 : size;
+}
@@ -0,0 +1,26 @@
+/*
+ * Content hashing of the files a recording depends on
+ *
+ * Files are hashed with XXH64: four independent 64-bit lanes over 32-byte stripes, so
+ * the work of one stripe does not wait on the previous one and the compiler can keep
+ * the lanes in separate registers (or vector lanes). A file up to HASH_CHUNK bytes long
+ * is hashed whole; a longer one is cut into HASH_CHUNK sized chunks, each hashed on its
+ * own, and its hash is the hash of the chunks' hashes in order. The chunks of one large
+ * file can so be hashed on several threads, and the result does not depend on how many.
+ */
+
+#ifndef RECORD_HASH_H
+#define RECORD_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// files longer than this are hashed in chunks of this size
+#define HASH_CHUNK (1024 * 1024)
+
+uint64_t HASH_bytes(const void *data, size_t len, uint64_t seed);
+uint64_t HASH_combine(const uint64_t *chunk_hashes, long chunks);
+int HASH_range(int fd, long long offset, size_t len, void *buffer, uint64_t *hash);
+long long HASH_file(const char *path, void *buffer, uint64_t *hash);
+
+#endif
@@ -0,0 +1,329 @@
+/*
+ * The include graph, see record_includes.h
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "record_core.h"
+#include "record_includes.h"
+#include "record_intern.h"
+#include "record_model.h"
+
+void INCLUDES_init(include_graph *g, char *sandbox_pwd) {
+  memset(g, 0, sizeof(include_graph));
+  INTERN_init(&g->paths);
+  g->sandbox_pwd = sandbox_pwd;
+}
+
+/*
+ * Returns the id of a path, with a node of its own
+ */
+static int INCLUDES_node(include_graph *g, const char *path) {
+  int id = INTERN_id(&g->paths, path);
+  if ( id >= g->node_cap ) {
+    int cap = g->node_cap ? g->node_cap * 2 : 1024;
+    while ( cap <= id ) {
+      cap *= 2;
+    }
+    g->nodes = realloc(g->nodes, cap * sizeof(include_node));
+    memset(g->nodes + g->node_cap, 0, (cap - g->node_cap) * sizeof(include_node));
+    g->node_cap = cap;
+  }
+  return id;
+}
+
+/*
+ * Reads the names of the #include (and #include_next, #import) lines of a file; an
+ * include of a macro names nothing and is skipped
+ */
+static void INCLUDES_scan(include_graph *g, int id) {
+  include_node *n = &g->nodes[id];
+  n->scanned = true;
+  char *path = (char *) INTERN_string(&g->paths, id);
+  FILE *file = fopen(path, "r");
+  if ( file == NULL && g->sandbox_pwd != NULL ) {
+    char *copy = sandbox_path(g->sandbox_pwd, path);
+    file = fopen(copy, "r");
+    free(copy);
+  }
+  if ( file == NULL ) {
+    g->unreadable++;
+    return;
+  }
+  n->readable = true;
+  int cap = 0;
+  char *line = NULL;
+  size_t line_cap = 0;
+  while ( getline(&line, &line_cap, file) != -1 ) {
+    char *p = line + strspn(line, " \t");
+    if ( *p != '#' ) {
+      continue;
+    }
+    p++;
+    p += strspn(p, " \t");
+    if ( strncmp(p, "include", 7) && strncmp(p, "import", 6) ) {
+      continue;
+    }
+    p += strcspn(p, "<\"\n");
+    if ( *p != '<' && *p != '"' ) {
+      continue;
+    }
+    char *end = strchr(p + 1, *p == '<' ? '>' : '"');
+    if ( end == NULL ) {
+      continue;
+    }
+    if ( n->name_count == cap ) {
+      cap = cap ? cap * 2 : 8;
+      n->names = realloc(n->names, cap * sizeof(char *));
+    }
+    n->names[n->name_count++] = strndup(p + 1, end - p - 1);
+  }
+  free(line);
+  fclose(file);
+}
+
+/*
+ * Does the file include path, by an #include whose name path ends with?
+ */
+static bool INCLUDES_names(include_graph *g, int id, const char *path) {
+  include_node *n = &g->nodes[id];
+  size_t path_len = strlen(path);
+  for ( int i = 0; i < n->name_count; i++ ) {
+    size_t len = strlen(n->names[i]);
+    if ( len <= path_len && !strcmp(path + path_len - len, n->names[i]) &&
+         ( len == path_len || path[path_len - len - 1] == '/' ) ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void INCLUDES_add_edge(include_graph *g, int from, int to) {
+  include_node *n = &g->nodes[from];
+  for ( int i = 0; i < n->count; i++ ) {
+    if ( n->children[i] == to ) {
+      return;
+    }
+  }
+  if ( n->count == n->cap ) {
+    n->cap = n->cap ? n->cap * 2 : 4;
+    n->children = realloc(n->children, n->cap * sizeof(int));
+  }
+  n->children[n->count++] = to;
+  g->edges++;
+}
+
+/*
+ * Reconstructs the include tree of a target from the order of its dependencies and
+ * merges it into the graph
+ */
+void INCLUDES_add_target(include_graph *g, target *tar) {
+  // the files still open in the walk, from the source down to the last header opened
+  int *stack = NULL;
+  int depth = 0;
+  int cap = 0;
+  for ( depnode *dep = tar->head; dep != NULL; dep = dep->next ) {
+    int id = INCLUDES_node(g, dep->dep);
+    if ( is_source_file(dep->dep) ) {
+      depth = 0;
+    }
+    else if ( depth == 0 ) {
+      // not included from a source, e.g. an object file being linked
+      continue;
+    }
+    else {
+      // the innermost open file naming it includes it; failing that, the innermost one
+      // that could not be read might
+      int includer = -1;
+      int unread = -1;
+      for ( int i = depth - 1; i >= 0 && includer == -1; i-- ) {
+        if ( !g->nodes[stack[i]].scanned ) {
+          INCLUDES_scan(g, stack[i]);
+        }
+        if ( !g->nodes[stack[i]].readable ) {
+          unread = unread == -1 ? i : unread;
+        }
+        else if ( INCLUDES_names(g, stack[i], dep->dep) ) {
+          includer = i;
+        }
+      }
+      if ( includer == -1 ) {
+        includer = unread;
+      }
+      if ( includer == -1 ) {
+        continue;
+      }
+      INCLUDES_add_edge(g, stack[includer], id);
+      depth = includer + 1;
+    }
+    if ( depth == cap ) {
+      cap = cap ? cap * 2 : 32;
+      stack = realloc(stack, cap * sizeof(int));
+    }
+    stack[depth++] = id;
+  }
+  free(stack);
+}
+
+/*
+ * Writes every file that includes others, with the files it includes
+ * Returns 0, or -1 if the file could not be written
+ */
+int INCLUDES_save(include_graph *g, const char *includes_file_name) {
+  char *tmp_path;
+  FILE *file = ATOMIC_open(includes_file_name, &tmp_path);
+  if ( file == NULL ) {
+    return -1;
+  }
+  for ( int id = 0; id < g->paths.count; id++ ) {
+    include_node *n = &g->nodes[id];
+    if ( n->count == 0 ) {
+      continue;
+    }
+    fprintf(file, "FILE:  %s\n", INTERN_string(&g->paths, id));
+    fprintf(file, "INCLUDES:");
+    int line_len = 12;
+    for ( int i = 0; i < n->count; i++ ) {
+      const char *child = INTERN_string(&g->paths, n->children[i]);
+      if ( line_len + strlen(child) > 80 ) {
+        fprintf(file, "\n            ");
+        line_len = 12;
+      }
+      fprintf(file, "  %s", child);
+      line_len += strlen(child) + 2;
+    }
+    fprintf(file, "\n");
+  }
+  return ATOMIC_commit(file, tmp_path, includes_file_name);
+}
+
+void INCLUDES_free(include_graph *g) {
+  for ( int id = 0; id < g->paths.count; id++ ) {
+    include_node *n = &g->nodes[id];
+    for ( int i = 0; i < n->name_count; i++ ) {
+      free(n->names[i]);
+    }
+    free(n->names);
+    free(n->children);
+  }
+  free(g->nodes);
+  INTERN_free(&g->paths);
+}
+
+/*
+ * Builds the include graph of every target of a dependency file and writes it
+ * Returns 0, or 1 if the dependency file could not be read or the graph written
+ */
+int INCLUDES_run(const char *dependency_file_name, const char *includes_file_name,
+                 char *sandbox_pwd) {
+  model_reader r;
+  if ( MODEL_open(&r, dependency_file_name) != 0 ) {
+    fprintf(stderr, "ERROR: dependency file %s could not be opened!\n", dependency_file_name);
+    return 1;
+  }
+  include_graph g;
+  INCLUDES_init(&g, sandbox_pwd);
+  long targets = 0;
+  target *tar;
+  while ( (tar = MODEL_read_target(&r)) != NULL ) {
+    INCLUDES_add_target(&g, tar);
+    TARGET_free(tar);
+    targets++;
+  }
+  MODEL_close(&r);
+  int failed = INCLUDES_save(&g, includes_file_name) != 0;
+  fprintf(stdout, "Reconstructed %ld includes between %d files of %ld targets into %s",
+          g.edges, g.paths.count, targets, includes_file_name);
+  fprintf(stdout, g.unreadable > 0 ? ", %ld files could not be scanned\n" : "\n", g.unreadable);
+  INCLUDES_free(&g);
+  return failed;
+}
+
+/*
+ * Prints the chain of includes through which a target depends on path: a recorded
+ * dependency, or the one that ends with "/path"
+ * Returns 0, or 1 if the target or the dependency was not found, or is not included
+ */
+int INCLUDES_why(const char *dependency_file_name, char *sandbox_pwd, const char *target_name,
+                 const char *path) {
+  model_reader r;
+  if ( MODEL_open(&r, dependency_file_name) != 0 ) {
+    fprintf(stderr, "ERROR: dependency file %s could not be opened!\n", dependency_file_name);
+    return 1;
+  }
+  target *tar;
+  while ( (tar = MODEL_read_target(&r)) != NULL && strcmp(tar->target_name, target_name) ) {
+    TARGET_free(tar);
+  }
+  MODEL_close(&r);
+  if ( tar == NULL ) {
+    fprintf(stderr, "ERROR: no target %s in %s!\n", target_name, dependency_file_name);
+    return 1;
+  }
+  const char *dep = NULL;
+  size_t path_len = strlen(path);
+  for ( depnode *d = tar->head; d != NULL && dep == NULL; d = d->next ) {
+    size_t len = strlen(d->dep);
+    if ( !strcmp(d->dep, path) ||
+         ( len > path_len && d->dep[len - path_len - 1] == '/' && !strcmp(d->dep + len - path_len, path) ) ) {
+      dep = d->dep;
+    }
+  }
+  if ( dep == NULL ) {
+    fprintf(stdout, "%s does not depend on %s\n", target_name, path);
+    TARGET_free(tar);
+    return 1;
+  }
+
+  // the target's own tree, searched breadth first from its sources for the shortest chain
+  include_graph g;
+  INCLUDES_init(&g, sandbox_pwd);
+  INCLUDES_add_target(&g, tar);
+  int goal = INTERN_find(&g.paths, dep);
+  int *parent = malloc(g.paths.count * sizeof(int));
+  int *queue = malloc(g.paths.count * sizeof(int));
+  int head = 0;
+  int tail = 0;
+  for ( int id = 0; id < g.paths.count; id++ ) {
+    parent[id] = -2;
+    if ( is_source_file(INTERN_string(&g.paths, id)) ) {
+      parent[id] = -1;
+      queue[tail++] = id;
+    }
+  }
+  while ( head < tail && parent[goal] == -2 ) {
+    include_node *n = &g.nodes[queue[head++]];
+    for ( int i = 0; i < n->count; i++ ) {
+      if ( parent[n->children[i]] == -2 ) {
+        parent[n->children[i]] = queue[head - 1];
+        queue[tail++] = n->children[i];
+      }
+    }
+  }
+  int status = 0;
+  if ( parent[goal] == -2 ) {
+    fprintf(stdout, "%s depends on %s, which none of the files it compiled includes\n",
+            target_name, dep);
+    status = 1;
+  }
+  else {
+    // the chain is found from the header up, and printed from the source down
+    int length = 0;
+    for ( int id = goal; id != -1; id = parent[id] ) {
+      queue[length++] = id;
+    }
+    fprintf(stdout, "%s depends on %s through:\n", target_name, dep);
+    for ( int i = length - 1; i >= 0; i-- ) {
+      fprintf(stdout, "  %*s%s\n", 2 * (length - 1 - i), "", INTERN_string(&g.paths, queue[i]));
+    }
+  }
+  free(parent);
+  free(queue);
+  INCLUDES_free(&g);
+  TARGET_free(tar);
+  return status;
+}
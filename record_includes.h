@@ -0,0 +1,63 @@
+/*
+ * The include graph: which file brought each header into a translation unit
+ *
+ * A target's dependencies are a flat list, in the order its compiler opened them. The
+ * preprocessor opens the headers depth first, so that order is a walk of the include
+ * tree, but it does not tell on its own where the walk came back up: after foo.h, bar.h
+ * may be included by foo.h or by the file that included foo.h. Each file is scanned for
+ * its #include lines (once, however many units include it) to tell: a header's includer
+ * is the innermost file still open that has an #include naming it. A file that cannot
+ * be read, in the tree or in the sandbox, is assumed to include what was opened after
+ * it; a dependency that no open file includes, such as a library a link reads, is not
+ * part of the graph. A header included again after its first time, and skipped by its
+ * include guard, is not opened again and keeps the includer that opened it first.
+ *
+ * The trees of every target are merged into one graph of the files, written as:
+ *    FILE:  path
+ *    INCLUDES:  header1  header2 ...
+ *               header3 ...           (continuation lines start with spaces)
+ * and the tree of one target answers why it depends on a header, with the chain of
+ * includes from its source down to the header.
+ */
+
+#ifndef RECORD_INCLUDES_H
+#define RECORD_INCLUDES_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "record_core.h"
+#include "record_intern.h"
+
+/*
+ * A file of the graph, with the headers it was found to include
+ */
+typedef struct include_node_struct {
+  int *children;          // ids of the files it includes, in the order first seen
+  int count;
+  int cap;
+  char **names;           // the names its #include lines give, once scanned
+  int name_count;
+  bool scanned;
+  bool readable;
+} include_node;
+
+typedef struct include_graph_struct {
+  intern_table paths;
+  include_node *nodes;    // path id -> its node
+  int node_cap;
+  char *sandbox_pwd;      // where a file gone from the tree is scanned instead
+  long edges;
+  long unreadable;        // files that could not be scanned
+} include_graph;
+
+void INCLUDES_init(include_graph *g, char *sandbox_pwd);
+void INCLUDES_add_target(include_graph *g, target *tar);
+int INCLUDES_save(include_graph *g, const char *includes_file_name);
+void INCLUDES_free(include_graph *g);
+int INCLUDES_run(const char *dependency_file_name, const char *includes_file_name,
+                 char *sandbox_pwd);
+int INCLUDES_why(const char *dependency_file_name, char *sandbox_pwd, const char *target_name,
+                 const char *path);
+
+#endif
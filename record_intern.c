@@ -0,0 +1,106 @@
+/*
+ * String intern table, see record_intern.h
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "record_intern.h"
+
+// initial number of buckets, grown to keep the table at most half full
+#define INTERN_BUCKETS 1024
+
+/*
+ * FNV-1a hash of a string
+ */
+uint64_t INTERN_hash(const char *s) {
+  uint64_t hash = 14695981039346656037ULL;
+  for ( const unsigned char *c = (const unsigned char *) s; *c != '\0'; c++ ) {
+    hash = (hash ^ *c) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+void INTERN_init(intern_table *t) {
+  memset(t, 0, sizeof(intern_table));
+  t->bucket_count = INTERN_BUCKETS;
+  t->buckets = malloc(t->bucket_count * sizeof(int));
+  memset(t->buckets, -1, t->bucket_count * sizeof(int));
+}
+
+/*
+ * Returns the bucket holding s, or the empty bucket where it would be inserted
+ */
+static size_t INTERN_slot(intern_table *t, const char *s, uint64_t hash) {
+  size_t mask = t->bucket_count - 1;
+  size_t slot = hash & mask;
+  while ( t->buckets[slot] != -1 ) {
+    int id = t->buckets[slot];
+    if ( t->hashes[id] == hash && !strcmp(t->strings[id], s) ) {
+      break;
+    }
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+static void INTERN_grow(intern_table *t) {
+  free(t->buckets);
+  t->bucket_count *= 2;
+  t->buckets = malloc(t->bucket_count * sizeof(int));
+  memset(t->buckets, -1, t->bucket_count * sizeof(int));
+  size_t mask = t->bucket_count - 1;
+  for ( int id = 0; id < t->count; id++ ) {
+    size_t slot = t->hashes[id] & mask;
+    while ( t->buckets[slot] != -1 ) {
+      slot = (slot + 1) & mask;
+    }
+    t->buckets[slot] = id;
+  }
+}
+
+/*
+ * Returns the id of s, adding it to the table if it is not there yet
+ */
+int INTERN_id(intern_table *t, const char *s) {
+  uint64_t hash = INTERN_hash(s);
+  size_t slot = INTERN_slot(t, s, hash);
+  if ( t->buckets[slot] != -1 ) {
+    return t->buckets[slot];
+  }
+  if ( t->count == t->cap ) {
+    t->cap = t->cap ? t->cap * 2 : 256;
+    t->strings = realloc(t->strings, t->cap * sizeof(char *));
+    t->hashes = realloc(t->hashes, t->cap * sizeof(uint64_t));
+  }
+  int id = t->count++;
+  t->strings[id] = strdup(s);
+  t->hashes[id] = hash;
+  t->buckets[slot] = id;
+  if ( (size_t) t->count * 2 > t->bucket_count ) {
+    INTERN_grow(t);
+  }
+  return id;
+}
+
+/*
+ * Returns the id of s, or -1 if it has never been added
+ */
+int INTERN_find(intern_table *t, const char *s) {
+  return t->buckets[INTERN_slot(t, s, INTERN_hash(s))];
+}
+
+const char *INTERN_string(intern_table *t, int id) {
+  return id >= 0 && id < t->count ? t->strings[id] : NULL;
+}
+
+void INTERN_free(intern_table *t) {
+  for ( int id = 0; id < t->count; id++ ) {
+    free(t->strings[id]);
+  }
+  free(t->strings);
+  free(t->hashes);
+  free(t->buckets);
+  memset(t, 0, sizeof(intern_table));
+}
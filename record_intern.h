@@ -0,0 +1,31 @@
+/*
+ * String intern table
+ *
+ * Maps each distinct string (usually a file path) to a small integer id, assigned in
+ * order of first appearance, and back. Ids let the dependency graph be stored and
+ * compared as integers instead of repeated strings.
+ */
+
+#ifndef RECORD_INTERN_H
+#define RECORD_INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct intern_table_struct {
+  char **strings;         // id -> string
+  uint64_t *hashes;       // id -> hash of the string
+  int count;
+  int cap;
+  int *buckets;           // open addressing table of ids, -1 when empty
+  size_t bucket_count;    // always a power of two
+} intern_table;
+
+void INTERN_init(intern_table *t);
+int INTERN_id(intern_table *t, const char *s);
+int INTERN_find(intern_table *t, const char *s);
+const char *INTERN_string(intern_table *t, int id);
+void INTERN_free(intern_table *t);
+uint64_t INTERN_hash(const char *s);
+
+#endif
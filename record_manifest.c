@@ -0,0 +1,328 @@
+/*
+ * The hash manifest, see record_manifest.h
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "record_core.h"
+#include "record_hash.h"
+#include "record_intern.h"
+#include "record_manifest.h"
+#include "record_model.h"
+#include "record_stats.h"
+
+/*
+ * A file being hashed: its full path, and the hash of each of its chunks
+ */
+typedef struct hash_file_struct {
+  char *path;
+  long chunks;            // 1 for a file hashed whole
+  uint64_t *chunk_hashes;
+  atomic_bool failed;
+} hash_file;
+
+/*
+ * One chunk of one file, the unit of work of the threads
+ */
+typedef struct hash_item_struct {
+  int file;
+  long chunk;
+} hash_item;
+
+typedef struct hash_pool_struct {
+  manifest *mf;
+  hash_file *files;       // path id -> the file being hashed
+  hash_item *items;
+  long count;
+  atomic_long next;       // the next item for a thread to take
+} hash_pool;
+
+typedef struct hash_worker_struct {
+  hash_pool *pool;
+  stats st;
+} hash_worker;
+
+void MANIFEST_init(manifest *mf) {
+  memset(mf, 0, sizeof(manifest));
+  INTERN_init(&mf->paths);
+  DEPSET_init(&mf->sets);
+}
+
+/*
+ * Adds a target and its dependencies to the manifest; the target itself is not kept
+ */
+void MANIFEST_add_target(manifest *mf, target *tar) {
+  if ( mf->count == mf->cap ) {
+    mf->cap = mf->cap ? mf->cap * 2 : 64;
+    mf->targets = realloc(mf->targets, mf->cap * sizeof(manifest_target));
+  }
+  manifest_target *mt = &mf->targets[mf->count++];
+  mt->name = strdup(tar->target_name);
+  int count = 0;
+  for ( depnode *dep = tar->head; dep != NULL; dep = dep->next ) {
+    if ( count == mf->id_cap ) {
+      mf->id_cap = mf->id_cap ? mf->id_cap * 2 : 256;
+      mf->ids = realloc(mf->ids, mf->id_cap * sizeof(int));
+    }
+    mf->ids[count++] = INTERN_id(&mf->paths, dep->dep);
+  }
+  mt->deps = DEPSET_intern(&mf->sets, mf->ids, count);
+  mt->digest = 0;
+}
+
+/*
+ * A thread of the pool: hashes chunks until there are none left
+ */
+static void *MANIFEST_work(void *arg) {
+  hash_worker *w = arg;
+  hash_pool *pool = w->pool;
+  STATS_enter(&w->st, PHASE_HASH);
+  void *buffer = malloc(HASH_CHUNK);
+  int open_file = -1;
+  int fd = -1;
+  long i;
+  while ( (i = atomic_fetch_add(&pool->next, 1)) < pool->count ) {
+    hash_item *item = &pool->items[i];
+    hash_file *hf = &pool->files[item->file];
+    manifest_file *f = &pool->mf->files[item->file];
+    if ( atomic_load(&hf->failed) ) {
+      continue;
+    }
+    // the chunks of a file are next to each other, a thread often takes several in a row
+    if ( open_file != item->file ) {
+      if ( fd >= 0 ) {
+        close(fd);
+      }
+      fd = open(hf->path, O_RDONLY | O_CLOEXEC);
+      open_file = item->file;
+    }
+    long long offset = (long long) item->chunk * HASH_CHUNK;
+    size_t len = f->size - offset < HASH_CHUNK ? f->size - offset : HASH_CHUNK;
+    if ( fd < 0 || HASH_range(fd, offset, len, buffer, &hf->chunk_hashes[item->chunk]) != 0 ) {
+      atomic_store(&hf->failed, true);
+    }
+  }
+  if ( fd >= 0 ) {
+    close(fd);
+  }
+  free(buffer);
+  STATS_enter(&w->st, PHASE_NONE);
+  return NULL;
+}
+
+/*
+ * Derives each target's digest from the paths and hashes of its dependencies, in order
+ */
+static void MANIFEST_digest(manifest *mf) {
+  char *buffer = NULL;
+  size_t cap = 0;
+  for ( int t = 0; t < mf->count; t++ ) {
+    manifest_target *mt = &mf->targets[t];
+    size_t len = 0;
+    const int *ids = DEPSET_expand(mt->deps, &mf->ids, &mf->id_cap);
+    for ( int i = 0; i < mt->deps->count; i++ ) {
+      const char *path = INTERN_string(&mf->paths, ids[i]);
+      manifest_file *f = &mf->files[ids[i]];
+      uint64_t hash = f->hashed ? f->hash : 0;
+      size_t need = len + strlen(path) + 1 + sizeof(hash);
+      if ( need > cap ) {
+        cap = need * 2;
+        buffer = realloc(buffer, cap);
+      }
+      memcpy(buffer + len, path, strlen(path) + 1);
+      len += strlen(path) + 1;
+      memcpy(buffer + len, &hash, sizeof(hash));
+      len += sizeof(hash);
+    }
+    mt->digest = HASH_bytes(buffer, len, 0);
+  }
+  free(buffer);
+}
+
+/*
+ * Hashes every distinct dependency once, on jobs threads, and derives the targets'
+ * digests; relative paths are found from base_dir
+ */
+void MANIFEST_hash(manifest *mf, const char *base_dir, int jobs, stats *st) {
+  int count = mf->paths.count;
+  mf->files = calloc(count, sizeof(manifest_file));
+  hash_pool pool;
+  pool.mf = mf;
+  pool.files = calloc(count, sizeof(hash_file));
+  pool.items = NULL;
+  pool.count = 0;
+  atomic_init(&pool.next, 0);
+  long item_cap = 0;
+  for ( int id = 0; id < count; id++ ) {
+    const char *path = INTERN_string(&mf->paths, id);
+    hash_file *hf = &pool.files[id];
+    hf->path = path[0] == '/' ? strdup(path) : sandbox_path((char *) base_dir, (char *) path);
+    atomic_init(&hf->failed, false);
+    struct stat sb;
+    if ( stat(hf->path, &sb) != 0 || !S_ISREG(sb.st_mode) ) {
+      atomic_store(&hf->failed, true);
+      continue;
+    }
+    manifest_file *f = &mf->files[id];
+    f->size = sb.st_size;
+    f->mtime = sb.st_mtim;
+    // an empty file is one empty chunk
+    hf->chunks = f->size > HASH_CHUNK ? (f->size + HASH_CHUNK - 1) / HASH_CHUNK : 1;
+    hf->chunk_hashes = calloc(hf->chunks, sizeof(uint64_t));
+    if ( pool.count + hf->chunks > item_cap ) {
+      item_cap = (pool.count + hf->chunks) * 2;
+      pool.items = realloc(pool.items, item_cap * sizeof(hash_item));
+    }
+    for ( long c = 0; c < hf->chunks; c++ ) {
+      pool.items[pool.count].file = id;
+      pool.items[pool.count++].chunk = c;
+    }
+  }
+  if ( jobs > pool.count ) {
+    jobs = pool.count > 0 ? pool.count : 1;
+  }
+
+  // the calling thread hashes too, every thread keeps its own statistics
+  phase prev = STATS_enter(st, PHASE_NONE);
+  hash_worker *workers = calloc(jobs, sizeof(hash_worker));
+  pthread_t *threads = calloc(jobs, sizeof(pthread_t));
+  for ( int i = 0; i < jobs; i++ ) {
+    workers[i].pool = &pool;
+    STATS_init(&workers[i].st, st->enabled);
+  }
+  for ( int i = 1; i < jobs; i++ ) {
+    pthread_create(&threads[i], NULL, MANIFEST_work, &workers[i]);
+  }
+  MANIFEST_work(&workers[0]);
+  for ( int i = 1; i < jobs; i++ ) {
+    pthread_join(threads[i], NULL);
+  }
+  STATS_enter(st, prev);
+  for ( int i = 0; i < jobs; i++ ) {
+    STATS_add(st, &workers[i].st);
+    STATS_free(&workers[i].st);
+  }
+  free(workers);
+  free(threads);
+
+  for ( int id = 0; id < count; id++ ) {
+    hash_file *hf = &pool.files[id];
+    manifest_file *f = &mf->files[id];
+    f->hashed = !atomic_load(&hf->failed);
+    if ( f->hashed ) {
+      f->hash = hf->chunks == 1 ? hf->chunk_hashes[0] : HASH_combine(hf->chunk_hashes, hf->chunks);
+      STATS_count_hash(st, f->size);
+    }
+    else {
+      f->size = -1;
+    }
+    free(hf->path);
+    free(hf->chunk_hashes);
+  }
+  free(pool.files);
+  free(pool.items);
+  MANIFEST_digest(mf);
+  STATS_count_depsets(st, mf->sets.count, mf->sets.deltas, mf->sets.ids, mf->sets.stored);
+}
+
+/*
+ * Writes the manifest, replacing an earlier one atomically
+ * Returns 0 on success, or -1 if it could not be written
+ */
+int MANIFEST_save(manifest *mf, const char *manifest_file_name) {
+  char *tmp_path;
+  FILE *file = ATOMIC_open(manifest_file_name, &tmp_path);
+  if ( file == NULL ) {
+    return -1;
+  }
+  for ( int id = 0; id < mf->paths.count; id++ ) {
+    manifest_file *f = &mf->files[id];
+    if ( f->hashed ) {
+      fprintf(file, "FILE  %016llx  %lld  %lld.%09ld  %s\n", (unsigned long long) f->hash, f->size,
+              (long long) f->mtime.tv_sec, f->mtime.tv_nsec, INTERN_string(&mf->paths, id));
+    }
+    else {
+      fprintf(file, "FILE  -  -1  0.000000000  %s\n", INTERN_string(&mf->paths, id));
+    }
+  }
+  for ( int t = 0; t < mf->count; t++ ) {
+    fprintf(file, "TARGET  %016llx  %s\n", (unsigned long long) mf->targets[t].digest,
+            mf->targets[t].name);
+  }
+  return ATOMIC_commit(file, tmp_path, manifest_file_name);
+}
+
+/*
+ * Reads a manifest written by MANIFEST_save(); the targets are read without their
+ * dependencies, which only dependency.txt lists
+ * Returns 0 on success, or -1 if the file could not be opened
+ */
+int MANIFEST_load(manifest *mf, const char *manifest_file_name) {
+  FILE *file = fopen(manifest_file_name, "r");
+  if ( file == NULL ) {
+    return -1;
+  }
+  char *line = NULL;
+  size_t cap = 0;
+  ssize_t len;
+  while ( (len = getline(&line, &cap, file)) != -1 ) {
+    if ( len > 0 && line[len - 1] == '\n' ) {
+      line[--len] = '\0';
+    }
+    char hash[24];
+    long long size;
+    long long sec;
+    long nsec;
+    int name = 0;
+    if ( sscanf(line, "FILE %23s %lld %lld.%ld %n", hash, &size, &sec, &nsec, &name) == 4 &&
+         name > 0 ) {
+      int id = INTERN_id(&mf->paths, line + name);
+      if ( id >= mf->file_cap ) {
+        int file_cap = mf->file_cap ? mf->file_cap * 2 : 256;
+        mf->files = realloc(mf->files, file_cap * sizeof(manifest_file));
+        memset(mf->files + mf->file_cap, 0, (file_cap - mf->file_cap) * sizeof(manifest_file));
+        mf->file_cap = file_cap;
+      }
+      manifest_file *f = &mf->files[id];
+      f->hashed = strcmp(hash, "-") != 0;
+      f->hash = strtoull(hash, NULL, 16);
+      f->size = size;
+      f->mtime.tv_sec = sec;
+      f->mtime.tv_nsec = nsec;
+    }
+    else if ( sscanf(line, "TARGET %23s %n", hash, &name) == 1 && name > 0 ) {
+      if ( mf->count == mf->cap ) {
+        mf->cap = mf->cap ? mf->cap * 2 : 64;
+        mf->targets = realloc(mf->targets, mf->cap * sizeof(manifest_target));
+      }
+      manifest_target *mt = &mf->targets[mf->count++];
+      mt->name = strdup(line + name);
+      mt->deps = NULL;
+      mt->digest = strtoull(hash, NULL, 16);
+    }
+  }
+  free(line);
+  fclose(file);
+  return 0;
+}
+
+void MANIFEST_free(manifest *mf) {
+  for ( int t = 0; t < mf->count; t++ ) {
+    free(mf->targets[t].name);
+  }
+  free(mf->targets);
+  free(mf->ids);
+  DEPSET_free(&mf->sets);
+  free(mf->files);
+  INTERN_free(&mf->paths);
+  memset(mf, 0, sizeof(manifest));
+}
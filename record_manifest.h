@@ -0,0 +1,67 @@
+/*
+ * The hash manifest of a recording, written by record_build --hash
+ *
+ * dependency.txt only lists the paths each target depends on. The manifest records
+ * which version of each of them the targets were built against: every distinct
+ * dependency, hashed once however many targets include it (see record_hash.h), with
+ * its size and modification time, and for every target a digest of its dependencies,
+ * which changes when any of them is renamed or changes contents. The file is:
+ *    FILE  hash  size  mtime  path        (hash "-" and size -1 for a file that could
+ *    ...                                   not be read; mtime as seconds.nanoseconds)
+ *    TARGET  digest  name
+ *    ...
+ * with the hashes and digests as 16 hex digits, and paths as recorded in dependency.txt.
+ */
+
+#ifndef RECORD_MANIFEST_H
+#define RECORD_MANIFEST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "record_core.h"
+#include "record_depset.h"
+#include "record_intern.h"
+#include "record_stats.h"
+
+/*
+ * What the manifest knows of one path
+ */
+typedef struct manifest_file_struct {
+  bool hashed;            // false when the file could not be read
+  uint64_t hash;
+  long long size;
+  struct timespec mtime;
+} manifest_file;
+
+/*
+ * The dependencies of one target, as a set of ids of the manifest's paths shared with
+ * the other targets that have the same ones
+ */
+typedef struct manifest_target_struct {
+  char *name;
+  const depset *deps;     // NULL for a target read from a manifest file
+  uint64_t digest;
+} manifest_target;
+
+typedef struct manifest_struct {
+  intern_table paths;
+  depset_table sets;
+  int *ids;               // the dependencies of the target being added
+  int id_cap;
+  manifest_file *files;   // path id -> its hash, size and modification time
+  int file_cap;           // of files, while a manifest is loaded
+  manifest_target *targets;
+  int count;
+  int cap;
+} manifest;
+
+void MANIFEST_init(manifest *mf);
+void MANIFEST_add_target(manifest *mf, target *tar);
+void MANIFEST_hash(manifest *mf, const char *base_dir, int jobs, stats *st);
+int MANIFEST_save(manifest *mf, const char *manifest_file_name);
+int MANIFEST_load(manifest *mf, const char *manifest_file_name);
+void MANIFEST_free(manifest *mf);
+
+#endif
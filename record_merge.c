@@ -0,0 +1,391 @@
+/*
+ * Merge mode, see record_merge.h
+ */
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "record_core.h"
+#include "record_intern.h"
+#include "record_merge.h"
+#include "record_model.h"
+#include "record_probed.h"
+
+/*
+ * One target of the merged model; the variants of a name are chained through next_variant
+ */
+typedef struct merged_target_struct {
+  int name_id;
+  int variant;              // 1 for the first command recorded for the name, then 2, 3, ...
+  int next_variant;         // index of the next variant of the same name, or -1
+  char *cmd;
+  char *dir;                // the directory the command ran in, as first recorded, or NULL
+  int *deps;                // interned dependency paths
+  long *bytes_read;         // of each dependency, the most any recording read
+  int dep_count;
+  int dep_cap;
+  probe_set absent;         // the union of the recordings' probes
+  probe_set exists;
+  double duration;          // the longest recorded
+  long peak_rss;            // the largest recorded
+  double cpu_time;          // the most recorded
+} merged_target;
+
+/*
+ * Everything merge mode collects from the recordings
+ */
+typedef struct merger_struct {
+  intern_table names;
+  intern_table paths;       // dependency paths, shared by every recording
+  intern_table sources;     // lines of the recordings' source file lists
+  int *first_variant;       // name id -> index of its first variant
+  int *origin;              // path id -> recording that first listed the path
+  int *mark;                // path id -> last target its presence was checked for
+  int *slot;                // path id -> its index in the deps of that target
+  int path_cap;
+  merged_target *targets;
+  int count;
+  int cap;
+  int stamp;
+  // counters for the summary
+  int recorded;             // targets read from all recordings
+  int duplicates;           // of those, identical to a target already merged
+  int variants;             // targets recorded with a different command than the first
+} merger;
+
+/*
+ * Grows the per path tables to cover every interned path
+ */
+static void MERGE_grow_paths(merger *mg) {
+  if ( mg->paths.count <= mg->path_cap ) {
+    return;
+  }
+  int cap = mg->path_cap ? mg->path_cap : 1024;
+  while ( cap < mg->paths.count ) {
+    cap *= 2;
+  }
+  mg->origin = realloc(mg->origin, cap * sizeof(int));
+  mg->mark = realloc(mg->mark, cap * sizeof(int));
+  mg->slot = realloc(mg->slot, cap * sizeof(int));
+  memset(mg->mark + mg->path_cap, 0, (cap - mg->path_cap) * sizeof(int));
+  mg->path_cap = cap;
+}
+
+/*
+ * Adds the dependencies of a recorded target to a merged one, skipping the ones it has,
+ * and what else was recorded of it
+ */
+static void MERGE_add_deps(merger *mg, merged_target *mt, target *tar, int recording) {
+  mg->stamp++;
+  for ( int i = 0; i < mt->dep_count; i++ ) {
+    mg->mark[mt->deps[i]] = mg->stamp;
+    mg->slot[mt->deps[i]] = i;
+  }
+  for ( depnode *dep = tar->head; dep != NULL; dep = dep->next ) {
+    int count = mg->paths.count;
+    int id = INTERN_id(&mg->paths, dep->dep);
+    if ( id == count ) {
+      MERGE_grow_paths(mg);
+      mg->origin[id] = recording;
+      mg->mark[id] = 0;
+    }
+    if ( mg->mark[id] == mg->stamp ) {
+      // a dependency the merged target has, the same file read again
+      if ( dep->bytes_read > mt->bytes_read[mg->slot[id]] ) {
+        mt->bytes_read[mg->slot[id]] = dep->bytes_read;
+      }
+      continue;
+    }
+    mg->mark[id] = mg->stamp;
+    mg->slot[id] = mt->dep_count;
+    if ( mt->dep_count == mt->dep_cap ) {
+      mt->dep_cap = mt->dep_cap ? mt->dep_cap * 2 : 16;
+      mt->deps = realloc(mt->deps, mt->dep_cap * sizeof(int));
+      mt->bytes_read = realloc(mt->bytes_read, mt->dep_cap * sizeof(long));
+    }
+    mt->bytes_read[mt->dep_count] = dep->bytes_read;
+    mt->deps[mt->dep_count++] = id;
+  }
+  for ( int i = 0; i < tar->absent.count; i++ ) {
+    PROBED_add(&mt->absent, PROBED_path(tar->absent.ids[i]));
+  }
+  for ( int i = 0; i < tar->exists.count; i++ ) {
+    PROBED_add(&mt->exists, PROBED_path(tar->exists.ids[i]));
+  }
+  if ( tar->duration > mt->duration ) {
+    mt->duration = tar->duration;
+  }
+  if ( tar->peak_rss > mt->peak_rss ) {
+    mt->peak_rss = tar->peak_rss;
+  }
+  if ( tar->cpu_time > mt->cpu_time ) {
+    mt->cpu_time = tar->cpu_time;
+  }
+}
+
+static merged_target *MERGE_new_target(merger *mg, int name_id, int variant, target *tar) {
+  if ( mg->count == mg->cap ) {
+    mg->cap = mg->cap ? mg->cap * 2 : 256;
+    mg->targets = realloc(mg->targets, mg->cap * sizeof(merged_target));
+  }
+  merged_target *mt = &mg->targets[mg->count++];
+  memset(mt, 0, sizeof(merged_target));
+  mt->name_id = name_id;
+  mt->variant = variant;
+  mt->next_variant = -1;
+  mt->cmd = strdup(tar->cmd);
+  mt->dir = tar->dir != NULL ? strdup(tar->dir) : NULL;
+  return mt;
+}
+
+/*
+ * Merges one recorded target: a known name and command adds to the target recorded
+ * before, a known name with a new command becomes another variant of it
+ */
+static void MERGE_target(merger *mg, target *tar, int recording) {
+  mg->recorded++;
+  int count = mg->names.count;
+  int name_id = INTERN_id(&mg->names, tar->target_name);
+  if ( name_id == count ) {
+    mg->first_variant = realloc(mg->first_variant, mg->names.count * sizeof(int));
+    mg->first_variant[name_id] = mg->count;
+    MERGE_add_deps(mg, MERGE_new_target(mg, name_id, 1, tar), tar, recording);
+    return;
+  }
+  int last = -1;
+  for ( int t = mg->first_variant[name_id]; t != -1; t = mg->targets[t].next_variant ) {
+    if ( !strcmp(mg->targets[t].cmd, tar->cmd) ) {
+      mg->duplicates++;
+      MERGE_add_deps(mg, &mg->targets[t], tar, recording);
+      return;
+    }
+    last = t;
+  }
+  mg->variants++;
+  int variant = mg->targets[last].variant + 1;
+  mg->targets[last].next_variant = mg->count;
+  MERGE_add_deps(mg, MERGE_new_target(mg, name_id, variant, tar), tar, recording);
+}
+
+/*
+ * Reads the source file list of a recording, keeping the lines not seen yet
+ */
+static void MERGE_sources(merger *mg, const char *dir) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/source_files.txt", dir);
+  FILE *file = fopen(path, "r");
+  if ( file == NULL ) {
+    return;
+  }
+  char *line = NULL;
+  size_t cap = 0;
+  while ( getline(&line, &cap, file) != -1 ) {
+    INTERN_id(&mg->sources, line);
+  }
+  free(line);
+  fclose(file);
+}
+
+/*
+ * Returns the name a merged target is written under, which must be freed
+ */
+static char *MERGE_target_name(merger *mg, merged_target *mt) {
+  const char *name = INTERN_string(&mg->names, mt->name_id);
+  char *variant_name = malloc(strlen(name) + 16);
+  if ( mt->variant == 1 ) {
+    strcpy(variant_name, name);
+  }
+  else {
+    sprintf(variant_name, "%s@%d", name, mt->variant);
+  }
+  return variant_name;
+}
+
+/*
+ * Copies every dependency path into the combined sandbox once, taking the copy in the
+ * sandbox of the recording that first listed it, or the original file if it has none
+ * Returns the number of files copied, and adds the bytes copied to *bytes
+ */
+static int MERGE_copy(merger *mg, char **dirs, char *sandbox_pwd, long *bytes) {
+  int copied = 0;
+  for ( int id = 0; id < mg->paths.count; id++ ) {
+    char *dep = (char *) INTERN_string(&mg->paths, id);
+    char rec_sandbox[PATH_MAX];
+    snprintf(rec_sandbox, sizeof(rec_sandbox), "%s/sandbox", dirs[mg->origin[id]]);
+    char *src = sandbox_path(rec_sandbox, dep);
+    if ( access(src, R_OK) != 0 ) {
+      free(src);
+      src = dep[0] == '/' ? strdup(dep) : sandbox_path(dirs[mg->origin[id]], dep);
+    }
+    char *new_path = sandbox_path(sandbox_pwd, dep);
+    // merging into one of the recordings, whose sandbox already has the file
+    long n = 0;
+    if ( strcmp(src, new_path) ) {
+      n = copy_to_sandbox(src, new_path, sandbox_pwd);
+    }
+    if ( n >= 0 ) {
+      copied++;
+      *bytes += n;
+    }
+    free(new_path);
+    free(src);
+  }
+  return copied;
+}
+
+/*
+ * Writes the sandbox Makefile of the merged model; only the first variant of each
+ * target is part of "all"
+ */
+static int MERGE_save_makefile(merger *mg, model *m, char *sandbox_pwd, const char *mkfile_path) {
+  char *tmp_path;
+  FILE *file = ATOMIC_open(mkfile_path, &tmp_path);
+  if ( file == NULL ) {
+    return -1;
+  }
+  size_t cap = BUFFER_SIZE;
+  char *make_targets_list = calloc(1, cap);
+  fprintf(file, "\nall: all_make_targets\n");
+  for ( int i = 0; i < m->count; i++ ) {
+    emit_target_to_makefile(file, sandbox_pwd, m->targets[i]);
+    if ( mg->targets[i].variant == 1 ) {
+      append_make_target(&make_targets_list, &cap, m->targets[i]->target_name);
+    }
+  }
+  fprintf(file, "\nall_make_targets:%s", make_targets_list);
+  free(make_targets_list);
+  return ATOMIC_commit(file, tmp_path, mkfile_path);
+}
+
+static int MERGE_save_sources(merger *mg, const char *sources_path) {
+  char *tmp_path;
+  FILE *file = ATOMIC_open(sources_path, &tmp_path);
+  if ( file == NULL ) {
+    return -1;
+  }
+  for ( int id = 0; id < mg->sources.count; id++ ) {
+    fputs(INTERN_string(&mg->sources, id), file);
+  }
+  return ATOMIC_commit(file, tmp_path, sources_path);
+}
+
+/*
+ * Returns the path of file name in directory dir, which must be freed
+ */
+static char *MERGE_path(const char *dir, const char *name) {
+  char *path = malloc(strlen(dir) + strlen(name) + 2);
+  sprintf(path, "%s/%s", dir, name);
+  return path;
+}
+
+/*
+ * Merges the recordings in the given directories into dependency.txt, commands_cache.txt,
+ * source_files.txt and sandbox/ in pwd
+ * Returns 0 on success, or 1 if a recording could not be read or an output written
+ */
+int MERGE_run(char **recordings, int count, char *pwd) {
+  merger mg;
+  memset(&mg, 0, sizeof(merger));
+  INTERN_init(&mg.names);
+  INTERN_init(&mg.paths);
+  INTERN_init(&mg.sources);
+  model merged;
+  MODEL_init(&merged);
+  char *sandbox_pwd = MERGE_path(pwd, "sandbox");
+  char *mkfile_path = MERGE_path(sandbox_pwd, "Makefile");
+  char *dep_file_path = MERGE_path(pwd, "dependency.txt");
+  char *cmds_file_path = MERGE_path(pwd, "commands_cache.txt");
+  char *sources_file_path = MERGE_path(pwd, "source_files.txt");
+  int failed = 0;
+
+  char **dirs = calloc(count, sizeof(char *));
+  for ( int r = 0; r < count; r++ ) {
+    // sandbox copies and relative paths are found from the recording's directory
+    dirs[r] = realpath(recordings[r], NULL);
+    char dep_path[PATH_MAX];
+    snprintf(dep_path, sizeof(dep_path), "%s/dependency.txt", recordings[r]);
+    model m;
+    MODEL_init(&m);
+    if ( dirs[r] == NULL || MODEL_load(&m, dep_path) != 0 ) {
+      fprintf(stderr, "ERROR: recording %s could not be opened!\n", dep_path);
+      MODEL_free(&m);
+      failed = 1;
+      goto done;
+    }
+    for ( int t = 0; t < m.count; t++ ) {
+      MERGE_target(&mg, m.targets[t], r);
+    }
+    MODEL_free(&m);
+    MERGE_sources(&mg, recordings[r]);
+  }
+
+  // the merged model, in the order its targets were first recorded
+  for ( int t = 0; t < mg.count; t++ ) {
+    merged_target *mt = &mg.targets[t];
+    target *tar = calloc(1, sizeof(target));
+    tar->target_name = MERGE_target_name(&mg, mt);
+    tar->cmd = strdup(mt->cmd);
+    tar->dir = mt->dir != NULL ? strdup(mt->dir) : NULL;
+    for ( int i = 0; i < mt->dep_count; i++ ) {
+      TARGET_append_dep(tar, (char *) INTERN_string(&mg.paths, mt->deps[i]));
+      tar->tail->bytes_read = mt->bytes_read[i];
+    }
+    // the probe sets move to the target
+    tar->absent = mt->absent;
+    tar->exists = mt->exists;
+    memset(&mt->absent, 0, sizeof(probe_set));
+    memset(&mt->exists, 0, sizeof(probe_set));
+    tar->duration = mt->duration;
+    tar->peak_rss = mt->peak_rss;
+    tar->cpu_time = mt->cpu_time;
+    MODEL_add_target(&merged, tar);
+  }
+
+  mkdir(sandbox_pwd, 0777);
+  long bytes = 0;
+  int copied = MERGE_copy(&mg, dirs, sandbox_pwd, &bytes);
+  failed |= MODEL_save(&merged, dep_file_path) != 0;
+  failed |= MODEL_save_commands(&merged, cmds_file_path) != 0;
+  failed |= MERGE_save_sources(&mg, sources_file_path) != 0;
+  failed |= MERGE_save_makefile(&mg, &merged, sandbox_pwd, mkfile_path) != 0;
+
+  fprintf(stdout, "Merged %d recordings: %d targets read, %d duplicates removed, %d variants kept\n",
+          count, mg.recorded, mg.duplicates, mg.variants);
+  fprintf(stdout, "%d targets, %d distinct paths, %d files (%ld bytes) copied to %s\n",
+          merged.count, mg.paths.count, copied, bytes, sandbox_pwd);
+
+done:
+  MODEL_free(&merged);
+  for ( int t = 0; t < mg.count; t++ ) {
+    free(mg.targets[t].cmd);
+    free(mg.targets[t].dir);
+    free(mg.targets[t].deps);
+    free(mg.targets[t].bytes_read);
+    PROBED_free(&mg.targets[t].absent);
+    PROBED_free(&mg.targets[t].exists);
+  }
+  for ( int r = 0; r < count; r++ ) {
+    free(dirs[r]);
+  }
+  free(dirs);
+  free(mg.targets);
+  free(mg.first_variant);
+  free(mg.origin);
+  free(mg.mark);
+  free(mg.slot);
+  INTERN_free(&mg.names);
+  INTERN_free(&mg.paths);
+  INTERN_free(&mg.sources);
+  free(sources_file_path);
+  free(cmds_file_path);
+  free(dep_file_path);
+  free(mkfile_path);
+  free(sandbox_pwd);
+  return failed;
+}
@@ -0,0 +1,22 @@
+/*
+ * Merge mode: union several recordings into one dependency model and sandbox
+ *
+ * Each recording is a directory holding the dependency.txt and sandbox/ of one
+ * record_build run, e.g. a debug and a release configuration, or sub-builds run by
+ * separate make invocations. Their dependency paths are interned in one shared table.
+ * Targets with the same name and command are kept once, with the union of their
+ * dependencies; a target recorded with different commands keeps every command as a
+ * variant. The first variant keeps the target's name, the others are named
+ * "name@2", "name@3", ... and get their own sandbox Makefile rules, left out of "all".
+ * A target recorded more than once keeps the most bytes read of each dependency, the
+ * union of its probed paths, and its longest duration, largest peak memory and most cpu
+ * time: each recording ran the same command, so the costs are not added up.
+ * Every file is copied into the combined sandbox once, however many recordings share it.
+ */
+
+#ifndef RECORD_MERGE_H
+#define RECORD_MERGE_H
+
+int MERGE_run(char **recordings, int count, char *pwd);
+
+#endif
@@ -0,0 +1,328 @@
+/*
+ * The recorded target model, see record_model.h
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "record_core.h"
+#include "record_intern.h"
+#include "record_model.h"
+#include "record_probed.h"
+
+void MODEL_init(model *m) {
+  m->targets = NULL;
+  m->count = 0;
+  m->cap = 0;
+}
+
+void MODEL_add_target(model *m, target *tar) {
+  if ( m->count == m->cap ) {
+    m->cap = m->cap ? m->cap * 2 : 64;
+    m->targets = realloc(m->targets, m->cap * sizeof(target *));
+  }
+  m->targets[m->count++] = tar;
+}
+
+/*
+ * Adds every whitespace separated path in a DEPENDENCY line, or its continuation, to tar
+ */
+static void MODEL_add_deps(target *tar, char *deps) {
+  char *save = NULL;
+  for ( char *dep = strtok_r(deps, " \t\n", &save); dep != NULL; dep = strtok_r(NULL, " \t\n", &save) ) {
+    TARGET_append_dep(tar, dep);
+  }
+}
+
+/*
+ * Sets the bytes read of the dependencies from dep on to the numbers on a READ line
+ * Returns the dependency the next number is for
+ */
+static depnode *MODEL_add_reads(depnode *dep, char *reads) {
+  char *save = NULL;
+  for ( char *bytes = strtok_r(reads, " \t\n", &save); bytes != NULL && dep != NULL;
+        bytes = strtok_r(NULL, " \t\n", &save) ) {
+    dep->bytes_read = atol(bytes);
+    dep = dep->next;
+  }
+  return dep;
+}
+
+/*
+ * Adds every whitespace separated path in an ABSENT or EXISTS line, or its continuation, to s
+ */
+static void MODEL_add_probed(probe_set *s, char *paths) {
+  char *save = NULL;
+  for ( char *path = strtok_r(paths, " \t\n", &save); path != NULL; path = strtok_r(NULL, " \t\n", &save) ) {
+    PROBED_add(s, path);
+  }
+}
+
+/*
+ * Opens a dependency file to read its targets one at a time with MODEL_read_target()
+ * Returns 0 on success, or -1 if the file could not be opened
+ */
+int MODEL_open(model_reader *r, const char *dependency_file_name) {
+  memset(r, 0, sizeof(model_reader));
+  r->file = fopen(dependency_file_name, "r");
+  return r->file != NULL ? 0 : -1;
+}
+
+/*
+ * Returns the next target of the file, or NULL at its end; the caller frees it
+ * The file is made of records in the format written by emit_target_to_file():
+ *    TARGET:  name
+ *    COMMAND:  command
+ *    DIRECTORY:  path             (only when the command ran outside the build's directory)
+ *    DEPENDENCY:  dep1  dep2 ...
+ *                 dep3 ...        (continuation lines start with spaces)
+ *    READ:  bytes1  bytes2 ...    (only with --reads, the bytes read from each dependency,
+ *           bytes3 ...           in the same order and continued the same way)
+ *    ABSENT:  path1  path2 ...    (only with --probes, the paths probed and not found,
+ *    EXISTS:  path1  path2 ...     and the ones found but not read, continued the same way)
+ *    DURATION:  seconds           (only when the trace had timestamps)
+ *    PEAK_RSS:  kB                (only with --usage, see record_usage.h)
+ *    CPU_TIME:  seconds
+ * A target ends where the next one's TARGET line starts, so that one is read ahead.
+ */
+target *MODEL_read_target(model_reader *r) {
+  target *cur = r->next;
+  r->next = NULL;
+  ssize_t len;
+  bool in_deps = false;
+  depnode *read_dep = NULL;     // the dependency the next number on a READ line is for
+  probe_set *probed = NULL;     // the set continuation lines of ABSENT or EXISTS add to
+  while ( (len = getline(&r->line, &r->cap, r->file)) != -1 ) {
+    char *line = r->line;
+    if ( len > 0 && line[len - 1] == '\n' ) {
+      line[--len] = '\0';
+    }
+    if ( line[0] != ' ' ) {
+      read_dep = NULL;
+      probed = NULL;
+    }
+    if ( !strncmp(line, "TARGET:", 7) ) {
+      target *tar = calloc(1, sizeof(target));
+      tar->target_name = strdup(line + 7 + strspn(line + 7, " "));
+      tar->cmd = strdup("");
+      if ( cur != NULL ) {
+        r->next = tar;
+        return cur;
+      }
+      cur = tar;
+      in_deps = false;
+    }
+    else if ( cur != NULL && !strncmp(line, "COMMAND:", 8) ) {
+      free(cur->cmd);
+      cur->cmd = strdup(line + 8 + strspn(line + 8, " "));
+    }
+    else if ( cur != NULL && !strncmp(line, "DIRECTORY:", 10) ) {
+      free(cur->dir);
+      cur->dir = strdup(line + 10 + strspn(line + 10, " "));
+    }
+    else if ( cur != NULL && !strncmp(line, "DEPENDENCY:", 11) ) {
+      MODEL_add_deps(cur, line + 11);
+      in_deps = true;
+    }
+    else if ( cur != NULL && in_deps && line[0] == ' ' ) {
+      MODEL_add_deps(cur, line);
+    }
+    else if ( cur != NULL && !strncmp(line, "READ:", 5) ) {
+      read_dep = MODEL_add_reads(cur->head, line + 5);
+      in_deps = false;
+    }
+    else if ( read_dep != NULL && line[0] == ' ' ) {
+      read_dep = MODEL_add_reads(read_dep, line);
+    }
+    else if ( cur != NULL && !strncmp(line, "ABSENT:", 7) ) {
+      probed = &cur->absent;
+      MODEL_add_probed(probed, line + 7);
+      in_deps = false;
+    }
+    else if ( cur != NULL && !strncmp(line, "EXISTS:", 7) ) {
+      probed = &cur->exists;
+      MODEL_add_probed(probed, line + 7);
+      in_deps = false;
+    }
+    else if ( probed != NULL && line[0] == ' ' ) {
+      MODEL_add_probed(probed, line);
+    }
+    else if ( cur != NULL && !strncmp(line, "DURATION:", 9) ) {
+      cur->duration = atof(line + 9);
+      in_deps = false;
+    }
+    else if ( cur != NULL && !strncmp(line, "PEAK_RSS:", 9) ) {
+      cur->peak_rss = atol(line + 9);
+      in_deps = false;
+    }
+    else if ( cur != NULL && !strncmp(line, "CPU_TIME:", 9) ) {
+      cur->cpu_time = atof(line + 9);
+      in_deps = false;
+    }
+    else {
+      in_deps = false;
+    }
+  }
+  return cur;
+}
+
+void MODEL_close(model_reader *r) {
+  if ( r->next != NULL ) {
+    TARGET_free(r->next);
+  }
+  free(r->line);
+  fclose(r->file);
+}
+
+/*
+ * Reads the targets in a dependency file into m, in the order they were recorded
+ * Returns 0 on success, or -1 if the file could not be opened
+ */
+int MODEL_load(model *m, const char *dependency_file_name) {
+  model_reader r;
+  if ( MODEL_open(&r, dependency_file_name) != 0 ) {
+    return -1;
+  }
+  target *tar;
+  while ( (tar = MODEL_read_target(&r)) != NULL ) {
+    MODEL_add_target(m, tar);
+  }
+  MODEL_close(&r);
+  return 0;
+}
+
+/*
+ * Replaces the targets of m that were recorded again, matched by target name, with their
+ * new versions, and appends the ones that are new. The targets of changed move to m.
+ * Returns the number of targets that were appended
+ */
+int MODEL_merge(model *m, model *changed) {
+  intern_table names;
+  INTERN_init(&names);
+  // target name id -> index in m; a later target with the same name replaces an earlier one
+  int *index = NULL;
+  for ( int i = 0; i < m->count; i++ ) {
+    int id = INTERN_id(&names, m->targets[i]->target_name);
+    if ( id == names.count - 1 ) {
+      index = realloc(index, names.count * sizeof(int));
+    }
+    index[id] = i;
+  }
+  int appended = 0;
+  for ( int i = 0; i < changed->count; i++ ) {
+    target *tar = changed->targets[i];
+    int id = INTERN_find(&names, tar->target_name);
+    if ( id != -1 ) {
+      TARGET_free(m->targets[index[id]]);
+      m->targets[index[id]] = tar;
+      continue;
+    }
+    MODEL_add_target(m, tar);
+    id = INTERN_id(&names, tar->target_name);
+    index = realloc(index, names.count * sizeof(int));
+    index[id] = m->count - 1;
+    appended++;
+  }
+  free(index);
+  INTERN_free(&names);
+  free(changed->targets);
+  MODEL_init(changed);
+  return appended;
+}
+
+/*
+ * Opens a temporary file next to path, to be renamed over it by ATOMIC_commit()
+ */
+FILE *ATOMIC_open(const char *path, char **tmp_path) {
+  *tmp_path = malloc(strlen(path) + 5);
+  strcpy(*tmp_path, path);
+  strcat(*tmp_path, ".tmp");
+  FILE *file = fopen(*tmp_path, "w");
+  if ( file == NULL ) {
+    fprintf(stderr, "ERROR: file %s could not be opened!\n", *tmp_path);
+    free(*tmp_path);
+    *tmp_path = NULL;
+  }
+  return file;
+}
+
+/*
+ * Flushes a file opened by ATOMIC_open() to disk and renames it over path
+ * Returns 0 on success, or -1 if the old contents of path were kept
+ */
+int ATOMIC_commit(FILE *file, char *tmp_path, const char *path) {
+  int failed = fflush(file) != 0 || fsync(fileno(file)) != 0;
+  failed |= fclose(file) != 0;
+  if ( !failed && rename(tmp_path, path) != 0 ) {
+    failed = 1;
+  }
+  if ( failed ) {
+    fprintf(stderr, "ERROR: file %s could not be written!\n", path);
+    unlink(tmp_path);
+  }
+  free(tmp_path);
+  return failed ? -1 : 0;
+}
+
+/*
+ * Writes the model to a dependency file, replacing it atomically
+ */
+int MODEL_save(model *m, const char *dependency_file_name) {
+  char *tmp_path;
+  FILE *file = ATOMIC_open(dependency_file_name, &tmp_path);
+  if ( file == NULL ) {
+    return -1;
+  }
+  for ( int i = 0; i < m->count; i++ ) {
+    emit_target_to_file(file, m->targets[i]);
+  }
+  return ATOMIC_commit(file, tmp_path, dependency_file_name);
+}
+
+/*
+ * Writes the command of every target, one per line, replacing the file atomically
+ */
+int MODEL_save_commands(model *m, const char *cmds_file_name) {
+  char *tmp_path;
+  FILE *file = ATOMIC_open(cmds_file_name, &tmp_path);
+  if ( file == NULL ) {
+    return -1;
+  }
+  for ( int i = 0; i < m->count; i++ ) {
+    fprintf(file, "%s\n", m->targets[i]->cmd);
+  }
+  return ATOMIC_commit(file, tmp_path, cmds_file_name);
+}
+
+/*
+ * Writes the sandbox Makefile for the model, replacing it atomically
+ */
+int MODEL_save_makefile(model *m, char *sandbox_pwd, const char *mkfile_path) {
+  char *tmp_path;
+  FILE *file = ATOMIC_open(mkfile_path, &tmp_path);
+  if ( file == NULL ) {
+    return -1;
+  }
+  size_t cap = BUFFER_SIZE;
+  char *make_targets_list = calloc(1, cap);
+  fprintf(file, "\nall: all_make_targets\n");
+  for ( int i = 0; i < m->count; i++ ) {
+    emit_target_to_makefile(file, sandbox_pwd, m->targets[i]);
+    append_make_target(&make_targets_list, &cap, m->targets[i]->target_name);
+  }
+  fprintf(file, "\nall_make_targets:%s", make_targets_list);
+  free(make_targets_list);
+  return ATOMIC_commit(file, tmp_path, mkfile_path);
+}
+
+void MODEL_free(model *m) {
+  for ( int i = 0; i < m->count; i++ ) {
+    TARGET_free(m->targets[i]);
+  }
+  free(m->targets);
+  MODEL_init(m);
+}
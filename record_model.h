@@ -0,0 +1,50 @@
+/*
+ * The recorded target model
+ *
+ * All targets of a recording, as read back from the dependency.txt file that
+ * record_build writes (see emit_target_to_file()). An incremental recording merges the
+ * targets it re-records into the previous model and saves it again; files are saved by
+ * writing a temporary copy and renaming it over the old one, so a reader, or a recording
+ * that is interrupted, only ever sees a complete file. A model_reader reads the targets
+ * of a file one at a time instead, for tools that stream through a recording too large
+ * to hold in memory.
+ */
+
+#ifndef RECORD_MODEL_H
+#define RECORD_MODEL_H
+
+#include <stdio.h>
+
+#include "record_core.h"
+
+typedef struct model_struct {
+  target **targets;
+  int count;
+  int cap;
+} model;
+
+/*
+ * A dependency file being read one target at a time, see MODEL_read_target()
+ */
+typedef struct model_reader_struct {
+  FILE *file;
+  char *line;
+  size_t cap;
+  target *next;           // read ahead: its TARGET line ended the previous target
+} model_reader;
+
+void MODEL_init(model *m);
+void MODEL_add_target(model *m, target *tar);
+int MODEL_open(model_reader *r, const char *dependency_file_name);
+target *MODEL_read_target(model_reader *r);
+void MODEL_close(model_reader *r);
+int MODEL_load(model *m, const char *dependency_file_name);
+int MODEL_merge(model *m, model *changed);
+int MODEL_save(model *m, const char *dependency_file_name);
+int MODEL_save_commands(model *m, const char *cmds_file_name);
+int MODEL_save_makefile(model *m, char *sandbox_pwd, const char *mkfile_path);
+FILE *ATOMIC_open(const char *path, char **tmp_path);
+int ATOMIC_commit(FILE *file, char *tmp_path, const char *path);
+void MODEL_free(model *m);
+
+#endif
@@ -0,0 +1,812 @@
+/*
+ * The streaming strace -f parser, see record_parser.h
+ *
+ * A line of output from strace -f is in the format [PID] [syscall]("filepath_to_executable", [arg1, arg2, ... ])
+ * This parser looks for lines in which the following conditions are met:
+    1: the system call performed is "execve"
+    2: the ending of the executable is "gcc", "g++", "ld", or "as"
+ * and collects the files opened after each gcc/g++ command as the dependencies of its target.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "record_core.h"
+#include "record_parser.h"
+#include "record_probed.h"
+#include "record_probes.h"
+#include "record_stats.h"
+
+void PARSER_init(parser *p, const char *pwd, FILE *cmds_file, FILE *sources_file, stats *st,
+                 void (*finish_target)(void *ctx, target *tar), void *ctx) {
+  memset(p, 0, sizeof(parser));
+  p->cmds_file = cmds_file;
+  p->sources_file = sources_file;
+  p->finish_target = finish_target;
+  p->ctx = ctx;
+  p->st = st;
+  p->pwd = strdup(pwd);
+  p->start_pwd = strdup(pwd);
+  p->pid = -1;
+  p->fps_list = calloc(1, sizeof(list));
+  p->follow_pids = true;
+  // the root process of the trace
+  p->processes = 1;
+}
+
+static open_file *PARSER_open_file(parser *p, int pid, int fd) {
+  for ( int i = 0; i < p->open_count; i++ ) {
+    if ( p->open_files[i].pid == pid && p->open_files[i].fd == fd ) {
+      return &p->open_files[i];
+    }
+  }
+  return NULL;
+}
+
+static owned_pid *PARSER_owner(parser *p, int pid) {
+  for ( int i = 0; i < p->owner_count; i++ ) {
+    if ( p->owners[i].pid == pid ) {
+      return &p->owners[i];
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Returns the target the calls of pid go to: the one it belongs to, or the current one
+ */
+static target *PARSER_target(parser *p, int pid) {
+  owned_pid *o = PARSER_owner(p, pid);
+  return o != NULL ? o->tar : p->cur_target;
+}
+
+/*
+ * Stops following an open file; if it was read it is a dependency of the target of the
+ * process that opened it
+ */
+static void PARSER_close_file(parser *p, open_file *f) {
+  target *tar = PARSER_target(p, f->pid);
+  if ( f->read && tar != NULL ) {
+    depnode *old_tail = tar->tail;
+    phase prev = STATS_enter(p->st, PHASE_DEPS);
+    TARGET_add_read(tar, f->path, f->bytes);
+    PROBE_DEPENDENCY_ADDED(f->pid, f->path);
+    STATS_enter(p->st, prev);
+    if ( tar->tail != old_tail ) {
+      p->deps_pending++;
+    }
+  }
+  free(f->path);
+  *f = p->open_files[--p->open_count];
+}
+
+static bool PARSER_is_dep(void *tar, const char *path) {
+  return TARGET_has_dep(tar, (char *) path);
+}
+
+/*
+ * Hands a finished target to the callback; start is the timestamp of its execve
+ */
+static void PARSER_finish_target(parser *p, target *tar, double start) {
+  // a path found by a probe and then read is a dependency already
+  if ( tar->exists.count > 0 ) {
+    PROBED_remove_if(&tar->exists, PARSER_is_dep, tar);
+  }
+  long deps = 0;
+  for ( depnode *dep = tar->head; dep != NULL; dep = dep->next ) {
+    deps++;
+  }
+  STATS_count_target(p->st, deps);
+  if ( p->timed ) {
+    // up to the last line seen while it was the current target, exact for serial builds;
+    //  a held target's runs up to the exit of its last process
+    tar->duration = p->now - start;
+  }
+  PROBE_TARGET_FINALIZED(tar->target_name, deps);
+  p->finish_target(p->ctx, tar);
+}
+
+static held_target *PARSER_held(parser *p, target *tar) {
+  for ( int i = 0; i < p->held_count; i++ ) {
+    if ( p->held[i].tar == tar ) {
+      return &p->held[i];
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Finishes a held target, keeping the others in the order they started
+ */
+static void PARSER_release(parser *p, held_target *h) {
+  target *tar = h->tar;
+  double start = h->start;
+  memmove(h, h + 1, (p->held + --p->held_count - h) * sizeof(held_target));
+  PARSER_finish_target(p, tar, start);
+}
+
+/*
+ * Forgets the process of a held target, which is finished with its last process unless
+ * it is still the current one
+ */
+static void PARSER_disown(parser *p, owned_pid *o) {
+  held_target *h = PARSER_held(p, o->tar);
+  *o = p->owners[--p->owner_count];
+  if ( h != NULL && --h->pids == 0 && h->tar != p->cur_target ) {
+    PARSER_release(p, h);
+  }
+}
+
+/*
+ * Makes pid a process of the held target tar, taking it from the target it belonged to
+ */
+static void PARSER_own(parser *p, int pid, target *tar) {
+  owned_pid *o = PARSER_owner(p, pid);
+  if ( o != NULL && o->tar == tar ) {
+    return;
+  }
+  if ( o != NULL ) {
+    PARSER_disown(p, o);
+  }
+  if ( p->owner_count == p->owner_cap ) {
+    p->owner_cap = p->owner_cap ? p->owner_cap * 2 : 16;
+    p->owners = realloc(p->owners, p->owner_cap * sizeof(owned_pid));
+  }
+  p->owners[p->owner_count].pid = pid;
+  p->owners[p->owner_count++].tar = tar;
+  PARSER_held(p, tar)->pids++;
+}
+
+/*
+ * The current target stops being current, when the next one starts or the parse ends.
+ * It is finished, unless it is held for some of its processes that have not exited.
+ */
+static void PARSER_leave_target(parser *p) {
+  // the files still open by processes of no target were opened for this one, what was
+  //  read of them so far counts; those of a held target's processes stay open
+  for ( int i = p->open_count - 1; i >= 0; i-- ) {
+    if ( PARSER_owner(p, p->open_files[i].pid) == NULL ) {
+      PARSER_close_file(p, &p->open_files[i]);
+    }
+  }
+  target *tar = p->cur_target;
+  p->cur_target = NULL;
+  held_target *h = PARSER_held(p, tar);
+  if ( h == NULL ) {
+    PARSER_finish_target(p, tar, p->target_start);
+  }
+  else if ( h->pids == 0 ) {
+    PARSER_release(p, h);
+  }
+}
+
+/*
+ * Adds a dependency to a target, keeping count of the ones not copied yet
+ */
+static void PARSER_add_dep(parser *p, target *tar, char *dep) {
+  depnode *old_tail = tar->tail;
+  phase prev = STATS_enter(p->st, PHASE_DEPS);
+  TARGET_add_dep(tar, dep);
+  PROBE_DEPENDENCY_ADDED(p->pid, dep);
+  STATS_enter(p->st, prev);
+  if ( tar->tail != old_tail ) {
+    p->deps_pending++;
+  }
+}
+
+/*
+ * Handles a successful execve by pid: a gcc/g++ command starts a new target
+ * args is the rest of the execve line after its opening quote:
+ *    /path/to/executable", ["arg1", "arg2", ... "argn"], ...
+ */
+void PARSER_execve(parser *p, int pid, char *args) {
+  // current line matches the desired format, check whether the command is one of
+  //  the desired commands: gcc, g++, ld, as
+  p->pid = pid;
+
+  int command_end_index = 0; //the index of the " at the end of the filepath to the executed command
+  //TODO: change to strchr
+  for ( int i = 0; i < strlen(args); i++ ) {
+    if ( args[i] == '\"' ) {
+      break;
+    }
+    command_end_index++;
+  }
+  int command_start_index = 0; //the index of the first letter in the name of the command to be run
+  for ( int i = command_end_index - 1; i >= 0; i-- ) {
+    if ( args[i] == '/' ) {
+      command_start_index = i + 1;
+      break;
+    }
+  }
+
+  int cmd_len = command_end_index - command_start_index;
+  //TODO: strndup for next 2 lines
+  char *cmd_name = malloc(cmd_len + 1);
+  strncpy(cmd_name, args + command_start_index, cmd_len);
+  *(cmd_name + cmd_len) = '\0'; //null terminator
+
+  if ( is_desired_cmd(cmd_name) == true) {
+    if ( !strcmp(cmd_name, "gcc") || !strcmp(cmd_name, "g++") ) {
+      LIST_add(p->fps_list, p->pid, cmd_name);
+    }
+    //parse the line and add appropriate entries in list of source files and list of commands
+    char *source = extract_sources(args);
+    if ( source != NULL && p->sources_file != NULL ) {
+      fprintf(p->sources_file, "%s/%s\n", p->pwd, source);
+    }
+    // the arguments passed to the executable run by execve are formated as such:
+    //   ["arg1", "arg2", ..."argn"]
+    int lbracket_index = -1;
+    int rbracket_index = -1;
+    for ( int i = 0; i < strlen(args); i++ ) {
+      if ( args[i] == ']' ) {
+        rbracket_index = i;
+        break;
+      }
+      else if ( lbracket_index == -1 && args[i] == '[' ) {
+        lbracket_index = i;
+      }
+    }
+    char *cmd_buffer = malloc(strlen(args) + 1);
+    if ( !strcmp(cmd_name, "gcc") || !strcmp(cmd_name, "g++") ) {
+      //this is the start of a new target, need to output the old target to dependency file and
+      // copy the dependencies to sandbox dir
+      if ( p->cur_target != NULL ) {
+        PARSER_leave_target(p);
+      }
+      int cmd_index = 0;
+      for ( int i = lbracket_index + 1; i < rbracket_index; i++ ) {
+        if ( args[i] != '\"' && args[i] != ',' ) {
+          if ( args[i] != '\0' ) {
+            cmd_buffer[cmd_index] = args[i];
+            cmd_index++;
+          }
+        }
+      }
+      //TODO: free cur target's members here
+      p->cur_target = calloc(1, sizeof(target));
+      //parse the target file from the command
+      cmd_buffer[cmd_index] = '\0'; //null terminate the command buffer
+      char *target_file = parse_target_from_cmd(cmd_buffer);
+      if ( target_file == NULL ) {
+        // no "-o", gcc writes a.out
+        target_file = "a.out";
+      }
+      p->cur_target->target_name = strndup(target_file, strlen(target_file));
+      p->cur_target->cmd = strndup(cmd_buffer, strlen(cmd_buffer));
+      if ( strcmp(p->pwd, p->start_pwd) ) {
+        p->cur_target->dir = strdup(p->pwd);
+      }
+      p->targets++;
+      p->target_start = p->now;
+      if ( p->follow_pids ) {
+        if ( p->held_count == p->held_cap ) {
+          p->held_cap = p->held_cap ? p->held_cap * 2 : 16;
+          p->held = realloc(p->held, p->held_cap * sizeof(held_target));
+        }
+        p->held[p->held_count].tar = p->cur_target;
+        p->held[p->held_count].start = p->now;
+        p->held[p->held_count++].pids = 0;
+        PARSER_own(p, p->pid, p->cur_target);
+      }
+      PROBE_TARGET_STARTED(p->pid, p->cur_target->target_name);
+
+      // write the command to the commands file
+      if ( p->cmds_file != NULL ) {
+        fprintf(p->cmds_file, "%s\n", cmd_buffer);
+      }
+      if ( source != NULL && LIST_find_pid(p->fps_list, p->pid)  != NULL ) {
+        PARSER_add_dep(p, p->cur_target, source);
+      }
+    } // end if ( gcc/g++ cmd match)
+    else {
+      //TODO: check if the cmd is as or ld
+    }
+    free(cmd_buffer);
+  }
+  free(cmd_name);
+}
+
+/*
+ * Returns the call pid has waiting for its resumed line, or NULL; with create, a new one
+ * is added if it has none
+ */
+static pending_call *PARSER_pending(parser *p, int pid, bool create) {
+  for ( int i = 0; i < p->pending_count; i++ ) {
+    if ( p->pending[i].pid == pid ) {
+      return &p->pending[i];
+    }
+  }
+  if ( !create ) {
+    return NULL;
+  }
+  if ( p->pending_count == p->pending_cap ) {
+    int cap = p->pending_cap ? p->pending_cap * 2 : 16;
+    p->pending = realloc(p->pending, cap * sizeof(pending_call));
+    memset(p->pending + p->pending_cap, 0, (cap - p->pending_cap) * sizeof(pending_call));
+    p->pending_cap = cap;
+  }
+  pending_call *pc = &p->pending[p->pending_count++];
+  pc->pid = pid;
+  pc->len = 0;
+  return pc;
+}
+
+/*
+ * Forgets a pending call, moving the last one into its slot and its buffer to the end
+ */
+static void PARSER_drop_pending(parser *p, pending_call *pc) {
+  pending_call last = p->pending[--p->pending_count];
+  p->pending[p->pending_count] = *pc;
+  *pc = last;
+}
+
+/*
+ * strace -f prints a call that is interrupted by another process's output in two parts:
+ *    PID openat(AT_FDCWD, "a.h", O_RDONLY <unfinished ...>
+ *    ...
+ *    PID <... openat resumed>) = 3
+ * The first part is held per pid until its second part arrives, and the call is then
+ * parsed as the single line strace would have printed without the interruption. A
+ * process that exits while it has a call pending never resumes it, so it is forgotten.
+ * Returns the line to parse, with *len updated, or NULL when it is held back
+ */
+static char *PARSER_stitch(parser *p, char *line, long *len) {
+  static const char unfinished[] = " <unfinished ...>";
+  const long unfinished_len = sizeof(unfinished) - 1;
+  long body_len = *len;
+  if ( body_len > 0 && line[body_len - 1] == '\n' ) {
+    body_len--;
+  }
+  int pid = atoi(line);
+  if ( body_len >= unfinished_len &&
+       !memcmp(line + body_len - unfinished_len, unfinished, unfinished_len) ) {
+    pending_call *pc = PARSER_pending(p, pid, true);
+    pc->len = body_len - unfinished_len;
+    if ( pc->len + 1 > pc->cap ) {
+      pc->cap = pc->len + 1;
+      pc->head = realloc(pc->head, pc->cap);
+    }
+    memcpy(pc->head, line, pc->len);
+    pc->head[pc->len] = '\0';
+    return NULL;
+  }
+
+  char *call = line;
+  while ( *call >= '0' && *call <= '9' ) {
+    call++;
+  }
+  while ( *call == ' ' ) {
+    call++;
+  }
+  if ( !strncmp(call, "<... ", 5) ) {
+    char *rest = strstr(call, " resumed>");
+    pending_call *pc = rest != NULL ? PARSER_pending(p, pid, false) : NULL;
+    if ( pc == NULL ) {
+      // its first part was before the start of the trace
+      return line;
+    }
+    rest += 9;
+    long rest_len = *len - (rest - line);
+    if ( pc->len + rest_len + 1 > p->stitched_cap ) {
+      p->stitched_cap = (pc->len + rest_len + 1) * 2;
+      p->stitched = realloc(p->stitched, p->stitched_cap);
+    }
+    memcpy(p->stitched, pc->head, pc->len);
+    memcpy(p->stitched + pc->len, rest, rest_len + 1);
+    *len = pc->len + rest_len;
+    PARSER_drop_pending(p, pc);
+    return p->stitched;
+  }
+  if ( !strncmp(call, "+++ ", 4) ) {
+    pending_call *pc = PARSER_pending(p, pid, false);
+    if ( pc != NULL ) {
+      PARSER_drop_pending(p, pc);
+    }
+  }
+  return line;
+}
+
+/*
+ * Returns the last ") = " on a line, before the value its call returned, or NULL
+ */
+static char *PARSER_return(char *line) {
+  char *ret = NULL;
+  for ( char *found = strstr(line, ") = "); found != NULL; found = strstr(found + 1, ") = ") ) {
+    ret = found;
+  }
+  return ret;
+}
+
+/*
+ * Returns the value a call returned, or -1 if it has none
+ */
+static long PARSER_result(char *line) {
+  char *ret = PARSER_return(line);
+  return ret != NULL ? strtol(ret + 4, NULL, 0) : -1;
+}
+
+/*
+ * Classifies a call looking for the path that is its first string argument, named by
+ * call_name on the line; a path relative to a directory fd other than AT_FDCWD is only
+ * taken when it is absolute. A probe failing with ENOENT or ENOTDIR did not find its
+ * path, one that succeeded found it; any other failure says nothing about the path.
+ */
+static call_kind PARSER_classify_probe(char *call_name, trace_call *call) {
+  char *args = strchr(call_name, '(') + 1;
+  char *path = strchr(args, '\"');
+  if ( path == NULL || path[1] == '\"' ) {
+    return call->kind = CALL_NONE;
+  }
+  path++;
+  if ( path - 1 != args && strncmp(args, "AT_FDCWD, ", 10) && path[0] != '/' ) {
+    return call->kind = CALL_NONE;
+  }
+  char *ret = PARSER_return(path);
+  if ( ret == NULL ) {
+    return call->kind = CALL_NONE;
+  }
+  if ( ret[4] != '-' ) {
+    call->value = 1;
+  }
+  else if ( strstr(ret, " ENOENT ") != NULL || strstr(ret, " ENOTDIR ") != NULL ) {
+    call->value = 0;
+  }
+  else {
+    return call->kind = CALL_NONE;
+  }
+  char *quote = strchr(path, '\"');
+  if ( quote != NULL ) {
+    *quote = '\0';
+  }
+  call->arg = path;
+  return call->kind = CALL_PROBE;
+}
+
+/*
+ * Classifies the system call on one whole line of trace, with or without the pid in
+ * front of it, into one of the calls the parser acts on. call->arg is set to the
+ * arguments of an execve, or the path of a chdir, openat or probe, which is cut off in
+ * the line itself.
+ */
+call_kind PARSER_classify(char *line, trace_call *call) {
+  char *name = line + strspn(line, " ");
+  name += strspn(name, "0123456789");
+  name += strspn(name, " ");
+  call->arg = NULL;
+  call->fd = -1;
+  call->value = 0;
+  // the calls on an open file, which never changed directory or created a process
+  //  whatever data strace printed for them
+  if ( !strncmp(name, "read(", 5) || !strncmp(name, "pread64(", 8) ||
+       !strncmp(name, "readv(", 6) || !strncmp(name, "preadv(", 7) ) {
+    call->fd = atoi(strchr(name, '(') + 1);
+    call->value = PARSER_result(name);
+    return call->kind = CALL_READ;
+  }
+  if ( !strncmp(name, "mmap(", 5) ) {
+    // mmap(addr, length, prot, flags, fd, offset): a mapped file counts as read in full
+    char *field = name + 5;
+    for ( int i = 0; i < 4 && field != NULL; i++ ) {
+      field = strchr(field, ',');
+      if ( field != NULL ) {
+        field++;
+        if ( i == 0 ) {
+          call->value = strtol(field, NULL, 0);
+        }
+      }
+    }
+    call->fd = field != NULL ? atoi(field) : -1;
+    if ( call->fd < 0 || PARSER_result(name) == -1 ) {
+      return call->kind = CALL_NONE;
+    }
+    return call->kind = CALL_READ;
+  }
+  if ( !strncmp(name, "close(", 6) ) {
+    call->fd = atoi(name + 6);
+    return call->kind = CALL_CLOSE;
+  }
+  if ( !strncmp(name, "+++ ", 4) ) {
+    return call->kind = CALL_EXIT;
+  }
+  // the calls looking for a file without opening it
+  static const char *const probes[] = { "stat(", "lstat(", "newfstatat(", "statx(", "access(",
+                                        "faccessat(", "faccessat2(", "readlink(", "readlinkat(" };
+  for ( int i = 0; i < (int) (sizeof(probes) / sizeof(probes[0])); i++ ) {
+    if ( !strncmp(name, probes[i], strlen(probes[i])) ) {
+      return PARSER_classify_probe(name, call);
+    }
+  }
+  // discard any lines that return -1 ENOENT, as these are commands that failed
+  if ( !strncmp(name, "execve(\"", 8) && name[8] != '\n' && name[8] != '\0' &&
+       strstr(name, "ENOENT") == NULL ) {
+    call->arg = name + 8;
+    char *newline = strchr(call->arg, '\n');
+    if ( newline != NULL ) {
+      *newline = '\0';
+    }
+    return call->kind = CALL_EXECVE;
+  }
+  // check for chdir calls, to change the current working directory appended to c/c++ file names
+  char *new_cwd = strstr(line, "chdir(");
+  if ( new_cwd != NULL ) { // syscall executed on this line was chdir, need to change cwd
+    new_cwd += 7; // cut off \"chdir("\" from the beginning of new_cwd
+    char *quote = strchr(new_cwd, '\"');
+    if ( quote != NULL ) {
+      *quote = '\0'; // null terminate the pathfile for the new working directory to cut off any further characters
+    }
+    call->arg = new_cwd;
+    return call->kind = CALL_CHDIR;
+  }
+  // check for openat
+  char *openat = strstr(line, "openat(");
+  //discard openat calls that return ENOENT, open failed
+  if ( openat != NULL && strstr(openat, "ENOENT") == NULL ) {
+    call->fd = PARSER_result(openat);
+    openat += 18; // cut off "openat(AT_FDCWD, \""
+    char *quote = strchr(openat, '\"');
+    if ( quote != NULL ) {
+      *quote = '\0';
+    }
+    call->arg = openat;
+    return call->kind = CALL_OPENAT;
+  }
+  if ( openat != NULL ) {
+    return PARSER_classify_probe(openat, call);
+  }
+  // the processes created, from the child pid returned by fork, vfork and clone
+  char *ret = strstr(line, ") = ");
+  if ( ret != NULL && atoi(ret + 4) > 0 && ( strstr(line, "fork") != NULL ||
+                                             strstr(line, "clone") != NULL ) ) {
+    call->value = atoi(ret + 4);
+    return call->kind = CALL_SPAWN;
+  }
+  return call->kind = CALL_NONE;
+}
+
+/*
+ * Parses one line of strace -f output. The line may be modified.
+ */
+void PARSER_feed_line(parser *p, char *buffer, long len) {
+  // with strace -ttt the time follows the pid: [PID] [seconds.microseconds] [syscall]...
+  //  it is cut out so the rest of the line parses as usual; strace pads the pid with
+  //  spaces to a width of five, so there may be several before the time
+  char *time_start = strchr(buffer, ' ');
+  char *digits = time_start != NULL ? time_start + strspn(time_start, " ") : NULL;
+  if ( digits != NULL && *digits >= '0' && *digits <= '9' ) {
+    char *time_end;
+    double now = strtod(digits, &time_end);
+    if ( *time_end == ' ' ) {
+      p->timed = true;
+      p->now = now;
+      memmove(time_start, time_end, buffer + len - time_end + 1);
+      len -= time_end - time_start;
+    }
+  }
+  STATS_count_line(p->st, buffer, len);
+  PROBE_LINE_PARSED(buffer, len);
+  p->lines++;
+  p->bytes += len;
+  buffer = PARSER_stitch(p, buffer, &len);
+  if ( buffer == NULL ) {
+    return;
+  }
+  // the pid a line starts with is the pid of its call
+  char *pid_end;
+  long pid = strtol(buffer, &pid_end, 10);
+  if ( pid_end != buffer ) {
+    p->pid = pid;
+  }
+  trace_call call;
+  switch ( PARSER_classify(buffer, &call) ) {
+    case CALL_EXECVE:
+      PARSER_execve(p, p->pid, call.arg);
+      break;
+    case CALL_CHDIR:
+      PARSER_chdir(p, call.arg);
+      break;
+    case CALL_OPENAT:
+      PARSER_open_fd(p, p->pid, call.fd, call.arg);
+      break;
+    case CALL_SPAWN:
+      PARSER_spawn(p, p->pid, call.value);
+      break;
+    case CALL_READ:
+      PARSER_read(p, p->pid, call.fd, call.value);
+      break;
+    case CALL_CLOSE:
+      PARSER_close(p, p->pid, call.fd);
+      break;
+    case CALL_EXIT:
+      PARSER_exit(p, p->pid);
+      break;
+    case CALL_PROBE:
+      PARSER_probe(p, p->pid, call.arg, call.value);
+      break;
+    case CALL_NONE:
+      break;
+  }
+}
+
+/*
+ * Is path, opened by pid, a dependency of tar, the target of pid? A file opened by a
+ * gcc/g++ process, or any header, is
+ */
+static bool PARSER_wanted(parser *p, target *tar, int pid, char *path) {
+  if ( tar == NULL ) {
+    return false;
+  }
+  if ( LIST_find_pid(p->fps_list, pid) == NULL && strstr(path, ".h") == NULL ) {
+    return false;
+  }
+  //ignore locale files being opened
+  return strstr(path, "locale") == NULL && strstr(path, "/etc/") == NULL &&
+         strstr(path, "/types/") == NULL && strstr(path, ".cache") == NULL &&
+         strstr(path, "/bits/") == NULL  && strstr(path, "/tmp/") == NULL;
+}
+
+/*
+ * Handles a successful open of path by pid, adding it to the target of pid if wanted
+ */
+void PARSER_openat(parser *p, int pid, char *path) {
+  p->pid = pid;
+  target *tar = PARSER_target(p, pid);
+  if ( PARSER_wanted(p, tar, pid, path) ) {
+    PARSER_add_dep(p, tar, path);
+  }
+}
+
+/*
+ * Handles a successful open of path by pid that returned fd. With track_reads the file
+ * only becomes a dependency once it is read; one the target already has, such as its
+ * source, is followed too, to count the bytes read from it.
+ */
+void PARSER_open_fd(parser *p, int pid, int fd, char *path) {
+  if ( !p->track_reads ) {
+    PARSER_openat(p, pid, path);
+    return;
+  }
+  p->pid = pid;
+  target *tar = PARSER_target(p, pid);
+  if ( !PARSER_wanted(p, tar, pid, path) && ( tar == NULL || !TARGET_has_dep(tar, path) ) ) {
+    return;
+  }
+  // the fd was closed in a way the trace does not show, by dup2 or close_range
+  PARSER_close(p, pid, fd);
+  if ( p->open_count == p->open_cap ) {
+    p->open_cap = p->open_cap ? p->open_cap * 2 : 16;
+    p->open_files = realloc(p->open_files, p->open_cap * sizeof(open_file));
+  }
+  open_file *f = &p->open_files[p->open_count++];
+  f->pid = pid;
+  f->fd = fd;
+  f->path = strdup(path);
+  f->bytes = 0;
+  f->read = false;
+}
+
+/*
+ * Handles a read of bytes from fd by pid, or a mapping of them
+ */
+void PARSER_read(parser *p, int pid, int fd, long bytes) {
+  open_file *f = p->track_reads ? PARSER_open_file(p, pid, fd) : NULL;
+  if ( f != NULL && bytes > 0 ) {
+    f->bytes += bytes;
+    f->read = true;
+  }
+}
+
+/*
+ * Handles a close of fd by pid
+ */
+void PARSER_close(parser *p, int pid, int fd) {
+  open_file *f = p->track_reads ? PARSER_open_file(p, pid, fd) : NULL;
+  if ( f != NULL ) {
+    PARSER_close_file(p, f);
+  }
+}
+
+/*
+ * Handles the exit of pid, which closes the files it still has open; a held target is
+ * finished with the exit of its last process, and with a usage sampler, what was
+ * sampled of a process of a target is added to it
+ */
+void PARSER_exit(parser *p, int pid) {
+  for ( int i = p->open_count - 1; i >= 0; i-- ) {
+    if ( p->open_files[i].pid == pid ) {
+      PARSER_close_file(p, &p->open_files[i]);
+    }
+  }
+  long peak_rss;
+  double cpu_time;
+  // taken out of the table whoever it belonged to, make and the shells included
+  bool sampled = p->usage != NULL && USAGE_take(p->usage, pid, &peak_rss, &cpu_time);
+  owned_pid *o = PARSER_owner(p, pid);
+  if ( o != NULL ) {
+    if ( sampled ) {
+      if ( peak_rss > o->tar->peak_rss ) {
+        o->tar->peak_rss = peak_rss;
+      }
+      o->tar->cpu_time += cpu_time;
+    }
+    PARSER_disown(p, o);
+  }
+}
+
+/*
+ * Handles a probe of path by pid, which found it or not
+ */
+void PARSER_probe(parser *p, int pid, char *path, bool found) {
+  p->pid = pid;
+  target *tar = p->track_probes ? PARSER_target(p, pid) : NULL;
+  if ( tar != NULL && PARSER_wanted(p, tar, pid, path) ) {
+    PROBED_add(found ? &tar->exists : &tar->absent, path);
+  }
+}
+
+/*
+ * Handles a chdir by the traced build, changing the directory sources are found in
+ */
+void PARSER_chdir(parser *p, char *path) {
+  // copy out of the line buffer, which is reused for the next line
+  free(p->pwd);
+  p->pwd = strdup(path);
+}
+
+/*
+ * Handles a fork, vfork or clone by pid that created the process child, which belongs
+ * to the target of pid if that has one
+ */
+void PARSER_spawn(parser *p, int pid, int child) {
+  p->processes++;
+  owned_pid *o = PARSER_owner(p, pid);
+  if ( o != NULL ) {
+    PARSER_own(p, child, o->tar);
+  }
+}
+
+/*
+ * Ends the current target now, rather than when the next one starts: for a tracer that
+ * knows the command which started it has exited
+ */
+void PARSER_end_target(parser *p) {
+  if ( p->cur_target != NULL ) {
+    PARSER_leave_target(p);
+  }
+}
+
+/*
+ * Finishes the last target, and the held ones whose processes the trace never saw exit
+ */
+void PARSER_finish(parser *p) {
+  PARSER_end_target(p);
+  // the files of held targets' processes never seen closed, with what was read of them
+  while ( p->open_count > 0 ) {
+    PARSER_close_file(p, &p->open_files[p->open_count - 1]);
+  }
+  while ( p->held_count > 0 ) {
+    PARSER_release(p, &p->held[0]);
+  }
+  for ( int i = 0; i < p->pending_cap; i++ ) {
+    free(p->pending[i].head);
+  }
+  free(p->pending);
+  p->pending = NULL;
+  p->pending_count = p->pending_cap = 0;
+  free(p->stitched);
+  p->stitched = NULL;
+  free(p->open_files);
+  p->open_files = NULL;
+  p->open_count = p->open_cap = 0;
+  free(p->held);
+  p->held = NULL;
+  p->held_cap = 0;
+  free(p->owners);
+  p->owners = NULL;
+  p->owner_count = p->owner_cap = 0;
+  LIST_free(p->fps_list);
+  p->fps_list = NULL;
+}
@@ -0,0 +1,168 @@
+/*
+ * The streaming strace -f parser of record_build
+ *
+ * The parser is fed one trace line at a time, so it can run on a trace that is still
+ * being written by a running build, or one system call at a time by a tracer that has
+ * already decoded them (PARSER_execve(), PARSER_openat(), ...). A call strace split into
+ * "<unfinished ...>" and "<... resumed>" lines is put back together, so it is handled
+ * once, with its result, by the pid that made it. With track_reads, the files opened are
+ * followed until they are closed, and only the ones read from become dependencies, each
+ * with the number of bytes read (or mapped) from it. With track_probes, the paths looked
+ * for without being read are kept with the target too (see record_probed.h): the ones
+ * not found, by an openat, stat, access or readlink that failed with ENOENT, and the
+ * ones found by a stat, access or readlink and never opened. Each gcc/g++ execve starts
+ * a new target; when the next one starts (or PARSER_finish() is called) the previous
+ * target is handed to the finish_target callback, which takes ownership of it.
+ *
+ * The processes the gcc/g++ of a target spawns belong to that target, and the files
+ * they open, read or probe are its dependencies; the calls of processes of no target
+ * go to the last target started. Under make -j a compiler may still be running when the
+ * next gcc/g++ starts, so the previous target is then held, and only handed to the
+ * callback once its last process exits. With a usage sampler, the peak memory and cpu
+ * time sampled of each of its processes is added to the target when the process exits.
+ * A tracer whose calls do not include the exits clears follow_pids, and each target is
+ * then finished when the next one starts, with the calls of every process until then.
+ */
+
+#ifndef RECORD_PARSER_H
+#define RECORD_PARSER_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "record_core.h"
+#include "record_stats.h"
+#include "record_usage.h"
+
+/*
+ * A system call strace -f printed the first half of, " <unfinished ...>", because another
+ * process's output came before it returned; held until its "<... resumed>" line
+ */
+typedef struct pending_call_struct {
+  int pid;
+  char *head;             // the first line, without " <unfinished ...>" and its newline
+  size_t len;
+  size_t cap;
+} pending_call;
+
+/*
+ * The system calls the parser acts on, see PARSER_classify()
+ */
+typedef enum {
+  CALL_NONE,
+  CALL_EXECVE,
+  CALL_CHDIR,
+  CALL_OPENAT,
+  CALL_SPAWN,
+  CALL_READ,              // read, pread64, readv, preadv, or mmap of a file
+  CALL_CLOSE,
+  CALL_EXIT,              // +++ exited/killed +++
+  CALL_PROBE              // stat, access, readlink and the like, or an openat of a missing file
+} call_kind;
+
+/*
+ * One system call on a line of trace, as PARSER_classify() found it
+ */
+typedef struct trace_call_struct {
+  call_kind kind;
+  char *arg;              // the arguments of an execve, or the path of a chdir, openat or probe
+  int fd;                 // the fd an openat returned, or the one a read or close was given
+  long value;             // the child pid of a spawn, the bytes a read returned or mmap mapped,
+                          //  1 if a probe found its path and 0 if it did not
+} trace_call;
+
+/*
+ * A file a process has open while track_reads follows it, see PARSER_open_fd()
+ */
+typedef struct open_file_struct {
+  int pid;
+  int fd;
+  char *path;
+  long bytes;             // read from it so far
+  bool read;              // read or mapped at least once
+} open_file;
+
+/*
+ * A target that is not finished yet because some of its processes have not exited, see
+ * PARSER_exit()
+ */
+typedef struct held_target_struct {
+  target *tar;
+  double start;           // the timestamp of its execve
+  int pids;               // its processes still running
+} held_target;
+
+/*
+ * A live process of a held target: its gcc/g++, or one of the processes those spawned
+ */
+typedef struct owned_pid_struct {
+  int pid;
+  target *tar;
+} owned_pid;
+
+/*
+ * The state of one parse, and counters describing its progress
+ */
+typedef struct parser_struct {
+  // where the results go
+  FILE *cmds_file;        // commands of the targets, one per line, or NULL
+  FILE *sources_file;     // absolute paths of the sources compiled, or NULL
+  void (*finish_target)(void *ctx, target *tar);
+  void *ctx;
+  stats *st;
+
+  // state carried from line to line
+  char *pwd;              // working directory of the traced build, changed by chdir
+  char *start_pwd;        // the directory the build started in
+  int pid;                // the pid of the system call on the current line
+  pending_call *pending;  // at most one call per live pid; the slots past pending_count
+  int pending_count;      //  keep their buffers for the next calls to be split
+  int pending_cap;
+  char *stitched;         // a split call put back together into one line
+  size_t stitched_cap;
+  list *fps_list;         // linked list to hold the filepaths of desired commands
+  target *cur_target;     // the target whose dependencies are being collected
+  bool track_reads;       // only files read after they were opened are dependencies
+  open_file *open_files;  // with track_reads, the wanted files open in any process
+  int open_count;
+  int open_cap;
+  bool track_probes;      // keep the paths probed by the target's command
+  bool timed;             // does the trace have strace -ttt timestamps?
+  double now;             // the timestamp of the current line
+  double target_start;    // the timestamp of cur_target's execve
+  usage_sampler *usage;   // what was sampled of each process, or NULL, see record_usage.h
+  bool follow_pids;       // hold each target until its processes exit, see PARSER_exit()
+  held_target *held;      // with follow_pids, cur_target and the targets before it whose
+  int held_count;         //  processes have not all exited yet, in the order they started
+  int held_cap;
+  owned_pid *owners;      // the target each live process of theirs belongs to
+  int owner_count;
+  int owner_cap;
+
+  // progress counters
+  long lines;
+  long bytes;
+  long processes;         // processes seen being created, plus the root process
+  long targets;
+  long deps_pending;      // dependencies recorded but not copied into the sandbox yet
+  long files_copied;      // the copy counters are kept by the finish_target callback
+  long bytes_copied;
+} parser;
+
+void PARSER_init(parser *p, const char *pwd, FILE *cmds_file, FILE *sources_file, stats *st,
+                 void (*finish_target)(void *ctx, target *tar), void *ctx);
+void PARSER_feed_line(parser *p, char *line, long len);
+call_kind PARSER_classify(char *line, trace_call *call);
+void PARSER_execve(parser *p, int pid, char *args);
+void PARSER_openat(parser *p, int pid, char *path);
+void PARSER_open_fd(parser *p, int pid, int fd, char *path);
+void PARSER_read(parser *p, int pid, int fd, long bytes);
+void PARSER_close(parser *p, int pid, int fd);
+void PARSER_exit(parser *p, int pid);
+void PARSER_probe(parser *p, int pid, char *path, bool found);
+void PARSER_chdir(parser *p, char *path);
+void PARSER_spawn(parser *p, int pid, int child);
+void PARSER_end_target(parser *p);
+void PARSER_finish(parser *p);
+
+#endif
@@ -0,0 +1,367 @@
+/*
+ * Per-process trace files, see record_perpid.h
+ */
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "record_parser.h"
+#include "record_perpid.h"
+#include "record_stats.h"
+
+/*
+ * One call of a process that the parser acts on
+ */
+typedef struct pid_call_struct {
+  call_kind kind;
+  int fd;
+  long value;             // see trace_call
+  size_t arg;             // offset of the call's argument in its process's strings
+  double time;            // with strace -ttt, 0 otherwise
+} pid_call;
+
+/*
+ * The calls of one process, read from its own trace file
+ */
+typedef struct pid_trace_struct {
+  int pid;
+  char *file_name;
+  pid_call *calls;
+  int count;
+  int cap;
+  char *strings;          // the arguments of the calls, one after the other
+  size_t strings_len;
+  size_t strings_cap;
+  long lines;
+  long bytes;
+  bool timed;
+  double end;             // the last timestamp in the file, normally the exit's
+  bool spawned;           // created by another traced process, so not a root of the tree
+  bool replayed;
+} pid_trace;
+
+/*
+ * The files of one trace and the threads reading them
+ */
+typedef struct perpid_pool_struct {
+  pid_trace *traces;      // sorted by pid
+  int count;
+  atomic_int next;        // the next file for a thread to take
+  bool track_reads;       // keep the reads and closes, see PARSER_open_fd()
+  bool track_probes;      // keep the probes, see PARSER_probe()
+  bool usage;             // keep the exits, for the parser's usage sampler
+} perpid_pool;
+
+typedef struct perpid_worker_struct {
+  perpid_pool *pool;
+  stats st;
+} perpid_worker;
+
+static int PERPID_compare(const void *a, const void *b) {
+  return ((const pid_trace *) a)->pid - ((const pid_trace *) b)->pid;
+}
+
+/*
+ * Lists the files trace_file_name.PID, sorted by pid
+ * Returns how many there are, or -1 if their directory could not be read
+ */
+static int PERPID_list(const char *trace_file_name, pid_trace **traces) {
+  const char *slash = strrchr(trace_file_name, '/');
+  const char *base = slash != NULL ? slash + 1 : trace_file_name;
+  char *dir = slash == NULL ? strdup(".") :
+              slash == trace_file_name ? strdup("/") : strndup(trace_file_name, slash - trace_file_name);
+  size_t base_len = strlen(base);
+  *traces = NULL;
+  DIR *d = opendir(dir);
+  if ( d == NULL ) {
+    fprintf(stderr, "ERROR: directory of the trace files, %s, could not be opened!\n", dir);
+    free(dir);
+    return -1;
+  }
+  int count = 0;
+  int cap = 0;
+  struct dirent *entry;
+  while ( (entry = readdir(d)) != NULL ) {
+    const char *name = entry->d_name;
+    if ( strncmp(name, base, base_len) || name[base_len] != '.' ) {
+      continue;
+    }
+    const char *pid = name + base_len + 1;
+    if ( *pid == '\0' || pid[strspn(pid, "0123456789")] != '\0' ) {
+      continue;
+    }
+    if ( count == cap ) {
+      cap = cap ? cap * 2 : 256;
+      *traces = realloc(*traces, cap * sizeof(pid_trace));
+    }
+    pid_trace *t = &(*traces)[count++];
+    memset(t, 0, sizeof(pid_trace));
+    t->pid = atoi(pid);
+    t->file_name = malloc(strlen(dir) + strlen(name) + 2);
+    sprintf(t->file_name, "%s/%s", dir, name);
+  }
+  closedir(d);
+  free(dir);
+  qsort(*traces, count, sizeof(pid_trace), PERPID_compare);
+  return count;
+}
+
+static void PERPID_free(pid_trace *traces, int count) {
+  for ( int i = 0; i < count; i++ ) {
+    free(traces[i].file_name);
+    free(traces[i].calls);
+    free(traces[i].strings);
+  }
+  free(traces);
+}
+
+/*
+ * Removes the files of an earlier trace, which must not be read as part of the next one
+ */
+void PERPID_remove(const char *trace_file_name) {
+  pid_trace *traces;
+  int count = PERPID_list(trace_file_name, &traces);
+  for ( int i = 0; i < count; i++ ) {
+    unlink(traces[i].file_name);
+  }
+  PERPID_free(traces, count);
+}
+
+static pid_trace *PERPID_find(perpid_pool *pool, int pid) {
+  pid_trace key = { .pid = pid };
+  return bsearch(&key, pool->traces, pool->count, sizeof(pid_trace), PERPID_compare);
+}
+
+static void PERPID_add_call(pid_trace *t, trace_call *call, double time) {
+  if ( t->count == t->cap ) {
+    t->cap = t->cap ? t->cap * 2 : 64;
+    t->calls = realloc(t->calls, t->cap * sizeof(pid_call));
+  }
+  pid_call *c = &t->calls[t->count++];
+  c->kind = call->kind;
+  c->fd = call->fd;
+  c->value = call->value;
+  c->time = time;
+  c->arg = t->strings_len;
+  const char *arg = call->arg != NULL ? call->arg : "";
+  size_t len = strlen(arg);
+  if ( t->strings_len + len + 1 > t->strings_cap ) {
+    t->strings_cap = (t->strings_len + len + 1) * 2;
+    t->strings = realloc(t->strings, t->strings_cap);
+  }
+  memcpy(t->strings + t->strings_len, arg, len + 1);
+  t->strings_len += len + 1;
+}
+
+/*
+ * Reads the trace file of one process into its list of calls
+ */
+static void PERPID_read(pid_trace *t, perpid_pool *pool, stats *st) {
+  FILE *in_file = fopen(t->file_name, "r");
+  if ( in_file == NULL ) {
+    fprintf(stderr, "ERROR: input file to be parsed,  %s, could not be opened!\n", t->file_name);
+    return;
+  }
+  static const char unfinished[] = "<unfinished ...>\n";
+  char *line = NULL;
+  size_t cap = 0;
+  ssize_t len;
+  double now = 0;
+  while ( (len = getline(&line, &cap, in_file)) != -1 ) {
+    t->lines++;
+    t->bytes += len;
+    // with strace -ttt every line starts with its time: [seconds.microseconds] [syscall]...
+    if ( line[0] >= '0' && line[0] <= '9' ) {
+      char *time_end;
+      double time = strtod(line, &time_end);
+      if ( *time_end == ' ' ) {
+        now = time;
+        t->timed = true;
+        t->end = now;
+        len -= time_end + 1 - line;
+        memmove(line, time_end + 1, len + 1);
+      }
+    }
+    STATS_count_line(st, line, len);
+    // a call is only left unfinished in a file of its own when the process is killed
+    //  during it, so it never returns
+    ssize_t unfinished_len = sizeof(unfinished) - 1;
+    if ( len >= unfinished_len && !strcmp(line + len - unfinished_len, unfinished) ) {
+      continue;
+    }
+    trace_call call;
+    call_kind kind = PARSER_classify(line, &call);
+    if ( kind == CALL_READ || kind == CALL_CLOSE || kind == CALL_EXIT ) {
+      // an exit also hands what was sampled of the process to its target
+      if ( pool->track_reads || ( kind == CALL_EXIT && pool->usage ) ) {
+        PERPID_add_call(t, &call, now);
+      }
+    }
+    else if ( kind == CALL_PROBE ) {
+      if ( pool->track_probes ) {
+        PERPID_add_call(t, &call, now);
+      }
+    }
+    else if ( kind != CALL_NONE ) {
+      PERPID_add_call(t, &call, now);
+    }
+  }
+  free(line);
+  fclose(in_file);
+}
+
+/*
+ * A thread of the pool: reads files until there are none left
+ */
+static void *PERPID_work(void *arg) {
+  perpid_worker *w = arg;
+  perpid_pool *pool = w->pool;
+  STATS_enter(&w->st, PHASE_PARSE);
+  int i;
+  while ( (i = atomic_fetch_add(&pool->next, 1)) < pool->count ) {
+    PERPID_read(&pool->traces[i], pool, &w->st);
+  }
+  STATS_enter(&w->st, PHASE_NONE);
+  return NULL;
+}
+
+/*
+ * Replays the calls of process t, and in place of each process it created, that
+ * process's calls. A target t started is finished when t exits.
+ */
+static void PERPID_replay(parser *p, perpid_pool *pool, pid_trace *t) {
+  t->replayed = true;
+  // the directory t inherited, restored after a child has changed it
+  char *cwd = strdup(p->pwd);
+  target *started = NULL;
+  for ( int i = 0; i < t->count; i++ ) {
+    pid_call *c = &t->calls[i];
+    char *arg = t->strings + c->arg;
+    if ( t->timed ) {
+      p->timed = true;
+      p->now = c->time;
+    }
+    switch ( c->kind ) {
+      case CALL_EXECVE: {
+        long targets = p->targets;
+        PARSER_execve(p, t->pid, arg);
+        if ( p->targets != targets ) {
+          started = p->cur_target;
+        }
+        break;
+      }
+      case CALL_CHDIR:
+        PARSER_chdir(p, arg);
+        free(cwd);
+        cwd = strdup(arg);
+        break;
+      case CALL_OPENAT:
+        PARSER_open_fd(p, t->pid, c->fd, arg);
+        break;
+      case CALL_READ:
+        PARSER_read(p, t->pid, c->fd, c->value);
+        break;
+      case CALL_CLOSE:
+        PARSER_close(p, t->pid, c->fd);
+        break;
+      case CALL_EXIT:
+        PARSER_exit(p, t->pid);
+        break;
+      case CALL_PROBE:
+        PARSER_probe(p, t->pid, arg, c->value);
+        break;
+      case CALL_SPAWN: {
+        PARSER_spawn(p, t->pid, c->value);
+        pid_trace *child = PERPID_find(pool, c->value);
+        if ( child != NULL && !child->replayed ) {
+          PERPID_replay(p, pool, child);
+          if ( strcmp(p->pwd, cwd) ) {
+            PARSER_chdir(p, cwd);
+          }
+        }
+        break;
+      }
+      case CALL_NONE:
+        break;
+    }
+  }
+  if ( started != NULL && p->cur_target == started ) {
+    if ( t->timed ) {
+      p->now = t->end;
+    }
+    PARSER_end_target(p);
+  }
+  free(cwd);
+}
+
+/*
+ * Parses the files trace_file_name.PID written by strace -ff, reading them on jobs threads
+ * Returns 0, or 1 if there are none
+ */
+int PERPID_parse(parser *p, const char *trace_file_name, int jobs) {
+  perpid_pool pool;
+  pool.count = PERPID_list(trace_file_name, &pool.traces);
+  if ( pool.count <= 0 ) {
+    if ( pool.count == 0 ) {
+      fprintf(stderr, "ERROR: no per-process trace files %s.PID could be found!\n", trace_file_name);
+    }
+    PERPID_free(pool.traces, 0);
+    return 1;
+  }
+  atomic_init(&pool.next, 0);
+  pool.track_reads = p->track_reads;
+  pool.track_probes = p->track_probes;
+  pool.usage = p->usage != NULL;
+  if ( jobs > pool.count ) {
+    jobs = pool.count;
+  }
+
+  // the calling thread reads files too, every thread keeps its own statistics
+  phase prev = STATS_enter(p->st, PHASE_NONE);
+  perpid_worker *workers = calloc(jobs, sizeof(perpid_worker));
+  pthread_t *threads = calloc(jobs, sizeof(pthread_t));
+  for ( int i = 0; i < jobs; i++ ) {
+    workers[i].pool = &pool;
+    STATS_init(&workers[i].st, p->st->enabled);
+  }
+  for ( int i = 1; i < jobs; i++ ) {
+    pthread_create(&threads[i], NULL, PERPID_work, &workers[i]);
+  }
+  PERPID_work(&workers[0]);
+  for ( int i = 1; i < jobs; i++ ) {
+    pthread_join(threads[i], NULL);
+  }
+  STATS_enter(p->st, prev);
+  for ( int i = 0; i < jobs; i++ ) {
+    STATS_add(p->st, &workers[i].st);
+    STATS_free(&workers[i].st);
+  }
+  free(workers);
+  free(threads);
+
+  // the processes not created by another one in the trace are the roots of the tree
+  for ( int i = 0; i < pool.count; i++ ) {
+    pid_trace *t = &pool.traces[i];
+    p->lines += t->lines;
+    p->bytes += t->bytes;
+    for ( int c = 0; c < t->count; c++ ) {
+      pid_trace *child = t->calls[c].kind == CALL_SPAWN ? PERPID_find(&pool, t->calls[c].value) : NULL;
+      if ( child != NULL && child != t ) {
+        child->spawned = true;
+      }
+    }
+  }
+  for ( int i = 0; i < pool.count; i++ ) {
+    if ( !pool.traces[i].spawned && !pool.traces[i].replayed ) {
+      PERPID_replay(p, &pool, &pool.traces[i]);
+    }
+  }
+  PERPID_free(pool.traces, pool.count);
+  return 0;
+}
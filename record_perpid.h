@@ -0,0 +1,26 @@
+/*
+ * Parsing a trace written one file per process, by strace -ff -o FILE
+ *
+ * strace -ff writes the calls of each process to its own FILE.PID, without the pid in
+ * front of them, so the calls of one process are never interleaved with another's or
+ * split into "<unfinished ...>" and "<... resumed>" parts. The files are independent, and
+ * PERPID_parse() reads them on a pool of threads, each turning whole files into the lists
+ * of calls the parser acts on (see PARSER_classify()).
+ *
+ * The lists are then joined along the process tree, from the child pids returned by fork,
+ * vfork and clone: the calls of each process are replayed into the parser in order, with
+ * all the calls of a child in place of the one that created it. Everything a gcc/g++
+ * process and its children (cc1, as, collect2, ...) did is replayed between its execve
+ * and its exit, where its target is finished, so the dependencies are attributed to the
+ * right target however many of the build's commands ran at the same time.
+ */
+
+#ifndef RECORD_PERPID_H
+#define RECORD_PERPID_H
+
+#include "record_parser.h"
+
+int PERPID_parse(parser *p, const char *trace_file_name, int jobs);
+void PERPID_remove(const char *trace_file_name);
+
+#endif
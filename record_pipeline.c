@@ -0,0 +1,150 @@
+/*
+ * Rings and stages of a --pipeline recording, see record_pipeline.h
+ */
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "record_pipeline.h"
+#include "record_stats.h"
+
+// a waiting stage retries this many times before yielding its cpu, then sleeps
+#define PIPE_SPINS 64
+#define PIPE_YIELDS 64
+#define PIPE_SLEEP_USEC 50
+
+const char PIPE_end_marker = 0;
+
+double PIPE_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * capacity is rounded up to a power of two
+ */
+void RING_init(ring *r, size_t capacity) {
+  size_t cap = 2;
+  while ( cap < capacity ) {
+    cap *= 2;
+  }
+  r->slots = calloc(cap, sizeof(void *));
+  r->mask = cap - 1;
+  atomic_init(&r->head, 0);
+  atomic_init(&r->tail, 0);
+}
+
+/*
+ * Called by the producer only
+ * Returns false if the ring is full
+ */
+bool RING_push(ring *r, void *item) {
+  size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+  if ( tail - head > r->mask ) {
+    return false;
+  }
+  r->slots[tail & r->mask] = item;
+  // the item is written before the consumer can see the new tail
+  atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+/*
+ * Called by the consumer only
+ * Returns the oldest item, or NULL if the ring is empty
+ */
+void *RING_pop(ring *r) {
+  size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+  if ( head == tail ) {
+    return NULL;
+  }
+  void *item = r->slots[head & r->mask];
+  // the slot is read before the producer can reuse it
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+  return item;
+}
+
+void RING_free(ring *r) {
+  free(r->slots);
+}
+
+/*
+ * Waits a little longer each time a ring is still empty or full
+ */
+static void PIPE_wait(int *tries) {
+  (*tries)++;
+  if ( *tries < PIPE_SPINS ) {
+    return;
+  }
+  if ( *tries < PIPE_SPINS + PIPE_YIELDS ) {
+    sched_yield();
+    return;
+  }
+  usleep(PIPE_SLEEP_USEC);
+}
+
+void STAGE_init(stage *sg, const char *name, ring *in, ring *out) {
+  sg->name = name;
+  sg->in = in;
+  sg->out = out;
+  sg->items = 0;
+  sg->start = PIPE_now();
+  sg->elapsed = 0;
+  sg->starved = 0;
+  sg->blocked = 0;
+}
+
+/*
+ * Takes the next item from the stage's input, waiting for one if there is none
+ */
+void *STAGE_take(stage *sg) {
+  void *item = RING_pop(sg->in);
+  if ( item == NULL ) {
+    double start = PIPE_now();
+    int tries = 0;
+    while ( (item = RING_pop(sg->in)) == NULL ) {
+      PIPE_wait(&tries);
+    }
+    sg->starved += PIPE_now() - start;
+  }
+  if ( item != PIPE_END ) {
+    sg->items++;
+  }
+  return item;
+}
+
+/*
+ * Puts an item into the stage's output, waiting while the next stage has no room for it
+ */
+void STAGE_give(stage *sg, void *item) {
+  if ( RING_push(sg->out, item) ) {
+    return;
+  }
+  double start = PIPE_now();
+  int tries = 0;
+  while ( !RING_push(sg->out, item) ) {
+    PIPE_wait(&tries);
+  }
+  sg->blocked += PIPE_now() - start;
+}
+
+/*
+ * Ends the stage, called by its own thread when it is done
+ */
+void STAGE_finish(stage *sg) {
+  sg->elapsed = PIPE_now() - sg->start;
+}
+
+/*
+ * Adds how a finished stage spent its time to st
+ */
+void STAGE_report(stage *sg, stats *st) {
+  STATS_add_stage(st, sg->name, sg->items, sg->elapsed, sg->starved, sg->blocked);
+}
@@ -0,0 +1,68 @@
+/*
+ * Bounded lock-free queues between the stages of a --pipeline recording
+ *
+ * With --pipeline, a recording runs as four stages on their own threads: the reader
+ * follows the trace and hands it on in chunks of whole lines, the parser turns them into
+ * finished targets, the copier copies their dependencies into the sandbox and the emitter
+ * writes them out. Each pair of neighbouring stages is connected by a ring: a fixed-size
+ * single-producer, single-consumer queue that needs no locks, only one atomic load and
+ * one atomic store per operation on either side.
+ *
+ * A stage that finds its input ring empty waits for it (starved); one that finds its
+ * output ring full waits for room (blocked), so a slow stage holds back the ones before
+ * it instead of letting them queue without bound. The time each stage spends working,
+ * starved and blocked is added to the --stats report, and shows which one bounds the
+ * throughput of the recording on the host.
+ */
+
+#ifndef RECORD_PIPELINE_H
+#define RECORD_PIPELINE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "record_stats.h"
+
+// passed down the rings after the last item, to stop each stage in turn
+#define PIPE_END ((void *) &PIPE_end_marker)
+extern const char PIPE_end_marker;
+
+/*
+ * A single-producer, single-consumer ring of pointers; items are never NULL
+ * head and tail keep growing, their difference is the number of items queued. They are
+ * on separate cache lines, so the two threads do not keep taking the line from each other.
+ */
+typedef struct ring_struct {
+  void **slots;
+  size_t mask;                      // capacity - 1, the capacity is a power of two
+  _Alignas(64) atomic_size_t head;  // next slot to take from, only written by the consumer
+  _Alignas(64) atomic_size_t tail;  // next slot to put into, only written by the producer
+} ring;
+
+/*
+ * The progress of one stage, kept by its own thread
+ */
+typedef struct stage_struct {
+  const char *name;
+  ring *in;               // NULL for the first stage
+  ring *out;              // NULL for the last stage
+  long items;
+  double start;
+  double elapsed;
+  double starved;
+  double blocked;
+} stage;
+
+void RING_init(ring *r, size_t capacity);
+bool RING_push(ring *r, void *item);
+void *RING_pop(ring *r);
+void RING_free(ring *r);
+void STAGE_init(stage *sg, const char *name, ring *in, ring *out);
+void *STAGE_take(stage *sg);
+void STAGE_give(stage *sg, void *item);
+void STAGE_finish(stage *sg);
+void STAGE_report(stage *sg, stats *st);
+double PIPE_now(void);
+
+#endif
@@ -0,0 +1,310 @@
+/*
+ * The preprocessed sandbox, see record_preprocess.h
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "record_core.h"
+#include "record_model.h"
+#include "record_preprocess.h"
+
+/*
+ * A recorded target, with the commands that preprocess and compile it when it is a
+ * compile of one source
+ */
+typedef struct pp_target_struct {
+  target *tar;
+  char *pp_cmd;           // the command run with -E, NULL for a target that is not a compile
+  char *compile_cmd;      // the command compiling the preprocessed file
+  char *output;           // the preprocessed file, relative to the sandbox
+  pid_t pid;
+  bool ok;
+} pp_target;
+
+// options only the preprocessor reads: those taking the next argument when given alone,
+//  and the prefixes of those given joined to it, like -Iinclude
+static const char *pp_separate[] = { "-I", "-D", "-U", "-include", "-imacros", "-isystem",
+                                     "-iquote", "-idirafter", "-MF", "-MT", "-MQ", "-x" };
+static const char *pp_prefixes[] = { "-I", "-D", "-U", "-include", "-imacros", "-isystem",
+                                     "-iquote", "-idirafter", "-x", "-nostdinc" };
+
+static bool PP_is_one_of(const char *arg, const char **options, int count, bool prefix) {
+  for ( int i = 0; i < count; i++ ) {
+    if ( prefix ? !strncmp(arg, options[i], strlen(options[i])) : !strcmp(arg, options[i]) ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * Appends an argument to a command being built, after a space
+ */
+static void PP_append(char **cmd, size_t *len, size_t *cap, const char *arg) {
+  size_t need = *len + strlen(arg) + 2;
+  if ( need > *cap ) {
+    *cap = need * 2;
+    *cmd = realloc(*cmd, *cap);
+  }
+  if ( *len > 0 ) {
+    (*cmd)[(*len)++] = ' ';
+  }
+  strcpy(*cmd + *len, arg);
+  *len += strlen(arg);
+}
+
+/*
+ * Returns the preprocessed file of a target, with its extension replaced by ext; the
+ * result must be freed
+ */
+static char *PP_output_name(const char *target_name, const char *ext) {
+  const char *dot = strrchr(target_name, '.');
+  size_t len = dot != NULL && strchr(dot, '/') == NULL ? (size_t) (dot - target_name) :
+               strlen(target_name);
+  // an absolute target is kept under the sandbox, as sandbox_path() copies it
+  const char *name = target_name[0] == '/' ? target_name + 1 : target_name;
+  len -= name - target_name;
+  char *output = malloc(len + strlen(ext) + 1);
+  memcpy(output, name, len);
+  strcpy(output + len, ext);
+  return output;
+}
+
+/*
+ * Derives the commands preprocessing and compiling a target, when its command is a gcc
+ * or g++ compile of one source
+ */
+static void PP_prepare(pp_target *pt, char *sandbox_pwd) {
+  char *copy = strdup(pt->tar->cmd);
+  int cap = 16;
+  int count = 0;
+  char **args = malloc(cap * sizeof(char *));
+  char *save = NULL;
+  for ( char *arg = strtok_r(copy, " ", &save); arg != NULL; arg = strtok_r(NULL, " ", &save) ) {
+    if ( count == cap ) {
+      cap *= 2;
+      args = realloc(args, cap * sizeof(char *));
+    }
+    args[count++] = arg;
+  }
+  // the source is the one argument that is a source file and not an option's value
+  int source = -1;
+  bool compile = false;
+  for ( int i = 1; i < count; i++ ) {
+    compile |= !strcmp(args[i], "-c");
+    if ( is_source_file(args[i]) && strcmp(args[i - 1], "-o") &&
+         !PP_is_one_of(args[i - 1], pp_separate, sizeof(pp_separate) / sizeof(char *), false) ) {
+      // a second source makes it a command this mode does not split
+      source = source == -1 ? i : -2;
+    }
+  }
+  if ( count == 0 || !compile || source < 0 ||
+       ( strstr(args[0], "gcc") == NULL && strstr(args[0], "g++") == NULL ) ) {
+    free(args);
+    free(copy);
+    return;
+  }
+  // the language the source is preprocessed as: the last -x before it, or else its
+  //  extension, which g++ takes as C++ whatever it is. The compile is told the same
+  //  language with -x right before the preprocessed file, since g++ takes a .i as C++.
+  const char *lang = NULL;
+  for ( int i = 1; i < source; i++ ) {
+    if ( !strcmp(args[i], "-x") ) {
+      lang = args[i + 1];
+    }
+    else if ( !strncmp(args[i], "-x", 2) ) {
+      lang = args[i] + 2;
+    }
+  }
+  bool cplusplus;
+  if ( lang == NULL || !strcmp(lang, "none") ) {
+    cplusplus = strstr(args[0], "g++") != NULL || strcmp(strrchr(args[source], '.'), ".c");
+  }
+  else if ( !strcmp(lang, "c") || !strcmp(lang, "c++") ) {
+    cplusplus = lang[1] == '+';
+  }
+  else {
+    // a language without a preprocessed form this mode knows
+    free(args);
+    free(copy);
+    return;
+  }
+  pt->output = PP_output_name(pt->tar->target_name, cplusplus ? ".ii" : ".i");
+  char *output_path = sandbox_path(sandbox_pwd, pt->output);
+
+  size_t pp_len = 0, pp_cap = 0, cc_len = 0, cc_cap = 0;
+  bool has_output = false;
+  for ( int i = 0; i < count; i++ ) {
+    char *arg = args[i];
+    bool takes_next = i + 1 < count &&
+                      PP_is_one_of(arg, pp_separate, sizeof(pp_separate) / sizeof(char *), false);
+    if ( !strcmp(arg, "-o") && i + 1 < count ) {
+      // the preprocessed file is written into the sandbox, the object from it as recorded
+      PP_append(&pt->pp_cmd, &pp_len, &pp_cap, "-o");
+      PP_append(&pt->pp_cmd, &pp_len, &pp_cap, output_path);
+      PP_append(&pt->compile_cmd, &cc_len, &cc_cap, "-o");
+      PP_append(&pt->compile_cmd, &cc_len, &cc_cap, args[++i]);
+      has_output = true;
+      continue;
+    }
+    if ( !strncmp(arg, "-M", 2) ) {
+      // dependency files are not written by either command
+      i += takes_next;
+      continue;
+    }
+    if ( i == source ) {
+      PP_append(&pt->pp_cmd, &pp_len, &pp_cap, arg);
+      PP_append(&pt->compile_cmd, &cc_len, &cc_cap, "-x");
+      PP_append(&pt->compile_cmd, &cc_len, &cc_cap, cplusplus ? "c++-cpp-output" : "cpp-output");
+      PP_append(&pt->compile_cmd, &cc_len, &cc_cap, pt->output);
+      continue;
+    }
+    PP_append(&pt->pp_cmd, &pp_len, &pp_cap, !strcmp(arg, "-c") ? "-E" : arg);
+    if ( takes_next ) {
+      PP_append(&pt->pp_cmd, &pp_len, &pp_cap, args[++i]);
+      continue;
+    }
+    if ( i == 0 || !PP_is_one_of(arg, pp_prefixes, sizeof(pp_prefixes) / sizeof(char *), true) ) {
+      PP_append(&pt->compile_cmd, &cc_len, &cc_cap, arg);
+    }
+  }
+  if ( !has_output ) {
+    PP_append(&pt->pp_cmd, &pp_len, &pp_cap, "-o");
+    PP_append(&pt->pp_cmd, &pp_len, &pp_cap, output_path);
+  }
+  sandbox_parent_dirs(output_path, sandbox_pwd);
+  free(output_path);
+  free(args);
+  free(copy);
+}
+
+/*
+ * Runs cmd in dir, the directory its relative paths are relative to, or in the current
+ * one if dir is NULL
+ */
+static pid_t PP_spawn(const char *cmd, const char *dir) {
+  pid_t pid = fork();
+  if ( pid == 0 ) {
+    if ( dir != NULL && chdir(dir) != 0 ) {
+      fprintf(stderr, "ERROR: directory %s could not be entered!\n", dir);
+      _exit(127);
+    }
+    execl("/bin/sh", "sh", "-c", cmd, (char *) NULL);
+    _exit(127);
+  }
+  return pid;
+}
+
+/*
+ * Runs the -E command of every compile, at most jobs at once
+ * Returns the number that failed
+ */
+static int PP_run_all(pp_target *targets, int count, int jobs) {
+  int running = 0;
+  int next = 0;
+  int failed = 0;
+  while ( next < count || running > 0 ) {
+    for ( ; next < count && running < jobs; next++ ) {
+      if ( targets[next].pp_cmd != NULL ) {
+        targets[next].pid = PP_spawn(targets[next].pp_cmd, targets[next].tar->dir);
+        running += targets[next].pid > 0;
+      }
+    }
+    if ( running == 0 ) {
+      break;
+    }
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if ( pid <= 0 ) {
+      break;
+    }
+    for ( int t = 0; t < next; t++ ) {
+      if ( targets[t].pid == pid ) {
+        targets[t].pid = 0;
+        targets[t].ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if ( !targets[t].ok ) {
+          fprintf(stderr, "ERROR: %s could not be preprocessed!\n", targets[t].tar->target_name);
+          failed++;
+        }
+        running--;
+        break;
+      }
+    }
+  }
+  return failed;
+}
+
+/*
+ * Preprocesses every compile of a recording into its sandbox, and writes the Makefile
+ * makefile_name there compiling them
+ * Returns 0, or 1 if the dependency file could not be read or the Makefile written
+ */
+int PREPROCESS_run(const char *dependency_file_name, char *sandbox_pwd,
+                   const char *makefile_name, int jobs) {
+  model m;
+  MODEL_init(&m);
+  if ( MODEL_load(&m, dependency_file_name) != 0 || m.count == 0 ) {
+    fprintf(stderr, "ERROR: no recorded targets could be read from %s!\n", dependency_file_name);
+    return 1;
+  }
+  pp_target *targets = calloc(m.count, sizeof(pp_target));
+  int compiles = 0;
+  for ( int t = 0; t < m.count; t++ ) {
+    targets[t].tar = m.targets[t];
+    PP_prepare(&targets[t], sandbox_pwd);
+    compiles += targets[t].pp_cmd != NULL;
+  }
+  int failed = PP_run_all(targets, m.count, jobs);
+
+  char *makefile_path = sandbox_path(sandbox_pwd, (char *) makefile_name);
+  char *tmp_path;
+  FILE *file = ATOMIC_open(makefile_path, &tmp_path);
+  int status = 0;
+  if ( file != NULL ) {
+    size_t cap = BUFFER_SIZE;
+    char *make_targets = calloc(1, cap);
+    long long bytes = 0;
+    fprintf(file, "\nall: all_make_targets\n");
+    for ( int t = 0; t < m.count; t++ ) {
+      pp_target *pt = &targets[t];
+      if ( pt->ok ) {
+        char *output_path = sandbox_path(sandbox_pwd, pt->output);
+        struct stat st;
+        bytes += stat(output_path, &st) == 0 ? st.st_size : 0;
+        free(output_path);
+        fprintf(file, "\n%s: %s\n\t%s\n", pt->tar->target_name, pt->output, pt->compile_cmd);
+      }
+      else {
+        emit_target_to_makefile(file, sandbox_pwd, pt->tar);
+      }
+      append_make_target(&make_targets, &cap, pt->tar->target_name);
+    }
+    fprintf(file, "\nall_make_targets:%s", make_targets);
+    free(make_targets);
+    status = ATOMIC_commit(file, tmp_path, makefile_path) != 0;
+    fprintf(stdout, "Preprocessed %d of %d targets into %s (%.1f MB), compiled by %s\n",
+            compiles - failed, m.count, sandbox_pwd, bytes / (1024.0 * 1024.0), makefile_path);
+    if ( failed > 0 ) {
+      fprintf(stdout, "%d failed, and are built from the copied sources\n", failed);
+    }
+  }
+  else {
+    status = 1;
+  }
+  free(makefile_path);
+  for ( int t = 0; t < m.count; t++ ) {
+    free(targets[t].pp_cmd);
+    free(targets[t].compile_cmd);
+    free(targets[t].output);
+  }
+  free(targets);
+  MODEL_free(&m);
+  return status;
+}
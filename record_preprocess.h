@@ -0,0 +1,28 @@
+/*
+ * The preprocessed sandbox: each translation unit as the one file it compiles from
+ *
+ * The sandbox rebuilds every target from copies of the files its command read, so a
+ * compile brings along the hundreds of headers it includes, looked up again through its
+ * include path at each rebuild. A sandbox that is rebuilt and timed, but not edited,
+ * does not need them: PREPROCESS_run() runs each recorded compile command again with -E
+ * in place of -c, jobs at a time, from the directory the command ran in, and keeps the
+ * output in the sandbox where the target's extension is replaced:
+ *    obj/foo.o  ->  sandbox/obj/foo.i       (.ii for C++: g++, a C++ source or -x c++)
+ * It then writes a Makefile next to the sandbox's own, with a rule compiling each of
+ * those with the recorded command, less its source and the options only the
+ * preprocessor reads (-I, -D, -U, -include, -isystem, -M..., -x and the like), and
+ * with -x naming the preprocessed language, which g++ would otherwise take as C++:
+ *    obj/foo.o: obj/foo.i
+ *    	gcc -c -O2 -o obj/foo.o -x cpp-output obj/foo.i
+ * so that `make -f Makefile.preprocessed` in the sandbox rebuilds without a header.
+ * A command that is not a gcc or g++ compile of one source, such as a link, or whose
+ * -E run fails, keeps its rule of the sandbox Makefile, and the copies it needs.
+ */
+
+#ifndef RECORD_PREPROCESS_H
+#define RECORD_PREPROCESS_H
+
+int PREPROCESS_run(const char *dependency_file_name, char *sandbox_pwd,
+                   const char *makefile_name, int jobs);
+
+#endif
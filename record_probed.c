@@ -0,0 +1,211 @@
+/*
+ * Probed paths, see record_probed.h
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "record_intern.h"
+#include "record_probed.h"
+
+// bits of bloom filter per path, with three bits set per path about 3% false positives
+#define PROBED_BLOOM_BITS_PER_PATH 16
+
+// the paths of every set, interned once; sets may be filled and read on several threads
+static intern_table probed_paths;
+static pthread_mutex_t probed_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool probed_init;
+
+int PROBED_intern(const char *path) {
+  pthread_mutex_lock(&probed_lock);
+  if ( !probed_init ) {
+    INTERN_init(&probed_paths);
+    probed_init = true;
+  }
+  int id = INTERN_id(&probed_paths, path);
+  pthread_mutex_unlock(&probed_lock);
+  return id;
+}
+
+/*
+ * Returns the path of an id; the string stays valid, and unchanged, for the whole run
+ */
+const char *PROBED_path(int id) {
+  pthread_mutex_lock(&probed_lock);
+  const char *path = INTERN_string(&probed_paths, id);
+  pthread_mutex_unlock(&probed_lock);
+  return path;
+}
+
+static void PROBED_set_bits(uint64_t *bloom, int words, uint64_t hash) {
+  uint64_t mask = (uint64_t) words * 64 - 1;
+  for ( int k = 0; k < 3; k++ ) {
+    uint64_t bit = (hash >> (21 * k)) & mask;
+    bloom[bit / 64] |= 1ULL << (bit % 64);
+  }
+}
+
+static bool PROBED_test_bits(const uint64_t *bloom, int words, uint64_t hash) {
+  uint64_t mask = (uint64_t) words * 64 - 1;
+  for ( int k = 0; k < 3; k++ ) {
+    uint64_t bit = (hash >> (21 * k)) & mask;
+    if ( !(bloom[bit / 64] & (1ULL << (bit % 64))) ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Sizes the bloom filter for the paths in the set and sets their bits again
+ */
+static void PROBED_rebuild_bloom(probe_set *s) {
+  int words = 1;
+  while ( words * 64 < s->count * PROBED_BLOOM_BITS_PER_PATH ) {
+    words *= 2;
+  }
+  if ( words != s->bloom_words ) {
+    free(s->bloom);
+    s->bloom = malloc(words * sizeof(uint64_t));
+    s->bloom_words = words;
+  }
+  memset(s->bloom, 0, words * sizeof(uint64_t));
+  pthread_mutex_lock(&probed_lock);
+  for ( int i = 0; i < s->count; i++ ) {
+    PROBED_set_bits(s->bloom, words, probed_paths.hashes[s->ids[i]]);
+  }
+  pthread_mutex_unlock(&probed_lock);
+}
+
+/*
+ * Adds path to the set, unless it is there already
+ */
+void PROBED_add(probe_set *s, const char *path) {
+  uint64_t hash = INTERN_hash(path);
+  int id = PROBED_intern(path);
+  if ( s->bloom != NULL && PROBED_test_bits(s->bloom, s->bloom_words, hash) ) {
+    for ( int i = 0; i < s->count; i++ ) {
+      if ( s->ids[i] == id ) {
+        return;
+      }
+    }
+  }
+  if ( s->count == s->cap ) {
+    s->cap = s->cap ? s->cap * 2 : 8;
+    s->ids = realloc(s->ids, s->cap * sizeof(int));
+  }
+  s->ids[s->count++] = id;
+  if ( s->bloom == NULL || s->bloom_words * 64 < s->count * PROBED_BLOOM_BITS_PER_PATH ) {
+    PROBED_rebuild_bloom(s);
+  }
+  else {
+    PROBED_set_bits(s->bloom, s->bloom_words, hash);
+  }
+}
+
+/*
+ * Returns false if path is certainly not in the set, true if it may be
+ */
+bool PROBED_may_contain(const probe_set *s, const char *path) {
+  return s->bloom != NULL && PROBED_test_bits(s->bloom, s->bloom_words, INTERN_hash(path));
+}
+
+bool PROBED_contains(const probe_set *s, const char *path) {
+  if ( !PROBED_may_contain(s, path) ) {
+    return false;
+  }
+  for ( int i = 0; i < s->count; i++ ) {
+    if ( !strcmp(PROBED_path(s->ids[i]), path) ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * Removes the paths drop() returns true for, keeping the order of the others
+ */
+void PROBED_remove_if(probe_set *s, bool (*drop)(void *ctx, const char *path), void *ctx) {
+  int kept = 0;
+  for ( int i = 0; i < s->count; i++ ) {
+    if ( !drop(ctx, PROBED_path(s->ids[i])) ) {
+      s->ids[kept++] = s->ids[i];
+    }
+  }
+  if ( kept != s->count ) {
+    s->count = kept;
+    PROBED_rebuild_bloom(s);
+  }
+}
+
+/*
+ * Returns the first path of the set whose existence is present, or NULL; relative paths
+ * are looked for in dir, or in the current directory if dir is NULL
+ */
+static const char *PROBED_first(const probe_set *s, const char *dir, bool present) {
+  // a directory that is gone has none of its relative paths
+  int dir_fd = dir != NULL ? open(dir, O_RDONLY | O_DIRECTORY) : AT_FDCWD;
+  const char *found = NULL;
+  struct stat st;
+  for ( int i = 0; i < s->count && found == NULL; i++ ) {
+    const char *path = PROBED_path(s->ids[i]);
+    int fd = path[0] == '/' ? AT_FDCWD : dir_fd;
+    if ( ( fd != -1 && fstatat(fd, path, &st, AT_SYMLINK_NOFOLLOW) == 0 ) == present ) {
+      found = path;
+    }
+  }
+  if ( dir_fd >= 0 ) {
+    close(dir_fd);
+  }
+  return found;
+}
+
+/*
+ * Returns the first path of the set that exists now, or NULL: for a set of absent paths,
+ * the one that makes its target stale
+ */
+const char *PROBED_first_present(const probe_set *s, const char *dir) {
+  return PROBED_first(s, dir, true);
+}
+
+/*
+ * Returns the first path of the set that does not exist any more, or NULL
+ */
+const char *PROBED_first_missing(const probe_set *s, const char *dir) {
+  return PROBED_first(s, dir, false);
+}
+
+/*
+ * Writes the set as a line of the dependency file, wrapped like its DEPENDENCY line;
+ * an empty set is left out
+ */
+void PROBED_emit(FILE *file, const char *label, const probe_set *s) {
+  if ( s->count == 0 ) {
+    return;
+  }
+  fprintf(file, "%s", label);
+  int line_len = 12;
+  for ( int i = 0; i < s->count; i++ ) {
+    const char *path = PROBED_path(s->ids[i]);
+    if ( line_len + strlen(path) > 80 ) {
+      fprintf(file, "\n            ");
+      line_len = 12;
+    }
+    fprintf(file, "  %s", path);
+    line_len += strlen(path) + 2;
+  }
+  fprintf(file, "\n");
+}
+
+void PROBED_free(probe_set *s) {
+  free(s->ids);
+  free(s->bloom);
+  memset(s, 0, sizeof(probe_set));
+}
@@ -0,0 +1,47 @@
+/*
+ * The paths a target's command probed: looked for without reading them
+ *
+ * A compiler searching its include path for a header tries each directory in turn, with
+ * openat, stat or access calls that fail until the header is found. The output of the
+ * command depends on those failures: a header created earlier in the include path would
+ * be found instead. Such absent paths are the negative dependencies of a target; the
+ * paths it probed successfully without reading them (programs found by gcc's driver,
+ * directories stat'ed) are its existence dependencies. A target is stale when one of
+ * the first appears or one of the second disappears, whatever its other dependencies.
+ *
+ * The same include directories are probed for the same headers by every target, so each
+ * path is interned once in a table shared by every set and thread; a set holds only the
+ * ids of its paths, and a bloom filter over their hashes that answers "could this file,
+ * just created, be in the set?" for most files without looking at the ids at all.
+ */
+
+#ifndef RECORD_PROBED_H
+#define RECORD_PROBED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * A set of probed paths, in the order first probed; all zeroes is an empty set
+ */
+typedef struct probe_set_struct {
+  int *ids;               // ids of the paths in the shared table
+  int count;
+  int cap;
+  uint64_t *bloom;        // PROBED_BLOOM_BITS_PER_PATH bits per path, rounded up to a power of two
+  int bloom_words;
+} probe_set;
+
+int PROBED_intern(const char *path);
+const char *PROBED_path(int id);
+void PROBED_add(probe_set *s, const char *path);
+bool PROBED_may_contain(const probe_set *s, const char *path);
+bool PROBED_contains(const probe_set *s, const char *path);
+void PROBED_remove_if(probe_set *s, bool (*drop)(void *ctx, const char *path), void *ctx);
+const char *PROBED_first_present(const probe_set *s, const char *dir);
+const char *PROBED_first_missing(const probe_set *s, const char *dir);
+void PROBED_emit(FILE *file, const char *label, const probe_set *s);
+void PROBED_free(probe_set *s);
+
+#endif
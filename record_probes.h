@@ -0,0 +1,52 @@
+/*
+ * USDT static tracepoints for record_build
+ *
+ * When <sys/sdt.h> (systemtap-sdt-dev) is available at build time each probe compiles to
+ * a single nop plus an ELF note, so production runs pay nothing until a tracer attaches:
+ *    bpftrace -e 'usdt:./record_build:record_build:copy_end { @bytes = sum(arg1); }'
+ *    perf probe -x ./record_build sdt_record_build:target_finalized
+ * Without the header, or when built with -DRECORD_BUILD_NO_USDT, the probes compile away.
+ *
+ * Probes (provider "record_build"):
+ *    line_parsed(char *line, long len)              every trace line read
+ *    target_started(int pid, char *target)          a gcc/g++ command starts a new target
+ *    dependency_added(int pid, char *path)          an opened file is recorded for a target
+ *    target_finalized(char *target, long deps)      a target is complete, before copy/emit
+ *    copy_begin(char *src, char *dst)               a dependency starts copying into the sandbox
+ *    copy_end(char *src, long bytes)                a dependency finished copying
+ *    emit(char *target, long deps)                  a target was written to the output files
+ */
+
+#ifndef RECORD_PROBES_H
+#define RECORD_PROBES_H
+
+#if !defined(RECORD_BUILD_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define RECORD_BUILD_HAVE_USDT 1
+#endif
+#endif
+
+#ifdef RECORD_BUILD_HAVE_USDT
+#include <sys/sdt.h>
+
+#define PROBE_LINE_PARSED(line, len)         DTRACE_PROBE2(record_build, line_parsed, line, len)
+#define PROBE_TARGET_STARTED(pid, target)    DTRACE_PROBE2(record_build, target_started, pid, target)
+#define PROBE_DEPENDENCY_ADDED(pid, path)    DTRACE_PROBE2(record_build, dependency_added, pid, path)
+#define PROBE_TARGET_FINALIZED(target, deps) DTRACE_PROBE2(record_build, target_finalized, target, deps)
+#define PROBE_COPY_BEGIN(src, dst)           DTRACE_PROBE2(record_build, copy_begin, src, dst)
+#define PROBE_COPY_END(src, bytes)           DTRACE_PROBE2(record_build, copy_end, src, bytes)
+#define PROBE_EMIT(target, deps)             DTRACE_PROBE2(record_build, emit, target, deps)
+
+#else
+
+#define PROBE_LINE_PARSED(line, len)         do { } while ( 0 )
+#define PROBE_TARGET_STARTED(pid, target)    do { } while ( 0 )
+#define PROBE_DEPENDENCY_ADDED(pid, path)    do { } while ( 0 )
+#define PROBE_TARGET_FINALIZED(target, deps) do { } while ( 0 )
+#define PROBE_COPY_BEGIN(src, dst)           do { } while ( 0 )
+#define PROBE_COPY_END(src, bytes)           do { } while ( 0 )
+#define PROBE_EMIT(target, deps)             do { } while ( 0 )
+
+#endif
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * Live progress display, see record_progress.h
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "record_parser.h"
+#include "record_progress.h"
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void PROGRESS_init(progress *pr, bool enabled, char *status_file) {
+  memset(pr, 0, sizeof(progress));
+  pr->enabled = enabled;
+  pr->status_file = status_file;
+  pr->tty = isatty(STDERR_FILENO);
+  pr->start = pr->last_report = now();
+}
+
+/*
+ * Writes the status file to a temporary name and renames it over the old one,
+ * so readers never see a partly written status
+ */
+static void write_status_file(progress *pr, parser *p, double elapsed, double lines_rate,
+                              double mb_rate, bool build_running) {
+  size_t len = strlen(pr->status_file);
+  char *tmp_name = malloc(len + 5);
+  strcpy(tmp_name, pr->status_file);
+  strcat(tmp_name, ".tmp");
+  FILE *status = fopen(tmp_name, "w");
+  if ( status == NULL ) {
+    fprintf(stderr, "ERROR: progress file %s could not be opened!\n", tmp_name);
+    free(tmp_name);
+    return;
+  }
+  fprintf(status, "state=%s\n", pr->done ? "done" : build_running ? "recording" : "parsing");
+  fprintf(status, "elapsed_seconds=%.1f\n", elapsed);
+  fprintf(status, "processes=%ld\n", p->processes);
+  fprintf(status, "targets=%ld\n", p->targets);
+  fprintf(status, "lines=%ld\n", p->lines);
+  fprintf(status, "lines_per_second=%.0f\n", lines_rate);
+  fprintf(status, "trace_mb_per_second=%.2f\n", mb_rate);
+  fprintf(status, "copy_backlog=%ld\n", p->deps_pending);
+  fprintf(status, "files_copied=%ld\n", p->files_copied);
+  fprintf(status, "mb_copied=%.2f\n", p->bytes_copied / (1024.0 * 1024.0));
+  fclose(status);
+  if ( rename(tmp_name, pr->status_file) != 0 ) {
+    fprintf(stderr, "ERROR: progress file %s could not be replaced!\n", pr->status_file);
+  }
+  free(tmp_name);
+}
+
+/*
+ * Reports progress if the interval has passed since the last report
+ * Cheap enough to call for every line
+ */
+void PROGRESS_update(progress *pr, parser *p, bool build_running) {
+  if ( !pr->enabled ) {
+    return;
+  }
+  double cur = now();
+  double since = cur - pr->last_report;
+  if ( since < PROGRESS_INTERVAL ) {
+    return;
+  }
+  double lines_rate = (p->lines - pr->last_lines) / since;
+  double mb_rate = (p->bytes - pr->last_bytes) / (1024.0 * 1024.0) / since;
+  pr->last_report = cur;
+  pr->last_lines = p->lines;
+  pr->last_bytes = p->bytes;
+
+  if ( pr->status_file != NULL ) {
+    write_status_file(pr, p, cur - pr->start, lines_rate, mb_rate, build_running);
+    return;
+  }
+  fprintf(stderr, "%s[%6.0fs] %ld processes, %ld targets, %.0f lines/s, backlog %ld deps, %.1f MB copied%s",
+          pr->tty ? "\r" : "", cur - pr->start, p->processes, p->targets, lines_rate, p->deps_pending,
+          p->bytes_copied / (1024.0 * 1024.0), pr->tty ? "\033[K" : "\n");
+}
+
+/*
+ * Writes the final report and ends the progress line
+ */
+void PROGRESS_finish(progress *pr, parser *p) {
+  if ( !pr->enabled ) {
+    return;
+  }
+  pr->done = true;
+  pr->last_report -= PROGRESS_INTERVAL;
+  PROGRESS_update(pr, p, false);
+  if ( pr->status_file == NULL && pr->tty ) {
+    fprintf(stderr, "\n");
+  }
+}
@@ -0,0 +1,35 @@
+/*
+ * Live progress display for long recordings
+ *
+ * While the build runs, record_build parses its trace as it is written and reports the
+ * processes traced, targets found, parse rate, copy backlog and data copied, at most once
+ * per interval: on stderr (one updating line on a terminal, one line per report
+ * otherwise), or into a status file that is replaced atomically on every update.
+ */
+
+#ifndef RECORD_PROGRESS_H
+#define RECORD_PROGRESS_H
+
+#include <stdbool.h>
+
+#include "record_parser.h"
+
+// seconds between two progress reports
+#define PROGRESS_INTERVAL 1.0
+
+typedef struct progress_struct {
+  bool enabled;
+  char *status_file;      // NULL to report on stderr
+  bool tty;               // stderr is a terminal, redraw one line
+  bool done;
+  double start;
+  double last_report;
+  long last_lines;
+  long last_bytes;
+} progress;
+
+void PROGRESS_init(progress *pr, bool enabled, char *status_file);
+void PROGRESS_update(progress *pr, parser *p, bool build_running);
+void PROGRESS_finish(progress *pr, parser *p);
+
+#endif
@@ -0,0 +1,1189 @@
+/*
+ * The record_build library, see record_session.h
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "record_checkpoint.h"
+#include "record_core.h"
+#include "record_intern.h"
+#include "record_model.h"
+#include "record_parser.h"
+#include "record_perpid.h"
+#include "record_pipeline.h"
+#include "record_probed.h"
+#include "record_probes.h"
+#include "record_progress.h"
+#include "record_session.h"
+#include "record_stats.h"
+#include "record_usage.h"
+
+// how long to wait for more trace output while the build is still running
+#define FOLLOW_SLEEP_USEC 20000
+
+/*
+ * Reads whole lines from a trace file that may still be being written by strace
+ * While the build runs, end of file only means strace has not written more yet, and
+ * a line without its newline is held back until the rest of it arrives.
+ */
+typedef struct trace_reader_struct {
+  FILE *file;
+  char *line;             // the line returned by TRACE_next_line
+  size_t line_cap;
+  char *partial;          // the start of a line whose end has not been written yet
+  size_t partial_len;
+  size_t partial_cap;
+} trace_reader;
+
+/*
+ * Returns the length of the next whole line, stored in r->line, or -1 when none is
+ * available yet. When the build has finished, a last unterminated line is returned too.
+ */
+static ssize_t TRACE_next_line(trace_reader *r, bool build_running) {
+  ssize_t len;
+  while ( (len = getline(&r->line, &r->line_cap, r->file)) != -1 ) {
+    if ( r->line[len - 1] == '\n' && r->partial_len == 0 ) {
+      return len;
+    }
+    // keep the piece read so far, until its line is complete
+    if ( r->partial_len + len + 1 > r->partial_cap ) {
+      r->partial_cap = (r->partial_len + len + 1) * 2;
+      r->partial = realloc(r->partial, r->partial_cap);
+    }
+    memcpy(r->partial + r->partial_len, r->line, len + 1);
+    r->partial_len += len;
+    if ( r->line[len - 1] == '\n' ) {
+      break;
+    }
+  }
+  if ( len == -1 ) {
+    // end of the file for now, more may be written later
+    clearerr(r->file);
+    if ( build_running || r->partial_len == 0 ) {
+      return -1;
+    }
+  }
+  // hand out the completed line
+  if ( r->partial_len + 1 > r->line_cap ) {
+    r->line_cap = r->partial_len + 1;
+    r->line = realloc(r->line, r->line_cap);
+  }
+  memcpy(r->line, r->partial, r->partial_len + 1);
+  len = r->partial_len;
+  r->partial_len = 0;
+  return len;
+}
+
+// a chunk of trace lines handed from the reader to the parser with --pipeline
+#define CHUNK_BYTES 65536
+#define CHUNK_LINES 1024
+// capacities of the rings between the stages, in chunks and in targets
+#define PIPE_CHUNKS 64
+#define PIPE_TARGETS 1024
+
+typedef struct line_chunk_struct {
+  char *data;             // the lines back to back, each followed by a '\0'
+  size_t used;
+  size_t cap;
+  long lengths[CHUNK_LINES];
+  int count;
+} line_chunk;
+
+/*
+ * The stages of a --pipeline recording and the rings between them, see record_pipeline.h
+ */
+struct record_pipeline_struct {
+  record_session *s;
+  ring lines;             // reader -> parser: chunks of lines
+  ring free_chunks;       // parser -> reader: chunks to fill again
+  ring parsed;            // parser -> copier: finished targets
+  ring copied;            // copier -> emitter: targets with their dependencies copied
+  stage reader;
+  stage parser;
+  stage copier;
+  stage emitter;
+  line_chunk *chunk;      // being filled by the reader
+  double idle_since;      // when the reader caught up with strace, 0 while it is reading
+  stats reader_st;
+  stats copy_st;
+  stats emit_st;
+  atomic_bool build_running;
+  atomic_long files_copied; // kept by the copier, read by the parser for progress reports
+  atomic_long bytes_copied;
+};
+
+/*
+ * Returns the number of threads to run the parallel work of a recording on
+ */
+static int RECORD_jobs(const record_config *config) {
+  return config->jobs > 0 ? config->jobs : sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+static double seconds(struct timeval tv) {
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*
+ * The settings of the record_build command
+ */
+void RECORD_default_config(record_config *config) {
+  memset(config, 0, sizeof(record_config));
+  // the output of the strace call will be found in t.out
+  config->trace_file_name = "t.out";
+  //the list of commands used to make the build will be written to commands_cache.txt
+  config->cmds_file_name = "commands_cache.txt";
+  //the list of c and c++ sourcefiles used to make the build will be written to source_files.txt
+  config->sources_file_name = "source_files.txt";
+  /* the dependency file: lists commands, sources, and dependencies in the following format
+   * OUTPUT: program/object/file/library
+   * COMMAND: gcc -o ...
+   * DEPENDENCY: dep1.c dep2.h dep3.cc ....
+   */
+  config->dependency_file_name = "dependency.txt";
+  // the hashes of the dependencies, with --hash
+  config->manifest_file_name = "manifest.txt";
+  // the include graph reconstructed from the dependency file, by --includes
+  config->includes_file_name = "includes.txt";
+  // the sandbox Makefile compiling the preprocessed translation units, by --preprocess
+  config->preprocessed_makefile_name = "Makefile.preprocessed";
+  // the state of a parse, to resume it from, with checkpoint_bytes
+  config->checkpoint_file_name = "t.out.checkpoint";
+  config->sandbox = true;
+}
+
+static long TARGET_dep_count(target *tar) {
+  long deps = 0;
+  for ( depnode *dep = tar->head; dep != NULL; dep = dep->next ) {
+    deps++;
+  }
+  return deps;
+}
+
+/*
+ * Copies a finished target's dependencies, through the copy hook when set
+ * Returns the number of bytes copied
+ */
+static long RECORD_copy_target(record_session *s, target *tar, stats *st) {
+  phase prev = STATS_enter(st, PHASE_COPY);
+  long bytes = 0;
+  if ( s->hooks.copy != NULL ) {
+    bytes = s->hooks.copy(s->hooks.ctx, s, tar);
+  }
+  else if ( s->config.sandbox ) {
+    bytes = TARGET_copy_deps(tar, s->sandbox_pwd, st);
+  }
+  STATS_enter(st, prev);
+  return bytes;
+}
+
+/*
+ * Writes a finished target out, through the emit hook when set, and frees it
+ */
+static void RECORD_emit_target(record_session *s, target *tar, long deps, stats *st) {
+  if ( s->config.incremental ) {
+    // written out with the rest of the model once it has been merged
+    MODEL_add_target(&s->changed, tar);
+    return;
+  }
+  if ( s->mf != NULL ) {
+    MANIFEST_add_target(s->mf, tar);
+  }
+  phase prev = STATS_enter(st, PHASE_EMIT);
+  if ( s->hooks.emit != NULL ) {
+    s->hooks.emit(s->hooks.ctx, s, tar);
+  }
+  else {
+    if ( s->dep_file != NULL ) {
+      emit_target_to_file(s->dep_file, tar);
+    }
+    if ( s->sandbox_mkfile != NULL ) {
+      emit_target_to_makefile(s->sandbox_mkfile, s->sandbox_pwd, tar);
+      //add the target to the list of make targets
+      append_make_target(&s->make_targets_list, &s->make_targets_cap, tar->target_name);
+    }
+  }
+  PROBE_EMIT(tar->target_name, deps);
+  STATS_enter(st, prev);
+  TARGET_free(tar);
+}
+
+/*
+ * Copies a finished target's dependencies and writes it out, or with --pipeline hands it
+ * to the stages that do
+ */
+static void RECORD_finish_target(void *ctx, target *tar) {
+  record_session *s = ctx;
+  parser *p = &s->p;
+  if ( s->hooks.target_finalized != NULL ) {
+    s->hooks.target_finalized(s->hooks.ctx, tar);
+  }
+  if ( s->pipe != NULL ) {
+    STAGE_give(&s->pipe->parser, tar);
+    return;
+  }
+  long deps = TARGET_dep_count(tar);
+  p->bytes_copied += RECORD_copy_target(s, tar, s->config.st);
+  p->files_copied += deps;
+  p->deps_pending -= deps;
+  RECORD_emit_target(s, tar, deps, s->config.st);
+}
+
+/*
+ * Opens a file to write results to, unless it has no name; with a length that is not -1,
+ * the file of a resumed parse, it keeps that many bytes written before the checkpoint
+ * Returns false if it has a name but could not be opened, or is shorter than length
+ */
+static bool RECORD_open_output(const char *file_name, const char *what, long long length,
+                               FILE **file) {
+  *file = NULL;
+  if ( file_name == NULL ) {
+    return true;
+  }
+  *file = fopen(file_name, length < 0 ? "w" : "r+");
+  if ( *file == NULL ) {
+    //check for fopen failure
+    fprintf(stderr, "ERROR: file to write %s to,  %s, could not be opened!\n", what, file_name);
+    return false;
+  }
+  struct stat sb;
+  if ( length >= 0 && ( fstat(fileno(*file), &sb) != 0 || sb.st_size < length ||
+                        ftruncate(fileno(*file), length) != 0 ||
+                        fseeko(*file, length, SEEK_SET) != 0 ) ) {
+    fprintf(stderr, "ERROR: file of %s, %s, is shorter than at the checkpoint!\n", what, file_name);
+    fclose(*file);
+    *file = NULL;
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Starts a recording session; config and hooks are copied, hooks may be NULL
+ * Returns NULL if an output file could not be opened
+ */
+record_session *RECORD_open(const record_config *config, const record_hooks *hooks) {
+  record_session *s = calloc(1, sizeof(record_session));
+  // the state of the parse being resumed, and what it had written to each output file
+  checkpoint ck;
+  memset(&ck, 0, sizeof(checkpoint));
+  for ( int i = 0; i < CHECKPOINT_OUTPUTS; i++ ) {
+    ck.outputs[i] = -1;
+  }
+  s->config = *config;
+  if ( hooks != NULL ) {
+    s->hooks = *hooks;
+  }
+  if ( s->config.st == NULL ) {
+    STATS_init(&s->own_stats, false);
+    s->config.st = &s->own_stats;
+  }
+
+  // get the current working directory, to list absolute filepaths in
+  if ( config->pwd != NULL ) {
+    s->pwd = strdup(config->pwd);
+  }
+  else {
+    s->pwd = malloc(BUFFER_SIZE);
+    if ( getcwd(s->pwd, BUFFER_SIZE) == NULL ) {
+      fprintf(stderr, "ERROR: current directory could not be read\n");
+      goto failed;
+    }
+  }
+
+  // the directory the sandbox dependencies are copied into
+  if ( config->sandbox_dir != NULL ) {
+    s->sandbox_pwd = strdup(config->sandbox_dir);
+  }
+  else {
+    s->sandbox_pwd = malloc(strlen(s->pwd) + 9);
+    strcpy(s->sandbox_pwd, s->pwd);
+    strcat(s->sandbox_pwd, "/");
+    strcat(s->sandbox_pwd, "sandbox");
+  }
+  s->sandbox_mkfile_path = malloc(strlen(s->sandbox_pwd) + 10);
+  strcpy(s->sandbox_mkfile_path, s->sandbox_pwd);
+  strcat(s->sandbox_mkfile_path, "/Makefile");
+
+  // the model of the previous recording, which an incremental recording updates
+  MODEL_init(&s->recorded);
+  MODEL_init(&s->changed);
+  if ( config->incremental && ( config->dependency_file_name == NULL ||
+                                MODEL_load(&s->recorded, config->dependency_file_name) != 0 ) ) {
+    fprintf(stderr, "No previous recording in %s, recording every target\n",
+            config->dependency_file_name ? config->dependency_file_name : "memory");
+  }
+
+  PARSER_init(&s->p, s->pwd, NULL, NULL, s->config.st, RECORD_finish_target, s);
+  s->p.track_reads = config->track_reads;
+  s->p.track_probes = config->track_probes;
+  s->trace_fd = -1;
+  if ( config->resume && ( config->checkpoint_file_name == NULL ||
+                           CHECKPOINT_load(config->checkpoint_file_name, &s->p, &ck) != 0 ) ) {
+    goto failed;
+  }
+  s->trace_offset = ck.trace_offset;
+  s->trace_check = ck.trace_check;
+
+  //  an incremental recording writes the files from the merged model at the end instead
+  if ( config->incremental ) {
+    if ( config->sources_file_name != NULL ) {
+      s->sources_file = tmpfile();
+    }
+  }
+  else if ( !RECORD_open_output(config->cmds_file_name, "list of commands",
+                                ck.outputs[CHECKPOINT_CMDS], &s->cmds_file) ||
+            !RECORD_open_output(config->sources_file_name, "source file names",
+                                ck.outputs[CHECKPOINT_SOURCES], &s->sources_file) ||
+            !RECORD_open_output(config->dependency_file_name, "dependencies",
+                                ck.outputs[CHECKPOINT_DEPS], &s->dep_file) ) {
+    goto failed;
+  }
+  s->p.cmds_file = s->cmds_file;
+  s->p.sources_file = s->sources_file;
+
+  if ( config->sandbox ) {
+    // create a new directory for the sandbox dependencies to be copied into
+    mkdir(s->sandbox_pwd, 0777);
+  }
+  if ( config->sandbox && !config->incremental && ck.outputs[CHECKPOINT_MAKEFILE] >= 0 ) {
+    // resumed, with its header and the targets written before the checkpoint
+    if ( !RECORD_open_output(s->sandbox_mkfile_path, "the sandbox",
+                             ck.outputs[CHECKPOINT_MAKEFILE], &s->sandbox_mkfile) ) {
+      goto failed;
+    }
+  }
+  else if ( config->sandbox && !config->incremental ) {
+    //create makefile inside the sandbox
+    s->sandbox_mkfile = fopen(s->sandbox_mkfile_path, "w");
+    if ( !s->sandbox_mkfile ) {
+      fprintf(stderr, "Sandbox makefile, \"%s\", could not be opened for writing!",
+                s->sandbox_mkfile_path);
+    }
+    else {
+      //write the wrapper for all targets to the makefile
+      //  all_make_targets is a special generated target that will have dependencies on all
+      //  other targets, and will be placed at the end, to allow the 'make' command to
+      //  build all of the targets based on building the 'all' target on the first line
+      fprintf(s->sandbox_mkfile, "\nall: all_make_targets\n");
+    }
+  }
+  //buffer to track all of the targets made by this build, grown as targets are added
+  s->make_targets_cap = BUFFER_SIZE;
+  if ( ck.make_targets != NULL && strlen(ck.make_targets) >= s->make_targets_cap ) {
+    s->make_targets_cap = strlen(ck.make_targets) * 2;
+  }
+  s->make_targets_list = calloc(1, s->make_targets_cap);
+  if ( ck.make_targets != NULL ) {
+    strcpy(s->make_targets_list, ck.make_targets);
+  }
+  CHECKPOINT_free(&ck);
+
+  if ( config->hash && config->manifest_file_name != NULL ) {
+    s->mf = malloc(sizeof(manifest));
+    MANIFEST_init(s->mf);
+    if ( config->resume && s->dep_file != NULL ) {
+      // the targets written out before the checkpoint are hashed with the rest
+      model written;
+      MODEL_init(&written);
+      fflush(s->dep_file);
+      MODEL_load(&written, config->dependency_file_name);
+      for ( int t = 0; t < written.count; t++ ) {
+        MANIFEST_add_target(s->mf, written.targets[t]);
+      }
+      MODEL_free(&written);
+    }
+  }
+  // checkpoints are taken by a single-threaded parse writing its outputs as it goes, and
+  //  not with usage, whose samples a checkpoint does not save
+  if ( config->checkpoint_bytes > 0 && config->checkpoint_file_name != NULL &&
+       !config->pipeline && !config->per_pid && !config->incremental && !config->usage ) {
+    s->checkpoint_at = s->trace_offset + config->checkpoint_bytes;
+  }
+  return s;
+
+failed:
+  // what was opened or loaded before the failure, without writing any of it out
+  for ( int i = 0; i < s->p.held_count; i++ ) {
+    if ( s->p.held[i].tar != s->p.cur_target ) {
+      TARGET_free(s->p.held[i].tar);
+    }
+  }
+  s->p.held_count = 0;
+  s->p.owner_count = 0;
+  if ( s->p.cur_target != NULL ) {
+    TARGET_free(s->p.cur_target);
+    s->p.cur_target = NULL;
+  }
+  for ( int i = 0; i < s->p.open_count; i++ ) {
+    free(s->p.open_files[i].path);
+  }
+  s->p.open_count = 0;
+  PARSER_finish(&s->p);
+  FILE *files[4] = { s->cmds_file, s->sources_file, s->dep_file, s->sandbox_mkfile };
+  for ( int i = 0; i < 4; i++ ) {
+    if ( files[i] != NULL ) {
+      fclose(files[i]);
+    }
+  }
+  CHECKPOINT_free(&ck);
+  MODEL_free(&s->recorded);
+  free(s->sandbox_mkfile_path);
+  free(s->sandbox_pwd);
+  free(s->pwd);
+  free(s->p.pwd);
+  free(s->p.start_pwd);
+  free(s);
+  return NULL;
+}
+
+/*
+ * Parses one line of strace -f output. The line may be modified.
+ */
+void RECORD_push_line(record_session *s, char *line, long len) {
+  PARSER_feed_line(&s->p, line, len);
+}
+
+/*
+ * Handles one decoded system call
+ */
+void RECORD_push_event(record_session *s, const record_event *ev) {
+  parser *p = &s->p;
+  if ( ev->time > 0 ) {
+    p->timed = true;
+    p->now = ev->time;
+  }
+  p->lines++;
+  // the events have no exits to wait for, each target ends when the next one starts
+  p->follow_pids = false;
+  if ( ev->result < 0 ) {
+    // the call failed: no program ran, no file was opened
+    return;
+  }
+  switch ( ev->type ) {
+    case RECORD_EVENT_EXECVE: {
+      // format the call as strace does, the form the parser reads the command line in:
+      //   /path/to/executable", ["arg1", "arg2", ...], ...
+      size_t len = strlen(ev->path) + 16;
+      for ( int i = 0; i < ev->argc; i++ ) {
+        len += strlen(ev->argv[i]) + 4;
+      }
+      if ( len > s->event_args_cap ) {
+        s->event_args_cap = len * 2;
+        s->event_args = realloc(s->event_args, s->event_args_cap);
+      }
+      char *args = s->event_args;
+      args += sprintf(args, "%s\", [", ev->path);
+      for ( int i = 0; i < ev->argc; i++ ) {
+        args += sprintf(args, "%s\"%s\"", i > 0 ? ", " : "", ev->argv[i]);
+      }
+      strcpy(args, "], ...");
+      PARSER_execve(p, ev->pid, s->event_args);
+      break;
+    }
+    case RECORD_EVENT_OPENAT: {
+      // the parser may cut the path short, so it gets a copy
+      char *path = strdup(ev->path);
+      PARSER_openat(p, ev->pid, path);
+      free(path);
+      break;
+    }
+    case RECORD_EVENT_CHDIR: {
+      char *path = strdup(ev->path);
+      PARSER_chdir(p, path);
+      free(path);
+      break;
+    }
+    case RECORD_EVENT_SPAWN:
+      PARSER_spawn(p, ev->pid, ev->child);
+      break;
+  }
+}
+
+/*
+ * Hands each line of a trace file to line(), following the file while build_pid, if not
+ * -1, is still writing it; idle(), if set, is called each time the reader catches up
+ * with a running build, and once when the build finishes
+ */
+static void RECORD_follow_trace(FILE *in_file, int build_pid, stats *st, record_line_fn line,
+                                void (*idle)(void *ctx, bool build_running), void *ctx) {
+  bool build_running = build_pid > 0;
+  //read the trace one line at a time, following it while the build is still running
+  trace_reader reader = { in_file, NULL, 0, NULL, 0, 0 };
+  STATS_enter(st, PHASE_PARSE);
+  for ( ;; ) {
+    ssize_t line_len = TRACE_next_line(&reader, build_running);
+    if ( line_len != -1 ) {
+      line(ctx, reader.line, line_len);
+      continue;
+    }
+    if ( !build_running ) {
+      break;
+    }
+    // caught up with strace, check whether the build is done before waiting for more
+    struct rusage trace_usage;
+    if ( wait4(build_pid, NULL, WNOHANG, &trace_usage) == build_pid ) {
+      // the rest of the trace is read before stopping
+      build_running = false;
+      STATS_add_trace_cpu(st, seconds(trace_usage.ru_utime) + seconds(trace_usage.ru_stime));
+      if ( idle != NULL ) {
+        idle(ctx, build_running);
+      }
+      continue;
+    }
+    if ( idle != NULL ) {
+      idle(ctx, build_running);
+    }
+    phase prev = STATS_enter(st, PHASE_TRACE);
+    usleep(FOLLOW_SLEEP_USEC);
+    STATS_enter(st, prev);
+  }
+  free(reader.line);
+  free(reader.partial);
+}
+
+/*
+ * Runs make with the given arguments under strace
+ * Returns the pid of strace
+ */
+static int RECORD_run_strace(const record_config *config, char **make_args, int count) {
+  const char *trace_file_name = config->trace_file_name;
+  // execvp("/usr/bin/strace", ["/usr/bin/strace", "-f"|"-ff", ["-ttt"], "-o", "t.out", "make", [targets], NULL);
+  // arguments for execve
+  char *exec_args[count + 7];
+  int exec_argc = 0;
+  exec_args[exec_argc++] = "/usr/bin/strace";
+  exec_args[exec_argc++] = config->per_pid ? "-ff" : "-f";
+  if ( config->timing ) {
+    exec_args[exec_argc++] = "-ttt";
+  }
+  exec_args[exec_argc++] = "-o";
+  exec_args[exec_argc++] = (char *) trace_file_name;
+  exec_args[exec_argc++] = "make";
+  for ( int i = 0; i < count; i++ ) {
+    exec_args[exec_argc++] = make_args[i];
+  }
+  exec_args[exec_argc] = NULL;
+
+  // a trace left over from an earlier recording must not be read as this one
+  if ( config->per_pid ) {
+    PERPID_remove(trace_file_name);
+  }
+  else {
+    unlink(trace_file_name);
+  }
+  STATS_enter(config->st, PHASE_TRACE);
+  // fork a child process to execute strace in
+  int build_pid = fork();
+  if ( build_pid == 0 ) {
+    if ( config->pwd != NULL && chdir(config->pwd) != 0 ) {
+      fprintf(stderr, "ERROR: directory %s could not be entered!\n", config->pwd);
+      _exit(1);
+    }
+    execvp(exec_args[0], exec_args);
+    fprintf(stderr, "ERROR: %s could not be executed!\n", exec_args[0]);
+    _exit(1);
+  }
+  return build_pid;
+}
+
+/*
+ * Runs make with the given arguments under strace and opens the trace it writes
+ * Returns the trace, or NULL if it could not be read; *build_pid is set to the pid
+ * of strace, or -1 if it has already finished
+ */
+static FILE *RECORD_start_trace(const record_config *config, char **make_args, int count,
+                                int *build_pid) {
+  const char *trace_file_name = config->trace_file_name;
+  *build_pid = RECORD_run_strace(config, make_args, count);
+
+  //open input file for reading, waiting for strace to create it
+  FILE *in_file = NULL;
+  while ( (in_file = fopen(trace_file_name, "r")) == NULL && *build_pid > 0 ) {
+    if ( waitpid(*build_pid, NULL, WNOHANG) == *build_pid ) {
+      *build_pid = -1;
+    }
+    else {
+      usleep(FOLLOW_SLEEP_USEC);
+    }
+  }
+  if (in_file == NULL ) {
+    //check for fopen failure
+    fprintf(stderr, "ERROR: input file to be parsed,  %s, could not be opened!\n", trace_file_name);
+  }
+  return in_file;
+}
+
+/*
+ * Parses the per-process files of a trace written by strace -ff
+ * Returns 0, or 1 if there are none
+ */
+static int RECORD_parse_per_pid(record_session *s) {
+  int jobs = RECORD_jobs(&s->config);
+  STATS_enter(s->config.st, PHASE_PARSE);
+  int status = PERPID_parse(&s->p, s->config.trace_file_name, jobs < 1 ? 1 : jobs);
+  if ( s->config.pr != NULL ) {
+    PROGRESS_update(s->config.pr, &s->p, false);
+  }
+  return status;
+}
+
+/*
+ * Writes a checkpoint of the parse, with the output files flushed up to it
+ */
+static void RECORD_checkpoint(record_session *s) {
+  phase prev = STATS_enter(s->config.st, PHASE_EMIT);
+  checkpoint ck;
+  ck.trace_offset = s->trace_offset;
+  ck.trace_check = CHECKPOINT_trace_check(s->trace_fd, s->trace_offset);
+  FILE *files[CHECKPOINT_OUTPUTS] = { s->cmds_file, s->sources_file, s->dep_file,
+                                      s->sandbox_mkfile };
+  bool flushed = true;
+  for ( int i = 0; i < CHECKPOINT_OUTPUTS; i++ ) {
+    ck.outputs[i] = -1;
+    if ( files[i] != NULL ) {
+      flushed &= fflush(files[i]) == 0;
+      ck.outputs[i] = ftello(files[i]);
+    }
+  }
+  ck.make_targets = s->make_targets_list;
+  if ( flushed ) {
+    CHECKPOINT_save(s->config.checkpoint_file_name, &s->p, &ck);
+  }
+  s->checkpoint_at = s->trace_offset + s->config.checkpoint_bytes;
+  STATS_enter(s->config.st, prev);
+}
+
+/*
+ * Parses one line of the trace, reporting progress every 4096 lines and checkpointing
+ * the parse every config.checkpoint_bytes
+ */
+static void RECORD_trace_line(void *ctx, char *line, long len) {
+  record_session *s = ctx;
+  s->trace_offset += len;
+  PARSER_feed_line(&s->p, line, len);
+  if ( s->config.pr != NULL && (s->p.lines & 0xfff) == 0 ) {
+    PROGRESS_update(s->config.pr, &s->p, s->build_running);
+  }
+  if ( s->checkpoint_at > 0 && s->trace_offset >= s->checkpoint_at ) {
+    RECORD_checkpoint(s);
+  }
+}
+
+static void RECORD_trace_idle(void *ctx, bool build_running) {
+  record_session *s = ctx;
+  s->build_running = build_running;
+  if ( s->config.pr != NULL ) {
+    PROGRESS_update(s->config.pr, &s->p, build_running);
+  }
+}
+
+/*
+ * A new or recycled chunk for the reader to fill
+ */
+static line_chunk *PIPE_new_chunk(record_pipeline *pl) {
+  line_chunk *c = RING_pop(&pl->free_chunks);
+  if ( c == NULL ) {
+    c = calloc(1, sizeof(line_chunk));
+    c->cap = CHUNK_BYTES;
+    c->data = malloc(c->cap);
+  }
+  c->used = 0;
+  c->count = 0;
+  return c;
+}
+
+static void PIPE_free_chunk(line_chunk *c) {
+  free(c->data);
+  free(c);
+}
+
+static void PIPE_send_chunk(record_pipeline *pl) {
+  STAGE_give(&pl->reader, pl->chunk);
+  pl->chunk = PIPE_new_chunk(pl);
+}
+
+/*
+ * The reader stage: adds one trace line to the chunk being filled
+ */
+static void PIPE_read_line(void *ctx, char *line, long len) {
+  record_pipeline *pl = ctx;
+  if ( pl->idle_since > 0 ) {
+    pl->reader.starved += PIPE_now() - pl->idle_since;
+    pl->idle_since = 0;
+  }
+  line_chunk *c = pl->chunk;
+  if ( c->count == CHUNK_LINES || ( c->used + len + 1 > c->cap && c->count > 0 ) ) {
+    PIPE_send_chunk(pl);
+    c = pl->chunk;
+  }
+  if ( c->used + len + 1 > c->cap ) {
+    // a line longer than a whole chunk
+    c->cap = c->used + len + 1;
+    c->data = realloc(c->data, c->cap);
+  }
+  memcpy(c->data + c->used, line, len);
+  c->data[c->used + len] = '\0';
+  c->used += len + 1;
+  c->lengths[c->count++] = len;
+  pl->reader.items++;
+}
+
+/*
+ * The reader caught up with strace: the lines read so far are passed on without waiting
+ * for the chunk to fill, and the time until the next line counts as starved
+ */
+static void PIPE_idle(void *ctx, bool build_running) {
+  record_pipeline *pl = ctx;
+  atomic_store(&pl->build_running, build_running);
+  if ( pl->chunk->count > 0 ) {
+    PIPE_send_chunk(pl);
+  }
+  if ( build_running && pl->idle_since == 0 ) {
+    pl->idle_since = PIPE_now();
+  }
+}
+
+/*
+ * Brings the parser's copy counters up to date with the copier's, for progress reports
+ */
+static void PIPE_sync_counters(record_pipeline *pl) {
+  parser *p = &pl->s->p;
+  long files = atomic_load(&pl->files_copied);
+  p->deps_pending -= files - p->files_copied;
+  p->files_copied = files;
+  p->bytes_copied = atomic_load(&pl->bytes_copied);
+}
+
+/*
+ * The parser stage: parses the chunks of lines, giving finished targets to the copier
+ * through RECORD_finish_target(), and returns the chunks to the reader
+ */
+static void *PIPE_parse(void *arg) {
+  record_pipeline *pl = arg;
+  record_session *s = pl->s;
+  parser *p = &s->p;
+  progress *pr = s->config.pr;
+  long first_line = p->lines;
+  STATS_enter(s->config.st, PHASE_PARSE);
+  line_chunk *c;
+  while ( (c = STAGE_take(&pl->parser)) != PIPE_END ) {
+    char *line = c->data;
+    for ( int i = 0; i < c->count; i++ ) {
+      PARSER_feed_line(p, line, c->lengths[i]);
+      line += c->lengths[i] + 1;
+      if ( pr != NULL && (p->lines & 0xfff) == 0 ) {
+        PIPE_sync_counters(pl);
+        PROGRESS_update(pr, p, atomic_load(&pl->build_running));
+      }
+    }
+    if ( !RING_push(&pl->free_chunks, c) ) {
+      PIPE_free_chunk(c);
+    }
+  }
+  STATS_enter(s->config.st, PHASE_NONE);
+  STAGE_give(&pl->parser, PIPE_END);
+  STAGE_finish(&pl->parser);
+  // reported in lines, like the reader, rather than in chunks
+  pl->parser.items = p->lines - first_line;
+  return NULL;
+}
+
+/*
+ * The copier stage
+ */
+static void *PIPE_copy(void *arg) {
+  record_pipeline *pl = arg;
+  target *tar;
+  while ( (tar = STAGE_take(&pl->copier)) != PIPE_END ) {
+    long bytes = RECORD_copy_target(pl->s, tar, &pl->copy_st);
+    atomic_fetch_add(&pl->files_copied, TARGET_dep_count(tar));
+    atomic_fetch_add(&pl->bytes_copied, bytes);
+    STAGE_give(&pl->copier, tar);
+  }
+  STAGE_give(&pl->copier, PIPE_END);
+  STAGE_finish(&pl->copier);
+  return NULL;
+}
+
+/*
+ * The emitter stage
+ */
+static void *PIPE_emit(void *arg) {
+  record_pipeline *pl = arg;
+  target *tar;
+  while ( (tar = STAGE_take(&pl->emitter)) != PIPE_END ) {
+    RECORD_emit_target(pl->s, tar, TARGET_dep_count(tar), &pl->emit_st);
+  }
+  STAGE_finish(&pl->emitter);
+  return NULL;
+}
+
+/*
+ * Reads a trace like RECORD_follow_trace(), with the reader on this thread and the
+ * parser, copier and emitter each on a thread of their own
+ */
+static void RECORD_run_pipeline(record_session *s, FILE *in_file, int build_pid) {
+  stats *st = s->config.st;
+  parser *p = &s->p;
+  record_pipeline *pl = calloc(1, sizeof(record_pipeline));
+  pl->s = s;
+  RING_init(&pl->lines, PIPE_CHUNKS);
+  RING_init(&pl->free_chunks, PIPE_CHUNKS * 2);
+  RING_init(&pl->parsed, PIPE_TARGETS);
+  RING_init(&pl->copied, PIPE_TARGETS);
+  // every thread keeps its own statistics, added together at the end
+  STATS_init(&pl->reader_st, st->enabled);
+  STATS_init(&pl->copy_st, st->enabled);
+  STATS_init(&pl->emit_st, st->enabled);
+  atomic_init(&pl->build_running, build_pid > 0);
+  atomic_init(&pl->files_copied, p->files_copied);
+  atomic_init(&pl->bytes_copied, p->bytes_copied);
+  STAGE_init(&pl->reader, "reader", NULL, &pl->lines);
+  STAGE_init(&pl->parser, "parser", &pl->lines, &pl->parsed);
+  STAGE_init(&pl->copier, "copier", &pl->parsed, &pl->copied);
+  STAGE_init(&pl->emitter, "emitter", &pl->copied, NULL);
+  pl->chunk = PIPE_new_chunk(pl);
+
+  // the parser's thread takes over st until the stages are done
+  STATS_enter(st, PHASE_NONE);
+  s->pipe = pl;
+  pthread_t threads[3];
+  pthread_create(&threads[0], NULL, PIPE_parse, pl);
+  pthread_create(&threads[1], NULL, PIPE_copy, pl);
+  pthread_create(&threads[2], NULL, PIPE_emit, pl);
+
+  RECORD_follow_trace(in_file, build_pid, &pl->reader_st, PIPE_read_line, PIPE_idle, pl);
+  if ( pl->chunk->count > 0 ) {
+    PIPE_send_chunk(pl);
+  }
+  PIPE_free_chunk(pl->chunk);
+  STAGE_give(&pl->reader, PIPE_END);
+  STAGE_finish(&pl->reader);
+  for ( int i = 0; i < 3; i++ ) {
+    pthread_join(threads[i], NULL);
+  }
+  s->pipe = NULL;
+
+  PIPE_sync_counters(pl);
+  STATS_enter(st, PHASE_PARSE);
+  stats *thread_stats[3] = { &pl->reader_st, &pl->copy_st, &pl->emit_st };
+  for ( int i = 0; i < 3; i++ ) {
+    STATS_add(st, thread_stats[i]);
+    STATS_free(thread_stats[i]);
+  }
+  stage *stages[4] = { &pl->reader, &pl->parser, &pl->copier, &pl->emitter };
+  for ( int i = 0; i < 4; i++ ) {
+    STAGE_report(stages[i], st);
+  }
+  line_chunk *c;
+  while ( (c = RING_pop(&pl->free_chunks)) != NULL ) {
+    PIPE_free_chunk(c);
+  }
+  RING_free(&pl->lines);
+  RING_free(&pl->free_chunks);
+  RING_free(&pl->parsed);
+  RING_free(&pl->copied);
+  free(pl);
+}
+
+/*
+ * Makes make rebuild, and so re-record, the targets of the previous recording that a
+ * probe shows to be stale: a path they looked for and did not find exists now, or one
+ * they found is gone. Neither is a prerequisite make knows of, so the target's output is
+ * given the oldest modification time instead, which any of its prerequisites is newer than.
+ * The relative paths of a target are found from the directory its command ran in.
+ */
+static void RECORD_expire_probed(record_session *s) {
+  for ( int t = 0; t < s->recorded.count; t++ ) {
+    target *tar = s->recorded.targets[t];
+    char *dir = tar->dir != NULL ? tar->dir : s->pwd;
+    const char *path = PROBED_first_present(&tar->absent, dir);
+    const char *change = "now exists";
+    if ( path == NULL ) {
+      path = PROBED_first_missing(&tar->exists, dir);
+      change = "no longer exists";
+    }
+    if ( path == NULL ) {
+      continue;
+    }
+    char *output = tar->target_name[0] == '/' ? strdup(tar->target_name) :
+                   sandbox_path(dir, tar->target_name);
+    struct timespec oldest[2] = { { 0, UTIME_OMIT }, { 0, 0 } };
+    if ( utimensat(AT_FDCWD, output, oldest, 0) == 0 ) {
+      fprintf(stderr, "Re-recording %s: %s %s\n", tar->target_name, path, change);
+    }
+    else if ( errno != ENOENT ) {
+      fprintf(stderr, "ERROR: %s could not be marked out of date: %s\n", output, strerror(errno));
+    }
+    free(output);
+  }
+}
+
+/*
+ * Starts sampling the processes under strace with config.usage, for the parser to add to
+ * the targets they belong to
+ */
+static void RECORD_start_usage(record_session *s, int build_pid) {
+  if ( !s->config.usage || build_pid <= 0 ) {
+    return;
+  }
+  s->usage = malloc(sizeof(usage_sampler));
+  if ( USAGE_start(s->usage, build_pid) != 0 ) {
+    USAGE_free(s->usage);
+    free(s->usage);
+    s->usage = NULL;
+    return;
+  }
+  s->p.usage = s->usage;
+}
+
+/*
+ * Runs make with the given arguments under strace, parsing its trace while it is written,
+ * or with config.per_pid once the build has finished
+ * Returns 0, or 1 if the trace could not be read
+ */
+int RECORD_trace_build(record_session *s, char **make_args, int count) {
+  if ( s->config.incremental && s->config.track_probes ) {
+    RECORD_expire_probed(s);
+  }
+  int build_pid;
+  if ( s->config.per_pid ) {
+    // the files of the processes are only read once the build is done
+    build_pid = RECORD_run_strace(&s->config, make_args, count);
+    RECORD_start_usage(s, build_pid);
+    struct rusage trace_usage;
+    if ( build_pid > 0 && wait4(build_pid, NULL, 0, &trace_usage) == build_pid ) {
+      STATS_add_trace_cpu(s->config.st, seconds(trace_usage.ru_utime) + seconds(trace_usage.ru_stime));
+    }
+    if ( s->usage != NULL ) {
+      USAGE_stop(s->usage);
+    }
+    return RECORD_parse_per_pid(s);
+  }
+  FILE *in_file = RECORD_start_trace(&s->config, make_args, count, &build_pid);
+  if ( in_file == NULL ) {
+    return 1;
+  }
+  RECORD_start_usage(s, build_pid);
+  s->build_running = build_pid > 0;
+  s->trace_fd = fileno(in_file);
+  if ( s->config.pipeline ) {
+    RECORD_run_pipeline(s, in_file, build_pid);
+  }
+  else {
+    RECORD_follow_trace(in_file, build_pid, s->config.st, RECORD_trace_line, RECORD_trace_idle, s);
+  }
+  if ( s->usage != NULL ) {
+    USAGE_stop(s->usage);
+  }
+  s->parsed = true;
+  fclose(in_file);
+  return 0;
+}
+
+/*
+ * Parses the trace file of an earlier run
+ * Returns 0, or 1 if it could not be read
+ */
+int RECORD_parse_trace(record_session *s) {
+  if ( s->config.per_pid ) {
+    return RECORD_parse_per_pid(s);
+  }
+  FILE *in_file = fopen(s->config.trace_file_name, "r");
+  if (in_file == NULL ) {
+    //check for fopen failure
+    fprintf(stderr, "ERROR: input file to be parsed,  %s, could not be opened!\n",
+            s->config.trace_file_name);
+    return 1;
+  }
+  s->trace_fd = fileno(in_file);
+  // a resumed parse starts where its checkpoint was taken, in the same trace
+  if ( s->config.resume &&
+       ( fseeko(in_file, s->trace_offset, SEEK_SET) != 0 ||
+         CHECKPOINT_trace_check(s->trace_fd, s->trace_offset) != s->trace_check ) ) {
+    fprintf(stderr, "ERROR: checkpoint %s is not of the trace in %s!\n",
+            s->config.checkpoint_file_name, s->config.trace_file_name);
+    fclose(in_file);
+    return 1;
+  }
+  if ( s->config.pipeline ) {
+    RECORD_run_pipeline(s, in_file, -1);
+  }
+  else {
+    RECORD_follow_trace(in_file, -1, s->config.st, RECORD_trace_line, RECORD_trace_idle, s);
+  }
+  s->parsed = true;
+  fclose(in_file);
+  return 0;
+}
+
+/*
+ * Runs make under strace like RECORD_trace_build(), or with make_args NULL reads the
+ * trace of an earlier run, but hands every line to line() instead of parsing it
+ * Returns 0, or 1 if the trace could not be read
+ */
+int RECORD_stream_trace(const record_config *config, char **make_args, int count,
+                        record_line_fn line, void *ctx) {
+  record_config streamed = *config;
+  stats own_stats;
+  if ( streamed.st == NULL ) {
+    STATS_init(&own_stats, false);
+    streamed.st = &own_stats;
+  }
+  config = &streamed;
+  int build_pid = -1;
+  FILE *in_file = make_args != NULL ? RECORD_start_trace(config, make_args, count, &build_pid) :
+                                      fopen(config->trace_file_name, "r");
+  if ( in_file == NULL ) {
+    if ( make_args == NULL ) {
+      fprintf(stderr, "ERROR: input file to be parsed,  %s, could not be opened!\n",
+              config->trace_file_name);
+    }
+    return 1;
+  }
+  RECORD_follow_trace(in_file, build_pid, config->st, line, NULL, ctx);
+  fclose(in_file);
+  return 0;
+}
+
+const char *RECORD_sandbox_dir(record_session *s) {
+  return s->sandbox_pwd;
+}
+
+/*
+ * Returns the lines of trace parsed so far, strace lines and events alike
+ */
+long RECORD_lines(record_session *s) {
+  return s->p.lines;
+}
+
+/*
+ * Adds the lines of new_sources that are not in the source file list yet to its end,
+ * replacing the file atomically
+ */
+static void merge_source_files(const char *sources_file_name, FILE *new_sources) {
+  intern_table seen;
+  INTERN_init(&seen);
+  char *tmp_path;
+  FILE *out = ATOMIC_open(sources_file_name, &tmp_path);
+  if ( out == NULL ) {
+    INTERN_free(&seen);
+    return;
+  }
+  char *line = NULL;
+  size_t cap = 0;
+  FILE *old_sources = fopen(sources_file_name, "r");
+  FILE *inputs[2] = { old_sources, new_sources };
+  rewind(new_sources);
+  for ( int i = 0; i < 2; i++ ) {
+    if ( inputs[i] == NULL ) {
+      continue;
+    }
+    while ( getline(&line, &cap, inputs[i]) != -1 ) {
+      // the old list is kept as it was, only lines it does not have yet are added
+      int count = seen.count;
+      if ( INTERN_id(&seen, line) == count || inputs[i] == old_sources ) {
+        fputs(line, out);
+      }
+    }
+  }
+  if ( old_sources != NULL ) {
+    fclose(old_sources);
+  }
+  free(line);
+  INTERN_free(&seen);
+  ATOMIC_commit(out, tmp_path, sources_file_name);
+}
+
+/*
+ * Finishes the last target, completes the output files and frees the session
+ * Returns 0, or 1 if an output file could not be written
+ */
+int RECORD_close(record_session *s) {
+  const record_config *config = &s->config;
+  int failed = 0;
+  PARSER_finish(&s->p);
+  if ( config->pr != NULL ) {
+    PROGRESS_finish(config->pr, &s->p);
+  }
+  if ( s->usage != NULL ) {
+    s->p.usage = NULL;
+    USAGE_free(s->usage);
+    free(s->usage);
+  }
+
+  STATS_enter(config->st, PHASE_EMIT);
+  if ( config->incremental ) {
+    // merge the re-recorded targets into the previous model and write it all out again
+    int rerecorded = s->changed.count;
+    int kept = s->recorded.count;
+    int added = MODEL_merge(&s->recorded, &s->changed);
+    kept -= rerecorded - added;
+    if ( config->dependency_file_name != NULL ) {
+      failed |= MODEL_save(&s->recorded, config->dependency_file_name) != 0;
+    }
+    if ( config->cmds_file_name != NULL ) {
+      failed |= MODEL_save_commands(&s->recorded, config->cmds_file_name) != 0;
+    }
+    if ( config->sandbox ) {
+      failed |= MODEL_save_makefile(&s->recorded, s->sandbox_pwd, s->sandbox_mkfile_path) != 0;
+    }
+    if ( s->sources_file != NULL ) {
+      merge_source_files(config->sources_file_name, s->sources_file);
+    }
+    fprintf(stdout, "Re-recorded %d targets (%d new), kept %d from the previous recording\n",
+            rerecorded, added, kept);
+  }
+  else if ( s->sandbox_mkfile != NULL ) {
+    //write the all_make_targets wrapper target at the end of the makefile
+    fprintf(s->sandbox_mkfile, "\nall_make_targets:%s", s->make_targets_list);
+  }
+
+  if ( s->mf != NULL ) {
+    // every distinct dependency of the recording is hashed once, at the end
+    if ( config->incremental ) {
+      for ( int t = 0; t < s->recorded.count; t++ ) {
+        MANIFEST_add_target(s->mf, s->recorded.targets[t]);
+      }
+    }
+    MANIFEST_hash(s->mf, s->pwd, RECORD_jobs(config), config->st);
+    failed |= MANIFEST_save(s->mf, config->manifest_file_name) != 0;
+    MANIFEST_free(s->mf);
+    free(s->mf);
+  }
+
+  //close opened files
+  FILE *files[4] = { s->cmds_file, s->sources_file, s->dep_file, s->sandbox_mkfile };
+  for ( int i = 0; i < 4; i++ ) {
+    if ( files[i] != NULL && fclose(files[i]) != 0 ) {
+      failed = 1;
+    }
+  }
+  if ( !failed && s->parsed && ( s->checkpoint_at > 0 || config->resume ) ) {
+    // the recording is complete, there is nothing left to resume
+    unlink(config->checkpoint_file_name);
+  }
+  MODEL_free(&s->recorded);
+  free(s->make_targets_list);
+  free(s->event_args);
+  free(s->sandbox_mkfile_path);
+  free(s->sandbox_pwd);
+  free(s->pwd);
+  free(s->p.pwd);
+  free(s->p.start_pwd);
+  free(s);
+  return failed;
+}
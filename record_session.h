@@ -0,0 +1,156 @@
+/*
+ * The record_build library: one recording session
+ *
+ * A session turns a stream of system calls from a build into targets, their commands
+ * and dependencies. The calls can be pushed as strace -f lines (RECORD_push_line()) or
+ * as decoded events from another tracer (RECORD_push_event()), or the session can run
+ * make under strace itself (RECORD_trace_build()). Each finished target is passed to the
+ * hooks: target_finalized to observe it, then the copier and the emitter, which default
+ * to copying its dependencies into the sandbox and writing it to the output files.
+ * Every output file is optional, so a session can run in-process without any of them.
+ * A parse of a single trace file can checkpoint itself every config.checkpoint_bytes and
+ * be resumed from its last checkpoint by a session opened with config.resume.
+ * With config.pipeline the hooks are called on the threads of the pipeline's stages: the
+ * finalized hook on the parser's, the copier on the copier's and the emitter on its own.
+ *
+ *    record_config config;
+ *    RECORD_default_config(&config);
+ *    record_session *s = RECORD_open(&config, NULL);
+ *    while ( ... ) RECORD_push_line(s, line, len);
+ *    RECORD_close(s);
+ */
+
+#ifndef RECORD_SESSION_H
+#define RECORD_SESSION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "record_core.h"
+#include "record_manifest.h"
+#include "record_model.h"
+#include "record_parser.h"
+#include "record_progress.h"
+#include "record_stats.h"
+#include "record_usage.h"
+
+/*
+ * Where a session writes its results; a NULL file name leaves that file out
+ */
+typedef struct record_config_struct {
+  const char *pwd;                    // directory the build starts in, NULL for the current one
+  const char *trace_file_name;        // written by strace in RECORD_trace_build()
+  const char *cmds_file_name;
+  const char *sources_file_name;
+  const char *dependency_file_name;
+  const char *sandbox_dir;            // NULL for pwd/sandbox
+  const char *manifest_file_name;     // written with hash, see record_manifest.h
+  const char *includes_file_name;     // the include graph, see record_includes.h
+  const char *preprocessed_makefile_name; // in the sandbox, see record_preprocess.h
+  const char *checkpoint_file_name;   // snapshots of the parse, see record_checkpoint.h
+  long long checkpoint_bytes;         // trace parsed between two checkpoints, 0 for none
+  bool sandbox;                       // copy dependencies and write the sandbox Makefile
+  bool incremental;                   // merge into the previous recording, see --incremental
+  bool timing;                        // strace -ttt, to record how long each target took
+  bool track_reads;                   // only files read are dependencies, see PARSER_open_fd()
+  bool track_probes;                  // keep the paths probed by each target, see record_probed.h
+  bool hash;                          // hash every dependency into the manifest file
+  bool pipeline;                      // read, parse, copy and emit on separate threads
+  bool per_pid;                       // strace -ff, one trace file per process, see record_perpid.h
+  bool resume;                        // RECORD_parse_trace() continues from the checkpoint
+  bool usage;                         // sample the memory and cpu time of the processes of the
+                                      //  build RECORD_trace_build() runs, see record_usage.h
+  int jobs;                           // threads reading per_pid trace files or hashing the
+                                      //  dependencies, 0 for one per cpu
+  stats *st;                          // NULL when no statistics are kept
+  progress *pr;                       // NULL when no progress is reported
+} record_config;
+
+typedef struct record_session_struct record_session;
+typedef struct record_pipeline_struct record_pipeline;
+
+/*
+ * Receives one line of strace output, which it may modify
+ */
+typedef void (*record_line_fn)(void *ctx, char *line, long len);
+
+/*
+ * Callbacks receiving the finished targets; any of them may be NULL
+ */
+typedef struct record_hooks_struct {
+  void *ctx;
+  // called first for every finished target
+  void (*target_finalized)(void *ctx, const target *tar);
+  // replaces the sandbox copy of the target's dependencies, returns the bytes copied
+  long (*copy)(void *ctx, record_session *s, target *tar);
+  // replaces writing the target to the dependency file and the sandbox Makefile
+  void (*emit)(void *ctx, record_session *s, target *tar);
+} record_hooks;
+
+/*
+ * A decoded system call, for tracers that do not produce strace output
+ */
+typedef enum {
+  RECORD_EVENT_EXECVE,    // pid ran path with argv
+  RECORD_EVENT_OPENAT,    // pid opened path
+  RECORD_EVENT_CHDIR,     // pid changed directory to path
+  RECORD_EVENT_SPAWN      // pid created the process child
+} record_event_type;
+
+typedef struct record_event_struct {
+  record_event_type type;
+  int pid;
+  int child;
+  const char *path;
+  const char *const *argv;
+  int argc;
+  int result;             // the return value, negative for a failed call
+  double time;            // seconds, 0 when unknown
+} record_event;
+
+/*
+ * Everything one recording keeps; treat as opaque outside record_session.c
+ */
+struct record_session_struct {
+  record_config config;
+  record_hooks hooks;
+  char *pwd;
+  char *sandbox_pwd;
+  char *sandbox_mkfile_path;
+  FILE *cmds_file;
+  FILE *sources_file;
+  FILE *dep_file;
+  FILE *sandbox_mkfile;
+  char *make_targets_list;
+  size_t make_targets_cap;
+  model recorded;         // previous recording, updated by an incremental one
+  model changed;          // targets re-recorded by an incremental recording
+  char *event_args;       // an execve event formatted as the parser reads it
+  size_t event_args_cap;
+  stats own_stats;        // used when the config has no statistics
+  bool build_running;     // is the trace being parsed still being written?
+  record_pipeline *pipe;  // the stages running with --pipeline, NULL otherwise
+  manifest *mf;           // the targets to hash with config.hash, NULL otherwise
+  usage_sampler *usage;   // the build's processes sampled with config.usage, NULL otherwise
+  long long trace_offset; // bytes of the trace handed to the parser
+  long long checkpoint_at; // the offset of the next checkpoint, 0 when none are taken
+  int trace_fd;           // the trace being parsed, for the checkpoints to check
+  uint64_t trace_check;   // of the trace resumed, see CHECKPOINT_trace_check()
+  bool parsed;            // the whole trace was parsed, its checkpoint is no longer needed
+  parser p;
+};
+
+void RECORD_default_config(record_config *config);
+record_session *RECORD_open(const record_config *config, const record_hooks *hooks);
+void RECORD_push_line(record_session *s, char *line, long len);
+void RECORD_push_event(record_session *s, const record_event *ev);
+int RECORD_trace_build(record_session *s, char **make_args, int count);
+int RECORD_parse_trace(record_session *s);
+int RECORD_stream_trace(const record_config *config, char **make_args, int count,
+                        record_line_fn line, void *ctx);
+const char *RECORD_sandbox_dir(record_session *s);
+long RECORD_lines(record_session *s);
+int RECORD_close(record_session *s);
+
+#endif
@@ -0,0 +1,365 @@
+/*
+ * Phase timing and throughput statistics, see record_stats.h
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "record_stats.h"
+
+// initial number of buckets in the copied path set
+#define COPIED_BUCKETS 1024
+
+static const char *phase_names[PHASE_COUNT] = { "trace", "parse", "deps", "copy", "emit", "hash" };
+
+static const char *line_class_names[LINE_CLASS_COUNT] = {
+  "execve", "openat", "chdir", "process", "resumed", "exit", "other"
+};
+
+static double clock_seconds(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void STATS_init(stats *st, bool enabled) {
+  memset(st, 0, sizeof(stats));
+  st->enabled = enabled;
+  st->current = PHASE_NONE;
+  if ( enabled ) {
+    st->copied_buckets = COPIED_BUCKETS;
+    st->copied = calloc(st->copied_buckets, sizeof(path_entry *));
+  }
+}
+
+/*
+ * Charges the time since the last switch to the current phase and makes next current.
+ * Returns the phase that was current, to switch back to when next is done.
+ */
+phase STATS_enter(stats *st, phase next) {
+  if ( !st->enabled ) {
+    return PHASE_NONE;
+  }
+  double wall = clock_seconds(CLOCK_MONOTONIC);
+  // the CPU time of this thread, which is the whole process unless --pipeline runs stages
+  // on threads of their own, each with its own stats
+  double cpu = clock_seconds(CLOCK_THREAD_CPUTIME_ID);
+  phase prev = st->current;
+  if ( prev != PHASE_NONE ) {
+    st->wall[prev] += wall - st->phase_start_wall;
+    st->cpu[prev] += cpu - st->phase_start_cpu;
+  }
+  st->current = next;
+  st->phase_start_wall = wall;
+  st->phase_start_cpu = cpu;
+  return prev;
+}
+
+/*
+ * The build runs in a child process, so the CPU time of the trace phase is measured by
+ * the caller; its wall time is the time spent waiting for the build to write more trace
+ */
+void STATS_add_trace_cpu(stats *st, double cpu) {
+  st->cpu[PHASE_TRACE] += cpu;
+}
+
+/*
+ * Counts one trace line by the class of its syscall
+ * A line is "PID syscall(...", "PID <... syscall resumed>", "PID +++ ..." or "PID --- ..."
+ */
+void STATS_count_line(stats *st, char *line, long len) {
+  if ( !st->enabled ) {
+    return;
+  }
+  st->bytes_parsed += len;
+  char *call = line;
+  while ( *call >= '0' && *call <= '9' ) {
+    call++;
+  }
+  while ( *call == ' ' ) {
+    call++;
+  }
+  line_class class = LINE_OTHER;
+  if ( !strncmp(call, "execve(", 7) ) {
+    class = LINE_EXECVE;
+  }
+  else if ( !strncmp(call, "openat(", 7) ) {
+    class = LINE_OPENAT;
+  }
+  else if ( !strncmp(call, "chdir(", 6) ) {
+    class = LINE_CHDIR;
+  }
+  else if ( !strncmp(call, "clone", 5) || !strncmp(call, "vfork(", 6) || !strncmp(call, "fork(", 5) ) {
+    class = LINE_PROCESS;
+  }
+  else if ( !strncmp(call, "<...", 4) ) {
+    class = LINE_RESUMED;
+  }
+  else if ( !strncmp(call, "+++", 3) || !strncmp(call, "---", 3) ) {
+    class = LINE_EXIT;
+  }
+  st->lines[class]++;
+}
+
+void STATS_count_target(stats *st, long deps) {
+  if ( !st->enabled ) {
+    return;
+  }
+  st->targets++;
+  st->deps += deps;
+}
+
+/*
+ * FNV-1a hash of a path
+ */
+static uint64_t hash_path(char *path) {
+  uint64_t hash = 14695981039346656037ULL;
+  for ( unsigned char *c = (unsigned char *) path; *c != '\0'; c++ ) {
+    hash = (hash ^ *c) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+/*
+ * Counts one distinct file hashed for the manifest
+ */
+void STATS_count_hash(stats *st, long bytes) {
+  if ( !st->enabled ) {
+    return;
+  }
+  st->hashed_files++;
+  st->hashed_bytes += bytes;
+}
+
+/*
+ * Counts the shared dependency sets the manifest kept the targets' dependencies in
+ */
+void STATS_count_depsets(stats *st, long sets, long deltas, long ids, long stored) {
+  if ( !st->enabled ) {
+    return;
+  }
+  st->dep_sets += sets;
+  st->dep_set_deltas += deltas;
+  st->dep_ids += ids;
+  st->dep_ids_stored += stored;
+}
+
+/*
+ * Counts one file copied into the sandbox, and whether it was the first copy of that path
+ */
+void STATS_count_copy(stats *st, char *path, long bytes) {
+  if ( !st->enabled ) {
+    return;
+  }
+  st->copied_files++;
+  st->copied_bytes += bytes;
+  size_t bucket = hash_path(path) % st->copied_buckets;
+  for ( path_entry *e = st->copied[bucket]; e != NULL; e = e->next ) {
+    if ( !strcmp(e->path, path) ) {
+      return;
+    }
+  }
+  path_entry *e = malloc(sizeof(path_entry));
+  e->path = strdup(path);
+  e->next = st->copied[bucket];
+  st->copied[bucket] = e;
+  st->unique_files++;
+  st->unique_bytes += bytes;
+  if ( st->unique_files > st->copied_buckets * 2 ) {
+    // rehash into twice as many buckets
+    size_t buckets = st->copied_buckets * 2;
+    path_entry **table = calloc(buckets, sizeof(path_entry *));
+    for ( size_t i = 0; i < st->copied_buckets; i++ ) {
+      path_entry *cur = st->copied[i];
+      while ( cur != NULL ) {
+        path_entry *next = cur->next;
+        size_t b = hash_path(cur->path) % buckets;
+        cur->next = table[b];
+        table[b] = cur;
+        cur = next;
+      }
+    }
+    free(st->copied);
+    st->copied = table;
+    st->copied_buckets = buckets;
+  }
+}
+
+/*
+ * Adds the statistics kept by another thread of the same recording to st; each kind of
+ * work is expected to be counted by one of them, so their copied files do not overlap
+ */
+void STATS_add(stats *st, stats *from) {
+  if ( !st->enabled || !from->enabled ) {
+    return;
+  }
+  STATS_enter(from, PHASE_NONE);
+  for ( int i = 0; i < PHASE_COUNT; i++ ) {
+    st->wall[i] += from->wall[i];
+    st->cpu[i] += from->cpu[i];
+  }
+  for ( int i = 0; i < LINE_CLASS_COUNT; i++ ) {
+    st->lines[i] += from->lines[i];
+  }
+  st->bytes_parsed += from->bytes_parsed;
+  st->targets += from->targets;
+  st->deps += from->deps;
+  st->copied_files += from->copied_files;
+  st->hashed_files += from->hashed_files;
+  st->hashed_bytes += from->hashed_bytes;
+  st->copied_bytes += from->copied_bytes;
+  st->unique_bytes += from->unique_bytes;
+  for ( size_t i = 0; i < from->copied_buckets; i++ ) {
+    for ( path_entry *e = from->copied[i]; e != NULL; e = e->next ) {
+      // recorded as unique here too; the copy itself was already counted above
+      STATS_count_copy(st, e->path, 0);
+      st->copied_files--;
+    }
+  }
+}
+
+/*
+ * Adds one stage of a --pipeline recording: how many items it handled, and how much of
+ * the elapsed time it was busy, starved of input, or blocked by a full output
+ */
+void STATS_add_stage(stats *st, const char *name, long items, double elapsed, double starved,
+                     double blocked) {
+  if ( !st->enabled || st->stage_count == STATS_MAX_STAGES ) {
+    return;
+  }
+  stage_stats *sg = &st->stages[st->stage_count++];
+  sg->name = name;
+  sg->items = items;
+  sg->elapsed = elapsed;
+  sg->starved = starved;
+  sg->blocked = blocked;
+}
+
+void STATS_free(stats *st) {
+  for ( size_t i = 0; i < st->copied_buckets; i++ ) {
+    path_entry *e = st->copied[i];
+    while ( e != NULL ) {
+      path_entry *next = e->next;
+      free(e->path);
+      free(e);
+      e = next;
+    }
+  }
+  free(st->copied);
+  st->copied = NULL;
+  st->copied_buckets = 0;
+}
+
+/*
+ * The share of its elapsed time a stage spent on its own work
+ */
+static double stage_busy(stage_stats *sg) {
+  if ( sg->elapsed <= 0 ) {
+    return 0;
+  }
+  double busy = sg->elapsed - sg->starved - sg->blocked;
+  return busy > 0 ? busy / sg->elapsed : 0;
+}
+
+/*
+ * Writes the report, as text for people or as one JSON object for tools
+ */
+void STATS_report(stats *st, FILE *out, bool json) {
+  if ( !st->enabled ) {
+    return;
+  }
+  // close the phase that is still running
+  phase last = STATS_enter(st, PHASE_NONE);
+  struct rusage self;
+  getrusage(RUSAGE_SELF, &self);
+  long peak_rss_kb = self.ru_maxrss;
+  long lines = 0;
+  for ( int i = 0; i < LINE_CLASS_COUNT; i++ ) {
+    lines += st->lines[i];
+  }
+  double parse_wall = st->wall[PHASE_PARSE] + st->wall[PHASE_DEPS];
+
+  if ( json ) {
+    fprintf(out, "{\"phases\": {");
+    for ( int i = 0; i < PHASE_COUNT; i++ ) {
+      fprintf(out, "%s\"%s\": {\"wall\": %.6f, \"cpu\": %.6f}", i ? ", " : "", phase_names[i],
+              st->wall[i], st->cpu[i]);
+    }
+    fprintf(out, "}, \"lines\": {\"total\": %ld", lines);
+    for ( int i = 0; i < LINE_CLASS_COUNT; i++ ) {
+      fprintf(out, ", \"%s\": %ld", line_class_names[i], st->lines[i]);
+    }
+    fprintf(out, "}, \"bytes_parsed\": %ld, \"targets\": %ld, \"deps\": %ld, ", st->bytes_parsed,
+            st->targets, st->deps);
+    fprintf(out, "\"copied_files\": %ld, \"copied_bytes\": %ld, \"unique_files\": %ld, "
+                 "\"unique_bytes\": %ld, ", st->copied_files, st->copied_bytes,
+            st->unique_files, st->unique_bytes);
+    fprintf(out, "\"hashed_files\": %ld, \"hashed_bytes\": %ld, ", st->hashed_files,
+            st->hashed_bytes);
+    if ( st->dep_sets > 0 ) {
+      fprintf(out, "\"dep_sets\": %ld, \"dep_set_deltas\": %ld, \"dep_ids\": %ld, "
+                   "\"dep_ids_stored\": %ld, ", st->dep_sets, st->dep_set_deltas, st->dep_ids,
+              st->dep_ids_stored);
+    }
+    if ( st->stage_count > 0 ) {
+      fprintf(out, "\"stages\": [");
+      for ( int i = 0; i < st->stage_count; i++ ) {
+        stage_stats *sg = &st->stages[i];
+        fprintf(out, "%s{\"name\": \"%s\", \"items\": %ld, \"elapsed\": %.6f, \"starved\": %.6f, "
+                     "\"blocked\": %.6f, \"busy_fraction\": %.4f}", i ? ", " : "", sg->name,
+                sg->items, sg->elapsed, sg->starved, sg->blocked, stage_busy(sg));
+      }
+      fprintf(out, "], ");
+    }
+    fprintf(out, "\"peak_rss_kb\": %ld}\n", peak_rss_kb);
+  }
+  else {
+    fprintf(out, "\nrecord_build statistics\n");
+    fprintf(out, "  %-8s %12s %12s\n", "phase", "wall(s)", "cpu(s)");
+    for ( int i = 0; i < PHASE_COUNT; i++ ) {
+      fprintf(out, "  %-8s %12.3f %12.3f\n", phase_names[i], st->wall[i], st->cpu[i]);
+    }
+    fprintf(out, "  lines:   %ld total", lines);
+    for ( int i = 0; i < LINE_CLASS_COUNT; i++ ) {
+      fprintf(out, ", %ld %s", st->lines[i], line_class_names[i]);
+    }
+    fprintf(out, "\n");
+    if ( parse_wall > 0 ) {
+      fprintf(out, "  parsing: %.0f lines/s, %.1f MB/s\n", lines / parse_wall,
+              st->bytes_parsed / (1024.0 * 1024.0) / parse_wall);
+    }
+    fprintf(out, "  targets: %ld with %ld dependencies\n", st->targets, st->deps);
+    fprintf(out, "  copied:  %ld files, %ld bytes (%ld unique files, %ld unique bytes)\n",
+            st->copied_files, st->copied_bytes, st->unique_files, st->unique_bytes);
+    if ( st->hashed_files > 0 ) {
+      fprintf(out, "  hashed:  %ld files, %ld bytes\n", st->hashed_files, st->hashed_bytes);
+    }
+    if ( st->dep_sets > 0 ) {
+      fprintf(out, "  dep sets: %ld distinct (%ld as deltas), %ld of %ld ids stored\n",
+              st->dep_sets, st->dep_set_deltas, st->dep_ids_stored, st->dep_ids);
+    }
+    if ( st->stage_count > 0 ) {
+      // the busiest stage is the one bounding the pipeline's throughput
+      int bottleneck = 0;
+      fprintf(out, "  %-8s %12s %9s %9s %9s\n", "stage", "items", "busy", "starved", "blocked");
+      for ( int i = 0; i < st->stage_count; i++ ) {
+        stage_stats *sg = &st->stages[i];
+        double elapsed = sg->elapsed > 0 ? sg->elapsed : 1;
+        fprintf(out, "  %-8s %12ld %8.1f%% %8.1f%% %8.1f%%\n", sg->name, sg->items,
+                100 * stage_busy(sg), 100 * sg->starved / elapsed, 100 * sg->blocked / elapsed);
+        if ( stage_busy(sg) > stage_busy(&st->stages[bottleneck]) ) {
+          bottleneck = i;
+        }
+      }
+      fprintf(out, "  bottleneck: %s\n", st->stages[bottleneck].name);
+    }
+    fprintf(out, "  peak RSS: %ld KB\n", peak_rss_kb);
+  }
+  STATS_enter(st, last);
+}
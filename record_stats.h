@@ -0,0 +1,106 @@
+/*
+ * Phase timing and throughput statistics for record_build --stats
+ *
+ * Time is charged to one phase at a time: STATS_enter() switches the current phase and
+ * returns the previous one, so a nested phase (copying inside parsing) is entered and
+ * then left by entering the returned phase again. With stats disabled every call is a
+ * cheap no-op, so the hooks can stay in the hot loop.
+ */
+
+#ifndef RECORD_STATS_H
+#define RECORD_STATS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/*
+ * The phases of one recording
+ */
+typedef enum {
+  PHASE_NONE = -1,
+  PHASE_TRACE,    // waiting for the build running under strace
+  PHASE_PARSE,    // reading and classifying trace lines
+  PHASE_DEPS,     // collecting dependencies for the current target
+  PHASE_COPY,     // copying dependencies into the sandbox
+  PHASE_EMIT,     // writing dependency.txt and the sandbox Makefile
+  PHASE_HASH,     // hashing the dependencies for the manifest, see record_manifest.h
+  PHASE_COUNT
+} phase;
+
+/*
+ * The classes of syscall lines counted while parsing
+ */
+typedef enum {
+  LINE_EXECVE,
+  LINE_OPENAT,
+  LINE_CHDIR,
+  LINE_PROCESS,   // clone, fork and vfork
+  LINE_RESUMED,   // <... syscall resumed>
+  LINE_EXIT,      // +++ exited/killed +++ and --- signal --- lines
+  LINE_OTHER,
+  LINE_CLASS_COUNT
+} line_class;
+
+/*
+ * Hash set of the sandbox paths copied so far, to count unique copied files
+ */
+typedef struct path_entry_struct {
+  char *path;
+  struct path_entry_struct *next;
+} path_entry;
+
+/*
+ * One stage of a --pipeline recording, see record_pipeline.h
+ */
+#define STATS_MAX_STAGES 8
+
+typedef struct stage_stats_struct {
+  const char *name;
+  long items;
+  double elapsed;         // wall seconds from the stage's start to its end
+  double starved;         // of those, waiting for input
+  double blocked;         // waiting for room in its output, held back by the next stage
+} stage_stats;
+
+typedef struct stats_struct {
+  bool enabled;
+  phase current;
+  double phase_start_wall;
+  double phase_start_cpu;
+  double wall[PHASE_COUNT];
+  double cpu[PHASE_COUNT];
+  long lines[LINE_CLASS_COUNT];
+  long bytes_parsed;
+  long targets;
+  long deps;
+  long copied_files;
+  long copied_bytes;
+  long unique_files;
+  long unique_bytes;
+  long hashed_files;
+  long hashed_bytes;
+  long dep_sets;          // distinct dependency sets of the manifest, see record_depset.h
+  long dep_set_deltas;
+  long dep_ids;           // ids in the targets' dependency lists
+  long dep_ids_stored;    // ids the shared sets store for them
+  path_entry **copied;
+  size_t copied_buckets;
+  stage_stats stages[STATS_MAX_STAGES];
+  int stage_count;
+} stats;
+
+void STATS_init(stats *st, bool enabled);
+phase STATS_enter(stats *st, phase next);
+void STATS_add_trace_cpu(stats *st, double cpu);
+void STATS_count_line(stats *st, char *line, long len);
+void STATS_count_target(stats *st, long deps);
+void STATS_count_copy(stats *st, char *path, long bytes);
+void STATS_count_hash(stats *st, long bytes);
+void STATS_count_depsets(stats *st, long sets, long deltas, long ids, long stored);
+void STATS_add(stats *st, stats *from);
+void STATS_add_stage(stats *st, const char *name, long items, double elapsed, double starved,
+                     double blocked);
+void STATS_report(stats *st, FILE *out, bool json);
+void STATS_free(stats *st);
+
+#endif
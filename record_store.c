@@ -0,0 +1,196 @@
+/*
+ * The shared content store, see record_store.h
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/fsuid.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "record_core.h"
+#include "record_intern.h"
+#include "record_store.h"
+
+#define STORE_EMPTY 0     // never copied, or the copy failed
+#define STORE_COPYING 1   // being copied by one session, the others wait for it
+#define STORE_READY 2
+
+/*
+ * Opens the store in dir, creating the directory if needed
+ * Returns 0, or -1 if it could not be created
+ */
+int STORE_init(content_store *cs, const char *dir) {
+  memset(cs, 0, sizeof(content_store));
+  mkdir(dir, 0777);
+  struct stat st;
+  if ( stat(dir, &st) != 0 || !S_ISDIR(st.st_mode) ) {
+    fprintf(stderr, "ERROR: store directory %s could not be created!\n", dir);
+    return -1;
+  }
+  cs->dir = realpath(dir, NULL);
+  cs->uid = geteuid();
+  cs->gid = getegid();
+  pthread_mutex_init(&cs->lock, NULL);
+  pthread_cond_init(&cs->copied, NULL);
+  INTERN_init(&cs->paths);
+  return 0;
+}
+
+/*
+ * Grows the entries to cover every interned path; called with the lock held
+ */
+static void STORE_grow(content_store *cs) {
+  if ( cs->paths.count <= cs->entry_cap ) {
+    return;
+  }
+  int cap = cs->entry_cap ? cs->entry_cap * 2 : 1024;
+  cs->entries = realloc(cs->entries, cap * sizeof(store_entry));
+  memset(cs->entries + cs->entry_cap, 0, (cap - cs->entry_cap) * sizeof(store_entry));
+  cs->entry_cap = cap;
+}
+
+static void STORE_file_name(content_store *cs, int id, int generation, char *name, size_t len) {
+  snprintf(name, len, "%s/%d.%d", cs->dir, id, generation);
+}
+
+/*
+ * Copies the open file src_fd into the store as stored, read-only, with the modification
+ * time of its original
+ * Returns the bytes copied, or -1 if the copy could not be written
+ */
+static long STORE_copy(int src_fd, const char *src, const char *stored) {
+  int out = open(stored, O_WRONLY | O_CREAT | O_EXCL, 0444);
+  long bytes = 0;
+  if ( out < 0 ) {
+    fprintf(stderr, "ERROR: Stored copy, %s, of %s could not be opened!\n", stored, src);
+    bytes = -1;
+  }
+  else {
+    char *buffer = malloc(BUFFER_SIZE);
+    ssize_t n;
+    while ( (n = read(src_fd, buffer, BUFFER_SIZE)) > 0 ) {
+      if ( write(out, buffer, n) != n ) {
+        break;
+      }
+      bytes += n;
+    }
+    free(buffer);
+    struct stat src_stat;
+    if ( n != 0 ) {
+      fprintf(stderr, "ERROR: %s could not be copied into the store!\n", src);
+      unlink(stored);
+      bytes = -1;
+    }
+    else if ( fstat(src_fd, &src_stat) == 0 ) {
+      struct timespec times[2] = { src_stat.st_atim, src_stat.st_mtim };
+      futimens(out, times);
+    }
+    close(out);
+  }
+  return bytes;
+}
+
+/*
+ * Places the file at the absolute path src at new_path inside the sandbox, copying it
+ * into the store first if it is not there yet or has changed since it was stored; src is
+ * opened, and the sandbox written, with the credentials of the calling thread
+ * Returns the size of the file, or -1 if it could not be placed
+ */
+long STORE_place(content_store *cs, const char *src, char *new_path, char *sandbox_pwd) {
+  struct stat src_stat;
+  int src_fd = open(src, O_RDONLY);
+  if ( src_fd < 0 || fstat(src_fd, &src_stat) != 0 ) {
+    fprintf(stderr, "ERROR: Dependency file %s could not be opened to copy!\n", src);
+    if ( src_fd >= 0 ) {
+      close(src_fd);
+    }
+    return -1;
+  }
+
+  pthread_mutex_lock(&cs->lock);
+  int count = cs->paths.count;
+  int id = INTERN_id(&cs->paths, src);
+  if ( id == count ) {
+    STORE_grow(cs);
+  }
+  // another session is storing this file, it is placed once that copy is done
+  while ( cs->entries[id].state == STORE_COPYING ) {
+    pthread_cond_wait(&cs->copied, &cs->lock);
+  }
+  store_entry *e = &cs->entries[id];
+  bool fresh = e->state == STORE_READY && e->size == src_stat.st_size &&
+               e->mtime.tv_sec == src_stat.st_mtim.tv_sec &&
+               e->mtime.tv_nsec == src_stat.st_mtim.tv_nsec;
+  if ( !fresh ) {
+    e->state = STORE_COPYING;
+    e->generation++;
+  }
+  int generation = e->generation;
+  pthread_mutex_unlock(&cs->lock);
+
+  char stored[PATH_MAX];
+  STORE_file_name(cs, id, generation, stored, sizeof(stored));
+  if ( !fresh ) {
+    // copied without the lock, so sessions storing different files do not wait on each other,
+    //  and as the store's owner, whatever user the calling thread acts as
+    uid_t caller_uid = setfsuid(cs->uid);
+    gid_t caller_gid = setfsgid(cs->gid);
+    unlink(stored);
+    long bytes = STORE_copy(src_fd, src, stored);
+    if ( generation > 1 ) {
+      // sandboxes linked to the outdated copy keep it until they are re-recorded
+      char outdated[PATH_MAX];
+      STORE_file_name(cs, id, generation - 1, outdated, sizeof(outdated));
+      unlink(outdated);
+    }
+    setfsgid(caller_gid);
+    setfsuid(caller_uid);
+    pthread_mutex_lock(&cs->lock);
+    e = &cs->entries[id];
+    e->state = bytes >= 0 ? STORE_READY : STORE_EMPTY;
+    e->size = src_stat.st_size;
+    e->mtime = src_stat.st_mtim;
+    if ( bytes >= 0 ) {
+      cs->files++;
+      cs->bytes += bytes;
+    }
+    pthread_cond_broadcast(&cs->copied);
+    pthread_mutex_unlock(&cs->lock);
+    if ( bytes < 0 ) {
+      close(src_fd);
+      return -1;
+    }
+  }
+  close(src_fd);
+
+  // a sandbox may still have the file from an earlier recording, possibly read-only
+  sandbox_parent_dirs(new_path, sandbox_pwd);
+  unlink(new_path);
+  if ( link(stored, new_path) == 0 ) {
+    pthread_mutex_lock(&cs->lock);
+    cs->links++;
+    pthread_mutex_unlock(&cs->lock);
+    return src_stat.st_size;
+  }
+  // the sandbox is on another file system, the system only lets the owner of the stored
+  //  copy link it (fs.protected_hardlinks), or the file changed again and was replaced
+  bool snapshot = errno == EXDEV || errno == EPERM;
+  return copy_to_sandbox(snapshot ? stored : (char *) src, new_path, sandbox_pwd);
+}
+
+void STORE_free(content_store *cs) {
+  INTERN_free(&cs->paths);
+  free(cs->entries);
+  free(cs->dir);
+  pthread_mutex_destroy(&cs->lock);
+  pthread_cond_destroy(&cs->copied);
+}
@@ -0,0 +1,53 @@
+/*
+ * The content store shared by the sessions of a record_build daemon
+ *
+ * Files outside a recording's own project, such as the system headers and libraries of
+ * the sysroot, are the same for every build a daemon records. The store copies each of
+ * them once into its directory, keyed by its interned path and checked against its size
+ * and modification time, and places it in each sandbox as a hard link to that snapshot.
+ * The stored files are read-only, so an edit in one sandbox cannot change another's.
+ * The originals are opened and the sandboxes written with the credentials of the calling
+ * thread, the store itself with those of the user that opened it; where the system lets
+ * only a file's owner link it, a sandbox of another user gets a copy of the snapshot.
+ * Every function may be called from several threads at once.
+ */
+
+#ifndef RECORD_STORE_H
+#define RECORD_STORE_H
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "record_intern.h"
+
+/*
+ * The stored copy of one path
+ */
+typedef struct store_entry_struct {
+  int state;              // STORE_EMPTY, STORE_COPYING or STORE_READY
+  int generation;         // bumped each time the file changed and was copied again
+  off_t size;             // of the original when it was copied
+  struct timespec mtime;
+} store_entry;
+
+typedef struct content_store_struct {
+  pthread_mutex_t lock;   // guards everything below
+  pthread_cond_t copied;  // signalled when an entry stops being copied
+  char *dir;
+  uid_t uid;              // the user and group the store is written as
+  gid_t gid;
+  intern_table paths;     // absolute paths of the originals, shared by every session
+  store_entry *entries;   // path id -> its stored copy
+  int entry_cap;
+  // counters for the daemon's summary
+  long files;             // copies made into the store
+  long bytes;             // bytes copied into the store
+  long links;             // files placed in a sandbox from the store
+} content_store;
+
+int STORE_init(content_store *cs, const char *dir);
+long STORE_place(content_store *cs, const char *src, char *new_path, char *sandbox_pwd);
+void STORE_free(content_store *cs);
+
+#endif
@@ -0,0 +1,299 @@
+/*
+ * The memory and cpu time of the processes of a traced build, see record_usage.h
+ */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "record_usage.h"
+
+// parents followed up from a process looking for the root, deeper than any build nests
+#define USAGE_MAX_DEPTH 64
+
+/*
+ * A process found in one round, see USAGE_round()
+ */
+typedef struct proc_info_struct {
+  int pid;
+  int ppid;
+  double cpu_time;
+  bool zombie;
+  int below;              // 1 if it descends from the root, -1 if not, 0 if not known yet
+} proc_info;
+
+/*
+ * Reads a small file of /proc into buffer
+ * Returns its length, or -1 if it could not be read
+ */
+static long USAGE_read(const char *path, char *buffer, size_t size) {
+  FILE *file = fopen(path, "r");
+  if ( file == NULL ) {
+    return -1;
+  }
+  size_t len = fread(buffer, 1, size - 1, file);
+  fclose(file);
+  buffer[len] = '\0';
+  return len;
+}
+
+/*
+ * Reads the parent, state and cpu time of pid from /proc/PID/stat
+ * Returns false if the process is gone
+ */
+static bool USAGE_read_stat(int pid, proc_info *info) {
+  char path[64];
+  char buffer[1024];
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  if ( USAGE_read(path, buffer, sizeof(buffer)) <= 0 ) {
+    return false;
+  }
+  // the command name in parentheses may hold spaces and parentheses of its own
+  char *fields = strrchr(buffer, ')');
+  char state;
+  unsigned long utime, stime;
+  if ( fields == NULL ||
+       sscanf(fields + 1, " %c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &state,
+              &info->ppid, &utime, &stime) != 4 ) {
+    return false;
+  }
+  static long ticks = 0;
+  if ( ticks == 0 ) {
+    ticks = sysconf(_SC_CLK_TCK);
+  }
+  info->pid = pid;
+  info->cpu_time = (double) (utime + stime) / ticks;
+  info->zombie = state == 'Z' || state == 'X';
+  info->below = 0;
+  return true;
+}
+
+/*
+ * Returns the high water mark of the resident set of pid in kB, or 0 if it is gone
+ */
+static long USAGE_read_peak(int pid) {
+  char path[64];
+  char buffer[4096];
+  snprintf(path, sizeof(path), "/proc/%d/status", pid);
+  if ( USAGE_read(path, buffer, sizeof(buffer)) <= 0 ) {
+    return 0;
+  }
+  char *hwm = strstr(buffer, "\nVmHWM:");
+  return hwm != NULL ? atol(hwm + 7) : 0;
+}
+
+static int USAGE_compare_pids(const void *a, const void *b) {
+  return ((const proc_info *) a)->pid - ((const proc_info *) b)->pid;
+}
+
+static int USAGE_find(const proc_info *procs, int count, int pid) {
+  int lo = 0, hi = count;
+  while ( lo < hi ) {
+    int mid = (lo + hi) / 2;
+    if ( procs[mid].pid < pid ) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  return lo < count && procs[lo].pid == pid ? lo : -1;
+}
+
+/*
+ * Does process i of a round descend from root? The answers are kept in the processes
+ */
+static bool USAGE_below(proc_info *procs, int count, int root, int i, int depth) {
+  if ( procs[i].below == 0 ) {
+    int parent = procs[i].ppid;
+    int p = parent == root ? -1 : USAGE_find(procs, count, parent);
+    bool below = parent == root ||
+                 ( p >= 0 && depth < USAGE_MAX_DEPTH &&
+                   USAGE_below(procs, count, root, p, depth + 1) );
+    procs[i].below = below ? 1 : -1;
+  }
+  return procs[i].below == 1;
+}
+
+/*
+ * Returns the slot of pid in the table, or NULL if it has none and create is not set
+ * The caller holds the lock
+ */
+static usage_entry *USAGE_slot(usage_sampler *u, int pid, bool create) {
+  if ( create && ( u->used + 1 ) * 2 > u->cap ) {
+    // grown, or rebuilt without the taken slots
+    usage_entry *old = u->entries;
+    int old_cap = u->cap;
+    int live = 0;
+    for ( int i = 0; i < old_cap; i++ ) {
+      live += old[i].pid > 0;
+    }
+    while ( ( live + 1 ) * 4 > u->cap ) {
+      u->cap *= 2;
+    }
+    u->entries = calloc(u->cap, sizeof(usage_entry));
+    u->used = 0;
+    for ( int i = 0; i < old_cap; i++ ) {
+      if ( old[i].pid > 0 ) {
+        *USAGE_slot(u, old[i].pid, true) = old[i];
+      }
+    }
+    free(old);
+  }
+  unsigned mask = u->cap - 1;
+  usage_entry *reuse = NULL;
+  for ( unsigned i = ((unsigned) pid * 2654435761u) & mask; ; i = (i + 1) & mask ) {
+    usage_entry *e = &u->entries[i];
+    if ( e->pid == pid ) {
+      return e;
+    }
+    if ( e->pid == -1 && reuse == NULL ) {
+      reuse = e;
+    }
+    if ( e->pid == 0 ) {
+      if ( !create ) {
+        return NULL;
+      }
+      if ( reuse == NULL ) {
+        reuse = e;
+        u->used++;
+      }
+      memset(reuse, 0, sizeof(usage_entry));
+      reuse->pid = pid;
+      return reuse;
+    }
+  }
+}
+
+/*
+ * Records one reading of pid, keeping the largest peak and cpu time read of it
+ */
+void USAGE_record(usage_sampler *u, int pid, long peak_rss, double cpu_time) {
+  pthread_mutex_lock(&u->lock);
+  usage_entry *e = USAGE_slot(u, pid, true);
+  if ( peak_rss > e->peak_rss ) {
+    e->peak_rss = peak_rss;
+  }
+  if ( cpu_time > e->cpu_time ) {
+    e->cpu_time = cpu_time;
+  }
+  pthread_mutex_unlock(&u->lock);
+}
+
+/*
+ * Samples every live descendant of the root once
+ */
+static void USAGE_round(usage_sampler *u, proc_info **procs, int *cap) {
+  DIR *dir = opendir("/proc");
+  if ( dir == NULL ) {
+    return;
+  }
+  int count = 0;
+  struct dirent *entry;
+  while ( (entry = readdir(dir)) != NULL ) {
+    if ( !isdigit((unsigned char) entry->d_name[0]) ) {
+      continue;
+    }
+    if ( count == *cap ) {
+      *cap = *cap ? *cap * 2 : 256;
+      *procs = realloc(*procs, *cap * sizeof(proc_info));
+    }
+    count += USAGE_read_stat(atoi(entry->d_name), &(*procs)[count]);
+  }
+  closedir(dir);
+  qsort(*procs, count, sizeof(proc_info), USAGE_compare_pids);
+
+  for ( int i = 0; i < count; i++ ) {
+    proc_info *info = &(*procs)[i];
+    // a zombie has no memory left, and its pid may be taken by the next process
+    if ( info->zombie || !USAGE_below(*procs, count, u->root, i, 0) ) {
+      continue;
+    }
+    USAGE_record(u, info->pid, USAGE_read_peak(info->pid), info->cpu_time);
+  }
+  u->rounds++;
+}
+
+static void *USAGE_sample(void *arg) {
+  usage_sampler *u = arg;
+  proc_info *procs = NULL;
+  int cap = 0;
+  while ( !atomic_load(&u->stop) ) {
+    USAGE_round(u, &procs, &cap);
+    usleep(USAGE_SAMPLE_MSEC * 1000);
+  }
+  free(procs);
+  return NULL;
+}
+
+/*
+ * Starts sampling the descendants of root, until USAGE_stop()
+ * Returns 0, or -1 if the sampling thread could not be started
+ */
+int USAGE_start(usage_sampler *u, int root) {
+  memset(u, 0, sizeof(usage_sampler));
+  u->root = root;
+  u->cap = 1024;
+  u->entries = calloc(u->cap, sizeof(usage_entry));
+  pthread_mutex_init(&u->lock, NULL);
+  atomic_init(&u->stop, false);
+  if ( pthread_create(&u->thread, NULL, USAGE_sample, u) != 0 ) {
+    fprintf(stderr, "ERROR: the memory and cpu time of the build could not be sampled!\n");
+    return -1;
+  }
+  u->started = true;
+  return 0;
+}
+
+/*
+ * Stops sampling; what was sampled can still be taken
+ */
+void USAGE_stop(usage_sampler *u) {
+  if ( u->started ) {
+    atomic_store(&u->stop, true);
+    pthread_join(u->thread, NULL);
+    u->started = false;
+  }
+}
+
+/*
+ * Takes what was sampled of pid, which has exited, out of the table
+ * Returns false if pid was never sampled
+ */
+bool USAGE_take(usage_sampler *u, int pid, long *peak_rss, double *cpu_time) {
+  pthread_mutex_lock(&u->lock);
+  usage_entry *e = USAGE_slot(u, pid, false);
+  if ( e != NULL ) {
+    *peak_rss = e->peak_rss;
+    *cpu_time = e->cpu_time;
+    e->pid = -1;
+  }
+  pthread_mutex_unlock(&u->lock);
+  return e != NULL;
+}
+
+void USAGE_free(usage_sampler *u) {
+  USAGE_stop(u);
+  pthread_mutex_destroy(&u->lock);
+  free(u->entries);
+  u->entries = NULL;
+}
+
+/*
+ * Returns the memory the kernel estimates is available for new processes, in kB, or 0
+ * if /proc/meminfo does not say
+ */
+long USAGE_available_memory(void) {
+  char buffer[4096];
+  if ( USAGE_read("/proc/meminfo", buffer, sizeof(buffer)) <= 0 ) {
+    return 0;
+  }
+  char *available = strstr(buffer, "MemAvailable:");
+  return available != NULL ? atol(available + 13) : 0;
+}
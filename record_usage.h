@@ -0,0 +1,60 @@
+/*
+ * The memory and cpu time of the processes of a traced build
+ *
+ * strace shows what each process of the build opened, but not what it cost: make waits
+ * for its children without asking for their rusage, so the trace has no peak resident
+ * set or cpu time to parse. A usage_sampler measures them itself instead, on a thread of
+ * its own that reads /proc every USAGE_SAMPLE_MSEC while the build runs. Each round
+ * finds the descendants of the traced build's root process, by their parent pids, and
+ * keeps for each the largest VmHWM of /proc/PID/status, the high water mark of its
+ * resident set, and the utime and stime of /proc/PID/stat.
+ *
+ * The parser takes a process's figures when the trace shows it exiting (USAGE_take()),
+ * by which time the sampler has seen the last of it, and rolls them up to the target the
+ * process belonged to, as getrusage(RUSAGE_CHILDREN) would: the largest peak of its
+ * processes and the sum of their cpu time. The peak of a process is exact once it has
+ * been sampled at all, since the high water mark only grows; a process that lives less
+ * than a round may not be, and its cpu time is short by what it used after its last
+ * round. Neither matters for what the figures are for: the compiles that take gigabytes
+ * are the ones that run for seconds.
+ */
+
+#ifndef RECORD_USAGE_H
+#define RECORD_USAGE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// milliseconds between two readings of /proc
+#define USAGE_SAMPLE_MSEC 50
+
+/*
+ * What was sampled of one process
+ */
+typedef struct usage_entry_struct {
+  int pid;                // 0 for a free slot, -1 for one whose process was taken
+  long peak_rss;          // kB
+  double cpu_time;        // seconds
+} usage_entry;
+
+typedef struct usage_sampler_struct {
+  int root;               // the pid whose descendants are sampled
+  pthread_t thread;
+  atomic_bool stop;
+  bool started;
+  pthread_mutex_t lock;   // of the table, written by the sampler and taken from by the parser
+  usage_entry *entries;   // open addressing by pid, a power of two of them
+  int cap;
+  int used;               // slots not free, taken ones included
+  long rounds;
+} usage_sampler;
+
+int USAGE_start(usage_sampler *u, int root);
+void USAGE_stop(usage_sampler *u);
+void USAGE_record(usage_sampler *u, int pid, long peak_rss, double cpu_time);
+bool USAGE_take(usage_sampler *u, int pid, long *peak_rss, double *cpu_time);
+void USAGE_free(usage_sampler *u);
+long USAGE_available_memory(void);
+
+#endif
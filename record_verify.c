@@ -0,0 +1,175 @@
+/*
+ * Verify mode, see record_verify.h
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "record_core.h"
+#include "record_hash.h"
+#include "record_intern.h"
+#include "record_manifest.h"
+#include "record_verify.h"
+
+/*
+ * How one file compares with the manifest
+ */
+typedef enum {
+  CHECK_SAME,
+  CHECK_CHANGED,
+  CHECK_MISSING
+} file_check;
+
+/*
+ * The result for one path of the manifest: its original and its sandbox copy
+ */
+typedef struct verify_result_struct {
+  file_check original;
+  file_check copy;
+  bool stale;             // the copy's contents are not the original's
+} verify_result;
+
+typedef struct verify_pool_struct {
+  manifest *mf;
+  char *sandbox_pwd;
+  verify_result *results; // path id -> its result
+  atomic_int next;        // the next path for a thread to take
+  atomic_long hashed;     // files whose stat differed, so they were hashed
+} verify_pool;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Compares one file with what the manifest recorded of its original, setting *hash to
+ * its hash; the file is only hashed when its size or modification time differ
+ */
+static file_check VERIFY_file(verify_pool *pool, const char *path, manifest_file *f, void *buffer,
+                              uint64_t *hash) {
+  struct stat sb;
+  if ( stat(path, &sb) != 0 ) {
+    return CHECK_MISSING;
+  }
+  if ( sb.st_size == f->size && sb.st_mtim.tv_sec == f->mtime.tv_sec &&
+       sb.st_mtim.tv_nsec == f->mtime.tv_nsec ) {
+    *hash = f->hash;
+    return CHECK_SAME;
+  }
+  atomic_fetch_add(&pool->hashed, 1);
+  if ( HASH_file(path, buffer, hash) < 0 ) {
+    return CHECK_MISSING;
+  }
+  return *hash == f->hash ? CHECK_SAME : CHECK_CHANGED;
+}
+
+/*
+ * A thread of the pool: checks paths until there are none left
+ */
+static void *VERIFY_work(void *arg) {
+  verify_pool *pool = arg;
+  void *buffer = malloc(HASH_CHUNK);
+  int id;
+  while ( (id = atomic_fetch_add(&pool->next, 1)) < pool->mf->paths.count ) {
+    manifest_file *f = &pool->mf->files[id];
+    verify_result *r = &pool->results[id];
+    if ( !f->hashed ) {
+      // not readable when it was recorded, there is nothing to compare it with
+      continue;
+    }
+    char *path = (char *) INTERN_string(&pool->mf->paths, id);
+    char *copy_path = sandbox_path(pool->sandbox_pwd, path);
+    uint64_t original_hash = 0;
+    uint64_t copy_hash = 0;
+    r->original = VERIFY_file(pool, path, f, buffer, &original_hash);
+    r->copy = VERIFY_file(pool, copy_path, f, buffer, &copy_hash);
+    r->stale = r->original != CHECK_MISSING && r->copy != CHECK_MISSING &&
+               original_hash != copy_hash;
+    free(copy_path);
+  }
+  free(buffer);
+  return NULL;
+}
+
+/*
+ * Checks the originals and sandbox copies of every file in the manifest, on jobs threads
+ * Returns 0 if they are all unchanged, 1 if any is missing, modified or stale, or 2 if
+ * the manifest could not be read
+ */
+int VERIFY_run(const char *manifest_file_name, char *sandbox_pwd, int jobs) {
+  double start = now();
+  manifest mf;
+  MANIFEST_init(&mf);
+  if ( MANIFEST_load(&mf, manifest_file_name) != 0 || mf.paths.count == 0 ) {
+    fprintf(stderr, "ERROR: no hashed files could be read from %s, record with --hash first!\n",
+            manifest_file_name);
+    MANIFEST_free(&mf);
+    return 2;
+  }
+  verify_pool pool;
+  pool.mf = &mf;
+  pool.sandbox_pwd = sandbox_pwd;
+  pool.results = calloc(mf.paths.count, sizeof(verify_result));
+  atomic_init(&pool.next, 0);
+  atomic_init(&pool.hashed, 0);
+  if ( jobs > mf.paths.count ) {
+    jobs = mf.paths.count;
+  }
+
+  pthread_t *threads = calloc(jobs, sizeof(pthread_t));
+  for ( int i = 1; i < jobs; i++ ) {
+    pthread_create(&threads[i], NULL, VERIFY_work, &pool);
+  }
+  VERIFY_work(&pool);
+  for ( int i = 1; i < jobs; i++ ) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+
+  // reported in the order of the manifest, whatever order the threads finished in
+  int checked = 0;
+  int missing = 0;
+  int modified = 0;
+  int stale = 0;
+  for ( int id = 0; id < mf.paths.count; id++ ) {
+    verify_result *r = &pool.results[id];
+    const char *path = INTERN_string(&mf.paths, id);
+    if ( !mf.files[id].hashed ) {
+      continue;
+    }
+    checked++;
+    if ( r->original == CHECK_MISSING ) {
+      fprintf(stdout, "  missing   %s\n", path);
+      missing++;
+    }
+    else if ( r->original == CHECK_CHANGED ) {
+      fprintf(stdout, "  modified  %s\n", path);
+      modified++;
+    }
+    if ( r->copy == CHECK_MISSING ) {
+      char *copy_path = sandbox_path(sandbox_pwd, (char *) path);
+      fprintf(stdout, "  missing   %s\n", copy_path);
+      free(copy_path);
+      missing++;
+    }
+    else if ( r->stale ) {
+      fprintf(stdout, "  stale     %s\n", path);
+      stale++;
+    }
+  }
+  fprintf(stdout, "Verified %d files and their sandbox copies in %.3fs: %d missing, %d modified, "
+                  "%d stale, %ld hashed\n", checked, now() - start, missing, modified, stale,
+          atomic_load(&pool.hashed));
+  free(pool.results);
+  MANIFEST_free(&mf);
+  return missing + modified + stale > 0 ? 1 : 0;
+}
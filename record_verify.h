@@ -0,0 +1,20 @@
+/*
+ * Verify mode: is the sandbox still a copy of the files the recording was made from?
+ *
+ * Every file in the manifest of a --hash recording is checked twice, the original in
+ * the tree and its copy in the sandbox, on a pool of threads. A file whose size and
+ * modification time are the ones the manifest recorded is taken as unchanged from a
+ * stat alone (copies keep the time of their original); only a file whose stat differs
+ * is hashed and compared with the recorded hash. Files are reported as:
+ *    missing    the original or its sandbox copy is gone
+ *    modified   the original no longer has the contents it was recorded with
+ *    stale      the sandbox copy does not have the original's current contents
+ * Nothing is copied or changed; record again, or --incremental, to refresh the sandbox.
+ */
+
+#ifndef RECORD_VERIFY_H
+#define RECORD_VERIFY_H
+
+int VERIFY_run(const char *manifest_file_name, char *sandbox_pwd, int jobs);
+
+#endif
@@ -0,0 +1,509 @@
+/*
+ * Watch mode, see record_watch.h
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <ftw.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "record_bitmap.h"
+#include "record_core.h"
+#include "record_intern.h"
+#include "record_model.h"
+#include "record_probed.h"
+#include "record_watch.h"
+
+// events arriving within this many milliseconds of each other are handled as one edit
+#define WATCH_SETTLE_MS 100
+
+// inotify events that mean a file in the sandbox has new contents
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE)
+
+/*
+ * A growable list of target indices
+ */
+typedef struct index_list_struct {
+  int *items;
+  int count;
+  int cap;
+} index_list;
+
+/*
+ * The state of one target in watch mode, kept between edits
+ */
+typedef enum {
+  STATE_IDLE,       // not affected by the current edit
+  STATE_WAITING,    // affected, waiting for affected prerequisites
+  STATE_RUNNING,
+  STATE_DONE,
+  STATE_FAILED
+} target_state;
+
+typedef struct watched_target_struct {
+  target *tar;
+  char *sandbox_cmd;
+  int output_id;            // interned sandbox path of the target's output
+  index_list prereqs;       // targets whose outputs this target depends on
+  index_list dependents;    // targets depending on this target's output
+  target_state state;
+  pid_t pid;
+  double start;
+  // results of the last rebuild
+  bool last_ok;
+  double last_seconds;
+  int rebuilds;
+} watched_target;
+
+/*
+ * Everything watch mode keeps in memory between edits
+ */
+typedef struct watcher_struct {
+  char *sandbox_pwd;
+  model m;
+  intern_table paths;       // sandbox paths of every dependency and output
+  watched_target *targets;
+  bitmap *users;            // path id -> targets that depend on the path
+  bitmap affected;          // targets depending on the files changed by the current events
+  int *affected_ids;
+  long affected_cap;
+  int *producer;            // path id -> target that writes the path, or -1
+  int inotify_fd;
+  char **watch_dirs;        // watch descriptor -> directory
+  int watch_dirs_cap;
+  long memory_budget;       // kB the running commands may have peaked at together, 0 for any
+  long default_rss;         // kB counted for a target recorded without a peak: the mean peak
+} watcher;
+
+// nftw() has no context argument, so the watcher being set up is kept here
+static watcher *setup_watcher;
+
+static void INDEX_add(index_list *l, int index) {
+  for ( int i = 0; i < l->count; i++ ) {
+    if ( l->items[i] == index ) {
+      return;
+    }
+  }
+  if ( l->count == l->cap ) {
+    l->cap = l->cap ? l->cap * 2 : 4;
+    l->items = realloc(l->items, l->cap * sizeof(int));
+  }
+  l->items[l->count++] = index;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Builds the reverse dependency graph of the loaded model
+ */
+static void WATCH_index_model(watcher *w) {
+  int count = w->m.count;
+  w->targets = calloc(count, sizeof(watched_target));
+  INTERN_init(&w->paths);
+  // intern every path first, so the per path tables can be sized once
+  for ( int t = 0; t < count; t++ ) {
+    target *tar = w->m.targets[t];
+    char *out = sandbox_path(w->sandbox_pwd, tar->target_name);
+    w->targets[t].tar = tar;
+    w->targets[t].sandbox_cmd = TARGET_sandbox_cmd(tar, w->sandbox_pwd);
+    w->targets[t].output_id = INTERN_id(&w->paths, out);
+    free(out);
+    for ( depnode *dep = tar->head; dep != NULL; dep = dep->next ) {
+      char *path = sandbox_path(w->sandbox_pwd, dep->dep);
+      INTERN_id(&w->paths, path);
+      free(path);
+    }
+  }
+  w->users = calloc(w->paths.count, sizeof(bitmap));
+  w->producer = malloc(w->paths.count * sizeof(int));
+  memset(w->producer, -1, w->paths.count * sizeof(int));
+  for ( int t = 0; t < count; t++ ) {
+    // a later target with the same output replaces an earlier one
+    w->producer[w->targets[t].output_id] = t;
+  }
+  for ( int t = 0; t < count; t++ ) {
+    for ( depnode *dep = w->targets[t].tar->head; dep != NULL; dep = dep->next ) {
+      char *path = sandbox_path(w->sandbox_pwd, dep->dep);
+      int id = INTERN_find(&w->paths, path);
+      free(path);
+      BITMAP_add(&w->users[id], t);
+      int prereq = w->producer[id];
+      if ( prereq != -1 && prereq != t ) {
+        INDEX_add(&w->targets[t].prereqs, prereq);
+        INDEX_add(&w->targets[prereq].dependents, t);
+      }
+    }
+  }
+  long peaks = 0;
+  long total = 0;
+  for ( int t = 0; t < count; t++ ) {
+    peaks += w->m.targets[t]->peak_rss > 0;
+    total += w->m.targets[t]->peak_rss;
+  }
+  w->default_rss = peaks > 0 ? total / peaks : 0;
+}
+
+/*
+ * nftw() callback adding an inotify watch on every directory of the sandbox
+ */
+static int WATCH_add_dir(const char *path, const struct stat *sb, int type, struct FTW *ftw) {
+  watcher *w = setup_watcher;
+  if ( type != FTW_D ) {
+    return 0;
+  }
+  int wd = inotify_add_watch(w->inotify_fd, path, WATCH_EVENTS);
+  if ( wd < 0 ) {
+    fprintf(stderr, "ERROR: directory %s could not be watched: %s\n", path, strerror(errno));
+    return 0;
+  }
+  if ( wd >= w->watch_dirs_cap ) {
+    int cap = w->watch_dirs_cap ? w->watch_dirs_cap : 64;
+    while ( wd >= cap ) {
+      cap *= 2;
+    }
+    w->watch_dirs = realloc(w->watch_dirs, cap * sizeof(char *));
+    memset(w->watch_dirs + w->watch_dirs_cap, 0, (cap - w->watch_dirs_cap) * sizeof(char *));
+    w->watch_dirs_cap = cap;
+  }
+  free(w->watch_dirs[wd]);
+  w->watch_dirs[wd] = strdup(path);
+  return 0;
+}
+
+static void WATCH_add_tree(watcher *w, const char *dir) {
+  setup_watcher = w;
+  nftw(dir, WATCH_add_dir, 16, FTW_PHYS);
+}
+
+/*
+ * Marks a target and everything built from its output as needing a rebuild
+ */
+static void WATCH_mark(watcher *w, int t) {
+  if ( w->targets[t].state == STATE_WAITING ) {
+    return;
+  }
+  w->targets[t].state = STATE_WAITING;
+  index_list *dependents = &w->targets[t].dependents;
+  for ( int i = 0; i < dependents->count; i++ ) {
+    WATCH_mark(w, dependents->items[i]);
+  }
+}
+
+/*
+ * Marks the targets that looked for a file not found when they were recorded, which has
+ * now been written at path in the sandbox; the bloom filter of each target's absent
+ * paths rules out almost every target without comparing any paths
+ * Returns 1 if some target had looked for it, 0 otherwise
+ */
+static int WATCH_mark_probed(watcher *w, const char *path) {
+  size_t sandbox_len = strlen(w->sandbox_pwd);
+  if ( strncmp(path, w->sandbox_pwd, sandbox_len) || path[sandbox_len] != '/' ) {
+    return 0;
+  }
+  // the recorded path, absolute or relative to the build's directory, see sandbox_path()
+  const char *absolute = path + sandbox_len;
+  const char *relative = absolute + 1;
+  int found = 0;
+  for ( int t = 0; t < w->m.count; t++ ) {
+    probe_set *absent = &w->targets[t].tar->absent;
+    if ( PROBED_contains(absent, absolute) || PROBED_contains(absent, relative) ) {
+      WATCH_mark(w, t);
+      found = 1;
+    }
+  }
+  return found;
+}
+
+/*
+ * Reads the pending inotify events, marking the targets whose dependencies changed
+ * Returns the number of changed files that are dependencies of some target
+ */
+static int WATCH_read_events(watcher *w) {
+  char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+  int changed = 0;
+  ssize_t len = read(w->inotify_fd, buf, sizeof(buf));
+  for ( char *ptr = buf; len > 0 && ptr < buf + len; ) {
+    struct inotify_event *event = (struct inotify_event *) ptr;
+    ptr += sizeof(struct inotify_event) + event->len;
+    if ( event->wd < 0 || event->wd >= w->watch_dirs_cap || w->watch_dirs[event->wd] == NULL ||
+         event->len == 0 ) {
+      continue;
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", w->watch_dirs[event->wd], event->name);
+    if ( event->mask & IN_ISDIR ) {
+      // a new directory, watch it and anything already created inside it
+      if ( event->mask & (IN_CREATE | IN_MOVED_TO) ) {
+        WATCH_add_tree(w, path);
+      }
+      continue;
+    }
+    if ( !(event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) ) {
+      continue;
+    }
+    int id = INTERN_find(&w->paths, path);
+    if ( id == -1 ) {
+      changed += WATCH_mark_probed(w, path);
+      continue;
+    }
+    // outputs are written by the rebuilds themselves, their dependents are already marked
+    if ( w->producer[id] != -1 ) {
+      continue;
+    }
+    changed++;
+    BITMAP_or(&w->affected, &w->users[id]);
+  }
+  // the users of every changed file, each target marked once however many it depends on
+  long count = BITMAP_values(&w->affected, &w->affected_ids, &w->affected_cap);
+  for ( long i = 0; i < count; i++ ) {
+    WATCH_mark(w, w->affected_ids[i]);
+  }
+  BITMAP_clear(&w->affected);
+  return changed;
+}
+
+/*
+ * Returns whether every affected prerequisite of a target has been rebuilt, or -1 if one failed
+ */
+static int WATCH_ready(watcher *w, int t) {
+  index_list *prereqs = &w->targets[t].prereqs;
+  for ( int i = 0; i < prereqs->count; i++ ) {
+    target_state state = w->targets[prereqs->items[i]].state;
+    if ( state == STATE_FAILED ) {
+      return -1;
+    }
+    if ( state == STATE_WAITING || state == STATE_RUNNING ) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Returns the memory a target's command is expected to take, in kB: its peak when it was
+ * recorded with --usage, 0 when no target was
+ */
+static long WATCH_memory(watcher *w, watched_target *wt) {
+  return wt->tar->peak_rss > 0 ? wt->tar->peak_rss : w->default_rss;
+}
+
+/*
+ * Starts a target's command in the sandbox
+ * Returns its pid, or -1 if no process could be created for it
+ */
+static pid_t WATCH_spawn(watcher *w, watched_target *wt) {
+  pid_t pid = fork();
+  if ( pid == 0 ) {
+    if ( chdir(w->sandbox_pwd) != 0 ) {
+      _exit(127);
+    }
+    execl("/bin/sh", "sh", "-c", wt->sandbox_cmd, (char *) NULL);
+    _exit(127);
+  }
+  return pid;
+}
+
+/*
+ * Rebuilds every marked target, prerequisites first, at most jobs at once and, with a
+ * memory budget, as many as the peaks they were recorded with fit in; a target that does
+ * not fit waits for the commands running to finish, and runs alone if it is too large
+ * for the budget. Targets that fit start in its place meanwhile.
+ * Returns the number of targets that failed
+ */
+static int WATCH_rebuild(watcher *w, int jobs) {
+  double start = now();
+  int running = 0;
+  long memory = 0;          // the peaks of the commands running
+  int rebuilt = 0;
+  int failed = 0;
+  for ( ;; ) {
+    // start every target whose prerequisites are done, while there are free job slots
+    bool waiting = false;
+    for ( int t = 0; t < w->m.count && running < jobs; t++ ) {
+      watched_target *wt = &w->targets[t];
+      if ( wt->state != STATE_WAITING ) {
+        continue;
+      }
+      int ready = WATCH_ready(w, t);
+      if ( ready == -1 ) {
+        // a prerequisite failed, this target can not be rebuilt
+        wt->state = STATE_FAILED;
+        failed++;
+        t = -1; // targets depending on this one are revisited
+        continue;
+      }
+      if ( ready == 0 ) {
+        waiting = true;
+        continue;
+      }
+      if ( running > 0 && w->memory_budget > 0 &&
+           memory + WATCH_memory(w, wt) > w->memory_budget ) {
+        continue;
+      }
+      wt->pid = WATCH_spawn(w, wt);
+      if ( wt->pid < 0 ) {
+        fprintf(stdout, "  FAILED  %s (could not be started: %s)\n", wt->tar->target_name,
+                strerror(errno));
+        wt->state = STATE_FAILED;
+        failed++;
+        t = -1; // targets depending on this one are revisited
+        continue;
+      }
+      wt->start = now();
+      wt->state = STATE_RUNNING;
+      running++;
+      memory += WATCH_memory(w, wt);
+    }
+    if ( running == 0 ) {
+      if ( waiting ) {
+        // nothing is running, yet targets still wait: their outputs depend on each other
+        for ( int t = 0; t < w->m.count; t++ ) {
+          if ( w->targets[t].state == STATE_WAITING ) {
+            fprintf(stdout, "  FAILED  %s (dependency cycle)\n", w->targets[t].tar->target_name);
+            w->targets[t].state = STATE_FAILED;
+            failed++;
+          }
+        }
+      }
+      break;
+    }
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if ( pid <= 0 ) {
+      break;
+    }
+    for ( int t = 0; t < w->m.count; t++ ) {
+      watched_target *wt = &w->targets[t];
+      if ( wt->state != STATE_RUNNING || wt->pid != pid ) {
+        continue;
+      }
+      running--;
+      memory -= WATCH_memory(w, wt);
+      wt->last_seconds = now() - wt->start;
+      wt->last_ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+      wt->rebuilds++;
+      wt->state = wt->last_ok ? STATE_DONE : STATE_FAILED;
+      if ( wt->last_ok ) {
+        rebuilt++;
+        fprintf(stdout, "  rebuilt %s (%.2fs)\n", wt->tar->target_name, wt->last_seconds);
+      }
+      else {
+        failed++;
+        fprintf(stdout, "  FAILED  %s (%.2fs)\n", wt->tar->target_name, wt->last_seconds);
+      }
+      break;
+    }
+  }
+  fprintf(stdout, "%d targets rebuilt, %d failed, in %.2fs\n", rebuilt, failed, now() - start);
+  fflush(stdout);
+  for ( int t = 0; t < w->m.count; t++ ) {
+    w->targets[t].state = STATE_IDLE;
+  }
+  return failed;
+}
+
+/*
+ * Loads the recorded model and indexes it for watch mode
+ * Returns 1 if no targets could be loaded
+ */
+static int WATCH_load(watcher *w, const char *dependency_file_name, char *sandbox_pwd,
+                      long memory_budget) {
+  memset(w, 0, sizeof(watcher));
+  w->sandbox_pwd = sandbox_pwd;
+  w->memory_budget = memory_budget;
+  MODEL_init(&w->m);
+  if ( MODEL_load(&w->m, dependency_file_name) != 0 || w->m.count == 0 ) {
+    fprintf(stderr, "ERROR: no recorded targets could be read from %s!\n", dependency_file_name);
+    return 1;
+  }
+  WATCH_index_model(w);
+  return 0;
+}
+
+/*
+ * Ends the line describing a run with the memory budget, when there are peaks to use it
+ */
+static void WATCH_print_budget(watcher *w) {
+  if ( w->memory_budget > 0 && w->default_rss > 0 ) {
+    fprintf(stdout, ", %ld MB of memory", w->memory_budget / 1024);
+  }
+  fprintf(stdout, "\n");
+}
+
+/*
+ * Rebuilds every target of the sandbox once, as watch mode does after an edit of every file
+ * Returns 0, or 1 if the model could not be loaded or a target failed
+ */
+int WATCH_rebuild_all(const char *dependency_file_name, char *sandbox_pwd, int jobs,
+                      long memory_budget) {
+  watcher w;
+  if ( WATCH_load(&w, dependency_file_name, sandbox_pwd, memory_budget) != 0 ) {
+    return 1;
+  }
+  fprintf(stdout, "Rebuilding %s: %d targets, %d jobs", sandbox_pwd, w.m.count, jobs);
+  WATCH_print_budget(&w);
+  for ( int t = 0; t < w.m.count; t++ ) {
+    w.targets[t].state = STATE_WAITING;
+  }
+  return WATCH_rebuild(&w, jobs) != 0;
+}
+
+/*
+ * Watches the sandbox until interrupted, rebuilding after every edit
+ * Returns 1 if the model or the sandbox could not be loaded
+ */
+int WATCH_run(const char *dependency_file_name, char *sandbox_pwd, int jobs, long memory_budget) {
+  watcher w;
+  if ( WATCH_load(&w, dependency_file_name, sandbox_pwd, memory_budget) != 0 ) {
+    return 1;
+  }
+
+  w.inotify_fd = inotify_init1(IN_CLOEXEC);
+  if ( w.inotify_fd < 0 ) {
+    fprintf(stderr, "ERROR: inotify could not be initialized: %s\n", strerror(errno));
+    return 1;
+  }
+  WATCH_add_tree(&w, sandbox_pwd);
+  if ( w.watch_dirs_cap == 0 ) {
+    fprintf(stderr, "ERROR: sandbox directory %s could not be watched!\n", sandbox_pwd);
+    return 1;
+  }
+  fprintf(stdout, "Watching %s: %d targets, %d files, %d jobs", sandbox_pwd, w.m.count,
+          w.paths.count, jobs);
+  WATCH_print_budget(&w);
+  fflush(stdout);
+
+  struct pollfd pfd = { w.inotify_fd, POLLIN, 0 };
+  for ( ;; ) {
+    if ( poll(&pfd, 1, -1) < 0 ) {
+      if ( errno == EINTR ) {
+        continue;
+      }
+      break;
+    }
+    // gather the whole edit: editors write, rename and touch several files at once
+    int changed = WATCH_read_events(&w);
+    while ( poll(&pfd, 1, WATCH_SETTLE_MS) > 0 ) {
+      changed += WATCH_read_events(&w);
+    }
+    if ( changed > 0 ) {
+      fprintf(stdout, "%d changed file%s\n", changed, changed == 1 ? "" : "s");
+      WATCH_rebuild(&w, jobs);
+    }
+  }
+  return 0;
+}
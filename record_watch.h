@@ -0,0 +1,27 @@
+/*
+ * Watch mode: rebuild only the targets affected by edits in the sandbox
+ *
+ * The recorded model is loaded once and kept in memory. inotify watches every directory
+ * of the sandbox; each file written there is mapped through the reverse dependency graph
+ * to the targets that depend on it, and those targets, plus every target that depends on
+ * their outputs, are rebuilt in dependency order with up to jobs commands in parallel.
+ * A file created where a target recorded with --probes looked for one and found nothing
+ * rebuilds that target too.
+ * No make process is started, so an edit costs only the compiler time.
+ *
+ * The targets of a recording made with --usage carry the peak memory of their commands,
+ * and rebuilds are then also limited by a memory budget: a command is started only while
+ * the peaks of those running, its own included, fit in it, so a host runs as many small
+ * compiles at once as it has cpus, and the few that take gigabytes with fewer beside
+ * them, rather than every rebuild at the -j the largest would allow. WATCH_rebuild_all()
+ * rebuilds every target of the sandbox once that way, in place of make.
+ */
+
+#ifndef RECORD_WATCH_H
+#define RECORD_WATCH_H
+
+int WATCH_run(const char *dependency_file_name, char *sandbox_pwd, int jobs, long memory_budget);
+int WATCH_rebuild_all(const char *dependency_file_name, char *sandbox_pwd, int jobs,
+                      long memory_budget);
+
+#endif
@@ -0,0 +1,214 @@
+/*
+ * Tests of the compressed bitmaps, checked against a plain array of flags
+ *
+ * Each test fills bitmaps across the containers of several high keys, with arrays on
+ * both sides of BITMAP_ARRAY_MAX, and checks membership, unions and the counts of
+ * intersections against the same ids kept one flag per id.
+ *
+ * usage: test_bitmap
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../record_bitmap.h"
+
+// the high 16 bits of the ids used, the last one that of the largest int
+#define KEYS 4
+static const int keys[KEYS] = { 0, 1, 1000, 0x7fff };
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if ( !(cond) ) { \
+      fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+      failures++; \
+    } \
+  } while ( 0 )
+
+/*
+ * A bitmap and the same ids as flags, one per low 16 bits of each key
+ */
+typedef struct id_set_struct {
+  bitmap b;
+  bool *in;
+} id_set;
+
+static void set_init(id_set *s) {
+  BITMAP_init(&s->b);
+  s->in = calloc(KEYS << 16, sizeof(bool));
+}
+
+static void set_add(id_set *s, int k, int low) {
+  BITMAP_add(&s->b, keys[k] << 16 | low);
+  s->in[k << 16 | low] = true;
+}
+
+static void set_free(id_set *s) {
+  BITMAP_free(&s->b);
+  free(s->in);
+}
+
+static long flags_count(const bool *in) {
+  long count = 0;
+  for ( int i = 0; i < KEYS << 16; i++ ) {
+    count += in[i];
+  }
+  return count;
+}
+
+static long flags_and_count(const bool *a, const bool *b) {
+  long count = 0;
+  for ( int i = 0; i < KEYS << 16; i++ ) {
+    count += a[i] && b[i];
+  }
+  return count;
+}
+
+/*
+ * Checks a bitmap holds exactly the ids flagged, in ascending order
+ */
+static bool set_matches(const id_set *s) {
+  if ( s->b.count != flags_count(s->in) ) {
+    return false;
+  }
+  int *values = NULL;
+  long cap = 0;
+  long n = BITMAP_values(&s->b, &values, &cap);
+  bool matches = n == s->b.count;
+  long at = 0;
+  for ( int i = 0; i < KEYS << 16 && matches; i++ ) {
+    int id = keys[i >> 16] << 16 | (i & 0xffff);
+    if ( BITMAP_contains(&s->b, id) != s->in[i] ) {
+      matches = false;
+    }
+    else if ( s->in[i] && ( at == n || values[at++] != id ) ) {
+      matches = false;
+    }
+  }
+  free(values);
+  return matches;
+}
+
+/*
+ * An array container turns into a bitset past BITMAP_ARRAY_MAX ids, keeping every id
+ */
+static void test_array_to_bitset(void) {
+  id_set s;
+  set_init(&s);
+  // out of order, so ids are inserted before others as well as appended
+  for ( int i = 0; i < BITMAP_ARRAY_MAX; i++ ) {
+    set_add(&s, 1, (i * 7919) & 0xffff);
+  }
+  CHECK(s.b.count == BITMAP_ARRAY_MAX);
+  CHECK(s.b.containers[0].words == NULL);
+  // an id already there is not counted again
+  set_add(&s, 1, 0);
+  CHECK(s.b.count == BITMAP_ARRAY_MAX);
+  set_add(&s, 1, 65535);
+  CHECK(s.b.count == BITMAP_ARRAY_MAX + 1);
+  CHECK(s.b.containers[0].words != NULL);
+  set_add(&s, 1, 65535);
+  CHECK(s.b.count == BITMAP_ARRAY_MAX + 1);
+  CHECK(set_matches(&s));
+  set_free(&s);
+}
+
+/*
+ * Ids of several high keys, added in any order, are kept in containers of ascending key
+ */
+static void test_high_keys(void) {
+  id_set s;
+  set_init(&s);
+  set_add(&s, 3, 65535);
+  set_add(&s, 0, 5);
+  set_add(&s, 2, 17);
+  set_add(&s, 3, 0);
+  set_add(&s, 1, 4096);
+  set_add(&s, 2, 3);
+  CHECK(s.b.container_count == KEYS);
+  for ( int k = 1; k < s.b.container_count; k++ ) {
+    CHECK(s.b.containers[k - 1].key < s.b.containers[k].key);
+  }
+  CHECK(BITMAP_contains(&s.b, 0x7fffffff));
+  CHECK(!BITMAP_contains(&s.b, 0x7ffffffe));
+  CHECK(!BITMAP_contains(&s.b, 2 << 16));
+  CHECK(set_matches(&s));
+  set_free(&s);
+}
+
+/*
+ * Unions and intersection counts of every kind of pair of containers: two bitsets, an
+ * array and a bitset, two arrays of close sizes and two of far apart sizes, and keys
+ * found in only one of the sets
+ */
+static void test_or_and_count(void) {
+  id_set a, b;
+  set_init(&a);
+  set_init(&b);
+  for ( int i = 0; i < 10000; i++ ) {
+    set_add(&a, 0, i * 3);                  // a bitset
+    set_add(&b, 0, i * 5);                  // a bitset
+  }
+  for ( int i = 0; i < 3000; i++ ) {
+    set_add(&a, 1, i * 2);                  // an array
+    set_add(&b, 1, i * 21 % 65536);         // a bitset once the rest is added
+  }
+  for ( int i = 0; i < 2000; i++ ) {
+    set_add(&b, 1, 60000 + i);
+  }
+  for ( int i = 0; i < 2000; i++ ) {
+    set_add(&a, 2, i * 4);                  // two arrays of close sizes
+    set_add(&b, 2, i * 6);
+  }
+  for ( int i = 0; i < 3; i++ ) {
+    set_add(&a, 3, i * 1000);               // three ids against an array of 3000
+  }
+  for ( int i = 0; i < 3000; i++ ) {
+    set_add(&b, 3, i * 7);
+  }
+  set_add(&a, 3, 65535);
+  CHECK(a.b.containers[1].words == NULL);
+  CHECK(b.b.containers[1].words != NULL);
+  CHECK(set_matches(&a));
+  CHECK(set_matches(&b));
+  CHECK(BITMAP_and_count(&a.b, &b.b) == flags_and_count(a.in, b.in));
+  CHECK(BITMAP_and_count(&b.b, &a.b) == flags_and_count(a.in, b.in));
+
+  // a key only in the other set, and one only in this one
+  id_set c;
+  set_init(&c);
+  set_add(&c, 2, 12);
+  CHECK(BITMAP_and_count(&a.b, &c.b) == 1);
+  BITMAP_or(&c.b, &b.b);
+  for ( int i = 0; i < KEYS << 16; i++ ) {
+    c.in[i] = c.in[i] || b.in[i];
+  }
+  CHECK(set_matches(&c));
+
+  // the union of a and b has all of each
+  BITMAP_or(&a.b, &b.b);
+  for ( int i = 0; i < KEYS << 16; i++ ) {
+    a.in[i] = a.in[i] || b.in[i];
+  }
+  CHECK(set_matches(&a));
+  CHECK(BITMAP_and_count(&a.b, &b.b) == b.b.count);
+  CHECK(BITMAP_and_count(&a.b, &c.b) == flags_and_count(a.in, c.in));
+  set_free(&a);
+  set_free(&b);
+  set_free(&c);
+}
+
+int main(void) {
+  test_array_to_bitset();
+  test_high_keys();
+  test_or_and_count();
+  if ( failures > 0 ) {
+    fprintf(stderr, "%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("test_bitmap: all passed\n");
+  return 0;
+}
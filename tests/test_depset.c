@@ -0,0 +1,173 @@
+/*
+ * Tests of the shared dependency sets
+ *
+ * Each test interns lists of ids and checks which sets they share, which are stored as
+ * deltas and which in full, and that every set expands back to the list it was
+ * interned from.
+ *
+ * usage: test_depset
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../record_depset.h"
+
+#define BASE_IDS 40
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if ( !(cond) ) { \
+      fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+      failures++; \
+    } \
+  } while ( 0 )
+
+/*
+ * Returns whether a set expands to the list of ids
+ */
+static bool expands_to(const depset *s, const int *ids, int count) {
+  int *buffer = NULL;
+  int cap = 0;
+  bool same = s->count == count &&
+              ( count == 0 || !memcmp(DEPSET_expand(s, &buffer, &cap), ids, count * sizeof(int)) );
+  free(buffer);
+  return same;
+}
+
+/*
+ * Interns a list, checking the set it gets expands back to it
+ */
+static const depset *intern(depset_table *t, const int *ids, int count) {
+  const depset *s = DEPSET_intern(t, ids, count);
+  CHECK(expands_to(s, ids, count));
+  return s;
+}
+
+/*
+ * Fills ids with count ids from first, a step apart
+ */
+static void fill(int *ids, int count, int first, int step) {
+  for ( int i = 0; i < count; i++ ) {
+    ids[i] = first + i * step;
+  }
+}
+
+/*
+ * The same list is one set, however often it is interned; the same ids in another
+ * order are another
+ */
+static void test_identical(void) {
+  depset_table t;
+  DEPSET_init(&t);
+  int ids[BASE_IDS];
+  fill(ids, BASE_IDS, 0, 3);
+  const depset *a = intern(&t, ids, BASE_IDS);
+  const depset *again = intern(&t, ids, BASE_IDS);
+  CHECK(a == again);
+  CHECK(a->ids != NULL);
+  CHECK(t.count == 1 && t.interned == 2);
+  const depset *empty = intern(&t, NULL, 0);
+  CHECK(intern(&t, NULL, 0) == empty);
+  CHECK(empty != a && t.count == 2);
+  // swapped, the two ids are kept from the base in their new order by a delta
+  int tmp = ids[0];
+  ids[0] = ids[1];
+  ids[1] = tmp;
+  const depset *swapped = intern(&t, ids, BASE_IDS);
+  CHECK(swapped != a);
+  CHECK(swapped->ids == NULL && swapped->base == a);
+  CHECK(t.count == 3);
+  DEPSET_free(&t);
+}
+
+/*
+ * A list close to a set interned lately is a delta against it: ids dropped, and ids
+ * added before, between and after those of the base, some beyond any id seen yet
+ */
+static void test_delta(void) {
+  depset_table t;
+  DEPSET_init(&t);
+  int base_ids[BASE_IDS];
+  fill(base_ids, BASE_IDS, 0, 3);
+  const depset *base = intern(&t, base_ids, BASE_IDS);
+
+  int ids[BASE_IDS + 3];
+  int count = 0;
+  ids[count++] = 1000000;
+  for ( int i = 0; i < BASE_IDS; i++ ) {
+    if ( i == 5 || i == 30 ) {
+      continue;
+    }
+    ids[count++] = base_ids[i];
+    if ( i == 20 ) {
+      ids[count++] = 7;
+    }
+  }
+  ids[count++] = 8;
+  const depset *near = intern(&t, ids, count);
+  CHECK(near != base);
+  CHECK(near->ids == NULL && near->base == base);
+  CHECK(near->removed_count == 2 && near->added_count == 3);
+  CHECK(t.deltas == 1);
+  // found again by its expansion
+  CHECK(intern(&t, ids, count) == near);
+
+  // a second delta against the same base leaves the first as it was
+  int shorter_ids[BASE_IDS - 1];
+  fill(shorter_ids, BASE_IDS - 1, 0, 3);
+  const depset *shorter = intern(&t, shorter_ids, BASE_IDS - 1);
+  CHECK(shorter->base == base);
+  CHECK(shorter->removed_count == 1 && shorter->added_count == 0);
+  CHECK(expands_to(near, ids, count));
+  CHECK(t.deltas == 2);
+  DEPSET_free(&t);
+}
+
+/*
+ * A list far from every recent set is stored in full, as is one close to a set that
+ * newer ones pushed out of the recent sets
+ */
+static void test_full(void) {
+  depset_table t;
+  DEPSET_init(&t);
+  int base_ids[BASE_IDS];
+  fill(base_ids, BASE_IDS, 0, 3);
+  const depset *base = intern(&t, base_ids, BASE_IDS);
+
+  // half the ids changed is more than a delta may store
+  int ids[BASE_IDS];
+  memcpy(ids, base_ids, sizeof(ids));
+  fill(ids, BASE_IDS / 2, 500, 1);
+  const depset *far = intern(&t, ids, BASE_IDS);
+  CHECK(far->ids != NULL);
+  CHECK(t.deltas == 0);
+
+  for ( int i = 0; i < DEPSET_RECENT; i++ ) {
+    fill(ids, BASE_IDS, 1000 * (i + 1), 1);
+    CHECK(intern(&t, ids, BASE_IDS)->ids != NULL);
+  }
+  memcpy(ids, base_ids, sizeof(ids));
+  ids[BASE_IDS - 1] = 1;
+  const depset *late = intern(&t, ids, BASE_IDS);
+  CHECK(late != base && late->ids != NULL);
+  CHECK(t.deltas == 0);
+  // the old base is found all the same
+  CHECK(intern(&t, base_ids, BASE_IDS) == base);
+  DEPSET_free(&t);
+}
+
+int main(void) {
+  test_identical();
+  test_delta();
+  test_full();
+  if ( failures > 0 ) {
+    fprintf(stderr, "%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("test_depset: all passed\n");
+  return 0;
+}
@@ -0,0 +1,331 @@
+/*
+ * Tests of the streaming strace -f parser, fed canned lines of trace
+ *
+ * Each test parses a few lines the way record_build would, collecting the targets the
+ * parser finishes, and checks what was recorded of them.
+ *
+ * usage: test_parser
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../record_checkpoint.h"
+#include "../record_core.h"
+#include "../record_parser.h"
+#include "../record_stats.h"
+#include "../record_usage.h"
+
+#define MAX_TARGETS 16
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if ( !(cond) ) { \
+      fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+      failures++; \
+    } \
+  } while ( 0 )
+
+/*
+ * The targets finished by one parse, in order
+ */
+typedef struct finished_struct {
+  target *targets[MAX_TARGETS];
+  int count;
+} finished;
+
+static void collect_target(void *ctx, target *tar) {
+  finished *f = ctx;
+  if ( f->count < MAX_TARGETS ) {
+    f->targets[f->count++] = tar;
+  }
+  else {
+    TARGET_free(tar);
+  }
+}
+
+static void start(parser *p, stats *st, finished *f) {
+  memset(f, 0, sizeof(finished));
+  STATS_init(st, false);
+  PARSER_init(p, "/src", NULL, NULL, st, collect_target, f);
+}
+
+/*
+ * Feeds one line to the parser from a buffer of its own, as the parser may modify it
+ */
+static void feed(parser *p, const char *line) {
+  char *buffer = strdup(line);
+  PARSER_feed_line(p, buffer, strlen(buffer));
+  free(buffer);
+}
+
+/*
+ * Frees what a parse left, after PARSER_finish()
+ */
+static void stop(parser *p, finished *f) {
+  for ( int i = 0; i < f->count; i++ ) {
+    TARGET_free(f->targets[i]);
+  }
+  free(p->pwd);
+  free(p->start_pwd);
+}
+
+static target *find_target(finished *f, const char *name) {
+  for ( int i = 0; i < f->count; i++ ) {
+    if ( !strcmp(f->targets[i]->target_name, name) ) {
+      return f->targets[i];
+    }
+  }
+  return NULL;
+}
+
+static bool has_dep(target *tar, const char *path) {
+  return tar != NULL && TARGET_has_dep(tar, (char *) path);
+}
+
+/*
+ * strace pads the pid to a width of five, so the time may follow several spaces
+ */
+static void test_padded_pid_with_time(void) {
+  parser p;
+  stats st;
+  finished f;
+  start(&p, &st, &f);
+  feed(&p, "123   1700000000.000000 execve(\"/usr/bin/gcc\", [\"gcc\", \"-c\", \"a.c\", "
+           "\"-o\", \"a.o\"], 0x7ffd /* 20 vars */) = 0\n");
+  feed(&p, "123   1700000001.000000 openat(AT_FDCWD, \"a.h\", O_RDONLY) = 3\n");
+  feed(&p, "123   1700000002.500000 +++ exited with 0 +++\n");
+  PARSER_finish(&p);
+  target *a = find_target(&f, "a.o");
+  CHECK(f.count == 1);
+  CHECK(p.timed);
+  CHECK(has_dep(a, "a.h"));
+  CHECK(a != NULL && a->duration > 2.49 && a->duration < 2.51);
+  stop(&p, &f);
+}
+
+/*
+ * A split call that failed, with timestamps on both of its lines, is not a dependency
+ */
+static void test_failed_resumed_call_with_time(void) {
+  parser p;
+  stats st;
+  finished f;
+  start(&p, &st, &f);
+  feed(&p, "123 1700000000.000000 execve(\"/usr/bin/gcc\", [\"gcc\", \"-c\", \"a.c\", "
+           "\"-o\", \"a.o\"], 0x7ffd /* 20 vars */) = 0\n");
+  feed(&p, "123 1700000000.100000 openat(AT_FDCWD, \"missing.h\", O_RDONLY <unfinished ...>\n");
+  feed(&p, "124 1700000000.200000 close(3) = 0\n");
+  feed(&p, "123 1700000000.300000 <... openat resumed>) = -1 ENOENT (No such file or directory)\n");
+  feed(&p, "123 1700000000.400000 openat(AT_FDCWD, \"found.h\", O_RDONLY <unfinished ...>\n");
+  feed(&p, "123 1700000000.500000 <... openat resumed>) = 4\n");
+  PARSER_finish(&p);
+  target *a = find_target(&f, "a.o");
+  CHECK(a != NULL);
+  CHECK(!has_dep(a, "missing.h"));
+  CHECK(has_dep(a, "found.h"));
+  stop(&p, &f);
+}
+
+/*
+ * A target compiled after a chdir keeps the directory its relative paths are found from
+ */
+static void test_target_directory(void) {
+  parser p;
+  stats st;
+  finished f;
+  start(&p, &st, &f);
+  feed(&p, "100 execve(\"/usr/bin/gcc\", [\"gcc\", \"-c\", \"a.c\", \"-o\", \"a.o\"], "
+           "0x7ffd /* 20 vars */) = 0\n");
+  feed(&p, "101 chdir(\"/src/sub\") = 0\n");
+  feed(&p, "102 execve(\"/usr/bin/gcc\", [\"gcc\", \"-c\", \"b.c\", \"-o\", \"b.o\"], "
+           "0x7ffd /* 20 vars */) = 0\n");
+  PARSER_finish(&p);
+  target *a = find_target(&f, "a.o");
+  target *b = find_target(&f, "b.o");
+  CHECK(a != NULL && a->dir == NULL);
+  CHECK(b != NULL && b->dir != NULL && !strcmp(b->dir, "/src/sub"));
+  stop(&p, &f);
+}
+
+/*
+ * A checkpoint taken while a gcc is running restores it, so the parse resumed from it
+ * finishes the target the same way
+ */
+static void test_checkpoint_round_trip(void) {
+  parser p;
+  stats st;
+  finished f;
+  start(&p, &st, &f);
+  feed(&p, "100 execve(\"/usr/bin/gcc\", [\"gcc\", \"-c\", \"a.c\", \"-o\", \"a.o\"], "
+           "0x7ffd /* 20 vars */) = 0\n");
+  feed(&p, "100 openat(AT_FDCWD, \"a.h\", O_RDONLY) = 3\n");
+  char file_name[] = "/tmp/test_parser.XXXXXX";
+  close(mkstemp(file_name));
+  checkpoint ck;
+  memset(&ck, 0, sizeof(checkpoint));
+  ck.trace_offset = 123;
+  CHECK(CHECKPOINT_save(file_name, &p, &ck) == 0);
+  PARSER_finish(&p);
+  stop(&p, &f);
+
+  parser resumed;
+  start(&resumed, &st, &f);
+  checkpoint loaded;
+  memset(&loaded, 0, sizeof(checkpoint));
+  CHECK(CHECKPOINT_load(file_name, &resumed, &loaded) == 0);
+  unlink(file_name);
+  CHECK(loaded.trace_offset == 123);
+  CHECK(LIST_find_pid(resumed.fps_list, 100) != NULL);
+  CHECK(resumed.cur_target != NULL && !strcmp(resumed.cur_target->target_name, "a.o"));
+  // the gcc opens b.c, which is only a dependency as long as pid 100 is known to run gcc
+  feed(&resumed, "100 openat(AT_FDCWD, \"b.c\", O_RDONLY) = 4\n");
+  PARSER_finish(&resumed);
+  target *a = find_target(&f, "a.o");
+  CHECK(f.count == 1);
+  CHECK(has_dep(a, "a.h"));
+  CHECK(has_dep(a, "b.c"));
+  CHECKPOINT_free(&loaded);
+  stop(&resumed, &f);
+}
+
+/*
+ * Under make -j the compiler of a target may exit after the next target started; what
+ * was sampled of it still goes to its own target
+ */
+static void test_interleaved_usage(void) {
+  parser p;
+  stats st;
+  finished f;
+  start(&p, &st, &f);
+  // a sampler with nothing to find, the readings are recorded by hand
+  usage_sampler u;
+  USAGE_start(&u, getpid());
+  USAGE_stop(&u);
+  USAGE_record(&u, 100, 5000, 0.1);
+  USAGE_record(&u, 101, 900000, 2.0);
+  USAGE_record(&u, 200, 4000, 0.1);
+  USAGE_record(&u, 201, 300000, 1.0);
+  p.usage = &u;
+  feed(&p, "100 execve(\"/usr/bin/g++\", [\"g++\", \"-c\", \"a.cc\", \"-o\", \"a.o\"], "
+           "0x7ffd /* 20 vars */) = 0\n");
+  feed(&p, "100 clone(child_stack=NULL, flags=CLONE_CHILD_SETTID|SIGCHLD) = 101\n");
+  feed(&p, "101 execve(\"/usr/lib/gcc/cc1plus\", [\"cc1plus\", \"a.cc\"], "
+           "0x7ffd /* 20 vars */) = 0\n");
+  feed(&p, "200 execve(\"/usr/bin/g++\", [\"g++\", \"-c\", \"b.cc\", \"-o\", \"b.o\"], "
+           "0x7ffd /* 20 vars */) = 0\n");
+  feed(&p, "200 clone(child_stack=NULL, flags=CLONE_CHILD_SETTID|SIGCHLD) = 201\n");
+  feed(&p, "201 +++ exited with 0 +++\n");
+  feed(&p, "101 +++ exited with 0 +++\n");
+  // a.o is held until the last of its processes exits
+  CHECK(f.count == 0);
+  feed(&p, "100 +++ exited with 0 +++\n");
+  CHECK(f.count == 1);
+  feed(&p, "200 +++ exited with 0 +++\n");
+  PARSER_finish(&p);
+  target *a = find_target(&f, "a.o");
+  target *b = find_target(&f, "b.o");
+  CHECK(f.count == 2);
+  CHECK(a != NULL && a->peak_rss == 900000);
+  CHECK(a != NULL && a->cpu_time > 2.09 && a->cpu_time < 2.11);
+  CHECK(b != NULL && b->peak_rss == 300000);
+  CHECK(b != NULL && b->cpu_time > 1.09 && b->cpu_time < 1.11);
+  stop(&p, &f);
+  USAGE_free(&u);
+}
+
+/*
+ * Under make -j the files a compiler opens after the next target started are still
+ * dependencies of its own target, and not of the other
+ */
+static void test_interleaved_deps(void) {
+  parser p;
+  stats st;
+  finished f;
+  start(&p, &st, &f);
+  feed(&p, "100 execve(\"/usr/bin/gcc\", [\"gcc\", \"-c\", \"a.c\", \"-o\", \"a.o\"], "
+           "0x7ffd /* 20 vars */) = 0\n");
+  feed(&p, "100 clone(child_stack=NULL, flags=CLONE_CHILD_SETTID|SIGCHLD) = 101\n");
+  feed(&p, "101 execve(\"/usr/lib/gcc/cc1\", [\"cc1\", \"a.c\"], 0x7ffd /* 20 vars */) = 0\n");
+  feed(&p, "200 execve(\"/usr/bin/gcc\", [\"gcc\", \"-c\", \"b.c\", \"-o\", \"b.o\"], "
+           "0x7ffd /* 20 vars */) = 0\n");
+  feed(&p, "101 openat(AT_FDCWD, \"a.h\", O_RDONLY) = 3\n");
+  feed(&p, "200 openat(AT_FDCWD, \"b.h\", O_RDONLY) = 3\n");
+  feed(&p, "101 +++ exited with 0 +++\n");
+  feed(&p, "100 +++ exited with 0 +++\n");
+  feed(&p, "200 +++ exited with 0 +++\n");
+  PARSER_finish(&p);
+  target *a = find_target(&f, "a.o");
+  target *b = find_target(&f, "b.o");
+  CHECK(f.count == 2);
+  CHECK(has_dep(a, "a.h") && !has_dep(a, "b.h"));
+  CHECK(has_dep(b, "b.h") && !has_dep(b, "a.h"));
+  stop(&p, &f);
+}
+
+/*
+ * A checkpoint taken while two compilers overlap restores both, so the older one's opens
+ * after resuming still go to its own target
+ */
+static void test_checkpoint_interleaved(void) {
+  parser p;
+  stats st;
+  finished f;
+  start(&p, &st, &f);
+  feed(&p, "100 execve(\"/usr/bin/gcc\", [\"gcc\", \"-c\", \"a.c\", \"-o\", \"a.o\"], "
+           "0x7ffd /* 20 vars */) = 0\n");
+  feed(&p, "100 clone(child_stack=NULL, flags=CLONE_CHILD_SETTID|SIGCHLD) = 101\n");
+  feed(&p, "200 execve(\"/usr/bin/gcc\", [\"gcc\", \"-c\", \"b.c\", \"-o\", \"b.o\"], "
+           "0x7ffd /* 20 vars */) = 0\n");
+  char file_name[] = "/tmp/test_parser.XXXXXX";
+  close(mkstemp(file_name));
+  checkpoint ck;
+  memset(&ck, 0, sizeof(checkpoint));
+  CHECK(CHECKPOINT_save(file_name, &p, &ck) == 0);
+  PARSER_finish(&p);
+  stop(&p, &f);
+
+  parser resumed;
+  start(&resumed, &st, &f);
+  checkpoint loaded;
+  memset(&loaded, 0, sizeof(checkpoint));
+  CHECK(CHECKPOINT_load(file_name, &resumed, &loaded) == 0);
+  unlink(file_name);
+  CHECK(resumed.held_count == 2);
+  CHECK(resumed.cur_target != NULL && !strcmp(resumed.cur_target->target_name, "b.o"));
+  feed(&resumed, "101 openat(AT_FDCWD, \"a.h\", O_RDONLY) = 3\n");
+  feed(&resumed, "200 openat(AT_FDCWD, \"b.h\", O_RDONLY) = 3\n");
+  feed(&resumed, "101 +++ exited with 0 +++\n");
+  feed(&resumed, "100 +++ exited with 0 +++\n");
+  // a.o is written out once its processes exit, before b.o
+  CHECK(f.count == 1 && !strcmp(f.targets[0]->target_name, "a.o"));
+  feed(&resumed, "200 +++ exited with 0 +++\n");
+  PARSER_finish(&resumed);
+  target *a = find_target(&f, "a.o");
+  target *b = find_target(&f, "b.o");
+  CHECK(f.count == 2);
+  CHECK(has_dep(a, "a.h") && !has_dep(a, "b.h"));
+  CHECK(has_dep(b, "b.h") && !has_dep(b, "a.h"));
+  CHECKPOINT_free(&loaded);
+  stop(&resumed, &f);
+}
+
+int main(void) {
+  test_padded_pid_with_time();
+  test_failed_resumed_call_with_time();
+  test_target_directory();
+  test_checkpoint_round_trip();
+  test_interleaved_usage();
+  test_interleaved_deps();
+  test_checkpoint_interleaved();
+  if ( failures > 0 ) {
+    fprintf(stderr, "%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("test_parser: all passed\n");
+  return 0;
+}